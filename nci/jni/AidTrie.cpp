@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Resolve the AID of a SELECT command against the AID cache of the
+ *  NFC service.
+ */
+#include "AidTrie.h"
+
+#include <android-base/stringprintf.h>
+#include <base/logging.h>
+#include <map>
+
+using android::base::StringPrintf;
+
+extern bool nfc_debug_enabled;
+
+namespace {
+const uint8_t SELECT_CLA = 0x00;
+const uint8_t SELECT_INS = 0xA4;
+const uint8_t SELECT_P1_BY_NAME = 0x04;
+const size_t SELECT_APDU_HDR_LEN = 5;
+const size_t MIN_AID_LEN = 5;  // shorter AIDs are rejected by the Java cache
+const size_t MAX_AID_LEN = 16;
+
+// Node of the trie while it is being built
+struct BuildNode {
+  std::map<uint8_t, BuildNode> children;
+  int32_t exact = -1;
+  int32_t prefix = -1;
+  int32_t subset = -1;
+};
+}  // namespace
+
+/*******************************************************************************
+**
+** Function:        build
+**
+** Description:     Build a trie from packed entries, each laid out as
+**                  [aidLen][aid][kind][index, 2 octets big-endian].
+**                  packed: packed entries.
+**                  len: length of packed.
+**                  generation: cache generation the entries belong to.
+**
+** Returns:         Trie, or NULL if the entries are malformed.
+**
+*******************************************************************************/
+std::shared_ptr<const AidTrie> AidTrie::build(const uint8_t* packed,
+                                              size_t len, int generation) {
+  BuildNode root;
+  size_t numEntries = 0;
+  size_t offset = 0;
+  while (offset < len) {
+    size_t aidLen = packed[offset];
+    if (aidLen > MAX_AID_LEN || len - offset < 1 + aidLen + 3) {
+      LOG(ERROR) << StringPrintf("%s: truncated entry at %zu", __func__,
+                                 offset);
+      return NULL;
+    }
+    const uint8_t* aid = &packed[offset + 1];
+    uint8_t kind = packed[offset + 1 + aidLen];
+    int32_t index = (packed[offset + 2 + aidLen] << 8) |
+                    packed[offset + 3 + aidLen];
+    offset += 1 + aidLen + 3;
+
+    BuildNode* node = &root;
+    for (size_t i = 0; i < aidLen; i++) node = &node->children[aid[i]];
+    int32_t* slot = kind == PREFIX   ? &node->prefix
+                    : kind == SUBSET ? &node->subset
+                                     : &node->exact;
+    if (*slot >= 0) {
+      LOG(ERROR) << StringPrintf("%s: duplicate entry %d", __func__, index);
+      return NULL;
+    }
+    *slot = index;
+    numEntries++;
+  }
+
+  // flatten breadth-first so the children of each node are contiguous
+  std::shared_ptr<AidTrie> trie(new AidTrie(generation));
+  trie->mNumEntries = numEntries;
+  std::vector<const BuildNode*> order(1, &root);
+  trie->mNodes.push_back(Node());
+  for (size_t n = 0; n < order.size(); n++) {
+    const BuildNode* from = order[n];
+    uint32_t firstChild = trie->mNodes.size();
+    for (const auto& child : from->children) {
+      Node node = Node();
+      node.byte = child.first;
+      trie->mNodes.push_back(node);
+      order.push_back(&child.second);
+    }
+    Node& to = trie->mNodes[n];
+    to.firstChild = firstChild;
+    to.numChildren = from->children.size();
+    to.exact = from->exact;
+    to.prefix = from->prefix;
+    to.subset = from->subset;
+    to.numSubsets = from->subset >= 0 ? 1 : 0;
+  }
+
+  // children always follow their parent, so a backward pass sees every
+  // subtree before its root
+  for (size_t n = trie->mNodes.size(); n-- > 0;) {
+    Node& node = trie->mNodes[n];
+    for (uint32_t c = 0; c < node.numChildren; c++) {
+      const Node& child = trie->mNodes[node.firstChild + c];
+      if (child.numSubsets > 0 && node.subset < 0) node.subset = child.subset;
+      node.numSubsets += child.numSubsets;
+    }
+  }
+
+  DLOG_IF(INFO, nfc_debug_enabled)
+      << StringPrintf("%s: generation=%d entries=%zu nodes=%zu", __func__,
+                      generation, numEntries, trie->mNodes.size());
+  return trie;
+}
+
+/*******************************************************************************
+**
+** Function:        parseSelect
+**
+** Description:     Find the AID of a SELECT by DF name command, using the
+**                  same rules as HostEmulationManager.findSelectAid().
+**                  apdu: command APDU.
+**                  len: length of apdu.
+**                  aid: receives a pointer to the AID within apdu.
+**                  aidLen: receives the length of the AID.
+**
+** Returns:         True if apdu is such a SELECT.
+**
+*******************************************************************************/
+bool AidTrie::parseSelect(const uint8_t* apdu, size_t len, const uint8_t** aid,
+                          size_t* aidLen) {
+  if (len < SELECT_APDU_HDR_LEN + MIN_AID_LEN) return false;
+  if (apdu[0] != SELECT_CLA || apdu[1] != SELECT_INS ||
+      apdu[2] != SELECT_P1_BY_NAME) {
+    return false;
+  }
+  size_t lc = apdu[4];
+  if (lc > MAX_AID_LEN || len < SELECT_APDU_HDR_LEN + lc) return false;
+  *aid = &apdu[SELECT_APDU_HDR_LEN];
+  *aidLen = lc;
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        findChild
+**
+** Description:     Find the child of a node for the next AID byte.
+**                  node: index of the parent node.
+**                  byte: next AID byte.
+**
+** Returns:         Index of the child, or -1.
+**
+*******************************************************************************/
+int AidTrie::findChild(int node, uint8_t byte) const {
+  uint32_t lo = mNodes[node].firstChild;
+  uint32_t hi = lo + mNodes[node].numChildren;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (mNodes[mid].byte < byte) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo < mNodes[node].firstChild + mNodes[node].numChildren &&
+      mNodes[lo].byte == byte) {
+    return lo;
+  }
+  return -1;
+}
+
+/*******************************************************************************
+**
+** Function:        resolve
+**
+** Description:     Match a selected AID against every entry.
+**                  aid: selected AID.
+**                  aidLen: length of aid.
+**
+** Returns:         Index of the only matching entry, NO_MATCH or
+**                  UNRESOLVED.
+**
+*******************************************************************************/
+int AidTrie::resolve(const uint8_t* aid, size_t aidLen) const {
+  if (aidLen < MIN_AID_LEN || mNodes.empty()) return UNRESOLVED;
+  int match = NO_MATCH;
+  int numMatches = 0;
+  auto addMatch = [&](int32_t index) {
+    if (index < 0) return;
+    match = index;
+    numMatches++;
+  };
+
+  // prefix entries along the path match; the last node also matches exact
+  // entries and every subset entry below it
+  int node = 0;
+  for (size_t i = 0; i < aidLen && node >= 0; i++) {
+    if (i >= MIN_AID_LEN) addMatch(mNodes[node].prefix);
+    node = findChild(node, aid[i]);
+  }
+  if (node >= 0) {
+    addMatch(mNodes[node].exact);
+    addMatch(mNodes[node].prefix);
+    if (mNodes[node].numSubsets > 1) return UNRESOLVED;
+    if (mNodes[node].numSubsets == 1) addMatch(mNodes[node].subset);
+  }
+
+  // several matches are merged by the Java cache
+  return numMatches > 1 ? UNRESOLVED : match;
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Resolve the AID of a SELECT command against the AID cache of the
+ *  NFC service.
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+/*****************************************************************************
+**
+**  Name:           AidTrie
+**
+**  Description:    Immutable byte-wise trie of the resolved AID cache.  Each
+**                  entry carries the index the Java cache assigned to it, so
+**                  a SELECT can be tagged with its resolution before the
+**                  APDU reaches Java.  Only a match against exactly one
+**                  entry is resolved here; anything else is left to Java.
+**
+*****************************************************************************/
+class AidTrie {
+ public:
+  // resolve() results besides an entry index
+  static const int UNRESOLVED = -1;  // let the Java cache decide
+  static const int NO_MATCH = -2;    // no registered AID matches
+
+  // how an entry matches, as marked by the '*' and '#' suffixes in Java
+  enum MatchKind : uint8_t { EXACT = 0, PREFIX = 1, SUBSET = 2 };
+
+  /*******************************************************************************
+  **
+  ** Function:        build
+  **
+  ** Description:     Build a trie from packed entries, each laid out as
+  **                  [aidLen][aid][kind][index, 2 octets big-endian].
+  **                  packed: packed entries.
+  **                  len: length of packed.
+  **                  generation: cache generation the entries belong to.
+  **
+  ** Returns:         Trie, or NULL if the entries are malformed.
+  **
+  *******************************************************************************/
+  static std::shared_ptr<const AidTrie> build(const uint8_t* packed,
+                                              size_t len, int generation);
+
+  /*******************************************************************************
+  **
+  ** Function:        parseSelect
+  **
+  ** Description:     Find the AID of a SELECT by DF name command, using the
+  **                  same rules as HostEmulationManager.findSelectAid().
+  **                  apdu: command APDU.
+  **                  len: length of apdu.
+  **                  aid: receives a pointer to the AID within apdu.
+  **                  aidLen: receives the length of the AID.
+  **
+  ** Returns:         True if apdu is such a SELECT.
+  **
+  *******************************************************************************/
+  static bool parseSelect(const uint8_t* apdu, size_t len, const uint8_t** aid,
+                          size_t* aidLen);
+
+  /*******************************************************************************
+  **
+  ** Function:        resolve
+  **
+  ** Description:     Match a selected AID against every entry.
+  **                  aid: selected AID.
+  **                  aidLen: length of aid.
+  **
+  ** Returns:         Index of the only matching entry, NO_MATCH or
+  **                  UNRESOLVED.
+  **
+  *******************************************************************************/
+  int resolve(const uint8_t* aid, size_t aidLen) const;
+
+  int generation() const { return mGeneration; }
+  size_t size() const { return mNumEntries; }
+
+ private:
+  // Children of a node are contiguous and sorted by byte.  Subset entries
+  // are counted per subtree, since a subset entry matches every selected
+  // AID that is a prefix of it.
+  struct Node {
+    uint32_t firstChild;
+    uint16_t numChildren;
+    uint8_t byte;
+    int32_t exact;   // entry index, or -1
+    int32_t prefix;  // entry index, or -1
+    int32_t subset;  // the subset entry in this subtree, if there is one
+    uint32_t numSubsets;
+  };
+
+  AidTrie(int generation) : mGeneration(generation), mNumEntries(0) {}
+  int findChild(int node, uint8_t byte) const;
+
+  std::vector<Node> mNodes;  // mNodes[0] is the root
+  int mGeneration;
+  size_t mNumEntries;
+};
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Wait for the result of one asynchronous stack operation.
+ */
+#pragma once
+#include "CondVar.h"
+#include "Mutex.h"
+
+/*****************************************************************************
+**
+**  Name:           Completion
+**
+**  Description:    Hand the result of an NFA request from the stack callback
+**                  to the thread that issued it.  The waiter calls start()
+**                  before issuing the request, so a result delivered before
+**                  the waiter blocks is kept rather than lost, and results
+**                  arriving while no request is outstanding are dropped.
+**                  The state is a predicate, so spurious wakeups are
+**                  harmless, and the object is reused by every request.
+**
+*****************************************************************************/
+template <class T>
+class Completion {
+ public:
+  Completion() : mState(IDLE), mValue() {}
+
+  /*******************************************************************************
+  **
+  ** Function:        start
+  **
+  ** Description:     Arm the completion for a new request.  Any result of
+  **                  an earlier request is discarded.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void start() {
+    Mutex::Autolock lock(mMutex);
+    mState = PENDING;
+    mValue = T();
+  }
+
+  /*******************************************************************************
+  **
+  ** Function:        complete
+  **
+  ** Description:     Deliver the result of the outstanding request and wake
+  **                  its waiter.
+  **                  value: result of the request.
+  **
+  ** Returns:         True if a request was outstanding.
+  **
+  *******************************************************************************/
+  bool complete(const T& value) {
+    Mutex::Autolock lock(mMutex);
+    if (mState != PENDING) return false;
+    mValue = value;
+    mState = DONE;
+    mCondVar.notifyAll();
+    return true;
+  }
+
+  /*******************************************************************************
+  **
+  ** Function:        cancel
+  **
+  ** Description:     Give up on the outstanding request; its waiter returns
+  **                  false and a late result is dropped.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void cancel() {
+    Mutex::Autolock lock(mMutex);
+    if (mState != PENDING) return;
+    mState = CANCELLED;
+    mCondVar.notifyAll();
+  }
+
+  /*******************************************************************************
+  **
+  ** Function:        isPending
+  **
+  ** Description:     Whether a request is outstanding.
+  **
+  ** Returns:         True if start() was called and no result arrived yet.
+  **
+  *******************************************************************************/
+  bool isPending() {
+    Mutex::Autolock lock(mMutex);
+    return mState == PENDING;
+  }
+
+  /*******************************************************************************
+  **
+  ** Function:        wait
+  **
+  ** Description:     Block until the request completes or is cancelled.
+  **                  value: receives the result; may be NULL.
+  **
+  ** Returns:         True if the request completed.
+  **
+  *******************************************************************************/
+  bool wait(T* value) {
+    Mutex::Autolock lock(mMutex);
+    while (mState == PENDING) mCondVar.wait(mMutex);
+    return finish(value);
+  }
+
+  /*******************************************************************************
+  **
+  ** Function:        wait
+  **
+  ** Description:     Block until the request completes, is cancelled or
+  **                  the timeout expires.  On timeout the request is
+  **                  cancelled.
+  **                  value: receives the result; may be NULL.
+  **                  millisec: timeout in milliseconds.
+  **
+  ** Returns:         True if the request completed.
+  **
+  *******************************************************************************/
+  bool wait(T* value, long millisec) {
+    Mutex::Autolock lock(mMutex);
+    const struct timespec deadline = CondVar::deadline(millisec);
+    while (mState == PENDING) {
+      if (!mCondVar.waitUntil(mMutex, deadline)) {
+        // the result may have been delivered right at the deadline
+        if (mState == PENDING) mState = CANCELLED;
+      }
+    }
+    return finish(value);
+  }
+
+ private:
+  enum State { IDLE, PENDING, DONE, CANCELLED };
+
+  bool finish(T* value) {
+    bool done = mState == DONE;
+    if (done && value) *value = mValue;
+    mState = IDLE;
+    return done;
+  }
+
+  Mutex mMutex;
+  CondVar mCondVar;
+  State mState;
+  T mValue;
+};
@@ -93,29 +93,55 @@ void CondVar::wait(Mutex& mutex) {
 **
 *******************************************************************************/
 bool CondVar::wait(Mutex& mutex, long millisec) {
-  bool retVal = false;
-  struct timespec absoluteTime;
+  return waitUntil(mutex, deadline(millisec));
+}
+
+/*******************************************************************************
+**
+** Function:        waitUntil
+**
+** Description:     Block the caller and wait for a condition.  Waiting
+**                  again with the same deadline does not extend the wait.
+**                  deadline: Absolute CLOCK_MONOTONIC time; see deadline().
+**
+** Returns:         True if wait is successful; false if deadline passes.
+**
+*******************************************************************************/
+bool CondVar::waitUntil(Mutex& mutex, const struct timespec& deadline) {
+  int waitResult =
+      pthread_cond_timedwait(&mCondition, mutex.nativeHandle(), &deadline);
+  if ((waitResult != 0) && (waitResult != ETIMEDOUT))
+    LOG(ERROR) << StringPrintf(
+        "CondVar::waitUntil: fail timed wait; error=0x%X", waitResult);
+  return (waitResult == 0);  // waited successfully
+}
+
+/*******************************************************************************
+**
+** Function:        deadline
+**
+** Description:     Compute the deadline for waitUntil().
+**                  millisec: Milliseconds from now.
+**
+** Returns:         Absolute CLOCK_MONOTONIC time.
+**
+*******************************************************************************/
+struct timespec CondVar::deadline(long millisec) {
+  struct timespec absoluteTime = {};
 
   if (clock_gettime(CLOCK_MONOTONIC, &absoluteTime) == -1) {
-    LOG(ERROR) << StringPrintf("CondVar::wait: fail get time; errno=0x%X",
+    LOG(ERROR) << StringPrintf("CondVar::deadline: fail get time; errno=0x%X",
                                errno);
-  } else {
-    absoluteTime.tv_sec += millisec / 1000;
-    long ns = absoluteTime.tv_nsec + ((millisec % 1000) * 1000000);
-    if (ns > 1000000000) {
-      absoluteTime.tv_sec++;
-      absoluteTime.tv_nsec = ns - 1000000000;
-    } else
-      absoluteTime.tv_nsec = ns;
   }
-
-  int waitResult =
-      pthread_cond_timedwait(&mCondition, mutex.nativeHandle(), &absoluteTime);
-  if ((waitResult != 0) && (waitResult != ETIMEDOUT))
-    LOG(ERROR) << StringPrintf("CondVar::wait: fail timed wait; error=0x%X",
-                               waitResult);
-  retVal = (waitResult == 0);  // waited successfully
-  return retVal;
+  if (millisec < 0) millisec = 0;
+  absoluteTime.tv_sec += millisec / 1000;
+  long ns = absoluteTime.tv_nsec + ((millisec % 1000) * 1000000);
+  if (ns >= 1000000000) {
+    absoluteTime.tv_sec++;
+    ns -= 1000000000;
+  }
+  absoluteTime.tv_nsec = ns;
+  return absoluteTime;
 }
 
 /*******************************************************************************
@@ -134,3 +160,20 @@ void CondVar::notifyOne() {
                                res);
   }
 }
+
+/*******************************************************************************
+**
+** Function:        notifyAll
+**
+** Description:     Unblock all waiting threads.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void CondVar::notifyAll() {
+  int const res = pthread_cond_broadcast(&mCondition);
+  if (res) {
+    LOG(ERROR) << StringPrintf("CondVar::notifyAll: fail broadcast; error=0x%X",
+                               res);
+  }
+}
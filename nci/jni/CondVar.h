@@ -20,6 +20,7 @@
 
 #pragma once
 #include <pthread.h>
+#include <time.h>
 #include "Mutex.h"
 
 class CondVar {
@@ -69,6 +70,31 @@ class CondVar {
   *******************************************************************************/
   bool wait(Mutex& mutex, long millisec);
 
+  /*******************************************************************************
+  **
+  ** Function:        waitUntil
+  **
+  ** Description:     Block the caller and wait for a condition.  Waiting
+  **                  again with the same deadline does not extend the wait.
+  **                  deadline: Absolute CLOCK_MONOTONIC time; see deadline().
+  **
+  ** Returns:         True if wait is successful; false if deadline passes.
+  **
+  *******************************************************************************/
+  bool waitUntil(Mutex& mutex, const struct timespec& deadline);
+
+  /*******************************************************************************
+  **
+  ** Function:        deadline
+  **
+  ** Description:     Compute the deadline for waitUntil().
+  **                  millisec: Milliseconds from now.
+  **
+  ** Returns:         Absolute CLOCK_MONOTONIC time.
+  **
+  *******************************************************************************/
+  static struct timespec deadline(long millisec);
+
   /*******************************************************************************
   **
   ** Function:        notifyOne
@@ -80,6 +106,17 @@ class CondVar {
   *******************************************************************************/
   void notifyOne();
 
+  /*******************************************************************************
+  **
+  ** Function:        notifyAll
+  **
+  ** Description:     Unblock all waiting threads.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void notifyAll();
+
  private:
   pthread_cond_t mCondition;
 };
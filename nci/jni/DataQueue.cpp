@@ -14,14 +14,15 @@
  * limitations under the License.
  */
 
+
 /*
  *  Store data bytes in a variable-size queue.
  */
 
 #include "DataQueue.h"
 
-#include <malloc.h>
 #include <string.h>
+#include <algorithm>
 
 #include <android-base/stringprintf.h>
 #include <base/logging.h>
@@ -32,11 +33,14 @@ using android::base::StringPrintf;
 ** Function:        DataQueue
 **
 ** Description:     Initialize member variables.
+**                  capacity: size of the ring in bytes, record headers
+**                  included.
 **
 ** Returns:         None.
 **
 *******************************************************************************/
-DataQueue::DataQueue() {}
+DataQueue::DataQueue(size_t capacity)
+    : mArena(capacity), mHead(0), mTail(0), mOffset(0), mRejectedCount(0) {}
 
 /*******************************************************************************
 **
@@ -47,28 +51,82 @@ DataQueue::DataQueue() {}
 ** Returns:         None.
 **
 *******************************************************************************/
-DataQueue::~DataQueue() {
-  mMutex.lock();
-  while (mQueue.empty() == false) {
-    tHeader* header = mQueue.front();
-    mQueue.pop_front();
-    free(header);
-  }
-  mMutex.unlock();
-}
+DataQueue::~DataQueue() {}
 
+/*******************************************************************************
+**
+** Function:        isEmpty
+**
+** Description:     Whether the queue is empty.
+**
+** Returns:         True if empty.
+**
+*******************************************************************************/
 bool DataQueue::isEmpty() {
-  mMutex.lock();
-  bool retval = mQueue.empty();
-  mMutex.unlock();
-  return retval;
+  return mHead.load(std::memory_order_acquire) ==
+         mTail.load(std::memory_order_acquire);
+}
+
+/*******************************************************************************
+**
+** Function:        freeSpace
+**
+** Description:     Get the longest data enqueue() would accept now.
+**
+** Returns:         Number of bytes.
+**
+*******************************************************************************/
+size_t DataQueue::freeSpace() {
+  size_t used = mTail.load(std::memory_order_acquire) -
+                mHead.load(std::memory_order_acquire);
+  size_t free = mArena.size() - used;
+  return free > RECORD_HEADER_LEN ? free - RECORD_HEADER_LEN : 0;
+}
+
+/*******************************************************************************
+**
+** Function:        copyIn
+**
+** Description:     Copy bytes into the ring, wrapping at its end.
+**                  pos: free-running position to copy to.
+**                  src: bytes to copy.
+**                  len: number of bytes.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void DataQueue::copyIn(size_t pos, const uint8_t* src, size_t len) {
+  size_t index = pos % mArena.size();
+  size_t first = std::min(len, mArena.size() - index);
+  memcpy(&mArena[index], src, first);
+  if (first < len) memcpy(&mArena[0], src + first, len - first);
+}
+
+/*******************************************************************************
+**
+** Function:        copyOut
+**
+** Description:     Copy bytes out of the ring, wrapping at its end.
+**                  pos: free-running position to copy from.
+**                  dst: where to copy to.
+**                  len: number of bytes.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void DataQueue::copyOut(size_t pos, uint8_t* dst, size_t len) {
+  size_t index = pos % mArena.size();
+  size_t first = std::min(len, mArena.size() - index);
+  memcpy(dst, &mArena[index], first);
+  if (first < len) memcpy(dst + first, &mArena[0], len - first);
 }
 
 /*******************************************************************************
 **
 ** Function:        enqueue
 **
-** Description:     Append data to the queue.
+** Description:     Append data to the queue.  The data is rejected, not
+**                  truncated, when the ring does not have room for it.
 **                  data: array of bytes
 **                  dataLen: length of the data.
 **
@@ -78,24 +136,22 @@ bool DataQueue::isEmpty() {
 bool DataQueue::enqueue(uint8_t* data, uint16_t dataLen) {
   if ((data == NULL) || (dataLen == 0)) return false;
 
-  mMutex.lock();
-
-  bool retval = false;
-  tHeader* header = (tHeader*)malloc(sizeof(tHeader) + dataLen);
-
-  if (header) {
-    memset(header, 0, sizeof(tHeader));
-    header->mDataLen = dataLen;
-    memcpy(header + 1, data, dataLen);
-
-    mQueue.push_back(header);
-
-    retval = true;
-  } else {
-    LOG(ERROR) << StringPrintf("DataQueue::enqueue: out of memory ?????");
+  size_t tail = mTail.load(std::memory_order_relaxed);
+  size_t head = mHead.load(std::memory_order_acquire);
+  if (mArena.size() - (tail - head) < RECORD_HEADER_LEN + dataLen) {
+    if (mRejectedCount++ == 0) {
+      LOG(ERROR) << StringPrintf("DataQueue::enqueue: full; len=%u", dataLen);
+    }
+    return false;
   }
-  mMutex.unlock();
-  return retval;
+
+  uint8_t header[RECORD_HEADER_LEN] = {(uint8_t)(dataLen >> 8),
+                                       (uint8_t)dataLen};
+  copyIn(tail, header, RECORD_HEADER_LEN);
+  copyIn(tail + RECORD_HEADER_LEN, data, dataLen);
+  // publish the record only once it is complete
+  mTail.store(tail + RECORD_HEADER_LEN + dataLen, std::memory_order_release);
+  return true;
 }
 
 /*******************************************************************************
@@ -112,31 +168,27 @@ bool DataQueue::enqueue(uint8_t* data, uint16_t dataLen) {
 *******************************************************************************/
 bool DataQueue::dequeue(uint8_t* buffer, uint16_t bufferMaxLen,
                         uint16_t& actualLen) {
-  mMutex.lock();
-
-  tHeader* header = mQueue.front();
-  bool retval = false;
-
-  if (header && buffer && (bufferMaxLen > 0)) {
-    if (header->mDataLen <= bufferMaxLen) {
-      // caller's buffer is big enough to store all data
-      actualLen = header->mDataLen;
-      char* src = (char*)(header) + sizeof(tHeader) + header->mOffset;
-      memcpy(buffer, src, actualLen);
-
-      mQueue.pop_front();
-      free(header);
-    } else {
-      // caller's buffer is too small
-      actualLen = bufferMaxLen;
-      char* src = (char*)(header) + sizeof(tHeader) + header->mOffset;
-      memcpy(buffer, src, actualLen);
-      // adjust offset so the next dequeue() will get the remainder
-      header->mDataLen -= actualLen;
-      header->mOffset += actualLen;
-    }
-    retval = true;
+  size_t head = mHead.load(std::memory_order_relaxed);
+  size_t tail = mTail.load(std::memory_order_acquire);
+  if ((head == tail) || (buffer == NULL) || (bufferMaxLen == 0)) return false;
+
+  uint8_t header[RECORD_HEADER_LEN];
+  copyOut(head, header, RECORD_HEADER_LEN);
+  uint16_t dataLen = (header[0] << 8) | header[1];
+  size_t src = head + RECORD_HEADER_LEN + mOffset;
+
+  if (dataLen - mOffset <= bufferMaxLen) {
+    // caller's buffer is big enough to store all data
+    actualLen = dataLen - mOffset;
+    copyOut(src, buffer, actualLen);
+    mOffset = 0;
+    // only now may the producer reuse the record
+    mHead.store(head + RECORD_HEADER_LEN + dataLen, std::memory_order_release);
+  } else {
+    // caller's buffer is too small; the next dequeue() gets the remainder
+    actualLen = bufferMaxLen;
+    copyOut(src, buffer, actualLen);
+    mOffset += actualLen;
   }
-  mMutex.unlock();
-  return retval;
+  return true;
 }
@@ -14,28 +14,43 @@
  * limitations under the License.
  */
 
+
 /*
  *  Store data bytes in a variable-size queue.
  */
 
 #pragma once
-#include <list>
-#include "Mutex.h"
+#include <atomic>
+#include <vector>
 #include "NfcJniUtil.h"
 #include "gki.h"
 
+/*****************************************************************************
+**
+**  Name:           DataQueue
+**
+**  Description:    Bounded queue of variable-length records in one ring
+**                  buffer allocated up front.  One thread may enqueue while
+**                  another dequeues without any lock; neither side may be
+**                  used from two threads at once.
+**
+*****************************************************************************/
 class DataQueue {
  public:
+  static const size_t DEFAULT_CAPACITY = 16 * 1024;
+
   /*******************************************************************************
   **
   ** Function:        DataQueue
   **
   ** Description:     Initialize member variables.
+  **                  capacity: size of the ring in bytes, record headers
+  **                  included.
   **
   ** Returns:         None.
   **
   *******************************************************************************/
-  DataQueue();
+  DataQueue(size_t capacity = DEFAULT_CAPACITY);
 
   /*******************************************************************************
   **
@@ -52,7 +67,10 @@ class DataQueue {
   **
   ** Function:        enqueue
   **
-  ** Description:     Append data to the queue.
+  ** Description:     Append data to the queue.  The data is rejected, not
+  **                  truncated, when the ring does not have room for it;
+  **                  the producer should then back off until the consumer
+  **                  has made room, see freeSpace().
   **                  data: array of bytes
   **                  dataLen: length of the data.
   **
@@ -66,6 +84,8 @@ class DataQueue {
   ** Function:        dequeue
   **
   ** Description:     Retrieve and remove data from the front of the queue.
+  **                  If the buffer is smaller than the front record, the
+  **                  record is kept and the next dequeue() gets the rest.
   **                  buffer: array to store the data.
   **                  bufferMaxLen: maximum size of the buffer.
   **                  actualLen: actual length of the data.
@@ -86,13 +106,40 @@ class DataQueue {
   *******************************************************************************/
   bool isEmpty();
 
+  /*******************************************************************************
+  **
+  ** Function:        freeSpace
+  **
+  ** Description:     Get the longest data enqueue() would accept now.
+  **
+  ** Returns:         Number of bytes.
+  **
+  *******************************************************************************/
+  size_t freeSpace();
+
+  /*******************************************************************************
+  **
+  ** Function:        getRejectedCount
+  **
+  ** Description:     Get how many times enqueue() rejected data for lack of
+  **                  room.
+  **
+  ** Returns:         Number of rejected enqueue() calls.
+  **
+  *******************************************************************************/
+  uint32_t getRejectedCount() { return mRejectedCount.load(); }
+
  private:
-  struct tHeader {
-    uint16_t mDataLen;  // number of octets of data
-    uint16_t mOffset;   // offset of the first octet of data
-  };
-  typedef std::list<tHeader*> Queue;
+  static const size_t RECORD_HEADER_LEN = 2;  // data length, big-endian
+
+  void copyIn(size_t pos, const uint8_t* src, size_t len);
+  void copyOut(size_t pos, uint8_t* dst, size_t len);
 
-  Queue mQueue;
-  Mutex mMutex;
+  std::vector<uint8_t> mArena;
+  // Free-running positions in the ring; mHead is only written by the
+  // consumer and mTail only by the producer
+  std::atomic<size_t> mHead;
+  std::atomic<size_t> mTail;
+  uint16_t mOffset;  // bytes of the front record already dequeued
+  std::atomic<uint32_t> mRejectedCount;
 };
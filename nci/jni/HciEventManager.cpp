@@ -18,18 +18,53 @@
 #include <base/logging.h>
 #include <log/log.h>
 #include <nativehelper/ScopedLocalRef.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
 #include "JavaClassConstants.h"
 #include "NfcJniUtil.h"
+#include "RoutingManager.h"
+#include "TlvReader.h"
 #include "nfc_config.h"
 
+// Lists of pipe ids, one per secure element, e.g.
+//   OFF_HOST_ESE_PIPE_IDS={16:17}
+//   OFF_HOST_SIM_PIPE_IDS={0A:0B}
+// They take precedence over the single OFF_HOST_ESE_PIPE_ID and
+// OFF_HOST_SIM_PIPE_ID.  Defined here until config.h of the stack has them.
+#ifndef NAME_OFF_HOST_ESE_PIPE_IDS
+#define NAME_OFF_HOST_ESE_PIPE_IDS "OFF_HOST_ESE_PIPE_IDS"
+#endif
+#ifndef NAME_OFF_HOST_SIM_PIPE_IDS
+#define NAME_OFF_HOST_SIM_PIPE_IDS "OFF_HOST_SIM_PIPE_IDS"
+#endif
+
 extern bool nfc_debug_enabled;
 const char* APP_NAME = "NfcNci";
-uint8_t HciEventManager::sEsePipe;
-uint8_t HciEventManager::sSimPipe;
 
 using android::base::StringPrintf;
 
-HciEventManager::HciEventManager() : mNativeData(nullptr) {}
+namespace {
+// events held while Java is busy; when full, the HCI callback waits up to
+// MAX_QUEUE_WAIT_MS for the flush thread, then drops the new event
+const size_t MAX_PENDING_TRANSACTIONS = 64;
+const long MAX_QUEUE_WAIT_MS = 100;
+}  // namespace
+
+HciEventManager::HciEventManager()
+    : mNativeData(nullptr),
+      mNumSePipes(0),
+      mUnknownPipeCount(0),
+      mFlushThreadStarted(false),
+      mReleaseJniRefs(false),
+      mEventCount(0),
+      mDroppedCount(0),
+      mBatchCount(0),
+      mMaxBatchSize(0) {
+  memset(mPipeToSe, NO_SE, sizeof(mPipeToSe));
+}
 
 HciEventManager& HciEventManager::getInstance() {
   static HciEventManager sHciEventManager;
@@ -37,100 +72,285 @@ HciEventManager& HciEventManager::getInstance() {
 }
 
 void HciEventManager::initialize(nfc_jni_native_data* native) {
-  mNativeData = native;
+  {
+    SyncEventGuard guard(mTransactionEvent);
+    mNativeData = native;
+    if (!mFlushThreadStarted) {
+      pthread_t thread;
+      pthread_attr_t attr;
+      pthread_attr_init(&attr);
+      pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+      if (pthread_create(&thread, &attr, flushThread, NULL) == 0) {
+        mFlushThreadStarted = true;
+      } else {
+        LOG(ERROR) << "fail create transaction thread";
+      }
+      pthread_attr_destroy(&attr);
+    }
+  }
+  buildPipeRegistry();
   tNFA_STATUS nfaStat = NFA_HciRegister(const_cast<char*>(APP_NAME),
                                         (tNFA_HCI_CBACK*)&nfaHciCallback, true);
   if (nfaStat != NFA_STATUS_OK) {
     LOG(ERROR) << "HCI registration failed; status=" << nfaStat;
   }
-  sEsePipe = NfcConfig::getUnsigned(NAME_OFF_HOST_ESE_PIPE_ID, 0x16);
-  sSimPipe = NfcConfig::getUnsigned(NAME_OFF_HOST_SIM_PIPE_ID, 0x0A);
 }
 
-void HciEventManager::notifyTransactionListenersOfAid(std::vector<uint8_t> aid,
-                                                      std::vector<uint8_t> data,
-                                                      std::string evtSrc) {
-  if (aid.empty()) {
-    return;
-  }
+/*******************************************************************************
+**
+** Function:        buildPipeRegistry
+**
+** Description:     Map the pipe of every configured secure element to its
+**                  name.  OFF_HOST_ESE_PIPE_IDS and OFF_HOST_SIM_PIPE_IDS
+**                  list one pipe per secure element, in the order of
+**                  OFFHOST_ROUTE_ESE and OFFHOST_ROUTE_UICC; without them
+**                  the single pipe of OFF_HOST_ESE_PIPE_ID and
+**                  OFF_HOST_SIM_PIPE_ID is used.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void HciEventManager::buildPipeRegistry() {
+  mNumSePipes = 0;
+  memset(mPipeToSe, NO_SE, sizeof(mPipeToSe));
 
-  JNIEnv* e = NULL;
-  ScopedAttach attach(mNativeData->vm, &e);
-  CHECK(e);
-
-  ScopedLocalRef<jobject> aidJavaArray(e, e->NewByteArray(aid.size()));
-  CHECK(aidJavaArray.get());
-  e->SetByteArrayRegion((jbyteArray)aidJavaArray.get(), 0, aid.size(),
-                        (jbyte*)&aid[0]);
-  CHECK(!e->ExceptionCheck());
-
-  ScopedLocalRef<jobject> srcJavaString(e, e->NewStringUTF(evtSrc.c_str()));
-  CHECK(srcJavaString.get());
-
-  if (data.size() > 0) {
-    ScopedLocalRef<jobject> dataJavaArray(e, e->NewByteArray(data.size()));
-    CHECK(dataJavaArray.get());
-    e->SetByteArrayRegion((jbyteArray)dataJavaArray.get(), 0, data.size(),
-                          (jbyte*)&data[0]);
-    CHECK(!e->ExceptionCheck());
-    e->CallVoidMethod(mNativeData->manager,
-                      android::gCachedNfcManagerNotifyTransactionListeners,
-                      aidJavaArray.get(), dataJavaArray.get(),
-                      srcJavaString.get());
+  RoutingManager& routingManager = RoutingManager::getInstance();
+  std::vector<uint8_t> discovered = routingManager.getDiscoveredNfceeIds();
+
+  std::vector<uint8_t> esePipes;
+  if (NfcConfig::hasKey(NAME_OFF_HOST_ESE_PIPE_IDS)) {
+    esePipes = NfcConfig::getBytes(NAME_OFF_HOST_ESE_PIPE_IDS);
   } else {
-    e->CallVoidMethod(mNativeData->manager,
-                      android::gCachedNfcManagerNotifyTransactionListeners,
-                      aidJavaArray.get(), NULL, srcJavaString.get());
+    esePipes.push_back(NfcConfig::getUnsigned(NAME_OFF_HOST_ESE_PIPE_ID, 0x16));
   }
+  std::vector<uint8_t> simPipes;
+  if (NfcConfig::hasKey(NAME_OFF_HOST_SIM_PIPE_IDS)) {
+    simPipes = NfcConfig::getBytes(NAME_OFF_HOST_SIM_PIPE_IDS);
+  } else {
+    simPipes.push_back(NfcConfig::getUnsigned(NAME_OFF_HOST_SIM_PIPE_ID, 0x0A));
+  }
+  addSePipes("eSE", esePipes, routingManager.getOffHostRouteEse(),
+             discovered);
+  addSePipes("SIM", simPipes, routingManager.getOffHostRouteUicc(),
+             discovered);
 }
 
-/**
- * BerTlv has the following format:
- *
- * byte1 byte2 byte3 byte4 byte5 byte6
- * 00-7F   -    -     -     -     -
- * 81    00-FF  -     -     -     -
- * 82    0000-FFFF    -     -     -
- * 83      000000-FFFFFF    -     -
- * 84      00000000-FFFFFFFF      -
- */
-std::vector<uint8_t> HciEventManager::getDataFromBerTlv(
-    std::vector<uint8_t> berTlv) {
-  if (berTlv.empty()) {
-    return std::vector<uint8_t>();
+/*******************************************************************************
+**
+** Function:        addSePipes
+**
+** Description:     Register the pipes of one kind of secure element, named
+**                  prefix1, prefix2 and so on.
+**                  prefix: "eSE" or "SIM".
+**                  pipes: pipe of each secure element.
+**                  nfceeIds: NFCEE ID of each secure element.
+**                  discovered: NFCEE IDs found during EE discovery.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void HciEventManager::addSePipes(const char* prefix,
+                                 const std::vector<uint8_t>& pipes,
+                                 const std::vector<uint8_t>& nfceeIds,
+                                 const std::vector<uint8_t>& discovered) {
+  for (size_t i = 0; i < pipes.size(); i++) {
+    uint8_t pipe = pipes[i];
+    if (pipe >= NUM_PIPE_IDS || mPipeToSe[pipe] != NO_SE) {
+      LOG(ERROR) << StringPrintf("%s: invalid or duplicate pipe 0x%02X",
+                                 __func__, pipe);
+      continue;
+    }
+    if (mNumSePipes >= MAX_SE_PIPES) {
+      LOG(ERROR) << StringPrintf("%s: too many pipes", __func__);
+      return;
+    }
+    SePipe& se = mSePipes[mNumSePipes];
+    snprintf(se.name, sizeof(se.name), "%s%zu", prefix, i + 1);
+    se.pipe = pipe;
+    se.nfceeId = i < nfceeIds.size() ? nfceeIds[i] : 0;
+    se.discovered = std::find(discovered.begin(), discovered.end(),
+                              se.nfceeId) != discovered.end();
+    se.eventCount = 0;
+    se.transactionCount = 0;
+    mPipeToSe[pipe] = mNumSePipes++;
+    DLOG_IF(INFO, nfc_debug_enabled)
+        << StringPrintf("%s: %s pipe=0x%02X nfcee=0x%02X discovered=%d",
+                        __func__, se.name, se.pipe, se.nfceeId, se.discovered);
+  }
+}
+
+/*******************************************************************************
+**
+** Function:        queueTransaction
+**
+** Description:     Copy a transaction event out of the HCI buffer and wake
+**                  the flush thread.  Events that arrive while Java handles
+**                  a batch are delivered together in the next one.  If the
+**                  queue is full, wait a little for the flush thread before
+**                  dropping the event.
+**                  aid: AID of the event.
+**                  aidLen: length of aid.
+**                  data: parameters of the event, or NULL.
+**                  dataLen: length of data.
+**                  evtSrc: name of the secure element.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void HciEventManager::queueTransaction(const uint8_t* aid, size_t aidLen,
+                                       const uint8_t* data, size_t dataLen,
+                                       const char* evtSrc) {
+  if (aidLen == 0) {
+    return;
+  }
+
+  SyncEventGuard guard(mTransactionEvent);
+  mEventCount++;
+  if (mNativeData != NULL && mPending.size() >= MAX_PENDING_TRANSACTIONS) {
+    mTransactionEvent.waitFor(MAX_QUEUE_WAIT_MS, [this] {
+      return mNativeData == NULL ||
+             mPending.size() < MAX_PENDING_TRANSACTIONS;
+    });
+  }
+  if (mNativeData == NULL || mPending.size() >= MAX_PENDING_TRANSACTIONS) {
+    mDroppedCount++;
+    LOG(ERROR) << StringPrintf("%s: dropping event from %s; %u dropped",
+                               __func__, evtSrc, mDroppedCount);
+    return;
+  }
+  Transaction transaction = {mPendingBytes.size(), aidLen, dataLen, evtSrc};
+  mPendingBytes.insert(mPendingBytes.end(), aid, aid + aidLen);
+  if (dataLen > 0) {
+    mPendingBytes.insert(mPendingBytes.end(), data, data + dataLen);
   }
-  size_t lengthTag = berTlv[0];
-  DLOG_IF(INFO, nfc_debug_enabled) << "decodeBerTlv: berTlv[0]=" << berTlv[0];
-
-  /* As per ISO/IEC 7816, read the first byte to determine the length and
-   * the start index accordingly
-   */
-  if (lengthTag < 0x80 && berTlv.size() == (lengthTag + 1)) {
-    return std::vector<uint8_t>(berTlv.begin() + 1, berTlv.end());
-  } else if (lengthTag == 0x81 && berTlv.size() > 2) {
-    size_t length = berTlv[1];
-    if ((length + 2) == berTlv.size()) {
-      return std::vector<uint8_t>(berTlv.begin() + 2, berTlv.end());
+  mPending.push_back(std::move(transaction));
+  if (mPending.size() == 1) mTransactionEvent.notifyAll();
+}
+
+void* HciEventManager::flushThread(void*) {
+  getInstance().runFlushes();
+  return NULL;
+}
+
+/*******************************************************************************
+**
+** Function:        runFlushes
+**
+** Description:     Deliver queued transaction events to Java, one call per
+**                  batch.  The thread stays attached to the JVM, and the
+**                  array classes and source names are resolved once per
+**                  initialize(); finalize() has their global references
+**                  released.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void HciEventManager::runFlushes() {
+  JNIEnv* e = NULL;
+  jclass byteArrayClass = NULL;
+  jclass stringClass = NULL;
+  std::vector<std::pair<std::string, jstring>> evtSrcStrings;
+  std::vector<Transaction> batch;
+  std::vector<uint8_t> batchBytes;
+
+  for (;;) {
+    nfc_jni_native_data* native;
+    bool releaseJniRefs;
+    {
+      SyncEventGuard guard(mTransactionEvent);
+      mTransactionEvent.waitFor(
+          [this] { return !mPending.empty() || mReleaseJniRefs; });
+      releaseJniRefs = mReleaseJniRefs;
+      mReleaseJniRefs = false;
+      // swapping keeps the capacity of both sides, so the steady state
+      // does not allocate
+      batch.swap(mPending);
+      batchBytes.swap(mPendingBytes);
+      mPending.clear();
+      mPendingBytes.clear();
+      native = mNativeData;
+      if (!batch.empty()) {
+        mBatchCount++;
+        mMaxBatchSize = std::max<uint32_t>(mMaxBatchSize, batch.size());
+      }
+      // wake a HCI callback waiting for room
+      mTransactionEvent.notifyAll();
     }
-  } else if (lengthTag == 0x82 && berTlv.size() > 3) {
-    size_t length = ((berTlv[1] << 8) | berTlv[2]);
-    if ((length + 3) == berTlv.size()) {
-      return std::vector<uint8_t>(berTlv.begin() + 3, berTlv.end());
+    if (releaseJniRefs && e != NULL) {
+      for (const auto& cached : evtSrcStrings) {
+        e->DeleteGlobalRef(cached.second);
+      }
+      evtSrcStrings.clear();
+      e->DeleteGlobalRef(byteArrayClass);
+      e->DeleteGlobalRef(stringClass);
+      byteArrayClass = NULL;
+      stringClass = NULL;
     }
-  } else if (lengthTag == 0x83 && berTlv.size() > 4) {
-    size_t length = (berTlv[1] << 16) | (berTlv[2] << 8) | berTlv[3];
-    if ((length + 4) == berTlv.size()) {
-      return std::vector<uint8_t>(berTlv.begin() + 4, berTlv.end());
+    if (native == NULL || batch.empty()) continue;
+
+    if (e == NULL) {
+      e = android::nfc_jni_attach_thread(native->vm);
+      if (e == NULL) {
+        LOG(ERROR) << "fail attach transaction thread";
+        continue;
+      }
     }
-  } else if (lengthTag == 0x84 && berTlv.size() > 5) {
-    size_t length =
-        (berTlv[1] << 24) | (berTlv[2] << 16) | (berTlv[3] << 8) | berTlv[4];
-    if ((length + 5) == berTlv.size()) {
-      return std::vector<uint8_t>(berTlv.begin() + 5, berTlv.end());
+    if (byteArrayClass == NULL) {
+      ScopedLocalRef<jclass> cls(e, e->FindClass("[B"));
+      byteArrayClass = (jclass)e->NewGlobalRef(cls.get());
+      cls.reset(e->FindClass("java/lang/String"));
+      stringClass = (jclass)e->NewGlobalRef(cls.get());
+    }
+
+    jsize count = batch.size();
+    ScopedLocalRef<jobjectArray> aids(
+        e, e->NewObjectArray(count, byteArrayClass, NULL));
+    ScopedLocalRef<jobjectArray> datas(
+        e, e->NewObjectArray(count, byteArrayClass, NULL));
+    ScopedLocalRef<jobjectArray> evtSrcs(
+        e, e->NewObjectArray(count, stringClass, NULL));
+    CHECK(aids.get() && datas.get() && evtSrcs.get());
+
+    for (jsize i = 0; i < count; i++) {
+      const Transaction& transaction = batch[i];
+      const jbyte* bytes = (const jbyte*)&batchBytes[transaction.offset];
+      ScopedLocalRef<jbyteArray> aid(e, e->NewByteArray(transaction.aidLen));
+      CHECK(aid.get());
+      e->SetByteArrayRegion(aid.get(), 0, transaction.aidLen, bytes);
+      e->SetObjectArrayElement(aids.get(), i, aid.get());
+      if (transaction.dataLen > 0) {
+        ScopedLocalRef<jbyteArray> data(
+            e, e->NewByteArray(transaction.dataLen));
+        CHECK(data.get());
+        e->SetByteArrayRegion(data.get(), 0, transaction.dataLen,
+                              bytes + transaction.aidLen);
+        e->SetObjectArrayElement(datas.get(), i, data.get());
+      }
+
+      // there are only a few sources, so a linear search is enough
+      jstring evtSrc = NULL;
+      for (const auto& cached : evtSrcStrings) {
+        if (cached.first == transaction.evtSrc) evtSrc = cached.second;
+      }
+      if (evtSrc == NULL) {
+        ScopedLocalRef<jstring> str(
+            e, e->NewStringUTF(transaction.evtSrc.c_str()));
+        CHECK(str.get());
+        evtSrc = (jstring)e->NewGlobalRef(str.get());
+        evtSrcStrings.push_back(std::make_pair(transaction.evtSrc, evtSrc));
+      }
+      e->SetObjectArrayElement(evtSrcs.get(), i, evtSrc);
+    }
+    CHECK(!e->ExceptionCheck());
+
+    e->CallVoidMethod(native->manager,
+                      android::gCachedNfcManagerNotifyTransactionListeners,
+                      aids.get(), datas.get(), evtSrcs.get());
+    if (e->ExceptionCheck()) {
+      e->ExceptionClear();
+      LOG(ERROR) << "fail notify";
     }
   }
-  LOG(ERROR) << "Error in TLV length encoding!";
-  return std::vector<uint8_t>();
 }
 
 void HciEventManager::nfaHciCallback(tNFA_HCI_EVT event,
@@ -143,43 +363,66 @@ void HciEventManager::nfaHciCallback(tNFA_HCI_EVT event,
       "event=%d code=%d pipe=%d len=%d", event, eventData->rcvd_evt.evt_code,
       eventData->rcvd_evt.pipe, eventData->rcvd_evt.evt_len);
 
-  std::string evtSrc;
-  if (eventData->rcvd_evt.pipe == sEsePipe) {
-    evtSrc = "eSE1";
-  } else if (eventData->rcvd_evt.pipe == sSimPipe) {
-    evtSrc = "SIM1";
-  } else {
+  HciEventManager& manager = getInstance();
+  uint8_t pipe = eventData->rcvd_evt.pipe;
+  uint8_t seIndex = pipe < NUM_PIPE_IDS ? manager.mPipeToSe[pipe] : NO_SE;
+  if (seIndex == NO_SE) {
+    manager.mUnknownPipeCount++;
     LOG(WARNING) << "Incorrect Pipe Id";
     return;
   }
+  SePipe& se = manager.mSePipes[seIndex];
+  se.eventCount++;
+  const char* evtSrc = se.name;
 
-  uint8_t* buff = eventData->rcvd_evt.p_evt_buf;
+  // parsed in place; queueTransaction() makes the only copy
+  const uint8_t* buff = eventData->rcvd_evt.p_evt_buf;
   uint32_t buffLength = eventData->rcvd_evt.evt_len;
-  std::vector<uint8_t> event_buff(buff, buff + buffLength);
   // Check the event and check if it contains the AID
   if (event == NFA_HCI_EVENT_RCVD_EVT &&
       eventData->rcvd_evt.evt_code == NFA_HCI_EVT_TRANSACTION &&
-      buffLength > 3 && event_buff[0] == 0x81) {
-    uint32_t aidlen = event_buff[1];
-    if (aidlen < (buffLength - 1)) {
-      std::vector<uint8_t> aid(event_buff.begin() + 2,
-                               event_buff.begin() + aidlen + 2);
-
-      int32_t berTlvStart = aidlen + 2 + 1;
-      int32_t berTlvLen = buffLength - berTlvStart;
-      std::vector<uint8_t> data;
-      if (berTlvLen > 0 && event_buff[2 + aidlen] == 0x82) {
-        std::vector<uint8_t> berTlv(event_buff.begin() + berTlvStart,
-                                    event_buff.end());
-        // BERTLV decoding here, to support extended data length for params.
-        data = getInstance().getDataFromBerTlv(berTlv);
-      }
-      getInstance().notifyTransactionListenersOfAid(aid, data, evtSrc);
-    } else {
+      buffLength > 3 && buff[0] == HciTransactionTag::AID) {
+    BerTlvReader reader(buff, buffLength);
+    Tlv aid;
+    if (!reader.next(&aid)) {
       android_errorWriteLog(0x534e4554, "181346545");
-      LOG(ERROR) << StringPrintf("error: aidlen(%d) is too big", aidlen);
+      LOG(ERROR) << StringPrintf("error: aidlen(%d) is too big", buff[1]);
+      return;
+    }
+
+    // BER length of the parameters, to support extended data length.
+    Tlv params = {0, NULL, 0};
+    if (reader.offset() < buffLength &&
+        buff[reader.offset()] == HciTransactionTag::PARAMETERS &&
+        !reader.next(&params)) {
+      LOG(ERROR) << "Error in TLV length encoding!";
     }
+    se.transactionCount++;
+    manager.queueTransaction(aid.value, aid.length, params.value,
+                             params.length, evtSrc);
   }
 }
 
-void HciEventManager::finalize() { mNativeData = NULL; }
+void HciEventManager::finalize() {
+  SyncEventGuard guard(mTransactionEvent);
+  mNativeData = NULL;
+  mPending.clear();
+  mPendingBytes.clear();
+  if (mFlushThreadStarted) mReleaseJniRefs = true;
+  mTransactionEvent.notifyAll();
+}
+
+void HciEventManager::dump(int fd) {
+  SyncEventGuard guard(mTransactionEvent);
+  dprintf(fd, "HCI transaction events:\n");
+  dprintf(fd, "  received=%u dropped=%u pending=%zu\n", mEventCount,
+          mDroppedCount, mPending.size());
+  dprintf(fd, "  batches=%u max batch=%u\n", mBatchCount, mMaxBatchSize);
+  dprintf(fd, "  events on unknown pipes=%u\n", mUnknownPipeCount.load());
+  for (size_t i = 0; i < mNumSePipes; i++) {
+    const SePipe& se = mSePipes[i];
+    dprintf(fd, "  %s: pipe=0x%02X nfcee=0x%02X%s events=%u transactions=%u\n",
+            se.name, se.pipe, se.nfceeId, se.discovered ? "" : " (absent)",
+            se.eventCount.load(), se.transactionCount.load());
+  }
+}
@@ -15,7 +15,12 @@
  */
 #pragma once
 
+#include <atomic>
+#include <string>
+#include <vector>
+
 #include "NfcJniUtil.h"
+#include "SyncEvent.h"
 #include "nfa_hci_api.h"
 #include "nfa_hci_defs.h"
 
@@ -25,19 +30,66 @@
  */
 class HciEventManager {
  private:
+  // A transaction event waiting to be delivered; aid and data are stored
+  // back to back at offset in mPendingBytes.  The source name is copied,
+  // since the pipe registry is rebuilt on every initialize().
+  struct Transaction {
+    size_t offset;
+    size_t aidLen;
+    size_t dataLen;
+    std::string evtSrc;
+  };
+
+  // A secure element that sends events on its own HCI pipe.  The counters
+  // are bumped on the HCI callback thread and read by dump().
+  struct SePipe {
+    char name[8];  // event source reported to Java, e.g. "SIM2"
+    uint8_t pipe;
+    uint8_t nfceeId;  // from the off-host route of the same index, or 0
+    bool discovered;  // nfceeId was found during EE discovery
+    std::atomic<uint32_t> eventCount;
+    std::atomic<uint32_t> transactionCount;
+  };
+  static const size_t MAX_SE_PIPES = 8;
+  static const size_t NUM_PIPE_IDS = 0x80;  // pipe identifiers are 7 bits
+  static const uint8_t NO_SE = 0xFF;
+
   nfc_jni_native_data* mNativeData;
-  static uint8_t sEsePipe;
-  static uint8_t sSimPipe;
+
+  // Pipe registry; built by initialize() before HCI events are registered
+  // for, and only read afterwards.  mPipeToSe is indexed by pipe identifier.
+  SePipe mSePipes[MAX_SE_PIPES];
+  size_t mNumSePipes;
+  uint8_t mPipeToSe[NUM_PIPE_IDS];
+  std::atomic<uint32_t> mUnknownPipeCount;
+
+  // Events queued by the HCI callback and delivered to Java in batches by
+  // the flush thread; guarded by mTransactionEvent.
+  SyncEvent mTransactionEvent;
+  std::vector<Transaction> mPending;
+  std::vector<uint8_t> mPendingBytes;
+  bool mFlushThreadStarted;
+  bool mReleaseJniRefs;  // finalize() asks the flush thread to clean up
+  uint32_t mEventCount;
+  uint32_t mDroppedCount;
+  uint32_t mBatchCount;
+  uint32_t mMaxBatchSize;
 
   HciEventManager();
-  std::vector<uint8_t> getDataFromBerTlv(std::vector<uint8_t> berTlv);
-  void notifyTransactionListenersOfAid(std::vector<uint8_t> aid,
-                                       std::vector<uint8_t> data,
-                                       std::string evtSrc);
+  void buildPipeRegistry();
+  void addSePipes(const char* prefix, const std::vector<uint8_t>& pipes,
+                  const std::vector<uint8_t>& nfceeIds,
+                  const std::vector<uint8_t>& discovered);
+  void queueTransaction(const uint8_t* aid, size_t aidLen,
+                        const uint8_t* data, size_t dataLen,
+                        const char* evtSrc);
+  static void* flushThread(void*);
+  void runFlushes();
   static void nfaHciCallback(tNFA_HCI_EVT event, tNFA_HCI_EVT_DATA* eventData);
 
  public:
   static HciEventManager& getInstance();
   void initialize(nfc_jni_native_data* native);
   void finalize();
+  void dump(int fd);
 };
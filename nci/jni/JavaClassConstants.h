@@ -28,6 +28,8 @@ extern jmethodID gCachedNfcManagerNotifyLlcpFirstPacketReceived;
  */
 extern jmethodID gCachedNfcManagerNotifyHostEmuActivated;
 extern jmethodID gCachedNfcManagerNotifyHostEmuData;
+extern jmethodID gCachedNfcManagerNotifyHostEmuSelect;
+extern jmethodID gCachedNfcManagerNotifyHostEmuStaticResponse;
 extern jmethodID gCachedNfcManagerNotifyHostEmuDeactivated;
 
 extern jmethodID gCachedNfcManagerNotifyEeUpdated;
@@ -0,0 +1,287 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Choose the MIU and receive window of LLCP connections from the
+ *  throughput earlier connections to the same peer reached.
+ */
+#include "LlcpLinkTuner.h"
+
+#include <android-base/stringprintf.h>
+#include <base/logging.h>
+#include <stdio.h>
+#include <time.h>
+
+using android::base::StringPrintf;
+
+extern bool nfc_debug_enabled;
+
+namespace {
+const size_t MAX_PEERS = 8;
+const size_t MAX_CANDIDATES = 12;  // per peer, oldest dropped first
+const size_t NUM_RUNGS = 3;
+const uint16_t MIN_MIU = 128;  // default MIU of LLCP
+// connections that moved less are too short to say anything
+const uint64_t MIN_SAMPLE_BYTES = 1024;
+// every so many links, the least tried candidate is tried again
+const uint32_t REPROBE_INTERVAL = 8;
+
+uint64_t monotonicNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+}  // namespace
+
+/*******************************************************************************
+**
+** Function:        addTraffic
+**
+** Description:     Account for data sent or received.
+**                  bytes: length of the data.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void LlcpLinkTuner::Meter::addTraffic(size_t bytes) {
+  uint64_t now = monotonicNs();
+  uint64_t unset = 0;
+  mFirstNs.compare_exchange_strong(unset, now);
+  mLastNs = now;
+  mBytes += bytes;
+}
+
+LlcpLinkTuner::LlcpLinkTuner()
+    : mCurrentPeer(PeerKey{0, 0, 0}), mLinkExplored(false), mUseCount(0) {}
+
+/*******************************************************************************
+**
+** Function:        getInstance
+**
+** Description:     Get the singleton LlcpLinkTuner object.
+**
+** Returns:         Singleton LlcpLinkTuner object.
+**
+*******************************************************************************/
+LlcpLinkTuner& LlcpLinkTuner::getInstance() {
+  static LlcpLinkTuner sTuner;
+  return sTuner;
+}
+
+/*******************************************************************************
+**
+** Function:        peerActivated
+**
+** Description:     Set the peer new connections are tuned for, at the
+**                  start of a link.
+**                  key: LLCP version, well-known services and fingerprint
+**                  of the peer.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void LlcpLinkTuner::peerActivated(const PeerKey& key) {
+  AutoMutex mutex(mMutex);
+  mCurrentPeer = key;
+  mLinkExplored = false;
+  DLOG_IF(INFO, nfc_debug_enabled)
+      << StringPrintf("%s: peer 0x%08X version 0x%02X wks 0x%04X", __func__,
+                      key.fingerprint, key.version, key.wks);
+}
+
+/*******************************************************************************
+**
+** Function:        findPeerLocked
+**
+** Description:     Find a peer, replacing the least recently used one if
+**                  the peer is new and the table is full.
+**                  key: key of the peer.
+**
+** Returns:         Peer.
+**
+*******************************************************************************/
+LlcpLinkTuner::Peer& LlcpLinkTuner::findPeerLocked(const PeerKey& key) {
+  Peer* oldest = NULL;
+  for (Peer& peer : mPeers) {
+    if (peer.key == key) {
+      peer.lastUsed = ++mUseCount;
+      return peer;
+    }
+    if (oldest == NULL || peer.lastUsed < oldest->lastUsed) oldest = &peer;
+  }
+  if (mPeers.size() < MAX_PEERS) {
+    mPeers.push_back(Peer());
+    oldest = &mPeers.back();
+  }
+  *oldest = Peer();
+  oldest->key = key;
+  oldest->lastUsed = ++mUseCount;
+  return *oldest;
+}
+
+/*******************************************************************************
+**
+** Function:        findCandidateLocked
+**
+** Description:     Find the statistics of a pair of parameters.
+**                  peer: peer they are used with.
+**                  miu: MIU.
+**                  rw: receive window.
+**
+** Returns:         Statistics.
+**
+*******************************************************************************/
+LlcpLinkTuner::Candidate& LlcpLinkTuner::findCandidateLocked(Peer& peer,
+                                                             uint16_t miu,
+                                                             uint8_t rw) {
+  for (Candidate& candidate : peer.candidates) {
+    if (candidate.miu == miu && candidate.rw == rw) return candidate;
+  }
+  peer.candidates.push_back(Candidate{miu, rw, 0, 0, 0, 0});
+  return peer.candidates.back();
+}
+
+/*******************************************************************************
+**
+** Function:        throughput
+**
+** Description:     Average throughput of a candidate.
+**                  candidate: candidate.
+**
+** Returns:         Bytes per second, or 0 if it was never measured.
+**
+*******************************************************************************/
+uint64_t LlcpLinkTuner::throughput(const Candidate& candidate) {
+  if (candidate.ns == 0) return 0;
+  return (uint64_t)((double)candidate.bytes * 1e9 / candidate.ns);
+}
+
+/*******************************************************************************
+**
+** Function:        choose
+**
+** Description:     Choose the parameters of a new connection to the
+**                  current peer.  The bounds themselves, half the receive
+**                  window and half the MIU are tried once each; after that
+**                  the best of them is used, with an occasional retry of
+**                  the least tried one so that changes are noticed.  Only
+**                  the first connection of a link tries, so the rest of a
+**                  transfer runs on the best parameters known.
+**                  maxMiu: largest MIU allowed.
+**                  maxRw: largest receive window allowed.
+**
+** Returns:         Parameters, within the bounds.
+**
+*******************************************************************************/
+LlcpLinkTuner::Params LlcpLinkTuner::choose(uint16_t maxMiu, uint8_t maxRw) {
+  AutoMutex mutex(mMutex);
+  Peer& peer = findPeerLocked(mCurrentPeer);
+  while (peer.candidates.size() + NUM_RUNGS > MAX_CANDIDATES) {
+    peer.candidates.pop_front();
+  }
+
+  Candidate* ladder[NUM_RUNGS];
+  size_t numRungs = 0;
+  ladder[numRungs++] = &findCandidateLocked(peer, maxMiu, maxRw);
+  if (maxRw > 1) {
+    ladder[numRungs++] = &findCandidateLocked(peer, maxMiu, maxRw / 2);
+  }
+  if (maxMiu / 2 >= MIN_MIU) {
+    ladder[numRungs++] = &findCandidateLocked(peer, maxMiu / 2, maxRw);
+  }
+
+  Candidate* chosen = NULL;
+  Candidate* leastTried = ladder[0];
+  for (size_t i = 0; i < numRungs; i++) {
+    if (ladder[i]->samples < leastTried->samples) leastTried = ladder[i];
+    if (chosen == NULL || throughput(*ladder[i]) > throughput(*chosen)) {
+      chosen = ladder[i];
+    }
+  }
+  peer.connections++;
+  if (!mLinkExplored) {
+    mLinkExplored = true;
+    peer.links++;
+    if (leastTried->samples == 0 || peer.links % REPROBE_INTERVAL == 0) {
+      chosen = leastTried;
+    }
+  }
+
+  peer.last = Params{peer.key, chosen->miu, chosen->rw};
+  DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
+      "%s: peer 0x%08X bounds %u/%u chose miu %u rw %u", __func__,
+      peer.key.fingerprint, maxMiu, maxRw, chosen->miu, chosen->rw);
+  return peer.last;
+}
+
+/*******************************************************************************
+**
+** Function:        record
+**
+** Description:     Record the traffic of a connection that is closing.
+**                  params: parameters the connection used.
+**                  meter: traffic of the connection.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void LlcpLinkTuner::record(const Params& params, const Meter& meter) {
+  uint64_t bytes = meter.mBytes;
+  uint64_t ns = meter.mLastNs - meter.mFirstNs;
+  if (bytes < MIN_SAMPLE_BYTES || ns == 0) return;
+
+  AutoMutex mutex(mMutex);
+  Candidate& candidate =
+      findCandidateLocked(findPeerLocked(params.peer), params.miu, params.rw);
+  candidate.samples++;
+  candidate.congestions += meter.mCongestions;
+  candidate.bytes += bytes;
+  candidate.ns += ns;
+  DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
+      "%s: peer 0x%08X miu %u rw %u: %llu bytes in %llu us", __func__,
+      params.peer.fingerprint, params.miu, params.rw, (unsigned long long)bytes,
+      (unsigned long long)(ns / 1000));
+}
+
+/*******************************************************************************
+**
+** Function:        dump
+**
+** Description:     Print the parameters tried with each peer.
+**                  fd: file descriptor to write to.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void LlcpLinkTuner::dump(int fd) {
+  AutoMutex mutex(mMutex);
+  dprintf(fd, "LLCP link tuning: current peer=0x%08X\n",
+          mCurrentPeer.fingerprint);
+  for (const Peer& peer : mPeers) {
+    dprintf(fd,
+            "  peer=0x%08X version=0x%02X wks=0x%04X links=%u connections=%u "
+            "last miu=%u rw=%u\n",
+            peer.key.fingerprint, peer.key.version, peer.key.wks, peer.links,
+            peer.connections, peer.last.miu, peer.last.rw);
+    for (const Candidate& candidate : peer.candidates) {
+      dprintf(fd,
+              "    miu=%u rw=%u samples=%u congestions=%u throughput=%lluB/s\n",
+              candidate.miu, candidate.rw, candidate.samples,
+              candidate.congestions,
+              (unsigned long long)throughput(candidate));
+    }
+  }
+}
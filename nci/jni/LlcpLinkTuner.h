@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Choose the MIU and receive window of LLCP connections from the
+ *  throughput earlier connections to the same peer reached.
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include "Mutex.h"
+
+/*****************************************************************************
+**
+**  Name:           LlcpLinkTuner
+**
+**  Description:    Keep the throughput of each MIU and receive window tried
+**                  with a peer, and pick the best one for new connections.
+**                  Peers are told apart by the LLCP version and well-known
+**                  services they announce when the link is activated, and
+**                  a fingerprint of their other link parameters.  Only the
+**                  first connection of each link tries parameters other
+**                  than the best known ones.
+**
+*****************************************************************************/
+class LlcpLinkTuner {
+ public:
+  // Key of a peer
+  struct PeerKey {
+    uint32_t fingerprint;
+    uint16_t wks;
+    uint8_t version;
+    bool operator==(const PeerKey& o) const {
+      return fingerprint == o.fingerprint && wks == o.wks &&
+             version == o.version;
+    }
+  };
+
+  // Local parameters of one connection, and the peer they were chosen for
+  struct Params {
+    PeerKey peer;
+    uint16_t miu;
+    uint8_t rw;
+  };
+
+  // Traffic of one connection.  send() and receive() update it without a
+  // lock, as they run on different threads.
+  class Meter {
+   public:
+    Meter() : mBytes(0), mFirstNs(0), mLastNs(0), mCongestions(0) {}
+    void addTraffic(size_t bytes);
+    void addCongestion() { mCongestions++; }
+
+   private:
+    friend class LlcpLinkTuner;
+    std::atomic<uint64_t> mBytes;
+    std::atomic<uint64_t> mFirstNs;
+    std::atomic<uint64_t> mLastNs;
+    std::atomic<uint32_t> mCongestions;
+  };
+
+  /*******************************************************************************
+  **
+  ** Function:        getInstance
+  **
+  ** Description:     Get the singleton LlcpLinkTuner object.
+  **
+  ** Returns:         Singleton LlcpLinkTuner object.
+  **
+  *******************************************************************************/
+  static LlcpLinkTuner& getInstance();
+
+  /*******************************************************************************
+  **
+  ** Function:        peerActivated
+  **
+  ** Description:     Set the peer new connections are tuned for, at the
+  **                  start of a link.
+  **                  key: LLCP version, well-known services and fingerprint
+  **                  of the peer.
+  **
+  ** Returns:         None
+  **
+  *******************************************************************************/
+  void peerActivated(const PeerKey& key);
+
+  /*******************************************************************************
+  **
+  ** Function:        choose
+  **
+  ** Description:     Choose the parameters of a new connection to the
+  **                  current peer.
+  **                  maxMiu: largest MIU allowed.
+  **                  maxRw: largest receive window allowed.
+  **
+  ** Returns:         Parameters, within the bounds.
+  **
+  *******************************************************************************/
+  Params choose(uint16_t maxMiu, uint8_t maxRw);
+
+  /*******************************************************************************
+  **
+  ** Function:        record
+  **
+  ** Description:     Record the traffic of a connection that is closing.
+  **                  params: parameters the connection used.
+  **                  meter: traffic of the connection.
+  **
+  ** Returns:         None
+  **
+  *******************************************************************************/
+  void record(const Params& params, const Meter& meter);
+
+  /*******************************************************************************
+  **
+  ** Function:        dump
+  **
+  ** Description:     Print the parameters tried with each peer.
+  **                  fd: file descriptor to write to.
+  **
+  ** Returns:         None
+  **
+  *******************************************************************************/
+  void dump(int fd);
+
+ private:
+  struct Candidate {
+    uint16_t miu;
+    uint8_t rw;
+    uint32_t samples;
+    uint32_t congestions;
+    uint64_t bytes;
+    uint64_t ns;
+  };
+  struct Peer {
+    PeerKey key;
+    uint32_t links;        // links that chose parameters for this peer
+    uint32_t connections;  // parameters chosen for this peer so far
+    uint64_t lastUsed;
+    Params last;
+    // a deque, so that adding a candidate keeps references to the others
+    std::deque<Candidate> candidates;
+  };
+
+  Mutex mMutex;
+  std::vector<Peer> mPeers;
+  PeerKey mCurrentPeer;
+  bool mLinkExplored;  // the current link already chose parameters
+  uint64_t mUseCount;
+
+  LlcpLinkTuner();
+  Peer& findPeerLocked(const PeerKey& key);
+  Candidate& findCandidateLocked(Peer& peer, uint16_t miu, uint8_t rw);
+  static uint64_t throughput(const Candidate& candidate);
+};
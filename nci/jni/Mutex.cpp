@@ -23,6 +23,7 @@
 
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 
 #include <android-base/stringprintf.h>
 #include <base/logging.h>
@@ -121,3 +122,85 @@ bool Mutex::tryLock() {
 **
 *******************************************************************************/
 pthread_mutex_t* Mutex::nativeHandle() { return &mMutex; }
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+static uint64_t monotonicNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*******************************************************************************
+**
+** Function:        TimedMutex
+**
+** Description:     Initialize member variables.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+TimedMutex::TimedMutex() : mLockedAtNs(0) {
+  memset(&mStats, 0, sizeof(mStats));
+}
+
+/*******************************************************************************
+**
+** Function:        lock
+**
+** Description:     Block the thread and try lock the mutex.  Only a lock
+**                  that is already held costs clock reads around the wait.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void TimedMutex::lock() {
+  bool measureHold;
+  if (mMutex.tryLock()) {
+    measureHold = mStats.acquisitions % HOLD_SAMPLE_PERIOD == 0;
+  } else {
+    uint64_t start = monotonicNs();
+    mMutex.lock();
+    uint64_t waitNs = monotonicNs() - start;
+    mStats.contended++;
+    mStats.waitNs += waitNs;
+    if (waitNs > mStats.maxWaitNs) mStats.maxWaitNs = waitNs;
+    measureHold = true;
+  }
+  mStats.acquisitions++;
+  mLockedAtNs = measureHold ? monotonicNs() : 0;
+}
+
+/*******************************************************************************
+**
+** Function:        unlock
+**
+** Description:     Unlock a mutex to unblock a thread.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void TimedMutex::unlock() {
+  if (mLockedAtNs != 0) {
+    uint64_t holdNs = monotonicNs() - mLockedAtNs;
+    mStats.holdSamples++;
+    mStats.holdNs += holdNs;
+    if (holdNs > mStats.maxHoldNs) mStats.maxHoldNs = holdNs;
+  }
+  mMutex.unlock();
+}
+
+/*******************************************************************************
+**
+** Function:        getStats
+**
+** Description:     Get the statistics recorded since construction.
+**
+** Returns:         Statistics.
+**
+*******************************************************************************/
+TimedMutex::Stats TimedMutex::getStats() {
+  AutoMutex mutex(mMutex);
+  return mStats;
+}
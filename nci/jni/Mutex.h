@@ -20,6 +20,7 @@
 
 #pragma once
 #include <pthread.h>
+#include <stdint.h>
 
 class Mutex {
  public:
@@ -104,3 +105,79 @@ class Mutex {
 };
 
 typedef Mutex::Autolock AutoMutex;
+
+/*****************************************************************************
+**
+**  Name:           TimedMutex
+**
+**  Description:    Mutex that records how often it is contended and how
+**                  long threads wait for it and hold it.  An uncontended
+**                  lock reads no clock; hold times are measured after every
+**                  contended acquisition and one in HOLD_SAMPLE_PERIOD of
+**                  the others.
+**
+*****************************************************************************/
+class TimedMutex {
+ public:
+  static const uint64_t HOLD_SAMPLE_PERIOD = 64;
+
+  struct Stats {
+    uint64_t acquisitions;
+    uint64_t contended;  // acquisitions that had to wait
+    uint64_t waitNs;
+    uint64_t maxWaitNs;
+    uint64_t holdSamples;  // acquisitions whose hold time was measured
+    uint64_t holdNs;
+    uint64_t maxHoldNs;
+  };
+
+  TimedMutex();
+
+  /*******************************************************************************
+  **
+  ** Function:        lock
+  **
+  ** Description:     Block the thread and try lock the mutex.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void lock();
+
+  /*******************************************************************************
+  **
+  ** Function:        unlock
+  **
+  ** Description:     Unlock a mutex to unblock a thread.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void unlock();
+
+  /*******************************************************************************
+  **
+  ** Function:        getStats
+  **
+  ** Description:     Get the statistics recorded since construction.
+  **
+  ** Returns:         Statistics.
+  **
+  *******************************************************************************/
+  Stats getStats();
+
+  class Autolock {
+   public:
+    inline Autolock(TimedMutex& mutex) : mLock(mutex) { mLock.lock(); }
+    inline ~Autolock() { mLock.unlock(); }
+
+   private:
+    TimedMutex& mLock;
+  };
+
+ private:
+  // Both protected by mMutex
+  Mutex mMutex;
+  uint64_t mLockedAtNs;  // 0 if this hold is not measured
+  Stats mStats;
+};
@@ -16,11 +16,8 @@
 
 #include <android-base/stringprintf.h>
 #include <base/logging.h>
-#include <errno.h>
-#include <malloc.h>
 #include <nativehelper/ScopedLocalRef.h>
 #include <nativehelper/ScopedPrimitiveArray.h>
-#include <semaphore.h>
 #include <string.h>
 #include "JavaClassConstants.h"
 #include "NfcJniUtil.h"
@@ -38,11 +35,27 @@ namespace android {
 ** private variables and functions
 **
 *****************************************************************************/
-static sem_t sConnlessRecvSem;
-static jboolean sConnlessRecvWaitingForData = JNI_FALSE;
-static uint8_t* sConnlessRecvBuf = NULL;
-static uint32_t sConnlessRecvLen = 0;
-static uint32_t sConnlessRecvRemoteSap = 0;
+// The NCI stack does not register connectionless sockets
+// (nfcManager_doCreateLlcpConnectionlessSocket returns NULL), and nothing
+// delivers UI PDUs to this file, so connectionless receive is not
+// supported on NCI.
+
+/*******************************************************************************
+**
+** Function:        getHandle
+**
+** Description:     Get the NFA handle of a Java socket object.
+**                  e: JVM environment.
+**                  o: Java object.
+**
+** Returns:         NFA handle.
+**
+*******************************************************************************/
+static tNFA_HANDLE getHandle(JNIEnv* e, jobject o) {
+  ScopedLocalRef<jclass> c(e, e->GetObjectClass(o));
+  jfieldID f = e->GetFieldID(c.get(), "mHandle", "I");
+  return (tNFA_HANDLE)e->GetIntField(o, f);
+}
 
 /*******************************************************************************
 **
@@ -63,9 +76,7 @@ static jboolean nativeLlcpConnectionlessSocket_doSendTo(JNIEnv* e, jobject o,
   DLOG_IF(INFO, nfc_debug_enabled)
       << StringPrintf("%s: nsap = %d", __func__, nsap);
 
-  ScopedLocalRef<jclass> c(e, e->GetObjectClass(o));
-  jfieldID f = e->GetFieldID(c.get(), "mHandle", "I");
-  jint handle = e->GetIntField(o, f);
+  tNFA_HANDLE handle = getHandle(e, o);
 
   ScopedByteArrayRO bytes(e, data);
   if (bytes.get() == NULL) {
@@ -78,7 +89,7 @@ static jboolean nativeLlcpConnectionlessSocket_doSendTo(JNIEnv* e, jobject o,
   uint8_t* raw_ptr = const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(
       &bytes[0]));  // TODO: API bug; NFA_P2pSendUI should take const*!
   tNFA_STATUS status =
-      NFA_P2pSendUI((tNFA_HANDLE)handle, nsap, byte_count, raw_ptr);
+      NFA_P2pSendUI(handle, nsap, byte_count, raw_ptr);
 
   DLOG_IF(INFO, nfc_debug_enabled)
       << StringPrintf("%s: NFA_P2pSendUI done, status = %d", __func__, status);
@@ -90,162 +101,23 @@ static jboolean nativeLlcpConnectionlessSocket_doSendTo(JNIEnv* e, jobject o,
   return JNI_TRUE;
 }
 
-/*******************************************************************************
-**
-** Function:        nativeLlcpConnectionlessSocket_receiveData
-**
-** Description:     Receive data from the stack.
-**                  data: buffer contains data.
-**                  len: length of data.
-**                  remoteSap: remote service access point.
-**
-** Returns:         None
-**
-*******************************************************************************/
-void nativeLlcpConnectionlessSocket_receiveData(uint8_t* data, uint32_t len,
-                                                uint32_t remoteSap) {
-  DLOG_IF(INFO, nfc_debug_enabled)
-      << StringPrintf("%s: waiting for data = %d, len = %d", __func__,
-                      sConnlessRecvWaitingForData, len);
-
-  // Quick check...
-  if (sConnlessRecvLen < len) {
-    len = sConnlessRecvLen;
-  }
-
-  if (sConnlessRecvWaitingForData) {
-    sConnlessRecvWaitingForData = JNI_FALSE;
-    sConnlessRecvLen = len;
-    memcpy(sConnlessRecvBuf, data, len);
-    sConnlessRecvRemoteSap = remoteSap;
-
-    sem_post(&sConnlessRecvSem);
-  }
-}
-
-/*******************************************************************************
-**
-** Function:        connectionlessCleanup
-**
-** Description:     Free resources.
-**
-** Returns:         None
-**
-*******************************************************************************/
-static jobject connectionlessCleanup() {
-  sConnlessRecvWaitingForData = JNI_FALSE;
-  sConnlessRecvLen = 0;
-  if (sConnlessRecvBuf != NULL) {
-    free(sConnlessRecvBuf);
-    sConnlessRecvBuf = NULL;
-  }
-  return NULL;
-}
-
-/*******************************************************************************
-**
-** Function:        nativeLlcpConnectionlessSocket_abortWait
-**
-** Description:     Abort current operation and unblock threads.
-**
-** Returns:         None
-**
-*******************************************************************************/
-void nativeLlcpConnectionlessSocket_abortWait() { sem_post(&sConnlessRecvSem); }
-
 /*******************************************************************************
 **
 ** Function:        nativeLlcpConnectionlessSocket_doReceiveFrom
 **
-** Description:     Receive data from a peer.
+** Description:     Receive data from a peer.  Not supported on NCI.
 **                  e: JVM environment.
 **                  o: Java object.
 **                  linkMiu: max info unit
 **
-** Returns:         LlcpPacket Java object.
+** Returns:         NULL.
 **
 *******************************************************************************/
-static jobject nativeLlcpConnectionlessSocket_doReceiveFrom(JNIEnv* e, jobject,
+static jobject nativeLlcpConnectionlessSocket_doReceiveFrom(JNIEnv*, jobject,
                                                             jint linkMiu) {
-  DLOG_IF(INFO, nfc_debug_enabled)
-      << StringPrintf("%s: linkMiu = %d", __func__, linkMiu);
-  jobject llcpPacket = NULL;
-  ScopedLocalRef<jclass> clsLlcpPacket(e, NULL);
-
-  if (sConnlessRecvWaitingForData != JNI_FALSE) {
-    DLOG_IF(INFO, nfc_debug_enabled)
-        << StringPrintf("%s: Already waiting for incoming data", __func__);
-    return NULL;
-  }
-
-  sConnlessRecvBuf = (uint8_t*)malloc(linkMiu);
-  if (sConnlessRecvBuf == NULL) {
-    DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
-        "%s: Failed to allocate %d bytes memory buffer", __func__, linkMiu);
-    return NULL;
-  }
-  sConnlessRecvLen = linkMiu;
-
-  // Create the write semaphore
-  if (sem_init(&sConnlessRecvSem, 0, 0) == -1) {
-    LOG(ERROR) << StringPrintf("%s: semaphore creation failed (errno=0x%08x)",
-                               __func__, errno);
-    return connectionlessCleanup();
-  }
-
-  sConnlessRecvWaitingForData = JNI_TRUE;
-
-  // Wait for sConnlessRecvSem completion status
-  if (sem_wait(&sConnlessRecvSem)) {
-    LOG(ERROR) << StringPrintf(
-        "%s: Failed to wait for write semaphore (errno=0x%08x)", __func__,
-        errno);
-    goto TheEnd;
-  }
-
-  // Create new LlcpPacket object
-  if (nfc_jni_cache_object_local(e, "com/android/nfc/LlcpPacket",
-                                 &(llcpPacket)) == -1) {
-    LOG(ERROR) << StringPrintf("%s: Find LlcpPacket class error", __func__);
-    return connectionlessCleanup();
-  }
-
-  // Get NativeConnectionless class object
-  clsLlcpPacket.reset(e->GetObjectClass(llcpPacket));
-  if (e->ExceptionCheck()) {
-    e->ExceptionClear();
-    LOG(ERROR) << StringPrintf("%s: Get Object class error", __func__);
-    return connectionlessCleanup();
-  }
-
-  // Set Llcp Packet remote SAP
-  jfieldID f;
-  f = e->GetFieldID(clsLlcpPacket.get(), "mRemoteSap", "I");
-  e->SetIntField(llcpPacket, f, (jbyte)sConnlessRecvRemoteSap);
-
-  // Set Llcp Packet Buffer
-  DLOG_IF(INFO, nfc_debug_enabled)
-      << StringPrintf("%s: Received Llcp packet buffer size = %d\n", __func__,
-                      sConnlessRecvLen);
-  f = e->GetFieldID(clsLlcpPacket.get(), "mDataBuffer", "[B");
-
-  {
-    ScopedLocalRef<jbyteArray> receivedData(e,
-                                            e->NewByteArray(sConnlessRecvLen));
-    e->SetByteArrayRegion(receivedData.get(), 0, sConnlessRecvLen,
-                          (jbyte*)sConnlessRecvBuf);
-    e->SetObjectField(llcpPacket, f, receivedData.get());
-  }
-
-TheEnd:  // TODO: should all the "return connectionlessCleanup()"s in this
-         // function jump here instead?
-  connectionlessCleanup();
-  if (sem_destroy(&sConnlessRecvSem)) {
-    LOG(ERROR) << StringPrintf(
-        "%s: Failed to destroy sConnlessRecvSem semaphore (errno=0x%08x)",
-        __func__, errno);
-  }
-  return llcpPacket;
+  LOG(ERROR) << StringPrintf("%s: not supported on NCI; linkMiu = %d",
+                             __func__, linkMiu);
+  return NULL;
 }
 
 /*******************************************************************************
@@ -262,11 +134,8 @@ TheEnd:  // TODO: should all the "return connectionlessCleanup()"s in this
 static jboolean nativeLlcpConnectionlessSocket_doClose(JNIEnv* e, jobject o) {
   DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf("%s", __func__);
 
-  ScopedLocalRef<jclass> c(e, e->GetObjectClass(o));
-  jfieldID f = e->GetFieldID(c.get(), "mHandle", "I");
-  jint handle = e->GetIntField(o, f);
-
-  tNFA_STATUS status = NFA_P2pDisconnect((tNFA_HANDLE)handle, FALSE);
+  tNFA_HANDLE handle = getHandle(e, o);
+  tNFA_STATUS status = NFA_P2pDisconnect(handle, FALSE);
   if (status != NFA_STATUS_OK) {
     LOG(ERROR) << StringPrintf("%s: disconnect failed, status = %d", __func__,
                                status);
@@ -38,11 +38,14 @@ namespace android {
 ** Description:     Accept a connection request from a peer.
 **                  e: JVM environment.
 **                  o: Java object.
-**                  miu: Maximum information unit.
-**                  rw: Receive window.
+**                  miu: Maximum information unit of the connections
+**                  accepted from now on.
+**                  rw: Receive window of the connections accepted from now
+**                  on.
 **                  linearBufferLength: Not used.
 **
-** Returns:         LlcpSocket Java object.
+** Returns:         LlcpSocket Java object, with the MIU and receive window
+**                  its connection was accepted with.
 **
 *******************************************************************************/
 static jobject nativeLlcpServiceSocket_doAccept(JNIEnv* e, jobject o, jint miu,
@@ -54,7 +57,7 @@ static jobject nativeLlcpServiceSocket_doAccept(JNIEnv* e, jobject o, jint miu,
   PeerToPeer::tJNI_HANDLE serverHandle;  // handle of the local server
   bool stat = false;
   PeerToPeer::tJNI_HANDLE connHandle =
-      PeerToPeer::getInstance().getNewJniHandle();
+      PeerToPeer::getInstance().allocJniHandle();
 
   DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf("%s: enter", __func__);
 
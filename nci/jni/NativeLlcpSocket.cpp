@@ -17,6 +17,7 @@
 #include <base/logging.h>
 #include <nativehelper/ScopedPrimitiveArray.h>
 #include <nativehelper/ScopedUtfChars.h>
+#include <vector>
 
 #include "JavaClassConstants.h"
 #include "PeerToPeer.h"
@@ -165,6 +166,97 @@ static jint nativeLlcpSocket_doReceive(JNIEnv* e, jobject o,
   return retval;
 }
 
+/*******************************************************************************
+**
+** Function:        receiveBatch
+**
+** Description:     Receive every PDU already available into a buffer.
+**                  e: JVM environment.
+**                  o: Java object.
+**                  buffer: Buffer to put received data.
+**                  bufferLen: Length of buffer.
+**                  pduLengths: Java array to put the length of each PDU.
+**
+** Returns:         Number of PDUs received, or -1.
+**
+*******************************************************************************/
+static jint receiveBatch(JNIEnv* e, jobject o, uint8_t* buffer,
+                         uint32_t bufferLen, jintArray pduLengths) {
+  PeerToPeer::tJNI_HANDLE jniHandle =
+      (PeerToPeer::tJNI_HANDLE)nfc_jni_get_nfc_socket_handle(e, o);
+  std::vector<uint16_t> pduLens(e->GetArrayLength(pduLengths));
+  size_t numPdus = 0;
+  if (pduLens.empty() || (bufferLen == 0) ||
+      !PeerToPeer::getInstance().receiveBatch(jniHandle, buffer, bufferLen,
+                                              &pduLens[0], pduLens.size(),
+                                              numPdus)) {
+    return -1;
+  }
+
+  std::vector<jint> lengths(pduLens.begin(), pduLens.begin() + numPdus);
+  e->SetIntArrayRegion(pduLengths, 0, numPdus, &lengths[0]);
+  return numPdus;
+}
+
+/*******************************************************************************
+**
+** Function:        nativeLlcpSocket_doReceiveBatch
+**
+** Description:     Receive every PDU already available from peer.
+**                  e: JVM environment.
+**                  o: Java object.
+**                  origBuffer: Buffer to put received data.
+**                  pduLengths: Array to put the length of each PDU.
+**
+** Returns:         Number of PDUs received, or -1.
+**
+*******************************************************************************/
+static jint nativeLlcpSocket_doReceiveBatch(JNIEnv* e, jobject o,
+                                            jbyteArray origBuffer,
+                                            jintArray pduLengths) {
+  ScopedByteArrayRW bytes(e, origBuffer);
+  jint retval =
+      receiveBatch(e, o, reinterpret_cast<uint8_t*>(bytes.get()),
+                   bytes.size(), pduLengths);
+  DLOG_IF(INFO, nfc_debug_enabled)
+      << StringPrintf("%s: exit; pdus=%d", __func__, retval);
+  return retval;
+}
+
+/*******************************************************************************
+**
+** Function:        nativeLlcpSocket_doReceiveBatchDirect
+**
+** Description:     Receive every PDU already available from peer, straight
+**                  into a direct ByteBuffer.
+**                  e: JVM environment.
+**                  o: Java object.
+**                  buffer: Direct buffer to put received data.
+**                  offset: Where to put the data in buffer.
+**                  length: Space available at offset.
+**                  pduLengths: Array to put the length of each PDU.
+**
+** Returns:         Number of PDUs received, or -1.
+**
+*******************************************************************************/
+static jint nativeLlcpSocket_doReceiveBatchDirect(JNIEnv* e, jobject o,
+                                                  jobject buffer, jint offset,
+                                                  jint length,
+                                                  jintArray pduLengths) {
+  uint8_t* address =
+      reinterpret_cast<uint8_t*>(e->GetDirectBufferAddress(buffer));
+  jlong capacity = e->GetDirectBufferCapacity(buffer);
+  if ((address == NULL) || (offset < 0) || (length < 0) ||
+      ((jlong)offset + length > capacity)) {
+    LOG(ERROR) << StringPrintf("%s: bad direct buffer", __func__);
+    return -1;
+  }
+  jint retval = receiveBatch(e, o, address + offset, length, pduLengths);
+  DLOG_IF(INFO, nfc_debug_enabled)
+      << StringPrintf("%s: exit; pdus=%d", __func__, retval);
+  return retval;
+}
+
 /*******************************************************************************
 **
 ** Function:        nativeLlcpSocket_doGetRemoteSocketMIU
@@ -221,6 +313,9 @@ static JNINativeMethod gMethods[] = {
     {"doClose", "()Z", (void*)nativeLlcpSocket_doClose},
     {"doSend", "([B)Z", (void*)nativeLlcpSocket_doSend},
     {"doReceive", "([B)I", (void*)nativeLlcpSocket_doReceive},
+    {"doReceiveBatch", "([B[I)I", (void*)nativeLlcpSocket_doReceiveBatch},
+    {"doReceiveBatchDirect", "(Ljava/nio/ByteBuffer;II[I)I",
+     (void*)nativeLlcpSocket_doReceiveBatchDirect},
     {"doGetRemoteSocketMiu", "()I",
      (void*)nativeLlcpSocket_doGetRemoteSocketMIU},
     {"doGetRemoteSocketRw", "()I", (void*)nativeLlcpSocket_doGetRemoteSocketRW},
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <android-base/stringprintf.h>
 #include <base/logging.h>
 #include <cutils/properties.h>
@@ -29,10 +30,12 @@
 #include "NfcAdaptation.h"
 #include "NfcJniUtil.h"
 #include "NfcTag.h"
+#include "NfccConfigBuilder.h"
 #include "PeerToPeer.h"
 #include "PowerSwitch.h"
 #include "RoutingManager.h"
 #include "SyncEvent.h"
+#include "TlvReader.h"
 #include "ce_api.h"
 #include "debug_lmrt.h"
 #include "nfa_api.h"
@@ -68,13 +71,9 @@ extern void nativeNfcTag_doReadCompleted(tNFA_STATUS status);
 extern void nativeNfcTag_setRfInterface(tNFA_INTF_TYPE rfInterface);
 extern void nativeNfcTag_setActivatedRfProtocol(tNFA_INTF_TYPE rfProtocol);
 extern void nativeNfcTag_abortWaits();
-extern void nativeLlcpConnectionlessSocket_abortWait();
 extern void nativeNfcTag_registerNdefTypeHandler();
 extern void nativeNfcTag_acquireRfInterfaceMutexLock();
 extern void nativeNfcTag_releaseRfInterfaceMutexLock();
-extern void nativeLlcpConnectionlessSocket_receiveData(uint8_t* data,
-                                                       uint32_t len,
-                                                       uint32_t remote_sap);
 }  // namespace android
 
 /*****************************************************************************
@@ -97,6 +96,8 @@ jmethodID gCachedNfcManagerNotifyLlcpLinkDeactivated;
 jmethodID gCachedNfcManagerNotifyLlcpFirstPacketReceived;
 jmethodID gCachedNfcManagerNotifyHostEmuActivated;
 jmethodID gCachedNfcManagerNotifyHostEmuData;
+jmethodID gCachedNfcManagerNotifyHostEmuSelect;
+jmethodID gCachedNfcManagerNotifyHostEmuStaticResponse;
 jmethodID gCachedNfcManagerNotifyHostEmuDeactivated;
 jmethodID gCachedNfcManagerNotifyRfFieldActivated;
 jmethodID gCachedNfcManagerNotifyRfFieldDeactivated;
@@ -113,7 +114,7 @@ const char* gNativeLlcpSocketClassName =
 const char* gNativeNfcTagClassName = "com/android/nfc/dhimpl/NativeNfcTag";
 const char* gNativeNfcManagerClassName =
     "com/android/nfc/dhimpl/NativeNfcManager";
-void doStartupConfig();
+void doStartupConfig(NfccConfigBuilder& config);
 void startStopPolling(bool isStartPolling);
 void startRfDiscovery(bool isStart);
 bool isDiscoveryStarted();
@@ -131,7 +132,6 @@ static SyncEvent sNfaDisableEvent;               // event for NFA_Disable()
 static SyncEvent sNfaEnableDisablePollingEvent;  // event for
                                                  // NFA_EnablePolling(),
                                                  // NFA_DisablePolling()
-static SyncEvent sNfaSetConfigEvent;             // event for Set_Config....
 static SyncEvent sNfaGetConfigEvent;             // event for Get_Config....
 static bool sIsNfaEnabled = false;
 static bool sDiscoveryEnabled = false;  // is polling or listening
@@ -155,6 +155,8 @@ static bool sIsRecovering = false;
    NFA_TECHNOLOGY_MASK_A_ACTIVE | NFA_TECHNOLOGY_MASK_F_ACTIVE |           \
    NFA_TECHNOLOGY_MASK_KOVIO)
 #define DEFAULT_DISCOVERY_DURATION 500
+// Longest short-form response APDU: 256 data bytes and SW1 SW2
+#define MAX_SHORT_RESPONSE_LEN 258
 #define READER_MODE_DISCOVERY_DURATION 200
 
 static void nfaConnectionCallback(uint8_t event, tNFA_CONN_EVT_DATA* eventData);
@@ -424,12 +426,11 @@ static void nfaConnectionCallback(uint8_t connEvent,
             << StringPrintf("%s: NFA_ACTIVATED_EVT; is p2p", __func__);
         if (NFC_GetNCIVersion() == NCI_VERSION_1_0) {
           // Disable RF field events in case of p2p
-          uint8_t nfa_disable_rf_events[] = {0x00};
+          NfccConfigBuilder config;
           DLOG_IF(INFO, nfc_debug_enabled)
               << StringPrintf("%s: Disabling RF field events", __func__);
-          status = NFA_SetConfig(NCI_PARAM_ID_RF_FIELD_INFO,
-                                 sizeof(nfa_disable_rf_events),
-                                 &nfa_disable_rf_events[0]);
+          config.add(NCI_PARAM_ID_RF_FIELD_INFO, 0x00);
+          status = config.apply(false);
           if (status == NFA_STATUS_OK) {
             DLOG_IF(INFO, nfc_debug_enabled)
                 << StringPrintf("%s: Disabled RF field events", __func__);
@@ -492,14 +493,12 @@ static void nfaConnectionCallback(uint8_t connEvent,
               << StringPrintf("%s: NFA_DEACTIVATED_EVT; is p2p", __func__);
           if (NFC_GetNCIVersion() == NCI_VERSION_1_0) {
             // Disable RF field events in case of p2p
-            uint8_t nfa_enable_rf_events[] = {0x01};
-
             if (!sIsDisabling && sIsNfaEnabled) {
+              NfccConfigBuilder config;
               DLOG_IF(INFO, nfc_debug_enabled)
                   << StringPrintf("%s: Enabling RF field events", __func__);
-              status = NFA_SetConfig(NCI_PARAM_ID_RF_FIELD_INFO,
-                                     sizeof(nfa_enable_rf_events),
-                                     &nfa_enable_rf_events[0]);
+              config.add(NCI_PARAM_ID_RF_FIELD_INFO, 0x01);
+              status = config.apply(false);
               if (status == NFA_STATUS_OK) {
                 DLOG_IF(INFO, nfc_debug_enabled)
                     << StringPrintf("%s: Enabled RF field events", __func__);
@@ -716,6 +715,12 @@ static jboolean nfcManager_initNativeStruc(JNIEnv* e, jobject o) {
   gCachedNfcManagerNotifyHostEmuData =
       e->GetMethodID(cls.get(), "notifyHostEmuData", "(I[B)V");
 
+  gCachedNfcManagerNotifyHostEmuSelect =
+      e->GetMethodID(cls.get(), "notifyHostEmuSelect", "(I[BII)V");
+
+  gCachedNfcManagerNotifyHostEmuStaticResponse =
+      e->GetMethodID(cls.get(), "notifyHostEmuStaticResponse", "(I[B)V");
+
   gCachedNfcManagerNotifyHostEmuDeactivated =
       e->GetMethodID(cls.get(), "notifyHostEmuDeactivated", "(I)V");
 
@@ -725,7 +730,7 @@ static jboolean nfcManager_initNativeStruc(JNIEnv* e, jobject o) {
       e->GetMethodID(cls.get(), "notifyRfFieldDeactivated", "()V");
 
   gCachedNfcManagerNotifyTransactionListeners = e->GetMethodID(
-      cls.get(), "notifyTransactionListeners", "([B[BLjava/lang/String;)V");
+      cls.get(), "notifyTransactionListeners", "([[B[[B[Ljava/lang/String;)V");
 
   gCachedNfcManagerNotifyEeUpdated =
       e->GetMethodID(cls.get(), "notifyEeUpdated", "()V");
@@ -789,10 +794,7 @@ void nfaDeviceManagementCallback(uint8_t dmEvent,
     case NFA_DM_SET_CONFIG_EVT:  // result of NFA_SetConfig
       DLOG_IF(INFO, nfc_debug_enabled)
           << StringPrintf("%s: NFA_DM_SET_CONFIG_EVT", __func__);
-      {
-        SyncEventGuard guard(sNfaSetConfigEvent);
-        sNfaSetConfigEvent.notifyOne();
-      }
+      NfccConfigBuilder::setConfigEvent(eventData->status);
       break;
 
     case NFA_DM_GET_CONFIG_EVT: /* Result of NFA_GetConfig */
@@ -880,12 +882,10 @@ void nfaDeviceManagementCallback(uint8_t dmEvent,
           SyncEventGuard guard(sNfaSetPowerSubState);
           sNfaSetPowerSubState.notifyOne();
         }
-        {
-          DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
-              "%s: aborting  sNfaSetConfigEvent", __func__);
-          SyncEventGuard guard(sNfaSetConfigEvent);
-          sNfaSetConfigEvent.notifyOne();
-        }
+        DLOG_IF(INFO, nfc_debug_enabled)
+            << StringPrintf("%s: aborting  set config waits", __func__);
+        NfccConfigBuilder::abortWaits();
+        RoutingManager::getInstance().abortEeUpdate();
         {
           DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
               "%s: aborting  sNfaGetConfigEvent", __func__);
@@ -896,7 +896,7 @@ void nfaDeviceManagementCallback(uint8_t dmEvent,
         nativeNfcTag_abortWaits();
         NfcTag::getInstance().abort();
         sAbortConnlessWait = true;
-        nativeLlcpConnectionlessSocket_abortWait();
+        RoutingManager::getInstance().abortEeUpdate();
         {
           DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
               "%s: aborting  sNfaEnableDisablePollingEvent", __func__);
@@ -966,91 +966,96 @@ void nfaDeviceManagementCallback(uint8_t dmEvent,
 **
 *******************************************************************************/
 static jboolean nfcManager_sendRawFrame(JNIEnv* e, jobject, jbyteArray data) {
-  ScopedByteArrayRO bytes(e, data);
-  uint8_t* buf =
-      const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(&bytes[0]));
-  size_t bufLen = bytes.size();
+  jsize bufLen = e->GetArrayLength(data);
+  // NFA_SendRawFrame can block on the stack, so copy the frame out rather
+  // than hold the array in a critical region; a short APDU fits the stack
+  uint8_t stackBuf[MAX_SHORT_RESPONSE_LEN];
+  std::vector<uint8_t> heapBuf;
+  uint8_t* buf = stackBuf;
+  if (bufLen > MAX_SHORT_RESPONSE_LEN) {
+    heapBuf.resize(bufLen);
+    buf = heapBuf.data();
+  }
+  e->GetByteArrayRegion(data, 0, bufLen, reinterpret_cast<jbyte*>(buf));
   tNFA_STATUS status = NFA_SendRawFrame(buf, bufLen, 0);
+  if (status != NFA_STATUS_OK) return JNI_FALSE;
 
-  return (status == NFA_STATUS_OK);
+  RoutingManager::getInstance().notifyHceResponse();
+  return JNI_TRUE;
 }
 
 /*******************************************************************************
 **
-** Function:        nfcManager_routeAid
+** Function:        nfcManager_commitRouting
 **
-** Description:     Route an AID to an EE
+** Description:     Queue sending the AID routing table to the controller;
+**                  back-to-back requests are merged into one commit.
 **                  e: JVM environment.
-**                  aid: aid to be added to routing table.
-**                  route: aid route location. i.e. DH/eSE/UICC
-**                  aidInfo: prefix or suffix aid.
+**                  o: Java object.
 **
-** Returns:         True if aid is accpted by NFA Layer.
+** Returns:         True if ok.
 **
 *******************************************************************************/
-static jboolean nfcManager_routeAid(JNIEnv* e, jobject, jbyteArray aid,
-                                    jint route, jint aidInfo, jint power) {
-  uint8_t* buf;
-  size_t bufLen;
-
-  if (aid == NULL) {
-    buf = NULL;
-    bufLen = 0;
-    return RoutingManager::getInstance().addAidRouting(buf, bufLen, route,
-                                                       aidInfo, power);
-  }
-  ScopedByteArrayRO bytes(e, aid);
-  buf = const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(&bytes[0]));
-  bufLen = bytes.size();
-  return RoutingManager::getInstance().addAidRouting(buf, bufLen, route,
-                                                     aidInfo, power);
+static jboolean nfcManager_commitRouting(JNIEnv* e, jobject) {
+  RoutingManager::getInstance().requestCommit();
+  return JNI_TRUE;
 }
 
 /*******************************************************************************
 **
-** Function:        nfcManager_unrouteAid
+** Function:        parsePackedAids
 **
-** Description:     Remove a AID routing
+** Description:     Unpack a list of AID routing entries from Java.
 **                  e: JVM environment.
-**                  o: Java object.
+**                  packedAids: entries as described in
+**                  RoutingManager::unpackAidRoutingEntries().
+**                  entries: receives the unpacked entries.
 **
-** Returns:         True if ok.
+** Returns:         False if packedAids is malformed.
 **
 *******************************************************************************/
-static jboolean nfcManager_unrouteAid(JNIEnv* e, jobject, jbyteArray aid) {
-  uint8_t* buf;
-  size_t bufLen;
-
-  if (aid == NULL) {
-    buf = NULL;
-    bufLen = 0;
-    return RoutingManager::getInstance().removeAidRouting(buf, bufLen);
-  }
-  ScopedByteArrayRO bytes(e, aid);
-  buf = const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(&bytes[0]));
-  bufLen = bytes.size();
-  return RoutingManager::getInstance().removeAidRouting(buf, bufLen);
+static bool parsePackedAids(
+    JNIEnv* e, jbyteArray packedAids,
+    std::vector<RoutingManager::AidRoutingEntry>* entries) {
+  if (packedAids == NULL) return true;
+  ScopedByteArrayRO bytes(e, packedAids);
+  return RoutingManager::unpackAidRoutingEntries(
+      reinterpret_cast<const uint8_t*>(bytes.get()), bytes.size(), entries);
 }
 
 /*******************************************************************************
 **
-** Function:        nfcManager_commitRouting
+** Function:        nfcManager_setAidRoutingTable
 **
-** Description:     Sends the AID routing table to the controller
+** Description:     Replace the AID routing table.  Only the entries that
+**                  differ from the current table are removed or added, and
+**                  the table is committed only if something changed.
 **                  e: JVM environment.
 **                  o: Java object.
+**                  packedAids: entries as described in parsePackedAids().
+**                  commit: allow the routing table to be committed.
+**                  force: commit even if no AID entry changed.
 **
 ** Returns:         True if ok.
 **
 *******************************************************************************/
-static jboolean nfcManager_commitRouting(JNIEnv* e, jobject) {
-  if (sRfEnabled) {
-    /*Update routing table only in Idle state.*/
-    startRfDiscovery(false);
+static jboolean nfcManager_setAidRoutingTable(JNIEnv* e, jobject,
+                                              jbyteArray packedAids,
+                                              jboolean commit,
+                                              jboolean force) {
+  std::vector<RoutingManager::AidRoutingEntry> entries;
+  if (!parsePackedAids(e, packedAids, &entries)) return JNI_FALSE;
+
+  bool changed = false;
+  bool status =
+      RoutingManager::getInstance().applyAidRoutingTable(entries, &changed);
+  if (commit && (changed || force)) {
+    RoutingManager::getInstance().requestCommit();
+  } else if (commit) {
+    DLOG_IF(INFO, nfc_debug_enabled)
+        << StringPrintf("%s: AID table unchanged; skip commit", __func__);
   }
-  jboolean commitStatus = RoutingManager::getInstance().commitRouting();
-  startRfDiscovery(true);
-  return commitStatus;
+  return status ? JNI_TRUE : JNI_FALSE;
 }
 
 /*******************************************************************************
@@ -1078,7 +1083,7 @@ static jint nfcManager_doRegisterT3tIdentifier(JNIEnv* e, jobject,
   DLOG_IF(INFO, nfc_debug_enabled)
       << StringPrintf("%s: handle=%d", __func__, handle);
   if (handle != NFA_HANDLE_INVALID)
-    RoutingManager::getInstance().commitRouting();
+    RoutingManager::getInstance().requestCommit();
   DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf("%s: exit", __func__);
 
   return handle;
@@ -1102,7 +1107,74 @@ static void nfcManager_doDeregisterT3tIdentifier(JNIEnv*, jobject,
       << StringPrintf("%s: enter; handle=%d", __func__, handle);
 
   RoutingManager::getInstance().deregisterT3tIdentifier(handle);
-  RoutingManager::getInstance().commitRouting();
+  RoutingManager::getInstance().requestCommit();
+
+  DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf("%s: exit", __func__);
+}
+
+/*******************************************************************************
+**
+** Function:        nfcManager_doRegisterT3tIdentifiers
+**
+** Description:     Registers a set of LF_T3T_IDENTIFIERs for NFC-F and
+**                  commits the routing table once.
+**                  e: JVM environment.
+**                  o: Java object.
+**                  t3tIdentifiers: LF_T3T_IDENTIFIER values.
+**
+** Returns:         Per-identifier handle, or NFA_HANDLE_INVALID.
+**
+*******************************************************************************/
+static jintArray nfcManager_doRegisterT3tIdentifiers(
+    JNIEnv* e, jobject, jobjectArray t3tIdentifiers) {
+  jsize count = e->GetArrayLength(t3tIdentifiers);
+  DLOG_IF(INFO, nfc_debug_enabled)
+      << StringPrintf("%s: enter; count=%d", __func__, count);
+
+  std::vector<std::vector<uint8_t>> t3tIds(count);
+  for (jsize i = 0; i < count; i++) {
+    ScopedLocalRef<jbyteArray> t3tId(
+        e, (jbyteArray)e->GetObjectArrayElement(t3tIdentifiers, i));
+    ScopedByteArrayRO bytes(e, t3tId.get());
+    const uint8_t* buf = reinterpret_cast<const uint8_t*>(bytes.get());
+    t3tIds[i].assign(buf, buf + bytes.size());
+  }
+  std::vector<int> handles =
+      RoutingManager::getInstance().registerT3tIdentifiers(t3tIds);
+
+  jintArray result = e->NewIntArray(count);
+  if (result == NULL) return NULL;
+  if (count > 0) e->SetIntArrayRegion(result, 0, count, handles.data());
+  if (std::any_of(handles.begin(), handles.end(),
+                  [](int h) { return h != NFA_HANDLE_INVALID; }))
+    RoutingManager::getInstance().requestCommit();
+  DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf("%s: exit", __func__);
+  return result;
+}
+
+/*******************************************************************************
+**
+** Function:        nfcManager_doDeregisterT3tIdentifiers
+**
+** Description:     Deregisters a set of LF_T3T_IDENTIFIERs for NFC-F and
+**                  commits the routing table once.
+**                  e: JVM environment.
+**                  o: Java object.
+**                  handles: Handles retrieved from libnfc-nci.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void nfcManager_doDeregisterT3tIdentifiers(JNIEnv* e, jobject,
+                                                  jintArray handles) {
+  ScopedIntArrayRO ids(e, handles);
+  DLOG_IF(INFO, nfc_debug_enabled)
+      << StringPrintf("%s: enter; count=%zu", __func__, ids.size());
+  if (ids.size() == 0) return;
+
+  RoutingManager::getInstance().deregisterT3tIdentifiers(
+      std::vector<int>(ids.get(), ids.get() + ids.size()));
+  RoutingManager::getInstance().requestCommit();
 
   DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf("%s: exit", __func__);
 }
@@ -1184,15 +1256,16 @@ static jboolean nfcManager_doInitialize(JNIEnv* e, jobject o) {
         /////////////////////////////////////////////////////////////////////////////////
         // Add extra configuration here (work-arounds, etc.)
 
+        // Controller was just reset; nothing in the shadow copy is valid.
+        NfccConfigBuilder::invalidate();
+        NfccConfigBuilder config;
         if (gIsDtaEnabled == true) {
-          uint8_t configData = 0;
-          configData = 0x01; /* Poll NFC-DEP : Highest Available Bit Rates */
-          NFA_SetConfig(NCI_PARAM_ID_BITR_NFC_DEP, sizeof(uint8_t),
-                        &configData);
-          configData = 0x0B; /* Listen NFC-DEP : Waiting Time */
-          NFA_SetConfig(NFC_PMID_WT, sizeof(uint8_t), &configData);
-          configData = 0x0F; /* Specific Parameters for NFC-DEP RF Interface */
-          NFA_SetConfig(NCI_PARAM_ID_NFC_DEP_OP, sizeof(uint8_t), &configData);
+          /* Poll NFC-DEP : Highest Available Bit Rates */
+          config.add(NCI_PARAM_ID_BITR_NFC_DEP, 0x01);
+          /* Listen NFC-DEP : Waiting Time */
+          config.add(NFC_PMID_WT, 0x0B);
+          /* Specific Parameters for NFC-DEP RF Interface */
+          config.add(NCI_PARAM_ID_NFC_DEP_OP, 0x0F);
         }
 
         struct nfc_jni_native_data* nat = getNative(e, o);
@@ -1216,19 +1289,28 @@ static jboolean nfcManager_doInitialize(JNIEnv* e, jobject o) {
           stat = NFA_GetConfig(1, configParam);
           if (stat == NFA_STATUS_OK) {
             sNfaGetConfigEvent.wait();
-            if (sCurrentConfigLen >= 4 ||
-                sConfig[1] == NCI_PARAM_ID_LF_T3T_MAX) {
-              DLOG_IF(INFO, nfc_debug_enabled)
-                  << StringPrintf("%s: lfT3tMax=%d", __func__, sConfig[3]);
-              sLfT3tMax = sConfig[3];
+            // the response carries its status and number of parameters
+            // ahead of the parameters themselves
+            size_t paramsLen =
+                sCurrentConfigLen >= 2 ? sCurrentConfigLen - 2 : 0;
+            SimpleTlvReader<NciParamTlvFormat> reader(&sConfig[1], paramsLen);
+            Tlv param;
+            while (reader.next(&param)) {
+              if (param.tag == NCI_PARAM_ID_LF_T3T_MAX && param.length >= 1) {
+                sLfT3tMax = param.value[0];
+                DLOG_IF(INFO, nfc_debug_enabled)
+                    << StringPrintf("%s: lfT3tMax=%d", __func__, sLfT3tMax);
+              }
             }
           }
         }
 
         prevScreenState = NFA_SCREEN_STATE_OFF_LOCKED;
 
-        // Do custom NFCA startup configuration.
-        doStartupConfig();
+        // Do custom NFCA startup configuration; sent together with the
+        // DTA parameters above.
+        doStartupConfig(config);
+        config.apply();
         goto TheEnd;
       }
     }
@@ -1269,20 +1351,11 @@ static void nfcManager_doShutdown(JNIEnv*, jobject) {
   theInstance.DeviceShutdown();
 }
 
-static void nfcManager_configNfccConfigControl(bool flag) {
+static void nfcManager_configNfccConfigControl(NfccConfigBuilder& config,
+                                               bool flag) {
     // configure NFCC_CONFIG_CONTROL- NFCC allowed to manage RF configuration.
     if (NFC_GetNCIVersion() != NCI_VERSION_1_0) {
-        uint8_t nfa_set_config[] = { 0x00 };
-
-        nfa_set_config[0] = (flag == true ? 1 : 0);
-
-        tNFA_STATUS status = NFA_SetConfig(NCI_PARAM_ID_NFCC_CONFIG_CONTROL,
-                                           sizeof(nfa_set_config),
-                                           &nfa_set_config[0]);
-        if (status != NFA_STATUS_OK) {
-            LOG(ERROR) << __func__
-            << ": Failed to configure NFCC_CONFIG_CONTROL";
-        }
+        config.add(NCI_PARAM_ID_NFCC_CONFIG_CONTROL, flag == true ? 1 : 0);
     }
 }
 
@@ -1322,6 +1395,9 @@ static void nfcManager_enableDiscovery(JNIEnv* e, jobject o,
     return;
   }
 
+  // keep the routing commit thread from restarting RF discovery under us
+  AutoMutex rfReconfigLock(RoutingManager::getInstance().getRfReconfigMutex());
+
   PowerSwitch::getInstance().setLevel(PowerSwitch::FULL_POWER);
 
   if (sRfEnabled) {
@@ -1354,7 +1430,11 @@ static void nfcManager_enableDiscovery(JNIEnv* e, jobject o,
         NFA_DisableListening();
 
         // configure NFCC_CONFIG_CONTROL- NFCC not allowed to manage RF configuration.
-        nfcManager_configNfccConfigControl(false);
+        NfccConfigBuilder config;
+        nfcManager_configNfccConfigControl(config, false);
+        if (config.apply(false) != NFA_STATUS_OK) {
+          LOG(ERROR) << __func__ << ": Failed to configure NFCC_CONFIG_CONTROL";
+        }
 
         NFA_SetRfDiscoveryDuration(READER_MODE_DISCOVERY_DURATION);
       } else if (!reader_mode && sReaderModeEnabled) {
@@ -1363,7 +1443,11 @@ static void nfcManager_enableDiscovery(JNIEnv* e, jobject o,
         NFA_EnableListening();
 
         // configure NFCC_CONFIG_CONTROL- NFCC allowed to manage RF configuration.
-        nfcManager_configNfccConfigControl(true);
+        NfccConfigBuilder config;
+        nfcManager_configNfccConfigControl(config, true);
+        if (config.apply(false) != NFA_STATUS_OK) {
+          LOG(ERROR) << __func__ << ": Failed to configure NFCC_CONFIG_CONTROL";
+        }
 
         NFA_SetRfDiscoveryDuration(nat->discovery_duration);
       }
@@ -1418,6 +1502,7 @@ static void nfcManager_enableDiscovery(JNIEnv* e, jobject o,
 void nfcManager_disableDiscovery(JNIEnv* e, jobject o) {
   tNFA_STATUS status = NFA_STATUS_OK;
   DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf("%s: enter;", __func__);
+  AutoMutex rfReconfigLock(RoutingManager::getInstance().getRfReconfigMutex());
 
   if (sDiscoveryEnabled == false) {
     DLOG_IF(INFO, nfc_debug_enabled)
@@ -1460,9 +1545,6 @@ static jobject nfcManager_doCreateLlcpServiceSocket(JNIEnv* e, jobject,
                                                     jint nSap, jstring sn,
                                                     jint miu, jint rw,
                                                     jint linearBufferLength) {
-  PeerToPeer::tJNI_HANDLE jniHandle =
-      PeerToPeer::getInstance().getNewJniHandle();
-
   ScopedUtfChars serviceName(e, sn);
 
   DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
@@ -1488,8 +1570,11 @@ static jobject nfcManager_doCreateLlcpServiceSocket(JNIEnv* e, jobject,
     return NULL;
   }
 
-  if (!PeerToPeer::getInstance().registerServer(jniHandle,
-                                                serviceName.c_str())) {
+  // allocated last so that the failures above do not leak it
+  PeerToPeer::tJNI_HANDLE jniHandle =
+      PeerToPeer::getInstance().allocJniHandle();
+  if (!PeerToPeer::getInstance().registerServer(
+          jniHandle, serviceName.c_str(), (uint16_t)miu, (uint8_t)rw)) {
     LOG(ERROR) << StringPrintf("%s: RegisterServer error", __func__);
     return NULL;
   }
@@ -1559,6 +1644,7 @@ static jboolean nfcManager_doDeinitialize(JNIEnv*, jobject) {
 
   sIsDisabling = true;
 
+  RoutingManager::getInstance().abortCommits();
   if (!recovery_option || !sIsRecovering) {
     RoutingManager::getInstance().onNfccShutdown();
   }
@@ -1582,7 +1668,6 @@ static jboolean nfcManager_doDeinitialize(JNIEnv*, jobject) {
   nativeNfcTag_abortWaits();
   NfcTag::getInstance().abort();
   sAbortConnlessWait = true;
-  nativeLlcpConnectionlessSocket_abortWait();
   sIsNfaEnabled = false;
   sRoutingInitialized = false;
   sDiscoveryEnabled = false;
@@ -1629,7 +1714,7 @@ static jobject nfcManager_doCreateLlcpSocket(JNIEnv* e, jobject, jint nSap,
                       __func__, nSap, miu, rw, linearBufferLength);
 
   PeerToPeer::tJNI_HANDLE jniHandle =
-      PeerToPeer::getInstance().getNewJniHandle();
+      PeerToPeer::getInstance().allocJniHandle();
   PeerToPeer::getInstance().createClient(jniHandle, miu, rw);
 
   /* Create new NativeLlcpSocket object */
@@ -1874,6 +1959,9 @@ static void nfcManager_doDump(JNIEnv* e, jobject obj, jobject fdobj) {
 
   NfcAdaptation& theInstance = NfcAdaptation::GetInstance();
   theInstance.Dump(fd);
+  RoutingManager::getInstance().dump(fd);
+  HciEventManager::getInstance().dump(fd);
+  PeerToPeer::getInstance().dump(fd);
 }
 
 static jint nfcManager_doGetNciVersion(JNIEnv*, jobject) {
@@ -1950,12 +2038,11 @@ static void nfcManager_doSetScreenState(JNIEnv* e, jobject o,
         NCI_LISTEN_DH_NFCEE_ENABLE_MASK | NCI_POLLING_DH_ENABLE_MASK;
   }
 
-  SyncEventGuard guard(sNfaSetConfigEvent);
-  status = NFA_SetConfig(NCI_PARAM_ID_CON_DISCOVERY_PARAM,
-                         NCI_PARAM_LEN_CON_DISCOVERY_PARAM, &discovry_param);
-  if (status == NFA_STATUS_OK) {
-    sNfaSetConfigEvent.wait();
-  } else {
+  NfccConfigBuilder config;
+  config.add(NCI_PARAM_ID_CON_DISCOVERY_PARAM, &discovry_param,
+             NCI_PARAM_LEN_CON_DISCOVERY_PARAM);
+  status = config.apply();
+  if (status != NFA_STATUS_OK) {
     LOG(ERROR) << StringPrintf("%s: Failed to update CON_DISCOVER_PARAM",
                                __FUNCTION__);
     return;
@@ -2206,9 +2293,7 @@ static JNINativeMethod gMethods[] = {
 
     {"sendRawFrame", "([B)Z", (void*)nfcManager_sendRawFrame},
 
-    {"routeAid", "([BIII)Z", (void*)nfcManager_routeAid},
-
-    {"unrouteAid", "([B)Z", (void*)nfcManager_unrouteAid},
+    {"setAidRoutingTable", "([BZZ)Z", (void*)nfcManager_setAidRoutingTable},
 
     {"commitRouting", "()Z", (void*)nfcManager_commitRouting},
 
@@ -2218,6 +2303,12 @@ static JNINativeMethod gMethods[] = {
     {"doDeregisterT3tIdentifier", "(I)V",
      (void*)nfcManager_doDeregisterT3tIdentifier},
 
+    {"doRegisterT3tIdentifiers", "([[B)[I",
+     (void*)nfcManager_doRegisterT3tIdentifiers},
+
+    {"doDeregisterT3tIdentifiers", "([I)V",
+     (void*)nfcManager_doDeregisterT3tIdentifiers},
+
     {"getLfT3tMax", "()I", (void*)nfcManager_getLfT3tMax},
 
     {"doEnableDiscovery", "(IZZZZZ)V", (void*)nfcManager_enableDiscovery},
@@ -2354,11 +2445,13 @@ bool isDiscoveryStarted() { return sRfEnabled; }
 ** Function:        doStartupConfig
 **
 ** Description:     Configure the NFC controller.
+**                  config: collects the parameters to send; the caller
+**                  applies it.
 **
 ** Returns:         None
 **
 *******************************************************************************/
-void doStartupConfig() {
+void doStartupConfig(NfccConfigBuilder& config) {
   // configure RF polling frequency for each technology
   static tNFA_DM_DISC_FREQ_CFG nfa_dm_disc_freq_cfg;
   // values in the polling_frequency[] map to members of nfa_dm_disc_freq_cfg
@@ -2381,8 +2474,7 @@ void doStartupConfig() {
   }
 
   // configure NFCC_CONFIG_CONTROL- NFCC allowed to manage RF configuration.
-  nfcManager_configNfccConfigControl(true);
-
+  nfcManager_configNfccConfigControl(config, true);
 }
 
 /*******************************************************************************
@@ -2414,7 +2506,7 @@ void startStopPolling(bool isStartPolling) {
       << StringPrintf("%s: enter; isStart=%u", __func__, isStartPolling);
 
   if (NFC_GetNCIVersion() >= NCI_VERSION_2_0) {
-    SyncEventGuard guard(sNfaSetConfigEvent);
+    NfccConfigBuilder config;
     if (isStartPolling) {
       discovry_param =
           NCI_LISTEN_DH_NFCEE_ENABLE_MASK | NCI_POLLING_DH_ENABLE_MASK;
@@ -2422,11 +2514,10 @@ void startStopPolling(bool isStartPolling) {
       discovry_param =
           NCI_LISTEN_DH_NFCEE_ENABLE_MASK | NCI_POLLING_DH_DISABLE_MASK;
     }
-    status = NFA_SetConfig(NCI_PARAM_ID_CON_DISCOVERY_PARAM,
-                           NCI_PARAM_LEN_CON_DISCOVERY_PARAM, &discovry_param);
-    if (status == NFA_STATUS_OK) {
-      sNfaSetConfigEvent.wait();
-    } else {
+    config.add(NCI_PARAM_ID_CON_DISCOVERY_PARAM, &discovry_param,
+               NCI_PARAM_LEN_CON_DISCOVERY_PARAM);
+    status = config.apply();
+    if (status != NFA_STATUS_OK) {
       LOG(ERROR) << StringPrintf("%s: Failed to update CON_DISCOVER_PARAM",
                                  __FUNCTION__);
     }
@@ -16,15 +16,14 @@
 
 #include <android-base/stringprintf.h>
 #include <base/logging.h>
-#include <errno.h>
 #include <malloc.h>
 #include <nativehelper/ScopedLocalRef.h>
 #include <nativehelper/ScopedPrimitiveArray.h>
-#include <semaphore.h>
 #include <signal.h>
 #include <string.h>
 #include <time.h>
 #include <string>
+#include "Completion.h"
 #include "IntervalTimer.h"
 #include "JavaClassConstants.h"
 #include "Mutex.h"
@@ -92,34 +91,29 @@ static std::basic_string<uint8_t> sRxDataBuffer;
 static tNFA_STATUS sRxDataStatus = NFA_STATUS_OK;
 static bool sWaitingForTransceive = false;
 static bool sTransceiveRfTimeout = false;
+static bool sTransceiveDone = false;
 static Mutex sRfInterfaceMutex;
 static uint32_t sReadDataLen = 0;
 static uint8_t* sReadData = NULL;
 static bool sIsReadingNdefMessage = false;
 static SyncEvent sReadEvent;
-static sem_t sWriteSem;
-static sem_t sFormatSem;
+static Completion<bool> sWriteCompletion;
+static Completion<bool> sFormatCompletion;
 static SyncEvent sTransceiveEvent;
 static SyncEvent sReconnectEvent;
-static sem_t sCheckNdefSem;
+static Completion<tNFA_STATUS> sCheckNdefCompletion;
 static SyncEvent sPresenceCheckEvent;
-static sem_t sMakeReadonlySem;
+static Completion<tNFA_STATUS> sMakeReadonlyCompletion;
 static IntervalTimer sSwitchBackTimer;  // timer used to tell us to switch back
                                         // to ISO_DEP frame interface
 uint8_t RW_TAG_SLP_REQ[] = {0x50, 0x00};
 uint8_t RW_DESELECT_REQ[] = {0xC2};
-static jboolean sWriteOk = JNI_FALSE;
-static jboolean sWriteWaitingForComplete = JNI_FALSE;
-static bool sFormatOk = false;
 static jboolean sConnectOk = JNI_FALSE;
 static jboolean sConnectWaitingForComplete = JNI_FALSE;
 static bool sGotDeactivate = false;
 static uint32_t sCheckNdefMaxSize = 0;
 static bool sCheckNdefCardReadOnly = false;
-static jboolean sCheckNdefWaitingForComplete = JNI_FALSE;
 static bool sIsTagPresent = true;
-static tNFA_STATUS sMakeReadonlyStatus = NFA_STATUS_FAILED;
-static jboolean sMakeReadonlyWaitingForComplete = JNI_FALSE;
 static int sCurrentConnectedTargetType = TARGET_TYPE_UNKNOWN;
 static int sCurrentConnectedTargetProtocol = NFC_PROTOCOL_UNKNOWN;
 static int sCurrentConnectedHandle = 0;
@@ -141,10 +135,12 @@ void nativeNfcTag_abortWaits() {
     SyncEventGuard g(sReadEvent);
     sReadEvent.notifyOne();
   }
-  sem_post(&sWriteSem);
-  sem_post(&sFormatSem);
+  sWriteCompletion.cancel();
+  sFormatCompletion.cancel();
   {
+    // a transceive that is cut short is reported like an RF timeout
     SyncEventGuard g(sTransceiveEvent);
+    if (sWaitingForTransceive) sTransceiveRfTimeout = true;
     sTransceiveEvent.notifyOne();
   }
   {
@@ -152,12 +148,12 @@ void nativeNfcTag_abortWaits() {
     sReconnectEvent.notifyOne();
   }
 
-  sem_post(&sCheckNdefSem);
+  sCheckNdefCompletion.cancel();
   {
     SyncEventGuard guard(sPresenceCheckEvent);
     sPresenceCheckEvent.notifyOne();
   }
-  sem_post(&sMakeReadonlySem);
+  sMakeReadonlyCompletion.cancel();
   sCurrentRfInterface = NFA_INTERFACE_ISO_DEP;
   sCurrentActivatedProtocl = NFA_INTERFACE_ISO_DEP;
   sCurrentConnectedTargetType = TARGET_TYPE_UNKNOWN;
@@ -331,11 +327,7 @@ static jbyteArray nativeNfcTag_doRead(JNIEnv* e, jobject) {
 **
 *******************************************************************************/
 void nativeNfcTag_doWriteStatus(jboolean isWriteOk) {
-  if (sWriteWaitingForComplete != JNI_FALSE) {
-    sWriteWaitingForComplete = JNI_FALSE;
-    sWriteOk = isWriteOk;
-    sem_post(&sWriteSem);
-  }
+  sWriteCompletion.complete(isWriteOk != JNI_FALSE);
 }
 
 /*******************************************************************************
@@ -350,8 +342,7 @@ void nativeNfcTag_doWriteStatus(jboolean isWriteOk) {
 **
 *******************************************************************************/
 void nativeNfcTag_formatStatus(bool isOk) {
-  sFormatOk = isOk;
-  sem_post(&sFormatSem);
+  sFormatCompletion.complete(isOk);
 }
 
 /*******************************************************************************
@@ -369,6 +360,8 @@ void nativeNfcTag_formatStatus(bool isOk) {
 static jboolean nativeNfcTag_doWrite(JNIEnv* e, jobject, jbyteArray buf) {
   jboolean result = JNI_FALSE;
   tNFA_STATUS status = 0;
+  bool formatOk = false;
+  bool writeOk = false;
   const int maxBufferSize = 1024;
   uint8_t buffer[maxBufferSize] = {0};
   uint32_t curDataSize = 0;
@@ -380,26 +373,14 @@ static jboolean nativeNfcTag_doWrite(JNIEnv* e, jobject, jbyteArray buf) {
   DLOG_IF(INFO, nfc_debug_enabled)
       << StringPrintf("%s: enter; len = %zu", __func__, bytes.size());
 
-  /* Create the write semaphore */
-  if (sem_init(&sWriteSem, 0, 0) == -1) {
-    LOG(ERROR) << StringPrintf("%s: semaphore creation failed (errno=0x%08x)",
-                               __func__, errno);
-    return JNI_FALSE;
-  }
-
-  sWriteWaitingForComplete = JNI_TRUE;
+  sWriteCompletion.start();
   if (sCheckNdefStatus == NFA_STATUS_FAILED) {
     // if tag does not contain a NDEF message
     // and tag is capable of storing NDEF message
     if (sCheckNdefCapable) {
       DLOG_IF(INFO, nfc_debug_enabled)
           << StringPrintf("%s: try format", __func__);
-      if (0 != sem_init(&sFormatSem, 0, 0)) {
-        LOG(ERROR) << StringPrintf(
-            "%s: semaphore creation failed (errno=0x%08x)", __func__, errno);
-        return JNI_FALSE;
-      }
-      sFormatOk = false;
+      sFormatCompletion.start();
       if (sCurrentConnectedTargetProtocol == NFC_PROTOCOL_MIFARE && legacy_mfc_reader) {
         static uint8_t mfc_key1[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
         static uint8_t mfc_key2[6] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7};
@@ -408,25 +389,17 @@ static jboolean nativeNfcTag_doWrite(JNIEnv* e, jobject, jbyteArray buf) {
         if (status != NFA_STATUS_OK) {
           LOG(ERROR) << StringPrintf("%s: can't format mifare classic tag",
                                      __func__);
-          sem_destroy(&sFormatSem);
           goto TheEnd;
         }
+        if (!sFormatCompletion.wait(&formatOk)) goto TheEnd;
 
-        if (sFormatOk == false)  // if format operation failed
+        if (!formatOk)  // retry with the other key
         {
-          sem_wait(&sFormatSem);
-          sem_destroy(&sFormatSem);
-          if (0 != sem_init(&sFormatSem, 0, 0)) {
-            LOG(ERROR) << StringPrintf(
-                "%s: semaphore creation failed (errno=0x%08x)", __func__,
-                errno);
-            return JNI_FALSE;
-          }
+          sFormatCompletion.start();
           status = EXTNS_MfcFormatTag(mfc_key2, sizeof(mfc_key2));
           if (status != NFA_STATUS_OK) {
             LOG(ERROR) << StringPrintf("%s: can't format mifare classic tag",
                                        __func__);
-            sem_destroy(&sFormatSem);
             goto TheEnd;
           }
         }
@@ -435,13 +408,11 @@ static jboolean nativeNfcTag_doWrite(JNIEnv* e, jobject, jbyteArray buf) {
         if (status != NFA_STATUS_OK) {
           LOG(ERROR) << StringPrintf("%s: can't format mifare classic tag",
                                      __func__);
-          sem_destroy(&sFormatSem);
           goto TheEnd;
         }
       }
-      sem_wait(&sFormatSem);
-      sem_destroy(&sFormatSem);
-      if (sFormatOk == false)  // if format operation failed
+      if (!formatOk) sFormatCompletion.wait(&formatOk);
+      if (!formatOk)  // if format operation failed
         goto TheEnd;
     }
     DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf("%s: try write", __func__);
@@ -476,22 +447,16 @@ static jboolean nativeNfcTag_doWrite(JNIEnv* e, jobject, jbyteArray buf) {
   }
 
   /* Wait for write completion status */
-  sWriteOk = false;
-  if (sem_wait(&sWriteSem)) {
-    LOG(ERROR) << StringPrintf("%s: wait semaphore (errno=0x%08x)", __func__,
-                               errno);
+  if (!sWriteCompletion.wait(&writeOk)) {
+    LOG(ERROR) << StringPrintf("%s: write aborted", __func__);
     goto TheEnd;
   }
 
-  result = sWriteOk;
+  result = writeOk ? JNI_TRUE : JNI_FALSE;
 
 TheEnd:
-  /* Destroy semaphore */
-  if (sem_destroy(&sWriteSem)) {
-    LOG(ERROR) << StringPrintf("%s: failed destroy semaphore (errno=0x%08x)",
-                               __func__, errno);
-  }
-  sWriteWaitingForComplete = JNI_FALSE;
+  sWriteCompletion.cancel();
+  sFormatCompletion.cancel();
   DLOG_IF(INFO, nfc_debug_enabled)
       << StringPrintf("%s: exit; result=%d", __func__, result);
   return result;
@@ -922,7 +887,10 @@ void nativeNfcTag_doTransceiveStatus(tNFA_STATUS status, uint8_t* buf,
   if (sRxDataStatus == NFA_STATUS_OK || sRxDataStatus == NFC_STATUS_CONTINUE)
     sRxDataBuffer.append(buf, bufLen);
 
-  if (sRxDataStatus == NFA_STATUS_OK) sTransceiveEvent.notifyOne();
+  if (sRxDataStatus == NFA_STATUS_OK) {
+    sTransceiveDone = true;
+    sTransceiveEvent.notifyOne();
+  }
 }
 
 void nativeNfcTag_notifyRfTimeout() {
@@ -993,6 +961,7 @@ static jbyteArray nativeNfcTag_doTransceive(JNIEnv* e, jobject o,
     {
       SyncEventGuard g(sTransceiveEvent);
       sTransceiveRfTimeout = false;
+      sTransceiveDone = false;
       sWaitingForTransceive = true;
       sRxDataStatus = NFA_STATUS_OK;
       sRxDataBuffer.clear();
@@ -1008,7 +977,8 @@ static jbyteArray nativeNfcTag_doTransceive(JNIEnv* e, jobject o,
         LOG(ERROR) << StringPrintf("%s: fail send; error=%d", __func__, status);
         break;
       }
-      waitOk = sTransceiveEvent.wait(timeout);
+      waitOk = sTransceiveEvent.waitFor(
+          timeout, [] { return sTransceiveDone || sTransceiveRfTimeout; });
     }
 
     if (waitOk == false || sTransceiveRfTimeout)  // if timeout occurred
@@ -1159,7 +1129,7 @@ void nativeNfcTag_doCheckNdefResult(tNFA_STATUS status, uint32_t maxSize,
   // capable/formated/read only */ #define RW_NDEF_FL_FORMATABLE 0x10    /* Tag
   // supports format operation */
 
-  if (!sCheckNdefWaitingForComplete) {
+  if (!sCheckNdefCompletion.isPending()) {
     LOG(ERROR) << StringPrintf("%s: not waiting", __func__);
     return;
   }
@@ -1180,7 +1150,6 @@ void nativeNfcTag_doCheckNdefResult(tNFA_STATUS status, uint32_t maxSize,
     DLOG_IF(INFO, nfc_debug_enabled)
         << StringPrintf("%s: flag formattable", __func__);
 
-  sCheckNdefWaitingForComplete = JNI_FALSE;
   sCheckNdefStatus = status;
   if (sCheckNdefStatus != NFA_STATUS_OK &&
       sCheckNdefStatus != NFA_STATUS_TIMEOUT)
@@ -1208,7 +1177,7 @@ void nativeNfcTag_doCheckNdefResult(tNFA_STATUS status, uint32_t maxSize,
     sCheckNdefCurrentSize = 0;
     sCheckNdefCardReadOnly = false;
   }
-  sem_post(&sCheckNdefSem);
+  sCheckNdefCompletion.complete(sCheckNdefStatus);
 }
 
 /*******************************************************************************
@@ -1225,6 +1194,7 @@ void nativeNfcTag_doCheckNdefResult(tNFA_STATUS status, uint32_t maxSize,
 *******************************************************************************/
 static jint nativeNfcTag_doCheckNdef(JNIEnv* e, jobject o, jintArray ndefInfo) {
   tNFA_STATUS status = NFA_STATUS_FAILED;
+  tNFA_STATUS ndefStatus = NFA_STATUS_FAILED;
   jint* ndef = NULL;
 
   DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf("%s: enter", __func__);
@@ -1242,14 +1212,6 @@ static jint nativeNfcTag_doCheckNdef(JNIEnv* e, jobject o, jintArray ndefInfo) {
     nativeNfcTag_doReconnect(e, o);
   }
 
-  /* Create the write semaphore */
-  if (sem_init(&sCheckNdefSem, 0, 0) == -1) {
-    LOG(ERROR) << StringPrintf(
-        "%s: Check NDEF semaphore creation failed (errno=0x%08x)", __func__,
-        errno);
-    return JNI_FALSE;
-  }
-
   if (NfcTag::getInstance().getActivationState() != NfcTag::Active) {
     LOG(ERROR) << StringPrintf("%s: tag already deactivated", __func__);
     goto TheEnd;
@@ -1257,7 +1219,7 @@ static jint nativeNfcTag_doCheckNdef(JNIEnv* e, jobject o, jintArray ndefInfo) {
 
   DLOG_IF(INFO, nfc_debug_enabled)
       << StringPrintf("%s: try NFA_RwDetectNDef", __func__);
-  sCheckNdefWaitingForComplete = JNI_TRUE;
+  sCheckNdefCompletion.start();
 
   if (sCurrentConnectedTargetProtocol == NFC_PROTOCOL_MIFARE && legacy_mfc_reader) {
     status = EXTNS_MfcCheckNDef();
@@ -1272,14 +1234,12 @@ static jint nativeNfcTag_doCheckNdef(JNIEnv* e, jobject o, jintArray ndefInfo) {
   }
 
   /* Wait for check NDEF completion status */
-  if (sem_wait(&sCheckNdefSem)) {
-    LOG(ERROR) << StringPrintf(
-        "%s: Failed to wait for check NDEF semaphore (errno=0x%08x)", __func__,
-        errno);
+  if (!sCheckNdefCompletion.wait(&ndefStatus)) {
+    LOG(ERROR) << StringPrintf("%s: check NDEF aborted", __func__);
     goto TheEnd;
   }
 
-  if (sCheckNdefStatus == NFA_STATUS_OK) {
+  if (ndefStatus == NFA_STATUS_OK) {
     // stack found a NDEF message on the tag
     ndef = e->GetIntArrayElements(ndefInfo, 0);
     if (NfcTag::getInstance().getProtocol() == NFA_PROTOCOL_T1T)
@@ -1292,7 +1252,7 @@ static jint nativeNfcTag_doCheckNdef(JNIEnv* e, jobject o, jintArray ndefInfo) {
       ndef[1] = NDEF_MODE_READ_WRITE;
     e->ReleaseIntArrayElements(ndefInfo, ndef, 0);
     status = NFA_STATUS_OK;
-  } else if (sCheckNdefStatus == NFA_STATUS_FAILED) {
+  } else if (ndefStatus == NFA_STATUS_FAILED) {
     // stack did not find a NDEF message on the tag;
     ndef = e->GetIntArrayElements(ndefInfo, 0);
     if (NfcTag::getInstance().getProtocol() == NFA_PROTOCOL_T1T)
@@ -1307,8 +1267,8 @@ static jint nativeNfcTag_doCheckNdef(JNIEnv* e, jobject o, jintArray ndefInfo) {
     status = NFA_STATUS_FAILED;
   } else {
     DLOG_IF(INFO, nfc_debug_enabled)
-        << StringPrintf("%s: unknown status 0x%X", __func__, sCheckNdefStatus);
-    status = sCheckNdefStatus;
+        << StringPrintf("%s: unknown status 0x%X", __func__, ndefStatus);
+    status = ndefStatus;
   }
 
   /* Reconnect Mifare Classic Tag for furture use */
@@ -1317,13 +1277,7 @@ static jint nativeNfcTag_doCheckNdef(JNIEnv* e, jobject o, jintArray ndefInfo) {
   }
 
 TheEnd:
-  /* Destroy semaphore */
-  if (sem_destroy(&sCheckNdefSem)) {
-    LOG(ERROR) << StringPrintf(
-        "%s: Failed to destroy check NDEF semaphore (errno=0x%08x)", __func__,
-        errno);
-  }
-  sCheckNdefWaitingForComplete = JNI_FALSE;
+  sCheckNdefCompletion.cancel();
   DLOG_IF(INFO, nfc_debug_enabled)
       << StringPrintf("%s: exit; status=0x%X", __func__, status);
   return status;
@@ -1557,25 +1511,20 @@ static jboolean nativeNfcTag_makeMifareNdefFormat(JNIEnv* e, jobject o,
     return JNI_FALSE;
   }
 
-  if (0 != sem_init(&sFormatSem, 0, 0)) {
-    LOG(ERROR) << StringPrintf("%s: semaphore creation failed (errno=0x%08x)",
-                               __func__, errno);
-    return JNI_FALSE;
-  }
-  sFormatOk = false;
-
+  bool formatOk = false;
+  sFormatCompletion.start();
   status = EXTNS_MfcFormatTag(key, keySize);
 
   if (status == NFA_STATUS_OK) {
     DLOG_IF(INFO, nfc_debug_enabled)
         << StringPrintf("%s: wait for completion", __func__);
-    sem_wait(&sFormatSem);
-    status = sFormatOk ? NFA_STATUS_OK : NFA_STATUS_FAILED;
+    sFormatCompletion.wait(&formatOk);
+    status = formatOk ? NFA_STATUS_OK : NFA_STATUS_FAILED;
   } else {
     LOG(ERROR) << StringPrintf("%s: error status=%u", __func__, status);
+    sFormatCompletion.cancel();
   }
 
-  sem_destroy(&sFormatSem);
   DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf("%s: exit", __func__);
   return (status == NFA_STATUS_OK) ? JNI_TRUE : JNI_FALSE;
 }
@@ -1617,21 +1566,18 @@ static jboolean nativeNfcTag_doNdefFormat(JNIEnv* e, jobject o, jbyteArray) {
     return result;
   }
 
-  if (0 != sem_init(&sFormatSem, 0, 0)) {
-    LOG(ERROR) << StringPrintf("%s: semaphore creation failed (errno=0x%08x)",
-                               __func__, errno);
-    return JNI_FALSE;
-  }
-  sFormatOk = false;
+  bool formatOk = false;
+  sFormatCompletion.start();
   status = NFA_RwFormatTag();
   if (status == NFA_STATUS_OK) {
     DLOG_IF(INFO, nfc_debug_enabled)
         << StringPrintf("%s: wait for completion", __func__);
-    sem_wait(&sFormatSem);
-    status = sFormatOk ? NFA_STATUS_OK : NFA_STATUS_FAILED;
-  } else
+    sFormatCompletion.wait(&formatOk);
+    status = formatOk ? NFA_STATUS_OK : NFA_STATUS_FAILED;
+  } else {
     LOG(ERROR) << StringPrintf("%s: error status=%u", __func__, status);
-  sem_destroy(&sFormatSem);
+    sFormatCompletion.cancel();
+  }
 
   if (sCurrentConnectedTargetProtocol == NFA_PROTOCOL_ISO_DEP) {
     int retCode = NFCSTATUS_SUCCESS;
@@ -1653,12 +1599,7 @@ static jboolean nativeNfcTag_doNdefFormat(JNIEnv* e, jobject o, jbyteArray) {
 **
 *******************************************************************************/
 void nativeNfcTag_doMakeReadonlyResult(tNFA_STATUS status) {
-  if (sMakeReadonlyWaitingForComplete != JNI_FALSE) {
-    sMakeReadonlyWaitingForComplete = JNI_FALSE;
-    sMakeReadonlyStatus = status;
-
-    sem_post(&sMakeReadonlySem);
-  }
+  sMakeReadonlyCompletion.complete(status);
 }
 
 /*******************************************************************************
@@ -1678,44 +1619,26 @@ static jboolean nativeNfcTag_makeMifareReadonly(JNIEnv* e, jobject o,
                                                 uint8_t* key, int32_t keySize) {
   jboolean result = JNI_FALSE;
   tNFA_STATUS status = NFA_STATUS_OK;
-
-  sMakeReadonlyStatus = NFA_STATUS_FAILED;
+  tNFA_STATUS readonlyStatus = NFA_STATUS_FAILED;
 
   DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf("%s", __func__);
 
-  /* Create the make_readonly semaphore */
-  if (sem_init(&sMakeReadonlySem, 0, 0) == -1) {
-    LOG(ERROR) << StringPrintf(
-        "%s: Make readonly semaphore creation failed (errno=0x%08x)", __func__,
-        errno);
-    return JNI_FALSE;
-  }
-
-  sMakeReadonlyWaitingForComplete = JNI_TRUE;
-
   status = nativeNfcTag_doReconnect(e, o);
   if (status != NFA_STATUS_OK) {
-    goto TheEnd;
+    return JNI_FALSE;
   }
 
+  sMakeReadonlyCompletion.start();
   status = EXTNS_MfcSetReadOnly(key, keySize);
   if (status != NFA_STATUS_OK) {
-    goto TheEnd;
+    sMakeReadonlyCompletion.cancel();
+    return JNI_FALSE;
   }
-  sem_wait(&sMakeReadonlySem);
 
-  if (sMakeReadonlyStatus == NFA_STATUS_OK) {
+  if (sMakeReadonlyCompletion.wait(&readonlyStatus) &&
+      readonlyStatus == NFA_STATUS_OK) {
     result = JNI_TRUE;
   }
-
-TheEnd:
-  /* Destroy semaphore */
-  if (sem_destroy(&sMakeReadonlySem)) {
-    LOG(ERROR) << StringPrintf(
-        "%s: Failed to destroy read_only semaphore (errno=0x%08x)", __func__,
-        errno);
-  }
-  sMakeReadonlyWaitingForComplete = JNI_FALSE;
   return result;
 }
 
@@ -1734,6 +1657,7 @@ TheEnd:
 static jboolean nativeNfcTag_doMakeReadonly(JNIEnv* e, jobject o, jbyteArray) {
   jboolean result = JNI_FALSE;
   tNFA_STATUS status;
+  tNFA_STATUS readonlyStatus = NFA_STATUS_FAILED;
 
   DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf("%s", __func__);
 
@@ -1748,15 +1672,7 @@ static jboolean nativeNfcTag_doMakeReadonly(JNIEnv* e, jobject o, jbyteArray) {
     return result;
   }
 
-  /* Create the make_readonly semaphore */
-  if (sem_init(&sMakeReadonlySem, 0, 0) == -1) {
-    LOG(ERROR) << StringPrintf(
-        "%s: Make readonly semaphore creation failed (errno=0x%08x)", __func__,
-        errno);
-    return JNI_FALSE;
-  }
-
-  sMakeReadonlyWaitingForComplete = JNI_TRUE;
+  sMakeReadonlyCompletion.start();
 
   // Hard-lock the tag (cannot be reverted)
   status = NFA_RwSetTagReadOnly(TRUE);
@@ -1773,26 +1689,18 @@ static jboolean nativeNfcTag_doMakeReadonly(JNIEnv* e, jobject o, jbyteArray) {
     goto TheEnd;
   }
 
-  /* Wait for check NDEF completion status */
-  if (sem_wait(&sMakeReadonlySem)) {
-    LOG(ERROR) << StringPrintf(
-        "%s: Failed to wait for make_readonly semaphore (errno=0x%08x)",
-        __func__, errno);
+  /* Wait for make read-only completion status */
+  if (!sMakeReadonlyCompletion.wait(&readonlyStatus)) {
+    LOG(ERROR) << StringPrintf("%s: make read-only aborted", __func__);
     goto TheEnd;
   }
 
-  if (sMakeReadonlyStatus == NFA_STATUS_OK) {
+  if (readonlyStatus == NFA_STATUS_OK) {
     result = JNI_TRUE;
   }
 
 TheEnd:
-  /* Destroy semaphore */
-  if (sem_destroy(&sMakeReadonlySem)) {
-    LOG(ERROR) << StringPrintf(
-        "%s: Failed to destroy read_only semaphore (errno=0x%08x)", __func__,
-        errno);
-  }
-  sMakeReadonlyWaitingForComplete = JNI_FALSE;
+  sMakeReadonlyCompletion.cancel();
   return result;
 }
 
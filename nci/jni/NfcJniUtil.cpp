@@ -68,6 +68,40 @@ jint JNI_OnLoad(JavaVM* jvm, void*) {
 
 namespace android {
 
+// Detaches a thread attached by nfc_jni_attach_thread() when it exits.
+static pthread_key_t sJniDetachKey;
+static pthread_once_t sJniDetachKeyOnce = PTHREAD_ONCE_INIT;
+
+static void detachJniThread(void* vm) {
+  static_cast<JavaVM*>(vm)->DetachCurrentThread();
+}
+
+static void createJniDetachKey() {
+  pthread_key_create(&sJniDetachKey, detachJniThread);
+}
+
+/*******************************************************************************
+**
+** Function:        nfc_jni_attach_thread
+**
+** Description:     Get a JNI environment for the calling thread, attaching
+**                  it to the JVM if needed.  A thread attached here stays
+**                  attached until it exits, so stack callbacks do not pay
+**                  for an attach and detach each.
+**                  vm: Java Virtual Machine.
+**
+** Returns:         JNI environment, or NULL.
+**
+*******************************************************************************/
+JNIEnv* nfc_jni_attach_thread(JavaVM* vm) {
+  JNIEnv* e = NULL;
+  if (vm->GetEnv((void**)&e, JNI_VERSION_1_6) == JNI_OK) return e;
+  pthread_once(&sJniDetachKeyOnce, createJniDetachKey);
+  if (vm->AttachCurrentThread(&e, NULL) != JNI_OK) return NULL;
+  pthread_setspecific(sJniDetachKey, vm);
+  return e;
+}
+
 /*******************************************************************************
 **
 ** Function:        nfc_jni_cache_object
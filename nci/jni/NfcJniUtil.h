@@ -120,18 +120,6 @@ struct nfc_jni_native_data {
   int handles[16];
 };
 
-class ScopedAttach {
- public:
-  ScopedAttach(JavaVM* vm, JNIEnv** env) : vm_(vm) {
-    vm_->AttachCurrentThread(env, NULL);
-  }
-
-  ~ScopedAttach() { vm_->DetachCurrentThread(); }
-
- private:
-  JavaVM* vm_;
-};
-
 jint JNI_OnLoad(JavaVM* jvm, void* reserved);
 
 namespace android {
@@ -146,4 +134,36 @@ int register_com_android_nfc_NativeP2pDevice(JNIEnv* e);
 int register_com_android_nfc_NativeLlcpConnectionlessSocket(JNIEnv* e);
 int register_com_android_nfc_NativeLlcpServiceSocket(JNIEnv* e);
 int register_com_android_nfc_NativeLlcpSocket(JNIEnv* e);
+JNIEnv* nfc_jni_attach_thread(JavaVM* vm);
 }  // namespace android
+
+/*****************************************************************************
+**
+**  Name:           ScopedAttach
+**
+**  Description:    Get a JNI environment for the scope of a stack callback.
+**                  The thread is attached once and stays attached until it
+**                  exits, whoever attached it first, so nested or repeated
+**                  callbacks never detach each other; the local references
+**                  made in the scope are released with it.
+**
+*****************************************************************************/
+class ScopedAttach {
+ public:
+  ScopedAttach(JavaVM* vm, JNIEnv** env)
+      : env_(android::nfc_jni_attach_thread(vm)) {
+    if (env_ != NULL && env_->PushLocalFrame(LOCAL_FRAME_CAPACITY) != JNI_OK) {
+      env_->ExceptionClear();
+      env_ = NULL;
+    }
+    *env = env_;
+  }
+
+  ~ScopedAttach() {
+    if (env_ != NULL) env_->PopLocalFrame(NULL);
+  }
+
+ private:
+  static const jint LOCAL_FRAME_CAPACITY = 16;
+  JNIEnv* env_;
+};
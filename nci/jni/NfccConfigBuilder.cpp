@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Collect NCI configuration parameters and send them to the controller
+ *  as one batch.
+ */
+#include "NfccConfigBuilder.h"
+
+#include <android-base/stringprintf.h>
+#include <base/logging.h>
+
+#include "SyncEvent.h"
+
+using android::base::StringPrintf;
+
+extern bool nfc_debug_enabled;
+
+// sSetConfigEvent also guards sShadow and sPendingSetConfig, since both are
+// touched from the stack callback while a caller is waiting.
+static SyncEvent sSetConfigEvent;
+static std::map<tNFA_PMID, std::vector<uint8_t>> sShadow;
+static int sPendingSetConfig = 0;  // NFA_SetConfig without a SET_CONFIG_EVT yet
+
+/*******************************************************************************
+**
+** Function:        NfccConfigBuilder
+**
+** Description:     Initialize member variables.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+NfccConfigBuilder::NfccConfigBuilder() {}
+
+/*******************************************************************************
+**
+** Function:        add
+**
+** Description:     Stage a parameter; replaces any value staged earlier
+**                  for the same parameter.
+**                  paramId: NCI parameter ID.
+**                  value: parameter value.
+**                  len: length of the value.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void NfccConfigBuilder::add(tNFA_PMID paramId, const uint8_t* value,
+                            uint8_t len) {
+  mStaged[paramId].assign(value, value + len);
+}
+
+/*******************************************************************************
+**
+** Function:        add
+**
+** Description:     Stage a one-octet parameter.
+**                  paramId: NCI parameter ID.
+**                  value: parameter value.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void NfccConfigBuilder::add(tNFA_PMID paramId, uint8_t value) {
+  add(paramId, &value, sizeof(value));
+}
+
+/*******************************************************************************
+**
+** Function:        apply
+**
+** Description:     Send every staged parameter that differs from the
+**                  shadow copy, then clear the staging area.
+**                  waitForCompletion: block until the controller has
+**                  acknowledged every outstanding parameter.  Must be
+**                  false when called from a stack callback.
+**
+** Returns:         NFA_STATUS_OK if all parameters were accepted.
+**
+*******************************************************************************/
+tNFA_STATUS NfccConfigBuilder::apply(bool waitForCompletion) {
+  tNFA_STATUS status = NFA_STATUS_OK;
+  int numSent = 0;
+  SyncEventGuard guard(sSetConfigEvent);
+
+  for (auto& param : mStaged) {
+    auto shadow = sShadow.find(param.first);
+    if (shadow != sShadow.end() && shadow->second == param.second) {
+      DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
+          "%s: param 0x%02X unchanged; skip", __func__, param.first);
+      continue;
+    }
+
+    tNFA_STATUS stat =
+        NFA_SetConfig(param.first, param.second.size(), param.second.data());
+    if (stat != NFA_STATUS_OK) {
+      LOG(ERROR) << StringPrintf("%s: fail set param 0x%02X; error=0x%X",
+                                 __func__, param.first, stat);
+      sShadow.erase(param.first);
+      status = stat;
+      continue;
+    }
+    sShadow[param.first] = param.second;
+    sPendingSetConfig++;
+    numSent++;
+  }
+  mStaged.clear();
+
+  DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
+      "%s: sent %d param(s); %d pending", __func__, numSent, sPendingSetConfig);
+
+  if (waitForCompletion) {
+    // one wait covers the whole batch; NFA completes them in order
+    while (sPendingSetConfig > 0) sSetConfigEvent.wait();
+    // pass the wakeup on to any other thread waiting for the same batch
+    sSetConfigEvent.notifyOne();
+  }
+  return status;
+}
+
+/*******************************************************************************
+**
+** Function:        setConfigEvent
+**
+** Description:     Handle NFA_DM_SET_CONFIG_EVT from the stack.
+**                  status: status of the completed NFA_SetConfig.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void NfccConfigBuilder::setConfigEvent(tNFA_STATUS status) {
+  SyncEventGuard guard(sSetConfigEvent);
+  if (status != NFA_STATUS_OK) {
+    // cannot tell which parameter was rejected; resend everything next time
+    LOG(ERROR) << StringPrintf("%s: set config failed; status=0x%X", __func__,
+                               status);
+    sShadow.clear();
+  }
+  if (sPendingSetConfig > 0) sPendingSetConfig--;
+  sSetConfigEvent.notifyOne();
+}
+
+/*******************************************************************************
+**
+** Function:        invalidate
+**
+** Description:     Forget the shadow copy because the controller has been
+**                  reset and its configuration is unknown.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void NfccConfigBuilder::invalidate() {
+  SyncEventGuard guard(sSetConfigEvent);
+  sShadow.clear();
+}
+
+/*******************************************************************************
+**
+** Function:        abortWaits
+**
+** Description:     Unblock any thread waiting in apply().
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void NfccConfigBuilder::abortWaits() {
+  SyncEventGuard guard(sSetConfigEvent);
+  sPendingSetConfig = 0;
+  sShadow.clear();
+  sSetConfigEvent.notifyOne();
+}
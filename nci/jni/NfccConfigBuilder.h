@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Collect NCI configuration parameters and send them to the controller
+ *  as one batch.
+ */
+#pragma once
+#include <map>
+#include <vector>
+#include "nfa_api.h"
+
+/*****************************************************************************
+**
+**  Name:           NfccConfigBuilder
+**
+**  Description:    Stage CORE_SET_CONFIG parameters and apply them with a
+**                  single completion wait.  A shadow copy of the values that
+**                  were last applied is kept, so parameters whose value is
+**                  unchanged are never sent again.
+**
+*****************************************************************************/
+class NfccConfigBuilder {
+ public:
+  /*******************************************************************************
+  **
+  ** Function:        NfccConfigBuilder
+  **
+  ** Description:     Initialize member variables.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  NfccConfigBuilder();
+
+  /*******************************************************************************
+  **
+  ** Function:        add
+  **
+  ** Description:     Stage a parameter; replaces any value staged earlier
+  **                  for the same parameter.
+  **                  paramId: NCI parameter ID.
+  **                  value: parameter value.
+  **                  len: length of the value.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void add(tNFA_PMID paramId, const uint8_t* value, uint8_t len);
+
+  /*******************************************************************************
+  **
+  ** Function:        add
+  **
+  ** Description:     Stage a one-octet parameter.
+  **                  paramId: NCI parameter ID.
+  **                  value: parameter value.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void add(tNFA_PMID paramId, uint8_t value);
+
+  /*******************************************************************************
+  **
+  ** Function:        apply
+  **
+  ** Description:     Send every staged parameter that differs from the
+  **                  shadow copy, then clear the staging area.
+  **                  waitForCompletion: block until the controller has
+  **                  acknowledged every outstanding parameter.  Must be
+  **                  false when called from a stack callback.
+  **
+  ** Returns:         NFA_STATUS_OK if all parameters were accepted.
+  **
+  *******************************************************************************/
+  tNFA_STATUS apply(bool waitForCompletion = true);
+
+  /*******************************************************************************
+  **
+  ** Function:        setConfigEvent
+  **
+  ** Description:     Handle NFA_DM_SET_CONFIG_EVT from the stack.
+  **                  status: status of the completed NFA_SetConfig.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  static void setConfigEvent(tNFA_STATUS status);
+
+  /*******************************************************************************
+  **
+  ** Function:        invalidate
+  **
+  ** Description:     Forget the shadow copy because the controller has been
+  **                  reset and its configuration is unknown.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  static void invalidate();
+
+  /*******************************************************************************
+  **
+  ** Function:        abortWaits
+  **
+  ** Description:     Unblock any thread waiting in apply().
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  static void abortWaits();
+
+ private:
+  std::map<tNFA_PMID, std::vector<uint8_t>> mStaged;
+};
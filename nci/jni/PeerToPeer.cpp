@@ -39,6 +39,14 @@ using android::base::StringPrintf;
  */
 #define LLCP_DATA_LINK_TIMEOUT 2000
 
+// Bytes send() queues on a connection before it blocks the caller
+static const size_t MAX_SEND_QUEUE_BYTES = 8 * 1024;
+// How long a disconnect waits for queued data to go out
+static const long SEND_QUEUE_LINGER_MS = 1000;
+// Connections a server accepts on the stack before Java takes them,
+// unless LLCP_ACCEPT_BACKLOG is configured
+static const size_t DEFAULT_ACCEPT_BACKLOG = 4;
+
 using namespace android;
 
 namespace android {
@@ -68,10 +76,8 @@ PeerToPeer::PeerToPeer()
       mP2pListenTechMask(NFA_TECHNOLOGY_MASK_A | NFA_TECHNOLOGY_MASK_F |
                          NFA_TECHNOLOGY_MASK_A_ACTIVE |
                          NFA_TECHNOLOGY_MASK_F_ACTIVE),
-      mNextJniHandle(1) {
-  memset(mServers, 0, sizeof(mServers));
-  memset(mClients, 0, sizeof(mClients));
-}
+      mAcceptBacklog(DEFAULT_ACCEPT_BACKLOG),
+      mFreeHandleSlot(MAX_HANDLE_SLOTS) {}
 
 /*******************************************************************************
 **
@@ -109,6 +115,9 @@ void PeerToPeer::initialize() {
 
   if (NfcConfig::hasKey(NAME_P2P_LISTEN_TECH_MASK))
     mP2pListenTechMask = NfcConfig::getUnsigned(NAME_P2P_LISTEN_TECH_MASK);
+  mAcceptBacklog =
+      NfcConfig::getUnsigned("LLCP_ACCEPT_BACKLOG", DEFAULT_ACCEPT_BACKLOG);
+  if (mAcceptBacklog == 0) mAcceptBacklog = 1;
 }
 
 /*******************************************************************************
@@ -123,10 +132,10 @@ void PeerToPeer::initialize() {
 **
 *******************************************************************************/
 sp<P2pServer> PeerToPeer::findServerLocked(tNFA_HANDLE nfaP2pServerHandle) {
-  for (int i = 0; i < sMax; i++) {
-    if ((mServers[i] != NULL) &&
-        (mServers[i]->mNfaP2pServerHandle == nfaP2pServerHandle)) {
-      return (mServers[i]);
+  for (const HandleSlot& slot : mHandleSlots) {
+    if ((slot.kind == HANDLE_SERVER) &&
+        (slot.server->mNfaP2pServerHandle == nfaP2pServerHandle)) {
+      return (slot.server);
     }
   }
 
@@ -146,11 +155,8 @@ sp<P2pServer> PeerToPeer::findServerLocked(tNFA_HANDLE nfaP2pServerHandle) {
 **
 *******************************************************************************/
 sp<P2pServer> PeerToPeer::findServerLocked(tJNI_HANDLE jniHandle) {
-  for (int i = 0; i < sMax; i++) {
-    if ((mServers[i] != NULL) && (mServers[i]->mJniHandle == jniHandle)) {
-      return (mServers[i]);
-    }
-  }
+  HandleSlot* slot = findSlotLocked(jniHandle);
+  if ((slot != NULL) && (slot->kind == HANDLE_SERVER)) return (slot->server);
 
   // If here, not found
   return NULL;
@@ -168,16 +174,114 @@ sp<P2pServer> PeerToPeer::findServerLocked(tJNI_HANDLE jniHandle) {
 **
 *******************************************************************************/
 sp<P2pServer> PeerToPeer::findServerLocked(const char* serviceName) {
-  for (int i = 0; i < sMax; i++) {
-    if ((mServers[i] != NULL) &&
-        (mServers[i]->mServiceName.compare(serviceName) == 0))
-      return (mServers[i]);
+  for (const HandleSlot& slot : mHandleSlots) {
+    if ((slot.kind == HANDLE_SERVER) &&
+        (slot.server->mServiceName.compare(serviceName) == 0))
+      return (slot.server);
   }
 
   // If here, not found
   return NULL;
 }
 
+/*******************************************************************************
+**
+** Function:        findSlotLocked
+**
+** Description:     Find the slot of a JNI handle.
+**                  Assumes mMutex is already held.
+**                  jniHandle: JNI handle.
+**
+** Returns:         Slot, or NULL if the handle is not allocated.
+**
+*******************************************************************************/
+PeerToPeer::HandleSlot* PeerToPeer::findSlotLocked(tJNI_HANDLE jniHandle) {
+  uint32_t index = (jniHandle & MAX_HANDLE_SLOTS) - 1;
+  if (index >= mHandleSlots.size()) return NULL;
+  HandleSlot* slot = &mHandleSlots[index];
+  if ((slot->kind == HANDLE_FREE) ||
+      (slot->generation != (jniHandle >> HANDLE_INDEX_BITS)))
+    return NULL;
+  return slot;
+}
+
+/*******************************************************************************
+**
+** Function:        allocJniHandle
+**
+** Description:     Reserve a JNI handle for a new server, client or
+**                  accepted connection.  The handle is freed when that
+**                  object is removed, or when creating it fails.
+**
+** Returns:         A new JNI handle, or 0 if every handle is in use.
+**
+*******************************************************************************/
+PeerToPeer::tJNI_HANDLE PeerToPeer::allocJniHandle() {
+  TimedMutex::Autolock mutex(mMutex);
+  uint32_t index = mFreeHandleSlot;
+  if (index != MAX_HANDLE_SLOTS) {
+    mFreeHandleSlot = mHandleSlots[index].nextFree;
+  } else if (mHandleSlots.size() < MAX_HANDLE_SLOTS) {
+    index = mHandleSlots.size();
+    mHandleSlots.push_back(HandleSlot());
+    mHandleSlots[index].generation = 0;
+  } else {
+    LOG(ERROR) << StringPrintf("%s: all %u handles in use", __func__,
+                               MAX_HANDLE_SLOTS);
+    return 0;
+  }
+  HandleSlot& slot = mHandleSlots[index];
+  slot.kind = HANDLE_RESERVED;
+  slot.nextFree = MAX_HANDLE_SLOTS;
+  return ((uint32_t)slot.generation << HANDLE_INDEX_BITS) | (index + 1);
+}
+
+/*******************************************************************************
+**
+** Function:        freeSlotLocked
+**
+** Description:     Release a slot and the objects it holds, so that its
+**                  handle is no longer valid.
+**                  Assumes mMutex is already held.
+**                  slot: Slot to release.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void PeerToPeer::freeSlotLocked(HandleSlot* slot) {
+  sp<NfaConn> conn = slot->conn;
+  if (conn != NULL) {
+    auto it = mConnsByNfaHandle.find(conn->mNfaConnHandle);
+    if (it != mConnsByNfaHandle.end() && it->second == conn)
+      mConnsByNfaHandle.erase(it);
+    mConnsByJniHandle.erase(conn->mJniHandle);
+  }
+  slot->kind = HANDLE_FREE;
+  slot->generation++;
+  slot->server = NULL;
+  slot->client = NULL;
+  slot->conn = NULL;
+  slot->nextFree = mFreeHandleSlot;
+  mFreeHandleSlot = slot - &mHandleSlots[0];
+}
+
+/*******************************************************************************
+**
+** Function:        freeJniHandle
+**
+** Description:     Release a JNI handle that is still reserved, because
+**                  the object it was allocated for could not be created.
+**                  jniHandle: JNI handle.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void PeerToPeer::freeJniHandle(tJNI_HANDLE jniHandle) {
+  TimedMutex::Autolock mutex(mMutex);
+  HandleSlot* slot = findSlotLocked(jniHandle);
+  if ((slot != NULL) && (slot->kind == HANDLE_RESERVED)) freeSlotLocked(slot);
+}
+
 /*******************************************************************************
 **
 ** Function:        registerServer
@@ -185,12 +289,16 @@ sp<P2pServer> PeerToPeer::findServerLocked(const char* serviceName) {
 ** Description:     Let a server start listening for peer's connection request.
 **                  jniHandle: Connection handle.
 **                  serviceName: Server's service name.
+**                  maxInfoUnit: Largest MIU of accepted connections.
+**                  recvWindow: Largest receive window of accepted
+**                  connections.
 **
 ** Returns:         True if ok.
 **
 *******************************************************************************/
 bool PeerToPeer::registerServer(tJNI_HANDLE jniHandle,
-                                const char* serviceName) {
+                                const char* serviceName,
+                                uint16_t maxInfoUnit, uint8_t recvWindow) {
   static const char fn[] = "PeerToPeer::registerServer";
   DLOG_IF(INFO, nfc_debug_enabled)
       << StringPrintf("%s: enter; service name: %s  JNI handle: %u", fn,
@@ -204,27 +312,38 @@ bool PeerToPeer::registerServer(tJNI_HANDLE jniHandle,
         "%s: service name=%s  already registered, handle: 0x%04x", fn,
         serviceName, pSrv->mNfaP2pServerHandle);
 
-    // Update JNI handle
+    // Update JNI handle; the old one is no longer valid
+    HandleSlot* slot = findSlotLocked(jniHandle);
+    if ((slot == NULL) || (slot->kind != HANDLE_RESERVED)) {
+      LOG(ERROR) << StringPrintf("%s: bad JNI handle: %u", fn, jniHandle);
+      mMutex.unlock();
+      return (false);
+    }
+    HandleSlot* oldSlot = findSlotLocked(pSrv->mJniHandle);
+    if (oldSlot != NULL) freeSlotLocked(oldSlot);
+    slot->kind = HANDLE_SERVER;
+    slot->server = pSrv;
     pSrv->mJniHandle = jniHandle;
     mMutex.unlock();
     return (true);
   }
 
-  for (int ii = 0; ii < sMax; ii++) {
-    if (mServers[ii] == NULL) {
-      pSrv = mServers[ii] = new P2pServer(jniHandle, serviceName);
+  HandleSlot* slot = findSlotLocked(jniHandle);
+  if ((slot != NULL) && (slot->kind == HANDLE_RESERVED)) {
+    pSrv = new P2pServer(jniHandle, serviceName, mAcceptBacklog, maxInfoUnit,
+                         recvWindow);
+    slot->kind = HANDLE_SERVER;
+    slot->server = pSrv;
 
-      DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
-          "%s: added new p2p server  index: %d  handle: %u  name: %s", fn, ii,
-          jniHandle, serviceName);
-      break;
-    }
+    DLOG_IF(INFO, nfc_debug_enabled)
+        << StringPrintf("%s: added new p2p server  handle: %u  name: %s", fn,
+                        jniHandle, serviceName);
   }
   mMutex.unlock();
 
   if (pSrv == NULL) {
-    LOG(ERROR) << StringPrintf("%s: service name=%s  no free entry", fn,
-                               serviceName);
+    LOG(ERROR) << StringPrintf("%s: service name=%s  bad JNI handle: %u", fn,
+                               serviceName, jniHandle);
     return (false);
   }
 
@@ -252,23 +371,46 @@ bool PeerToPeer::registerServer(tJNI_HANDLE jniHandle,
 void PeerToPeer::removeServer(tJNI_HANDLE jniHandle) {
   static const char fn[] = "PeerToPeer::removeServer";
 
-  AutoMutex mutex(mMutex);
+  TimedMutex::Autolock mutex(mMutex);
 
-  for (int i = 0; i < sMax; i++) {
-    if ((mServers[i] != NULL) && (mServers[i]->mJniHandle == jniHandle)) {
-      DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
-          "%s: server jni_handle: %u;  nfa_handle: 0x%04x; name: %s; index=%d",
-          fn, jniHandle, mServers[i]->mNfaP2pServerHandle,
-          mServers[i]->mServiceName.c_str(), i);
+  HandleSlot* slot = findSlotLocked(jniHandle);
+  if ((slot != NULL) && (slot->kind == HANDLE_SERVER)) {
+    DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
+        "%s: server jni_handle: %u;  nfa_handle: 0x%04x; name: %s", fn,
+        jniHandle, slot->server->mNfaP2pServerHandle,
+        slot->server->mServiceName.c_str());
 
-      mServers[i] = NULL;
-      return;
-    }
+    freeSlotLocked(slot);
+    return;
   }
   LOG(ERROR) << StringPrintf("%s: unknown server jni handle: %u", fn,
                              jniHandle);
 }
 
+/*******************************************************************************
+**
+** Function:        peerFingerprint
+**
+** Description:     Tell peers apart by the link parameters they announce,
+**                  besides their LLCP version and well-known services.
+**                  activated: Event data.
+**
+** Returns:         Fingerprint of the peer.
+**
+*******************************************************************************/
+static uint32_t peerFingerprint(const tNFA_LLCP_ACTIVATED& activated) {
+  // FNV-1a over the fields, so equal devices end up sharing a fingerprint
+  const uint32_t fields[] = {activated.remote_lsc, activated.remote_link_miu,
+                             activated.is_initiator};
+  uint32_t hash = 2166136261u;
+  for (uint32_t field : fields) {
+    for (int shift = 0; shift < 32; shift += 8) {
+      hash = (hash ^ ((field >> shift) & 0xFF)) * 16777619u;
+    }
+  }
+  return hash;
+}
+
 /*******************************************************************************
 **
 ** Function:        llcpActivatedHandler
@@ -289,6 +431,9 @@ void PeerToPeer::llcpActivatedHandler(nfc_jni_native_data* nat,
   android::nativeNfcTag_deregisterNdefTypeHandler();
 
   mRemoteWKS = activated.remote_wks;
+  LlcpLinkTuner::getInstance().peerActivated(LlcpLinkTuner::PeerKey{
+      peerFingerprint(activated), activated.remote_wks,
+      activated.remote_version});
 
   JNIEnv* e = NULL;
   ScopedAttach attach(nat->vm, &e);
@@ -416,17 +561,22 @@ void PeerToPeer::llcpFirstPacketHandler(nfc_jni_native_data* nat) {
 **
 ** Function:        accept
 **
-** Description:     Accept a peer's request to connect.
+** Description:     Accept a peer's request to connect.  The request was
+**                  accepted on the stack when it arrived, so the MIU and
+**                  receive window passed in only bound the connections
+**                  the server accepts from now on.
 **                  serverJniHandle: Server's handle.
 **                  connJniHandle: Connection handle.
-**                  maxInfoUnit: Maximum information unit.
-**                  recvWindow: Receive window size.
+**                  maxInfoUnit: Maximum information unit; receives the
+**                  one of the accepted connection.
+**                  recvWindow: Receive window size; receives the one of
+**                  the accepted connection.
 **
 ** Returns:         True if ok.
 **
 *******************************************************************************/
 bool PeerToPeer::accept(tJNI_HANDLE serverJniHandle, tJNI_HANDLE connJniHandle,
-                        int maxInfoUnit, int recvWindow) {
+                        int& maxInfoUnit, int& recvWindow) {
   static const char fn[] = "PeerToPeer::accept";
   sp<P2pServer> pSrv = NULL;
 
@@ -440,11 +590,150 @@ bool PeerToPeer::accept(tJNI_HANDLE serverJniHandle, tJNI_HANDLE connJniHandle,
     LOG(ERROR) << StringPrintf("%s: unknown server jni handle: %u", fn,
                                serverJniHandle);
     mMutex.unlock();
+    freeJniHandle(connJniHandle);
     return (false);
   }
   mMutex.unlock();
 
-  return pSrv->accept(serverJniHandle, connJniHandle, maxInfoUnit, recvWindow);
+  if (pSrv->accept(serverJniHandle, connJniHandle, maxInfoUnit, recvWindow)) {
+    sp<NfaConn> pConn = pSrv->findServerConnection(connJniHandle);
+    if (pConn != NULL) {
+      if (addConnection(pSrv, pConn)) {
+        maxInfoUnit = pConn->mMaxInfoUnit;
+        recvWindow = pConn->mRecvWindow;
+        return (true);
+      }
+      // Java can no longer close the connection, so close it here
+      LOG(ERROR) << StringPrintf("%s: conn jni handle %u no longer reserved",
+                                 fn, connJniHandle);
+      pSrv->removeServerConnection(connJniHandle);
+      tNFA_HANDLE nfaConnHandle = pConn->mNfaConnHandle;
+      setConnNfaHandle(pConn, NFA_HANDLE_INVALID);
+      if (nfaConnHandle != NFA_HANDLE_INVALID)
+        NFA_P2pDisconnect(nfaConnHandle, FALSE);
+    }
+  }
+  freeJniHandle(connJniHandle);
+  return (false);
+}
+
+/*******************************************************************************
+**
+** Function:        addConnection
+**
+** Description:     Bind the JNI handle of a connection accepted by a
+**                  server to that connection.
+**                  server: Server that accepted the connection.
+**                  conn: Accepted connection.
+**
+** Returns:         True if the handle was still reserved.
+**
+*******************************************************************************/
+bool PeerToPeer::addConnection(const sp<P2pServer>& server,
+                               const sp<NfaConn>& conn) {
+  TimedMutex::Autolock mutex(mMutex);
+  HandleSlot* slot = findSlotLocked(conn->mJniHandle);
+  if ((slot == NULL) || (slot->kind != HANDLE_RESERVED)) return (false);
+  slot->kind = HANDLE_SERVER_CONN;
+  slot->server = server;
+  slot->conn = conn;
+  mConnsByJniHandle[conn->mJniHandle] = conn;
+  return (true);
+}
+
+/*******************************************************************************
+**
+** Function:        setConnNfaHandle
+**
+** Description:     Assign an NFA handle to a connection, or invalidate it,
+**                  and keep the lookup by NFA handle up to date.
+**                  conn: Connection of a server or client.
+**                  nfaConnHandle: New NFA handle, or NFA_HANDLE_INVALID.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void PeerToPeer::setConnNfaHandle(const sp<NfaConn>& conn,
+                                  tNFA_HANDLE nfaConnHandle) {
+  TimedMutex::Autolock mutex(mMutex);
+  setConnNfaHandleLocked(conn, nfaConnHandle);
+}
+
+/*******************************************************************************
+**
+** Function:        setConnNfaHandleLocked
+**
+** Description:     Same as setConnNfaHandle().  Assumes mMutex is already
+**                  held.
+**                  conn: Connection of a server or client.
+**                  nfaConnHandle: New NFA handle, or NFA_HANDLE_INVALID.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void PeerToPeer::setConnNfaHandleLocked(const sp<NfaConn>& conn,
+                                        tNFA_HANDLE nfaConnHandle) {
+  auto it = mConnsByNfaHandle.find(conn->mNfaConnHandle);
+  if (it != mConnsByNfaHandle.end() && it->second == conn)
+    mConnsByNfaHandle.erase(it);
+  if (nfaConnHandle != NFA_HANDLE_INVALID)
+    mConnsByNfaHandle[nfaConnHandle] = conn;
+  conn->mNfaConnHandle = nfaConnHandle;
+}
+
+/*******************************************************************************
+**
+** Function:        queueConnRequest
+**
+** Description:     Accept a peer's request to connect to a server on
+**                  the stack right away, and queue the connection until
+**                  Java accepts it; reject it if the backlog is full.
+**                  server: Server the request is for.
+**                  request: Event data of NFA_P2P_CONN_REQ_EVT.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void PeerToPeer::queueConnRequest(const sp<P2pServer>& server,
+                                  const tNFA_P2P_CONN_REQ& request) {
+  static const char fn[] = "PeerToPeer::queueConnRequest";
+  uint16_t maxInfoUnit = 0;
+  uint8_t recvWindow = 0;
+  sp<NfaConn> conn = server->takeFreeConnection(maxInfoUnit, recvWindow);
+  if (conn == NULL) {
+    LOG(ERROR) << StringPrintf(
+        "%s: server jni h=%u: backlog full; reject nfa conn h=0x%04x", fn,
+        server->mJniHandle, request.conn_handle);
+    NFA_P2pRejectConn(request.conn_handle);
+    return;
+  }
+
+  conn->mRemoteMaxInfoUnit = request.remote_miu;
+  conn->mRemoteRecvWindow = request.remote_rw;
+  conn->mLinkParams =
+      LlcpLinkTuner::getInstance().choose(maxInfoUnit, recvWindow);
+  conn->mMaxInfoUnit = conn->mLinkParams.miu;
+  conn->mRecvWindow = conn->mLinkParams.rw;
+  conn->mTuned = true;
+  setConnNfaHandle(conn, request.conn_handle);
+
+  tNFA_STATUS nfaStat = NFA_P2pAcceptConn(
+      request.conn_handle, conn->mMaxInfoUnit, conn->mRecvWindow);
+  if (nfaStat != NFA_STATUS_OK) {
+    // the next accept() preallocates a replacement for conn
+    LOG(ERROR) << StringPrintf("%s: fail to accept remote; error=0x%X", fn,
+                               nfaStat);
+    setConnNfaHandle(conn, NFA_HANDLE_INVALID);
+    return;
+  }
+  if (!server->addToBacklog(conn)) {
+    setConnNfaHandle(conn, NFA_HANDLE_INVALID);
+    NFA_P2pDisconnect(request.conn_handle, FALSE);
+    return;
+  }
+  DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
+      "%s: server jni h=%u; queued nfa conn h=0x%04x", fn, server->mJniHandle,
+      request.conn_handle);
 }
 
 /*******************************************************************************
@@ -476,10 +765,13 @@ bool PeerToPeer::deregisterServer(tJNI_HANDLE jniHandle) {
     startRfDiscovery(false);
   }
 
-  {
-    // Server does not call NFA_P2pDisconnect(), so unblock the accept()
-    SyncEventGuard guard(pSrv->mConnRequestEvent);
-    pSrv->mConnRequestEvent.notifyOne();
+  // Server does not call NFA_P2pDisconnect(), so unblock the accept(), and
+  // let go of the connections Java never took
+  for (const sp<NfaConn>& conn : pSrv->stopAccepting()) {
+    tNFA_HANDLE nfaConnHandle = conn->mNfaConnHandle;
+    if (nfaConnHandle == NFA_HANDLE_INVALID) continue;
+    setConnNfaHandle(conn, NFA_HANDLE_INVALID);
+    NFA_P2pDisconnect(nfaConnHandle, FALSE);
   }
 
   nfaStat = NFA_P2pDeregister(pSrv->mNfaP2pServerHandle);
@@ -511,21 +803,21 @@ bool PeerToPeer::deregisterServer(tJNI_HANDLE jniHandle) {
 *******************************************************************************/
 bool PeerToPeer::createClient(tJNI_HANDLE jniHandle, uint16_t miu, uint8_t rw) {
   static const char fn[] = "PeerToPeer::createClient";
-  int i = 0;
   DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
       "%s: enter: jni h: %u  miu: %u  rw: %u", fn, jniHandle, miu, rw);
 
   mMutex.lock();
   sp<P2pClient> client = NULL;
-  for (i = 0; i < sMax; i++) {
-    if (mClients[i] == NULL) {
-      mClients[i] = client = new P2pClient();
-
-      mClients[i]->mClientConn->mJniHandle = jniHandle;
-      mClients[i]->mClientConn->mMaxInfoUnit = miu;
-      mClients[i]->mClientConn->mRecvWindow = rw;
-      break;
-    }
+  HandleSlot* slot = findSlotLocked(jniHandle);
+  if ((slot != NULL) && (slot->kind == HANDLE_RESERVED)) {
+    client = new P2pClient();
+    client->mClientConn->mJniHandle = jniHandle;
+    client->mClientConn->mMaxInfoUnit = miu;
+    client->mClientConn->mRecvWindow = rw;
+    slot->kind = HANDLE_CLIENT;
+    slot->client = client;
+    slot->conn = client->mClientConn;
+    mConnsByJniHandle[client->mClientConn->mJniHandle] = client->mClientConn;
   }
   mMutex.unlock();
 
@@ -538,13 +830,17 @@ bool PeerToPeer::createClient(tJNI_HANDLE jniHandle, uint16_t miu, uint8_t rw) {
       << StringPrintf("%s: pClient: 0x%p  assigned for client jniHandle: %u",
                       fn, client.get(), jniHandle);
 
-  {
-    SyncEventGuard guard(mClients[i]->mRegisteringEvent);
-    NFA_P2pRegisterClient(NFA_P2P_DLINK_TYPE, nfaClientCallback);
-    mClients[i]->mRegisteringEvent.wait();  // wait for NFA_P2P_REG_CLIENT_EVT
+  tNFA_HANDLE clientHandle = NFA_HANDLE_INVALID;
+  client->mRegistered.start();
+  if (NFA_P2pRegisterClient(NFA_P2P_DLINK_TYPE, nfaClientCallback) ==
+      NFA_STATUS_OK) {
+    // wait for NFA_P2P_REG_CLIENT_EVT
+    client->mRegistered.wait(&clientHandle);
+  } else {
+    client->mRegistered.cancel();
   }
 
-  if (mClients[i]->mNfaP2pClientHandle != NFA_HANDLE_INVALID) {
+  if (clientHandle != NFA_HANDLE_INVALID) {
     DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
         "%s: exit; new client jniHandle: %u   NFA Handle: 0x%04x", fn,
         jniHandle, client->mClientConn->mNfaConnHandle);
@@ -571,28 +867,28 @@ bool PeerToPeer::createClient(tJNI_HANDLE jniHandle, uint16_t miu, uint8_t rw) {
 void PeerToPeer::removeConn(tJNI_HANDLE jniHandle) {
   static const char fn[] = "PeerToPeer::removeConn";
 
-  AutoMutex mutex(mMutex);
+  TimedMutex::Autolock mutex(mMutex);
+  HandleSlot* slot = findSlotLocked(jniHandle);
+  if ((slot != NULL) && (slot->conn != NULL) && slot->conn->mTuned)
+    LlcpLinkTuner::getInstance().record(slot->conn->mLinkParams,
+                                        slot->conn->mMeter);
+
   // If the connection is a for a client, delete the client itself
-  for (int ii = 0; ii < sMax; ii++) {
-    if ((mClients[ii] != NULL) &&
-        (mClients[ii]->mClientConn->mJniHandle == jniHandle)) {
-      if (mClients[ii]->mNfaP2pClientHandle != NFA_HANDLE_INVALID)
-        NFA_P2pDeregister(mClients[ii]->mNfaP2pClientHandle);
+  if ((slot != NULL) && (slot->kind == HANDLE_CLIENT)) {
+    if (slot->client->mNfaP2pClientHandle != NFA_HANDLE_INVALID)
+      NFA_P2pDeregister(slot->client->mNfaP2pClientHandle);
 
-      mClients[ii] = NULL;
-      DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
-          "%s: deleted client handle: %u  index: %u", fn, jniHandle, ii);
-      return;
-    }
+    freeSlotLocked(slot);
+    DLOG_IF(INFO, nfc_debug_enabled)
+        << StringPrintf("%s: deleted client handle: %u", fn, jniHandle);
+    return;
   }
 
   // If the connection is for a server, just delete the connection
-  for (int ii = 0; ii < sMax; ii++) {
-    if (mServers[ii] != NULL) {
-      if (mServers[ii]->removeServerConnection(jniHandle)) {
-        return;
-      }
-    }
+  if ((slot != NULL) && (slot->kind == HANDLE_SERVER_CONN)) {
+    slot->server->removeServerConnection(jniHandle);
+    freeSlotLocked(slot);
+    return;
   }
 
   LOG(ERROR) << StringPrintf("%s: could not find handle: %u", fn, jniHandle);
@@ -668,6 +964,14 @@ bool PeerToPeer::createDataLinkConn(tJNI_HANDLE jniHandle,
     return (false);
   }
 
+  // the MIU and receive window from Java are upper bounds
+  sp<NfaConn> conn = pClient->mClientConn;
+  conn->mLinkParams = LlcpLinkTuner::getInstance().choose(conn->mMaxInfoUnit,
+                                                          conn->mRecvWindow);
+  conn->mMaxInfoUnit = conn->mLinkParams.miu;
+  conn->mRecvWindow = conn->mLinkParams.rw;
+  conn->mTuned = true;
+
   {
     SyncEventGuard guard(pClient->mConnectingEvent);
     pClient->mIsConnecting = true;
@@ -716,11 +1020,11 @@ bool PeerToPeer::createDataLinkConn(tJNI_HANDLE jniHandle,
 **
 *******************************************************************************/
 sp<P2pClient> PeerToPeer::findClient(tNFA_HANDLE nfaConnHandle) {
-  AutoMutex mutex(mMutex);
-  for (int i = 0; i < sMax; i++) {
-    if ((mClients[i] != NULL) &&
-        (mClients[i]->mNfaP2pClientHandle == nfaConnHandle))
-      return (mClients[i]);
+  TimedMutex::Autolock mutex(mMutex);
+  for (const HandleSlot& slot : mHandleSlots) {
+    if ((slot.kind == HANDLE_CLIENT) &&
+        (slot.client->mNfaP2pClientHandle == nfaConnHandle))
+      return (slot.client);
   }
   return (NULL);
 }
@@ -736,12 +1040,9 @@ sp<P2pClient> PeerToPeer::findClient(tNFA_HANDLE nfaConnHandle) {
 **
 *******************************************************************************/
 sp<P2pClient> PeerToPeer::findClient(tJNI_HANDLE jniHandle) {
-  AutoMutex mutex(mMutex);
-  for (int i = 0; i < sMax; i++) {
-    if ((mClients[i] != NULL) &&
-        (mClients[i]->mClientConn->mJniHandle == jniHandle))
-      return (mClients[i]);
-  }
+  TimedMutex::Autolock mutex(mMutex);
+  HandleSlot* slot = findSlotLocked(jniHandle);
+  if ((slot != NULL) && (slot->kind == HANDLE_CLIENT)) return (slot->client);
   return (NULL);
 }
 
@@ -756,11 +1057,11 @@ sp<P2pClient> PeerToPeer::findClient(tJNI_HANDLE jniHandle) {
 **
 *******************************************************************************/
 sp<P2pClient> PeerToPeer::findClientCon(tNFA_HANDLE nfaConnHandle) {
-  AutoMutex mutex(mMutex);
-  for (int i = 0; i < sMax; i++) {
-    if ((mClients[i] != NULL) &&
-        (mClients[i]->mClientConn->mNfaConnHandle == nfaConnHandle))
-      return (mClients[i]);
+  TimedMutex::Autolock mutex(mMutex);
+  for (const HandleSlot& slot : mHandleSlots) {
+    if ((slot.kind == HANDLE_CLIENT) &&
+        (slot.client->mClientConn->mNfaConnHandle == nfaConnHandle))
+      return (slot.client);
   }
   return (NULL);
 }
@@ -776,27 +1077,9 @@ sp<P2pClient> PeerToPeer::findClientCon(tNFA_HANDLE nfaConnHandle) {
 **
 *******************************************************************************/
 sp<NfaConn> PeerToPeer::findConnection(tNFA_HANDLE nfaConnHandle) {
-  AutoMutex mutex(mMutex);
-  // First, look through all the client control blocks
-  for (int ii = 0; ii < sMax; ii++) {
-    if ((mClients[ii] != NULL) &&
-        (mClients[ii]->mClientConn->mNfaConnHandle == nfaConnHandle)) {
-      return mClients[ii]->mClientConn;
-    }
-  }
-
-  // Not found yet. Look through all the server control blocks
-  for (int ii = 0; ii < sMax; ii++) {
-    if (mServers[ii] != NULL) {
-      sp<NfaConn> conn = mServers[ii]->findServerConnection(nfaConnHandle);
-      if (conn != NULL) {
-        return conn;
-      }
-    }
-  }
-
-  // Not found...
-  return NULL;
+  TimedMutex::Autolock mutex(mMutex);
+  auto it = mConnsByNfaHandle.find(nfaConnHandle);
+  return it != mConnsByNfaHandle.end() ? it->second : NULL;
 }
 
 /*******************************************************************************
@@ -810,45 +1093,29 @@ sp<NfaConn> PeerToPeer::findConnection(tNFA_HANDLE nfaConnHandle) {
 **
 *******************************************************************************/
 sp<NfaConn> PeerToPeer::findConnection(tJNI_HANDLE jniHandle) {
-  AutoMutex mutex(mMutex);
-  // First, look through all the client control blocks
-  for (int ii = 0; ii < sMax; ii++) {
-    if ((mClients[ii] != NULL) &&
-        (mClients[ii]->mClientConn->mJniHandle == jniHandle)) {
-      return mClients[ii]->mClientConn;
-    }
-  }
-
-  // Not found yet. Look through all the server control blocks
-  for (int ii = 0; ii < sMax; ii++) {
-    if (mServers[ii] != NULL) {
-      sp<NfaConn> conn = mServers[ii]->findServerConnection(jniHandle);
-      if (conn != NULL) {
-        return conn;
-      }
-    }
-  }
-
-  // Not found...
-  return NULL;
+  TimedMutex::Autolock mutex(mMutex);
+  auto it = mConnsByJniHandle.find(jniHandle);
+  return it != mConnsByJniHandle.end() ? it->second : NULL;
 }
 
 /*******************************************************************************
 **
 ** Function:        send
 **
-** Description:     Send data to peer.
+** Description:     Send data to peer.  True means only that the stack
+**                  took the data or it was queued; if the stack later
+**                  refuses queued data, the next send() and
+**                  disconnectConnOriented() return false.
 **                  jniHandle: Handle of connection.
 **                  buffer: Buffer of data.
 **                  bufferLen: Length of data.
 **
-** Returns:         True if ok.
+** Returns:         True if the data was sent or queued.
 **
 *******************************************************************************/
 bool PeerToPeer::send(tJNI_HANDLE jniHandle, uint8_t* buffer,
                       uint16_t bufferLen) {
   static const char fn[] = "PeerToPeer::send";
-  tNFA_STATUS nfaStat = NFA_STATUS_FAILED;
   sp<NfaConn> pConn = NULL;
 
   if ((pConn = findConnection(jniHandle)) == NULL) {
@@ -861,33 +1128,40 @@ bool PeerToPeer::send(tJNI_HANDLE jniHandle, uint8_t* buffer,
       << StringPrintf("%s: send data; jniHandle: %u  nfaHandle: 0x%04X", fn,
                       pConn->mJniHandle, pConn->mNfaConnHandle);
 
-  while (true) {
-    SyncEventGuard guard(pConn->mCongEvent);
-    nfaStat = NFA_P2pSendData(pConn->mNfaConnHandle, bufferLen, buffer);
-    if (nfaStat == NFA_STATUS_CONGESTED)
-      pConn->mCongEvent.wait();  // wait for NFA_P2P_CONGEST_EVT
-    else
-      break;
-
-    if (pConn->mNfaConnHandle ==
-        NFA_HANDLE_INVALID)  // peer already disconnected
-    {
-      DLOG_IF(INFO, nfc_debug_enabled)
-          << StringPrintf("%s: peer disconnected", fn);
-      return (false);
-    }
-  }
-
-  if (nfaStat == NFA_STATUS_OK)
+  SyncEventGuard guard(pConn->mCongEvent);
+  // wait for NFA_P2P_CONGEST_EVT to make room
+  pConn->mCongEvent.waitFor([&] {
+    return pConn->mSendQueue.empty() ||
+           (pConn->mSendQueueBytes + bufferLen <= MAX_SEND_QUEUE_BYTES) ||
+           (pConn->mNfaConnHandle == NFA_HANDLE_INVALID) ||
+           pConn->mSendFailed;
+  });
+  if (pConn->mNfaConnHandle == NFA_HANDLE_INVALID) {
     DLOG_IF(INFO, nfc_debug_enabled)
-        << StringPrintf("%s: exit OK; JNI handle: %u  NFA Handle: 0x%04x", fn,
-                        jniHandle, pConn->mNfaConnHandle);
-  else
+        << StringPrintf("%s: peer disconnected", fn);
+    return (false);
+  }
+  if (pConn->mSendFailed) {
     LOG(ERROR) << StringPrintf(
-        "%s: Data not sent; JNI handle: %u  NFA Handle: 0x%04x  error: 0x%04x",
-        fn, jniHandle, pConn->mNfaConnHandle, nfaStat);
+        "%s: Data not sent; JNI handle: %u  NFA Handle: 0x%04x", fn, jniHandle,
+        pConn->mNfaConnHandle);
+    return (false);
+  }
 
-  return nfaStat == NFA_STATUS_OK;
+  // nothing is queued ahead of the caller's buffer, so send straight from it
+  // and copy only what the stack does not take
+  size_t sent = 0;
+  if (pConn->mSendQueue.empty() && !pConn->mCongested)
+    sent = pConn->sendSegments(buffer, bufferLen);
+  if (sent < bufferLen && !pConn->mSendFailed) {
+    pConn->mSendQueue.emplace_back(buffer + sent, buffer + bufferLen);
+    pConn->mSendQueueBytes += bufferLen - sent;
+  }
+
+  DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
+      "%s: exit; JNI handle: %u  NFA Handle: 0x%04x  sent: %zu  queued: %zu",
+      fn, jniHandle, pConn->mNfaConnHandle, sent, pConn->mSendQueueBytes);
+  return !pConn->mSendFailed;
 }
 
 /*******************************************************************************
@@ -931,14 +1205,20 @@ bool PeerToPeer::receive(tJNI_HANDLE jniHandle, uint8_t* buffer,
     if ((stat == NFA_STATUS_OK) && (actualDataLen2 > 0))  // received some data
     {
       actualLen = (uint16_t)actualDataLen2;
+      pConn->mMeter.addTraffic(actualDataLen2);
       retVal = true;
       break;
     }
     DLOG_IF(INFO, nfc_debug_enabled)
         << StringPrintf("%s: waiting for data...", fn);
     {
+      // data that arrived since the read above has set mDataReady
       SyncEventGuard guard(pConn->mReadEvent);
-      pConn->mReadEvent.wait();
+      pConn->mReadEvent.waitFor([&] {
+        return pConn->mDataReady ||
+               (pConn->mNfaConnHandle == NFA_HANDLE_INVALID);
+      });
+      pConn->mDataReady = false;
     }
   }  // while
 
@@ -950,17 +1230,78 @@ bool PeerToPeer::receive(tJNI_HANDLE jniHandle, uint8_t* buffer,
 
 /*******************************************************************************
 **
-** Function:        disconnectConnOriented
+** Function:        receiveBatch
 **
-** Description:     Disconnect a connection-oriented connection with peer.
+** Description:     Receive data from peer like receive(), then keep reading
+**                  the PDUs that are already available while a whole PDU
+**                  of the local MIU still fits in the buffer.
 **                  jniHandle: Handle of connection.
+**                  buffer: Buffer to store data, PDUs back to back.
+**                  bufferLen: Max length of buffer.
+**                  pduLens: Receives the length of each PDU.
+**                  maxPdus: Number of entries of pduLens.
+**                  numPdus: Receives the number of PDUs read.
 **
 ** Returns:         True if ok.
 **
 *******************************************************************************/
+bool PeerToPeer::receiveBatch(tJNI_HANDLE jniHandle, uint8_t* buffer,
+                              uint32_t bufferLen, uint16_t* pduLens,
+                              size_t maxPdus, size_t& numPdus) {
+  static const char fn[] = "PeerToPeer::receiveBatch";
+  sp<NfaConn> pConn = NULL;
+  uint16_t firstLen = 0;
+
+  numPdus = 0;
+  if ((maxPdus == 0) || ((pConn = findConnection(jniHandle)) == NULL)) {
+    LOG(ERROR) << StringPrintf("%s: can't find connection handle: %u", fn,
+                               jniHandle);
+    return (false);
+  }
+
+  // block for the first PDU
+  if (!receive(jniHandle, buffer, (uint16_t)std::min(bufferLen, 0xFFFFu),
+               firstLen))
+    return (false);
+  pduLens[numPdus++] = firstLen;
+
+  // a PDU is never longer than the local MIU, so only read on while one
+  // cannot end up split between this call and the next
+  uint32_t miu = pConn->mMaxInfoUnit ? pConn->mMaxInfoUnit : LLCP_MIU;
+  uint32_t offset = firstLen;
+  bool isMoreData = TRUE;
+  while (isMoreData && (numPdus < maxPdus) && (bufferLen - offset >= miu)) {
+    uint32_t len = 0;
+    tNFA_STATUS stat = NFA_P2pReadData(pConn->mNfaConnHandle, miu, &len,
+                                       buffer + offset, &isMoreData);
+    if ((stat != NFA_STATUS_OK) || (len == 0)) break;
+    pConn->mMeter.addTraffic(len);
+    pduLens[numPdus++] = (uint16_t)len;
+    offset += len;
+  }
+
+  DLOG_IF(INFO, nfc_debug_enabled)
+      << StringPrintf("%s: exit; jniHandle: %u  pdus: %zu  len: %u", fn,
+                      jniHandle, numPdus, offset);
+  return (true);
+}
+
+/*******************************************************************************
+**
+** Function:        disconnectConnOriented
+**
+** Description:     Disconnect a connection-oriented connection with peer,
+**                  after giving queued data a chance to go out.
+**                  jniHandle: Handle of connection.
+**
+** Returns:         True if ok; false also if data accepted by send() was
+**                  not sent.
+**
+*******************************************************************************/
 bool PeerToPeer::disconnectConnOriented(tJNI_HANDLE jniHandle) {
   static const char fn[] = "PeerToPeer::disconnectConnOriented";
   tNFA_STATUS nfaStat = NFA_STATUS_FAILED;
+  bool dataLost = false;
   sp<P2pClient> pClient = NULL;
   sp<NfaConn> pConn = NULL;
 
@@ -977,17 +1318,31 @@ bool PeerToPeer::disconnectConnOriented(tJNI_HANDLE jniHandle) {
   // case
   if (((pClient = findClient(jniHandle)) != NULL) && (pClient->mIsConnecting)) {
     SyncEventGuard guard(pClient->mConnectingEvent);
-    pClient->mConnectingEvent.notifyOne();
+    pClient->mConnectingEvent.notifyAll();
     return (true);
   }
 
   {
+    // give queued data a chance to go out first, then drop the rest and
+    // unblock send() if congested
     SyncEventGuard guard1(pConn->mCongEvent);
-    pConn->mCongEvent.notifyOne();  // unblock send() if congested
+    while (!pConn->mSendQueue.empty() &&
+           (pConn->mNfaConnHandle != NFA_HANDLE_INVALID)) {
+      if (!pConn->mCongEvent.wait(SEND_QUEUE_LINGER_MS)) {
+        LOG(ERROR) << StringPrintf("%s: dropping %zu queued bytes", fn,
+                                   pConn->mSendQueueBytes);
+        break;
+      }
+    }
+    dataLost = pConn->mSendFailed || !pConn->mSendQueue.empty();
+    pConn->mSendQueue.clear();
+    pConn->mSendQueueOffset = 0;
+    pConn->mSendQueueBytes = 0;
+    pConn->mCongEvent.notifyAll();
   }
   {
     SyncEventGuard guard2(pConn->mReadEvent);
-    pConn->mReadEvent.notifyOne();  // unblock receive()
+    pConn->mReadEvent.notifyAll();  // unblock receive()
   }
 
   if (pConn->mNfaConnHandle != NFA_HANDLE_INVALID) {
@@ -1002,13 +1357,13 @@ bool PeerToPeer::disconnectConnOriented(tJNI_HANDLE jniHandle) {
       pConn->mDisconnectingEvent.wait();
   }
 
-  mDisconnectMutex.lock();
+  pConn->mDisconnectMutex.lock();
   removeConn(jniHandle);
-  mDisconnectMutex.unlock();
+  pConn->mDisconnectMutex.unlock();
 
   DLOG_IF(INFO, nfc_debug_enabled)
       << StringPrintf("%s: exit; jni handle: %u", fn, jniHandle);
-  return nfaStat == NFA_STATUS_OK;
+  return (nfaStat == NFA_STATUS_OK) && !dataLost;
 }
 
 /*******************************************************************************
@@ -1161,44 +1516,100 @@ void PeerToPeer::handleNfcOnOff(bool isOn) {
 
   mIsP2pListening = false;  // In both cases, P2P will not be listening
 
-  AutoMutex mutex(mMutex);
+  TimedMutex::Autolock mutex(mMutex);
   if (isOn) {
-    // Start with no clients or servers
-    memset(mServers, 0, sizeof(mServers));
-    memset(mClients, 0, sizeof(mClients));
+    // Start with no clients or servers; handles Java still holds from
+    // before become invalid
+    mConnsByNfaHandle.clear();
+    mConnsByJniHandle.clear();
+    for (HandleSlot& slot : mHandleSlots) {
+      if (slot.kind != HANDLE_FREE) freeSlotLocked(&slot);
+    }
   } else {
     // Disconnect through all the clients
-    for (int ii = 0; ii < sMax; ii++) {
-      if (mClients[ii] != NULL) {
-        if (mClients[ii]->mClientConn->mNfaConnHandle == NFA_HANDLE_INVALID) {
-          SyncEventGuard guard(mClients[ii]->mConnectingEvent);
-          mClients[ii]->mConnectingEvent.notifyOne();
+    for (const HandleSlot& slot : mHandleSlots) {
+      if (slot.kind == HANDLE_CLIENT) {
+        const sp<P2pClient>& client = slot.client;
+        if (client->mClientConn->mNfaConnHandle == NFA_HANDLE_INVALID) {
+          SyncEventGuard guard(client->mConnectingEvent);
+          client->mConnectingEvent.notifyAll();
         } else {
-          mClients[ii]->mClientConn->mNfaConnHandle = NFA_HANDLE_INVALID;
+          setConnNfaHandleLocked(client->mClientConn, NFA_HANDLE_INVALID);
           {
-            SyncEventGuard guard1(mClients[ii]->mClientConn->mCongEvent);
-            mClients[ii]
-                ->mClientConn->mCongEvent.notifyOne();  // unblock send()
+            SyncEventGuard guard1(client->mClientConn->mCongEvent);
+            client->mClientConn->mCongEvent.notifyAll();  // unblock send()
           }
           {
-            SyncEventGuard guard2(mClients[ii]->mClientConn->mReadEvent);
-            mClients[ii]
-                ->mClientConn->mReadEvent.notifyOne();  // unblock receive()
+            SyncEventGuard guard2(client->mClientConn->mReadEvent);
+            client->mClientConn->mReadEvent.notifyAll();  // unblock receive()
           }
         }
       }
     }  // loop
 
     // Now look through all the server control blocks
-    for (int ii = 0; ii < sMax; ii++) {
-      if (mServers[ii] != NULL) {
-        mServers[ii]->unblockAll();
+    for (const HandleSlot& slot : mHandleSlots) {
+      if (slot.kind == HANDLE_SERVER) {
+        // accept(), send() and receive() see the invalid handle once woken
+        for (const sp<NfaConn>& conn : slot.server->getConnections())
+          setConnNfaHandleLocked(conn, NFA_HANDLE_INVALID);
+        slot.server->unblockAll();
       }
     }  // loop
   }
   DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf("%s: exit", fn);
 }
 
+/*******************************************************************************
+**
+** Function:        dump
+**
+** Description:     Print the handles in use and how contended the lock
+**                  of the control path is.
+**                  fd: File descriptor to write to.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void PeerToPeer::dump(int fd) {
+  size_t counts[HANDLE_SERVER_CONN + 1] = {};
+  size_t numSlots = 0;
+  size_t numConns = 0;
+  size_t numConnected = 0;
+  std::vector<sp<P2pServer>> servers;
+  {
+    TimedMutex::Autolock mutex(mMutex);
+    numConns = mConnsByJniHandle.size();
+    numConnected = mConnsByNfaHandle.size();
+    for (const HandleSlot& slot : mHandleSlots) {
+      counts[slot.kind]++;
+      if (slot.kind == HANDLE_SERVER) servers.push_back(slot.server);
+    }
+    numSlots = mHandleSlots.size();
+  }
+  TimedMutex::Stats stats = mMutex.getStats();
+  uint64_t holdSamples = stats.holdSamples ? stats.holdSamples : 1;
+  uint64_t contended = stats.contended ? stats.contended : 1;
+
+  dprintf(fd, "LLCP:\n");
+  dprintf(fd, "  handle slots=%zu servers=%zu clients=%zu accepted=%zu\n",
+          numSlots, counts[HANDLE_SERVER], counts[HANDLE_CLIENT],
+          counts[HANDLE_SERVER_CONN]);
+  dprintf(fd, "  connections=%zu connected=%zu\n", numConns, numConnected);
+  dprintf(fd, "  lock: acquisitions=%llu contended=%llu\n",
+          (unsigned long long)stats.acquisitions,
+          (unsigned long long)stats.contended);
+  // the average wait is over the contended acquisitions only, the average
+  // hold over the sampled ones
+  dprintf(fd, "  lock: wait avg=%lluus max=%lluus hold avg=%lluus max=%lluus\n",
+          (unsigned long long)(stats.waitNs / contended / 1000),
+          (unsigned long long)(stats.maxWaitNs / 1000),
+          (unsigned long long)(stats.holdNs / holdSamples / 1000),
+          (unsigned long long)(stats.maxHoldNs / 1000));
+  for (const sp<P2pServer>& server : servers) server->dump(fd);
+  LlcpLinkTuner::getInstance().dump(fd);
+}
+
 /*******************************************************************************
 **
 ** Function:        nfaServerCallback
@@ -1237,9 +1648,9 @@ void PeerToPeer::nfaServerCallback(tNFA_P2P_EVT p2pEvent,
             "%s: NFA_P2P_REG_SERVER_EVT for unknown service: %s", fn,
             eventData->reg_server.service_name);
       } else {
-        SyncEventGuard guard(pSrv->mRegServerEvent);
         pSrv->mNfaP2pServerHandle = eventData->reg_server.server_handle;
-        pSrv->mRegServerEvent.notifyOne();  // unblock registerServer()
+        // unblock registerServer()
+        pSrv->mRegistered.complete(eventData->reg_server.server_handle);
       }
       break;
 
@@ -1273,22 +1684,7 @@ void PeerToPeer::nfaServerCallback(tNFA_P2P_EVT p2pEvent,
       DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
           "%s: NFA_P2P_CONN_REQ_EVT; server jni h=%u", fn, pSrv->mJniHandle);
 
-      // Look for a connection block that is waiting (handle invalid)
-      if ((pConn = pSrv->findServerConnection(
-               (tNFA_HANDLE)NFA_HANDLE_INVALID)) == NULL) {
-        LOG(ERROR) << StringPrintf(
-            "%s: NFA_P2P_CONN_REQ_EVT; server not listening", fn);
-      } else {
-        SyncEventGuard guard(pSrv->mConnRequestEvent);
-        pConn->mNfaConnHandle = eventData->conn_req.conn_handle;
-        pConn->mRemoteMaxInfoUnit = eventData->conn_req.remote_miu;
-        pConn->mRemoteRecvWindow = eventData->conn_req.remote_rw;
-        DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
-            "%s: NFA_P2P_CONN_REQ_EVT; server jni h=%u; conn jni "
-            "h=%u; notify conn req",
-            fn, pSrv->mJniHandle, pConn->mJniHandle);
-        pSrv->mConnRequestEvent.notifyOne();  // unblock accept()
-      }
+      sP2p.queueConnRequest(pSrv, eventData->conn_req);
       break;
 
     case NFA_P2P_CONNECTED_EVT:
@@ -1307,13 +1703,13 @@ void PeerToPeer::nfaServerCallback(tNFA_P2P_EVT p2pEvent,
             "%s: NFA_P2P_DISC_EVT: can't find conn for NFA handle: 0x%04x", fn,
             eventData->disc.handle);
       } else {
-        sP2p.mDisconnectMutex.lock();
-        pConn->mNfaConnHandle = NFA_HANDLE_INVALID;
+        pConn->mDisconnectMutex.lock();
+        sP2p.setConnNfaHandle(pConn, NFA_HANDLE_INVALID);
         {
           DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
               "%s: NFA_P2P_DISC_EVT; try guard disconn event", fn);
           SyncEventGuard guard3(pConn->mDisconnectingEvent);
-          pConn->mDisconnectingEvent.notifyOne();
+          pConn->mDisconnectingEvent.notifyAll();
           DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
               "%s: NFA_P2P_DISC_EVT; notified disconn event", fn);
         }
@@ -1321,7 +1717,7 @@ void PeerToPeer::nfaServerCallback(tNFA_P2P_EVT p2pEvent,
           DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
               "%s: NFA_P2P_DISC_EVT; try guard congest event", fn);
           SyncEventGuard guard1(pConn->mCongEvent);
-          pConn->mCongEvent.notifyOne();  // unblock write (if congested)
+          pConn->mCongEvent.notifyAll();  // unblock write (if congested)
           DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
               "%s: NFA_P2P_DISC_EVT; notified congest event", fn);
         }
@@ -1329,11 +1725,11 @@ void PeerToPeer::nfaServerCallback(tNFA_P2P_EVT p2pEvent,
           DLOG_IF(INFO, nfc_debug_enabled)
               << StringPrintf("%s: NFA_P2P_DISC_EVT; try guard read event", fn);
           SyncEventGuard guard2(pConn->mReadEvent);
-          pConn->mReadEvent.notifyOne();  // unblock receive()
+          pConn->mReadEvent.notifyAll();  // unblock receive()
           DLOG_IF(INFO, nfc_debug_enabled)
               << StringPrintf("%s: NFA_P2P_DISC_EVT; notified read event", fn);
         }
-        sP2p.mDisconnectMutex.unlock();
+        pConn->mDisconnectMutex.unlock();
       }
       break;
 
@@ -1348,6 +1744,7 @@ void PeerToPeer::nfaServerCallback(tNFA_P2P_EVT p2pEvent,
             << StringPrintf("%s: NFA_P2P_DATA_EVT; h=0x%X; remote sap=0x%X", fn,
                             eventData->data.handle, eventData->data.remote_sap);
         SyncEventGuard guard(pConn->mReadEvent);
+        pConn->mDataReady = true;
         pConn->mReadEvent.notifyOne();
       }
       break;
@@ -1364,7 +1761,9 @@ void PeerToPeer::nfaServerCallback(tNFA_P2P_EVT p2pEvent,
             eventData->congest.handle, eventData->congest.is_congested);
         if (eventData->congest.is_congested == FALSE) {
           SyncEventGuard guard(pConn->mCongEvent);
-          pConn->mCongEvent.notifyOne();
+          pConn->mCongested = false;
+          pConn->drainSendQueue();
+          pConn->mCongEvent.notifyAll();  // unblock send() and disconnect
         }
       }
       break;
@@ -1409,9 +1808,8 @@ void PeerToPeer::nfaClientCallback(tNFA_P2P_EVT p2pEvent,
             "%s: NFA_P2P_REG_CLIENT_EVT; Conn Handle: 0x%04x, pClient: 0x%p",
             fn, eventData->reg_client.client_handle, pClient.get());
 
-        SyncEventGuard guard(pClient->mRegisteringEvent);
         pClient->mNfaP2pClientHandle = eventData->reg_client.client_handle;
-        pClient->mRegisteringEvent.notifyOne();
+        pClient->mRegistered.complete(eventData->reg_client.client_handle);
       }
       break;
 
@@ -1448,8 +1846,9 @@ void PeerToPeer::nfaClientCallback(tNFA_P2P_EVT p2pEvent,
             eventData->connected.conn_handle, eventData->connected.remote_sap,
             pClient.get());
 
+        sP2p.setConnNfaHandle(pClient->mClientConn,
+                              eventData->connected.conn_handle);
         SyncEventGuard guard(pClient->mConnectingEvent);
-        pClient->mClientConn->mNfaConnHandle = eventData->connected.conn_handle;
         pClient->mClientConn->mRemoteMaxInfoUnit =
             eventData->connected.remote_miu;
         pClient->mClientConn->mRemoteRecvWindow =
@@ -1473,15 +1872,15 @@ void PeerToPeer::nfaClientCallback(tNFA_P2P_EVT p2pEvent,
         }
         // Unblock createDataLinkConn()
         SyncEventGuard guard(pClient->mConnectingEvent);
-        pClient->mConnectingEvent.notifyOne();
+        pClient->mConnectingEvent.notifyAll();
       } else {
-        sP2p.mDisconnectMutex.lock();
-        pConn->mNfaConnHandle = NFA_HANDLE_INVALID;
+        pConn->mDisconnectMutex.lock();
+        sP2p.setConnNfaHandle(pConn, NFA_HANDLE_INVALID);
         {
           DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
               "%s: NFA_P2P_DISC_EVT; try guard disconn event", fn);
           SyncEventGuard guard3(pConn->mDisconnectingEvent);
-          pConn->mDisconnectingEvent.notifyOne();
+          pConn->mDisconnectingEvent.notifyAll();
           DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
               "%s: NFA_P2P_DISC_EVT; notified disconn event", fn);
         }
@@ -1489,7 +1888,7 @@ void PeerToPeer::nfaClientCallback(tNFA_P2P_EVT p2pEvent,
           DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
               "%s: NFA_P2P_DISC_EVT; try guard congest event", fn);
           SyncEventGuard guard1(pConn->mCongEvent);
-          pConn->mCongEvent.notifyOne();  // unblock write (if congested)
+          pConn->mCongEvent.notifyAll();  // unblock write (if congested)
           DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
               "%s: NFA_P2P_DISC_EVT; notified congest event", fn);
         }
@@ -1497,11 +1896,11 @@ void PeerToPeer::nfaClientCallback(tNFA_P2P_EVT p2pEvent,
           DLOG_IF(INFO, nfc_debug_enabled)
               << StringPrintf("%s: NFA_P2P_DISC_EVT; try guard read event", fn);
           SyncEventGuard guard2(pConn->mReadEvent);
-          pConn->mReadEvent.notifyOne();  // unblock receive()
+          pConn->mReadEvent.notifyAll();  // unblock receive()
           DLOG_IF(INFO, nfc_debug_enabled)
               << StringPrintf("%s: NFA_P2P_DISC_EVT; notified read event", fn);
         }
-        sP2p.mDisconnectMutex.unlock();
+        pConn->mDisconnectMutex.unlock();
       }
       break;
 
@@ -1516,6 +1915,7 @@ void PeerToPeer::nfaClientCallback(tNFA_P2P_EVT p2pEvent,
             << StringPrintf("%s: NFA_P2P_DATA_EVT; h=0x%X; remote sap=0x%X", fn,
                             eventData->data.handle, eventData->data.remote_sap);
         SyncEventGuard guard(pConn->mReadEvent);
+        pConn->mDataReady = true;
         pConn->mReadEvent.notifyOne();
       }
       break;
@@ -1531,8 +1931,12 @@ void PeerToPeer::nfaClientCallback(tNFA_P2P_EVT p2pEvent,
             "%s: NFA_P2P_CONGEST_EVT; nfa handle: 0x%04x  congested: %u", fn,
             eventData->congest.handle, eventData->congest.is_congested);
 
-        SyncEventGuard guard(pConn->mCongEvent);
-        pConn->mCongEvent.notifyOne();
+        if (eventData->congest.is_congested == FALSE) {
+          SyncEventGuard guard(pConn->mCongEvent);
+          pConn->mCongested = false;
+          pConn->drainSendQueue();
+          pConn->mCongEvent.notifyAll();  // unblock send() and disconnect
+        }
       }
       break;
 
@@ -1564,24 +1968,6 @@ void PeerToPeer::connectionEventHandler(uint8_t event,
   }
 }
 
-/*******************************************************************************
-**
-** Function:        getNextJniHandle
-**
-** Description:     Get a new JNI handle.
-**
-** Returns:         A new JNI handle.
-**
-*******************************************************************************/
-PeerToPeer::tJNI_HANDLE PeerToPeer::getNewJniHandle() {
-  tJNI_HANDLE newHandle = 0;
-
-  mNewJniHandleMutex.lock();
-  newHandle = mNextJniHandle++;
-  mNewJniHandleMutex.unlock();
-  return newHandle;
-}
-
 /////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////
 
@@ -1590,15 +1976,30 @@ PeerToPeer::tJNI_HANDLE PeerToPeer::getNewJniHandle() {
 ** Function:        P2pServer
 **
 ** Description:     Initialize member variables.
+**                  jniHandle: JNI handle of the server.
+**                  serviceName: Service name.
+**                  backlogDepth: Connections queued until Java accepts
+**                  them.
+**                  maxInfoUnit: Largest MIU of accepted connections.
+**                  recvWindow: Largest receive window of accepted
+**                  connections.
 **
 ** Returns:         None
 **
 *******************************************************************************/
-P2pServer::P2pServer(PeerToPeer::tJNI_HANDLE jniHandle, const char* serviceName)
-    : mNfaP2pServerHandle(NFA_HANDLE_INVALID), mJniHandle(jniHandle) {
+P2pServer::P2pServer(PeerToPeer::tJNI_HANDLE jniHandle, const char* serviceName,
+                     size_t backlogDepth, uint16_t maxInfoUnit,
+                     uint8_t recvWindow)
+    : mNfaP2pServerHandle(NFA_HANDLE_INVALID),
+      mJniHandle(jniHandle),
+      mBacklogDepth(backlogDepth),
+      mMaxInfoUnit(std::min<uint16_t>(maxInfoUnit, LLCP_MIU)),
+      mRecvWindow(recvWindow),
+      mStopped(false),
+      mRejected(0) {
   mServiceName.assign(serviceName);
-
-  memset(mServerConn, 0, sizeof(mServerConn));
+  mFreeConns.reserve(backlogDepth);
+  refillFreeConnectionsLocked();  // nothing else can see this server yet
 }
 
 bool P2pServer::registerWithStack() {
@@ -1637,78 +2038,67 @@ bool P2pServer::registerWithStack() {
   if (sSnepServiceName.compare(mServiceName) == 0)
     serverSap = 4;  // LLCP_SAP_SNEP == 4
 
-  {
-    SyncEventGuard guard(mRegServerEvent);
-    stat = NFA_P2pRegisterServer(serverSap, NFA_P2P_DLINK_TYPE,
-                                 const_cast<char*>(mServiceName.c_str()),
-                                 PeerToPeer::nfaServerCallback);
-    if (stat != NFA_STATUS_OK) {
-      LOG(ERROR) << StringPrintf("%s: fail register p2p server; error=0x%X", fn,
-                                 stat);
-      return (false);
-    }
-    DLOG_IF(INFO, nfc_debug_enabled)
-        << StringPrintf("%s: wait for listen-completion event", fn);
-    // Wait for NFA_P2P_REG_SERVER_EVT
-    mRegServerEvent.wait();
+  tNFA_HANDLE serverHandle = NFA_HANDLE_INVALID;
+  mRegistered.start();
+  stat = NFA_P2pRegisterServer(serverSap, NFA_P2P_DLINK_TYPE,
+                               const_cast<char*>(mServiceName.c_str()),
+                               PeerToPeer::nfaServerCallback);
+  if (stat != NFA_STATUS_OK) {
+    LOG(ERROR) << StringPrintf("%s: fail register p2p server; error=0x%X", fn,
+                               stat);
+    mRegistered.cancel();
+    return (false);
   }
+  DLOG_IF(INFO, nfc_debug_enabled)
+      << StringPrintf("%s: wait for listen-completion event", fn);
+  // Wait for NFA_P2P_REG_SERVER_EVT
+  mRegistered.wait(&serverHandle);
 
-  return (mNfaP2pServerHandle != NFA_HANDLE_INVALID);
+  return (serverHandle != NFA_HANDLE_INVALID);
 }
 
 bool P2pServer::accept(PeerToPeer::tJNI_HANDLE serverJniHandle,
                        PeerToPeer::tJNI_HANDLE connJniHandle, int maxInfoUnit,
                        int recvWindow) {
   static const char fn[] = "P2pServer::accept";
-  tNFA_STATUS nfaStat = NFA_STATUS_OK;
+  sp<NfaConn> connection = NULL;
 
-  sp<NfaConn> connection = allocateConnection(connJniHandle);
-  if (connection == NULL) {
-    LOG(ERROR) << StringPrintf("%s: failed to allocate new server connection",
-                               fn);
-    return false;
+  if (maxInfoUnit > (int)LLCP_MIU) {
+    DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
+        "%s: overriding the miu passed by the app(%d) with stack miu(%zu)", fn,
+        maxInfoUnit, LLCP_MIU);
+    maxInfoUnit = LLCP_MIU;
   }
 
   {
-    // Wait for NFA_P2P_CONN_REQ_EVT or NFA_NDEF_DATA_EVT when remote device
-    // requests connection
+    // Wait for queueConnRequest() if no connection is queued yet
     SyncEventGuard guard(mConnRequestEvent);
-    DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
-        "%s: serverJniHandle: %u; connJniHandle: %u; wait for "
-        "incoming connection",
-        fn, serverJniHandle, connJniHandle);
-    mConnRequestEvent.wait();
-    DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
-        "%s: serverJniHandle: %u; connJniHandle: %u; nfa conn h: 0x%X; got "
-        "incoming connection",
-        fn, serverJniHandle, connJniHandle, connection->mNfaConnHandle);
+    mMaxInfoUnit = (uint16_t)maxInfoUnit;
+    mRecvWindow = (uint8_t)recvWindow;
+    while (connection == NULL) {
+      DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
+          "%s: serverJniHandle: %u; connJniHandle: %u; backlog: %zu", fn,
+          serverJniHandle, connJniHandle, mBacklog.size());
+      while (mBacklog.empty() && !mStopped) mConnRequestEvent.wait();
+      if (mBacklog.empty()) break;
+      connection = mBacklog.front();
+      mBacklog.pop_front();
+      refillFreeConnectionsLocked();
+      // the peer may have gone while the connection was queued
+      if (connection->mNfaConnHandle == NFA_HANDLE_INVALID) connection = NULL;
+    }
   }
 
-  if (connection->mNfaConnHandle == NFA_HANDLE_INVALID) {
-    removeServerConnection(connJniHandle);
+  if (connection == NULL) {
     DLOG_IF(INFO, nfc_debug_enabled)
-        << StringPrintf("%s: no handle assigned", fn);
+        << StringPrintf("%s: server closed", fn);
     return (false);
   }
 
-  if (maxInfoUnit > (int)LLCP_MIU) {
-    DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
-        "%s: overriding the miu passed by the app(%d) with stack miu(%zu)", fn,
-        maxInfoUnit, LLCP_MIU);
-    maxInfoUnit = LLCP_MIU;
-  }
-
-  DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
-      "%s: serverJniHandle: %u; connJniHandle: %u; nfa conn h: 0x%X; try "
-      "accept",
-      fn, serverJniHandle, connJniHandle, connection->mNfaConnHandle);
-  nfaStat =
-      NFA_P2pAcceptConn(connection->mNfaConnHandle, maxInfoUnit, recvWindow);
-
-  if (nfaStat != NFA_STATUS_OK) {
-    LOG(ERROR) << StringPrintf("%s: fail to accept remote; error=0x%X", fn,
-                               nfaStat);
-    return (false);
+  connection->mJniHandle = connJniHandle;
+  {
+    AutoMutex mutex(mMutex);
+    mServerConn.push_back(connection);
   }
 
   DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
@@ -1719,34 +2109,134 @@ bool P2pServer::accept(PeerToPeer::tJNI_HANDLE serverJniHandle,
 
 void P2pServer::unblockAll() {
   AutoMutex mutex(mMutex);
-  for (int jj = 0; jj < MAX_NFA_CONNS_PER_SERVER; jj++) {
-    if (mServerConn[jj] != NULL) {
-      mServerConn[jj]->mNfaConnHandle = NFA_HANDLE_INVALID;
-      {
-        SyncEventGuard guard1(mServerConn[jj]->mCongEvent);
-        mServerConn[jj]
-            ->mCongEvent.notifyOne();  // unblock write (if congested)
-      }
-      {
-        SyncEventGuard guard2(mServerConn[jj]->mReadEvent);
-        mServerConn[jj]->mReadEvent.notifyOne();  // unblock receive()
-      }
+  for (const sp<NfaConn>& conn : mServerConn) {
+    {
+      SyncEventGuard guard1(conn->mCongEvent);
+      conn->mCongEvent.notifyAll();  // unblock write (if congested)
+    }
+    {
+      SyncEventGuard guard2(conn->mReadEvent);
+      conn->mReadEvent.notifyAll();  // unblock receive()
     }
   }
 }
 
-sp<NfaConn> P2pServer::allocateConnection(PeerToPeer::tJNI_HANDLE jniHandle) {
-  AutoMutex mutex(mMutex);
-  // First, find a free connection block to handle the connection
-  for (int ii = 0; ii < MAX_NFA_CONNS_PER_SERVER; ii++) {
-    if (mServerConn[ii] == NULL) {
-      mServerConn[ii] = new NfaConn;
-      mServerConn[ii]->mJniHandle = jniHandle;
-      return mServerConn[ii];
-    }
+/*******************************************************************************
+**
+** Function:        refillFreeConnectionsLocked
+**
+** Description:     Preallocate connections for the free part of the
+**                  backlog.  Assumes mConnRequestEvent is held.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void P2pServer::refillFreeConnectionsLocked() {
+  while (mFreeConns.size() + mBacklog.size() < mBacklogDepth)
+    mFreeConns.push_back(new NfaConn);
+}
+
+/*******************************************************************************
+**
+** Function:        takeFreeConnection
+**
+** Description:     Take a preallocated connection for a peer's request.
+**                  maxInfoUnit: Receives the largest MIU to accept with.
+**                  recvWindow: Receives the largest receive window to
+**                  accept with.
+**
+** Returns:         Connection, or NULL if the backlog is full or the
+**                  server is closed.
+**
+*******************************************************************************/
+sp<NfaConn> P2pServer::takeFreeConnection(uint16_t& maxInfoUnit,
+                                          uint8_t& recvWindow) {
+  SyncEventGuard guard(mConnRequestEvent);
+  if (mStopped || mFreeConns.empty()) {
+    mRejected++;
+    return (NULL);
+  }
+  sp<NfaConn> conn = mFreeConns.back();
+  mFreeConns.pop_back();
+  maxInfoUnit = mMaxInfoUnit;
+  recvWindow = mRecvWindow;
+  return conn;
+}
+
+/*******************************************************************************
+**
+** Function:        addToBacklog
+**
+** Description:     Queue a connection the stack accepted for accept().
+**                  conn: Connection from takeFreeConnection().
+**
+** Returns:         False if the server was closed in the meantime.
+**
+*******************************************************************************/
+bool P2pServer::addToBacklog(const sp<NfaConn>& conn) {
+  SyncEventGuard guard(mConnRequestEvent);
+  if (mStopped) return (false);
+  mBacklog.push_back(conn);
+  mConnRequestEvent.notifyOne();  // unblock accept()
+  return (true);
+}
+
+/*******************************************************************************
+**
+** Function:        getConnections
+**
+** Description:     Get the connections of the backlog and the accepted
+**                  ones.
+**
+** Returns:         Connections of the server.
+**
+*******************************************************************************/
+std::vector<sp<NfaConn>> P2pServer::getConnections() {
+  std::vector<sp<NfaConn>> conns;
+  {
+    SyncEventGuard guard(mConnRequestEvent);
+    conns.assign(mBacklog.begin(), mBacklog.end());
   }
+  AutoMutex mutex(mMutex);
+  conns.insert(conns.end(), mServerConn.begin(), mServerConn.end());
+  return conns;
+}
 
-  return NULL;
+/*******************************************************************************
+**
+** Function:        stopAccepting
+**
+** Description:     Unblock accept() for good and empty the backlog.
+**
+** Returns:         Connections of the backlog, for the caller to
+**                  disconnect.
+**
+*******************************************************************************/
+std::vector<sp<NfaConn>> P2pServer::stopAccepting() {
+  SyncEventGuard guard(mConnRequestEvent);
+  mStopped = true;
+  std::vector<sp<NfaConn>> backlog(mBacklog.begin(), mBacklog.end());
+  mBacklog.clear();
+  mFreeConns.clear();
+  mConnRequestEvent.notifyAll();
+  return backlog;
+}
+
+/*******************************************************************************
+**
+** Function:        dump
+**
+** Description:     Print the backlog of the server.
+**                  fd: file descriptor to write to.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void P2pServer::dump(int fd) {
+  SyncEventGuard guard(mConnRequestEvent);
+  dprintf(fd, "  server %s: backlog=%zu/%zu free=%zu rejected=%u\n",
+          mServiceName.c_str(), mBacklog.size(), mBacklogDepth,
+          mFreeConns.size(), mRejected);
 }
 
 /*******************************************************************************
@@ -1760,13 +2250,9 @@ sp<NfaConn> P2pServer::allocateConnection(PeerToPeer::tJNI_HANDLE jniHandle) {
 **
 *******************************************************************************/
 sp<NfaConn> P2pServer::findServerConnection(tNFA_HANDLE nfaConnHandle) {
-  int jj = 0;
-
   AutoMutex mutex(mMutex);
-  for (jj = 0; jj < MAX_NFA_CONNS_PER_SERVER; jj++) {
-    if ((mServerConn[jj] != NULL) &&
-        (mServerConn[jj]->mNfaConnHandle == nfaConnHandle))
-      return (mServerConn[jj]);
+  for (const sp<NfaConn>& conn : mServerConn) {
+    if (conn->mNfaConnHandle == nfaConnHandle) return (conn);
   }
 
   // If here, not found
@@ -1784,12 +2270,9 @@ sp<NfaConn> P2pServer::findServerConnection(tNFA_HANDLE nfaConnHandle) {
 **
 *******************************************************************************/
 sp<NfaConn> P2pServer::findServerConnection(PeerToPeer::tJNI_HANDLE jniHandle) {
-  int jj = 0;
-
   AutoMutex mutex(mMutex);
-  for (jj = 0; jj < MAX_NFA_CONNS_PER_SERVER; jj++) {
-    if ((mServerConn[jj] != NULL) && (mServerConn[jj]->mJniHandle == jniHandle))
-      return (mServerConn[jj]);
+  for (const sp<NfaConn>& conn : mServerConn) {
+    if (conn->mJniHandle == jniHandle) return (conn);
   }
 
   // If here, not found
@@ -1807,13 +2290,10 @@ sp<NfaConn> P2pServer::findServerConnection(PeerToPeer::tJNI_HANDLE jniHandle) {
 **
 *******************************************************************************/
 bool P2pServer::removeServerConnection(PeerToPeer::tJNI_HANDLE jniHandle) {
-  int jj = 0;
-
   AutoMutex mutex(mMutex);
-  for (jj = 0; jj < MAX_NFA_CONNS_PER_SERVER; jj++) {
-    if ((mServerConn[jj] != NULL) &&
-        (mServerConn[jj]->mJniHandle == jniHandle)) {
-      mServerConn[jj] = NULL;
+  for (auto it = mServerConn.begin(); it != mServerConn.end(); ++it) {
+    if ((*it)->mJniHandle == jniHandle) {
+      mServerConn.erase(it);
       return true;
     }
   }
@@ -1867,4 +2347,79 @@ NfaConn::NfaConn()
       mMaxInfoUnit(0),
       mRecvWindow(0),
       mRemoteMaxInfoUnit(0),
-      mRemoteRecvWindow(0) {}
+      mRemoteRecvWindow(0),
+      mDataReady(false),
+      mSendQueueOffset(0),
+      mSendQueueBytes(0),
+      mCongested(false),
+      mSendFailed(false),
+      mLinkParams(),
+      mTuned(false) {}
+
+/*******************************************************************************
+**
+** Function:        sendSegments
+**
+** Description:     Hand data to the stack in I-PDUs of at most the remote
+**                  MIU, until it is all sent or the stack is congested.
+**                  Assumes mCongEvent is held.
+**                  data: Data to send.
+**                  len: Length of data.
+**
+** Returns:         Number of bytes the stack took.
+**
+*******************************************************************************/
+size_t NfaConn::sendSegments(uint8_t* data, size_t len) {
+  size_t sent = 0;
+  while (sent < len) {
+    size_t segment = len - sent;
+    if ((mRemoteMaxInfoUnit > 0) && (segment > mRemoteMaxInfoUnit))
+      segment = mRemoteMaxInfoUnit;
+    tNFA_STATUS stat =
+        NFA_P2pSendData(mNfaConnHandle, (uint16_t)segment, data + sent);
+    if (stat == NFA_STATUS_CONGESTED) {
+      mCongested = true;
+      mMeter.addCongestion();
+      break;
+    } else if (stat != NFA_STATUS_OK) {
+      LOG(ERROR) << StringPrintf(
+          "NfaConn::sendSegments: NFA Handle: 0x%04x  error: 0x%04x",
+          mNfaConnHandle, stat);
+      mSendFailed = true;
+      break;
+    }
+    sent += segment;
+    mMeter.addTraffic(segment);
+  }
+  return sent;
+}
+
+/*******************************************************************************
+**
+** Function:        drainSendQueue
+**
+** Description:     Send queued data until the queue is empty or the stack
+**                  is congested.  Assumes mCongEvent is held.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void NfaConn::drainSendQueue() {
+  while (!mSendQueue.empty() && !mCongested && !mSendFailed &&
+         (mNfaConnHandle != NFA_HANDLE_INVALID)) {
+    std::vector<uint8_t>& front = mSendQueue.front();
+    size_t sent = sendSegments(&front[mSendQueueOffset],
+                               front.size() - mSendQueueOffset);
+    mSendQueueOffset += sent;
+    mSendQueueBytes -= sent;
+    if (mSendQueueOffset == front.size()) {
+      mSendQueue.pop_front();
+      mSendQueueOffset = 0;
+    }
+  }
+  if (mSendFailed) {
+    mSendQueue.clear();
+    mSendQueueOffset = 0;
+    mSendQueueBytes = 0;
+  }
+}
@@ -20,7 +20,12 @@
 #pragma once
 #include <utils/RefBase.h>
 #include <utils/StrongPointer.h>
+#include <deque>
 #include <string>
+#include <unordered_map>
+#include <vector>
+#include "Completion.h"
+#include "LlcpLinkTuner.h"
 #include "NfcJniUtil.h"
 #include "SyncEvent.h"
 #include "nfa_p2p_api.h"
@@ -28,7 +33,6 @@
 class P2pServer;
 class P2pClient;
 class NfaConn;
-#define MAX_NFA_CONNS_PER_SERVER 5
 
 /*****************************************************************************
 **
@@ -136,11 +140,15 @@ class PeerToPeer {
   *request.
   **                  jniHandle: Connection handle.
   **                  serviceName: Server's service name.
+  **                  maxInfoUnit: Largest MIU of accepted connections.
+  **                  recvWindow: Largest receive window of accepted
+  **                  connections.
   **
   ** Returns:         True if ok.
   **
   *******************************************************************************/
-  bool registerServer(tJNI_HANDLE jniHandle, const char* serviceName);
+  bool registerServer(tJNI_HANDLE jniHandle, const char* serviceName,
+                      uint16_t maxInfoUnit, uint8_t recvWindow);
 
   /*******************************************************************************
   **
@@ -157,17 +165,22 @@ class PeerToPeer {
   **
   ** Function:        accept
   **
-  ** Description:     Accept a peer's request to connect.
+  ** Description:     Accept a peer's request to connect.  The request was
+  **                  accepted on the stack when it arrived, so the MIU and
+  **                  receive window passed in only bound the connections
+  **                  the server accepts from now on.
   **                  serverJniHandle: Server's handle.
   **                  connJniHandle: Connection handle.
-  **                  maxInfoUnit: Maximum information unit.
-  **                  recvWindow: Receive window size.
+  **                  maxInfoUnit: Maximum information unit; receives the
+  **                  one of the accepted connection.
+  **                  recvWindow: Receive window size; receives the one of
+  **                  the accepted connection.
   **
   ** Returns:         True if ok.
   **
   *******************************************************************************/
   bool accept(tJNI_HANDLE serverJniHandle, tJNI_HANDLE connJniHandle,
-              int maxInfoUnit, int recvWindow);
+              int& maxInfoUnit, int& recvWindow);
 
   /*******************************************************************************
   **
@@ -213,12 +226,17 @@ class PeerToPeer {
   **
   ** Function:        send
   **
-  ** Description:     Send data to peer.
+  ** Description:     Send data to peer.  What the stack does not take at
+  **                  once is queued on the connection, and the call only
+  **                  blocks while that queue is full.  True means only
+  **                  that the stack took the data or it was queued; if the
+  **                  stack later refuses queued data, the next send() and
+  **                  disconnectConnOriented() return false.
   **                  jniHandle: Handle of connection.
   **                  buffer: Buffer of data.
   **                  bufferLen: Length of data.
   **
-  ** Returns:         True if ok.
+  ** Returns:         True if the data was sent or queued.
   **
   *******************************************************************************/
   bool send(tJNI_HANDLE jniHandle, uint8_t* buffer, uint16_t bufferLen);
@@ -241,14 +259,36 @@ class PeerToPeer {
 
   /*******************************************************************************
   **
-  ** Function:        disconnectConnOriented
+  ** Function:        receiveBatch
   **
-  ** Description:     Disconnect a connection-oriented connection with peer.
+  ** Description:     Receive data from peer like receive(), then keep reading
+  **                  the PDUs that are already available while a whole PDU
+  **                  of the local MIU still fits in the buffer.
   **                  jniHandle: Handle of connection.
+  **                  buffer: Buffer to store data, PDUs back to back.
+  **                  bufferLen: Max length of buffer.
+  **                  pduLens: Receives the length of each PDU.
+  **                  maxPdus: Number of entries of pduLens.
+  **                  numPdus: Receives the number of PDUs read.
   **
   ** Returns:         True if ok.
   **
   *******************************************************************************/
+  bool receiveBatch(tJNI_HANDLE jniHandle, uint8_t* buffer, uint32_t bufferLen,
+                    uint16_t* pduLens, size_t maxPdus, size_t& numPdus);
+
+  /*******************************************************************************
+  **
+  ** Function:        disconnectConnOriented
+  **
+  ** Description:     Disconnect a connection-oriented connection with peer,
+  **                  after giving queued data a chance to go out.
+  **                  jniHandle: Handle of connection.
+  **
+  ** Returns:         True if ok; false also if data accepted by send() was
+  **                  not sent.
+  **
+  *******************************************************************************/
   bool disconnectConnOriented(tJNI_HANDLE jniHandle);
 
   /*******************************************************************************
@@ -335,14 +375,29 @@ class PeerToPeer {
 
   /*******************************************************************************
   **
-  ** Function:        getNextJniHandle
+  ** Function:        dump
   **
-  ** Description:     Get a new JNI handle.
+  ** Description:     Print the handles in use and how contended the lock
+  **                  of the control path is.
+  **                  fd: File descriptor to write to.
   **
-  ** Returns:         A new JNI handle.
+  ** Returns:         None
   **
   *******************************************************************************/
-  tJNI_HANDLE getNewJniHandle();
+  void dump(int fd);
+
+  /*******************************************************************************
+  **
+  ** Function:        allocJniHandle
+  **
+  ** Description:     Reserve a JNI handle for a new server, client or
+  **                  accepted connection.  The handle is freed when that
+  **                  object is removed, or when creating it fails.
+  **
+  ** Returns:         A new JNI handle, or 0 if every handle is in use.
+  **
+  *******************************************************************************/
+  tJNI_HANDLE allocJniHandle();
 
   /*******************************************************************************
   **
@@ -373,23 +428,52 @@ class PeerToPeer {
                                 tNFA_P2P_EVT_DATA* eventData);
 
  private:
-  static const int sMax = 10;
   static PeerToPeer sP2p;
 
+  // A JNI handle is the index of its slot in mHandleSlots plus one in the
+  // low bits, and the generation of the slot above them.  Freeing a slot
+  // bumps its generation, so a handle Java still holds for a closed socket
+  // does not reach whatever reuses the slot.
+  static const uint32_t HANDLE_INDEX_BITS = 16;
+  static const uint32_t MAX_HANDLE_SLOTS = (1 << HANDLE_INDEX_BITS) - 1;
+  enum HandleKind {
+    HANDLE_FREE,
+    HANDLE_RESERVED,  // allocated, not yet bound to an object
+    HANDLE_SERVER,
+    HANDLE_CLIENT,
+    HANDLE_SERVER_CONN,
+  };
+  struct HandleSlot {
+    HandleKind kind;
+    uint16_t generation;
+    uint32_t nextFree;  // next slot of the free list
+    // the server itself, or the server that accepted conn
+    android::sp<P2pServer> server;
+    android::sp<P2pClient> client;
+    android::sp<NfaConn> conn;  // of the client, or accepted by server
+  };
+
   // Variables below only accessed from a single thread
   uint16_t mRemoteWKS;   // Peer's well known services
   bool mIsP2pListening;  // If P2P listening is enabled or not
   tNFA_TECHNOLOGY_MASK mP2pListenTechMask;  // P2P Listen mask
-
-  // Variable below is protected by mNewJniHandleMutex
-  tJNI_HANDLE mNextJniHandle;
+  size_t mAcceptBacklog;  // connections a server queues for Java
 
   // Variables below protected by mMutex
   // A note on locking order: mMutex in PeerToPeer is *ALWAYS*
-  // locked before any locks / guards in P2pServer / P2pClient
-  Mutex mMutex;
-  android::sp<P2pServer> mServers[sMax];
-  android::sp<P2pClient> mClients[sMax];
+  // locked before any locks / guards in P2pServer / P2pClient, and after
+  // NfaConn::mDisconnectMutex
+
+  // Connections by handle, for the data path.  A lookup holds mMutex for
+  // a hash lookup only; see benchmarks/ConnLookupBenchmark.cpp.
+  // A connection is in mConnsByNfaHandle only while its NFA handle is
+  // valid.
+  std::unordered_map<tNFA_HANDLE, android::sp<NfaConn>> mConnsByNfaHandle;
+  std::unordered_map<tJNI_HANDLE, android::sp<NfaConn>> mConnsByJniHandle;
+  TimedMutex mMutex;
+  // Every server, client and connection, by JNI handle
+  std::vector<HandleSlot> mHandleSlots;
+  uint32_t mFreeHandleSlot;  // head of the free list, or MAX_HANDLE_SLOTS
 
   // Synchronization variables
   SyncEvent mSetTechEvent;  // completion event for NFA_SetP2pListenTech()
@@ -398,8 +482,6 @@ class PeerToPeer {
                                                // NFA_SnepStopDefaultServer()
   SyncEvent
       mSnepRegisterEvent;    // completion event for NFA_SnepRegisterClient()
-  Mutex mDisconnectMutex;    // synchronize the disconnect operation
-  Mutex mNewJniHandleMutex;  // synchronize the creation of a new JNI handle
 
   /*******************************************************************************
   **
@@ -451,6 +533,46 @@ class PeerToPeer {
   *******************************************************************************/
   android::sp<P2pServer> findServerLocked(const char* serviceName);
 
+  /*******************************************************************************
+  **
+  ** Function:        findSlotLocked
+  **
+  ** Description:     Find the slot of a JNI handle.
+  **                  Assumes mMutex is already held.
+  **                  jniHandle: JNI handle.
+  **
+  ** Returns:         Slot, or NULL if the handle is not allocated.
+  **
+  *******************************************************************************/
+  HandleSlot* findSlotLocked(tJNI_HANDLE jniHandle);
+
+  /*******************************************************************************
+  **
+  ** Function:        freeSlotLocked
+  **
+  ** Description:     Release a slot and the objects it holds, so that its
+  **                  handle is no longer valid.
+  **                  Assumes mMutex is already held.
+  **                  slot: Slot to release.
+  **
+  ** Returns:         None
+  **
+  *******************************************************************************/
+  void freeSlotLocked(HandleSlot* slot);
+
+  /*******************************************************************************
+  **
+  ** Function:        freeJniHandle
+  **
+  ** Description:     Release a JNI handle that is still reserved, because
+  **                  the object it was allocated for could not be created.
+  **                  jniHandle: JNI handle.
+  **
+  ** Returns:         None
+  **
+  *******************************************************************************/
+  void freeJniHandle(tJNI_HANDLE jniHandle);
+
   /*******************************************************************************
   **
   ** Function:        removeServer
@@ -475,6 +597,67 @@ class PeerToPeer {
   *******************************************************************************/
   void removeConn(tJNI_HANDLE jniHandle);
 
+  /*******************************************************************************
+  **
+  ** Function:        addConnection
+  **
+  ** Description:     Bind the JNI handle of a connection accepted by a
+  **                  server to that connection.
+  **                  server: Server that accepted the connection.
+  **                  conn: Accepted connection.
+  **
+  ** Returns:         True if the handle was still reserved.
+  **
+  *******************************************************************************/
+  bool addConnection(const android::sp<P2pServer>& server,
+                     const android::sp<NfaConn>& conn);
+
+  /*******************************************************************************
+  **
+  ** Function:        setConnNfaHandle
+  **
+  ** Description:     Assign an NFA handle to a connection, or invalidate it,
+  **                  and keep the lookup by NFA handle up to date.
+  **                  conn: Connection of a server or client.
+  **                  nfaConnHandle: New NFA handle, or NFA_HANDLE_INVALID.
+  **
+  ** Returns:         None
+  **
+  *******************************************************************************/
+  void setConnNfaHandle(const android::sp<NfaConn>& conn,
+                        tNFA_HANDLE nfaConnHandle);
+
+  /*******************************************************************************
+  **
+  ** Function:        setConnNfaHandleLocked
+  **
+  ** Description:     Same as setConnNfaHandle().  Assumes mMutex is already
+  **                  held.
+  **                  conn: Connection of a server or client.
+  **                  nfaConnHandle: New NFA handle, or NFA_HANDLE_INVALID.
+  **
+  ** Returns:         None
+  **
+  *******************************************************************************/
+  void setConnNfaHandleLocked(const android::sp<NfaConn>& conn,
+                              tNFA_HANDLE nfaConnHandle);
+
+  /*******************************************************************************
+  **
+  ** Function:        queueConnRequest
+  **
+  ** Description:     Accept a peer's request to connect to a server on
+  **                  the stack right away, and queue the connection until
+  **                  Java accepts it; reject it if the backlog is full.
+  **                  server: Server the request is for.
+  **                  request: Event data of NFA_P2P_CONN_REQ_EVT.
+  **
+  ** Returns:         None
+  **
+  *******************************************************************************/
+  void queueConnRequest(const android::sp<P2pServer>& server,
+                        const tNFA_P2P_CONN_REQ& request);
+
   /*******************************************************************************
   **
   ** Function:        createDataLinkConn
@@ -569,6 +752,26 @@ class NfaConn : public android::RefBase {
   SyncEvent mReadEvent;           // event for reading
   SyncEvent mCongEvent;           // event for congestion
   SyncEvent mDisconnectingEvent;  // event for disconnecting
+  // Set by NFA_P2P_DATA_EVT, cleared when receive() wakes; protected by
+  // mReadEvent
+  bool mDataReady;
+  // Serializes removal of the connection with NFA_P2P_DISC_EVT
+  Mutex mDisconnectMutex;
+
+  // Data send() could not hand to the stack yet, protected by mCongEvent.
+  // The stack is congested while the remote receive window is full, and
+  // the queue drains on NFA_P2P_CONGEST_EVT.
+  std::deque<std::vector<uint8_t>> mSendQueue;
+  size_t mSendQueueOffset;  // bytes of the front buffer already sent
+  size_t mSendQueueBytes;   // bytes not yet sent
+  bool mCongested;
+  bool mSendFailed;
+
+  // Local MIU and receive window chosen by LlcpLinkTuner, and the traffic
+  // they carried; mTuned is false if the connection never got that far.
+  LlcpLinkTuner::Params mLinkParams;
+  LlcpLinkTuner::Meter mMeter;
+  bool mTuned;
 
   /*******************************************************************************
   **
@@ -580,6 +783,33 @@ class NfaConn : public android::RefBase {
   **
   *******************************************************************************/
   NfaConn();
+
+  /*******************************************************************************
+  **
+  ** Function:        sendSegments
+  **
+  ** Description:     Hand data to the stack in I-PDUs of at most the remote
+  **                  MIU, until it is all sent or the stack is congested.
+  **                  Assumes mCongEvent is held.
+  **                  data: Data to send.
+  **                  len: Length of data.
+  **
+  ** Returns:         Number of bytes the stack took.
+  **
+  *******************************************************************************/
+  size_t sendSegments(uint8_t* data, size_t len);
+
+  /*******************************************************************************
+  **
+  ** Function:        drainSendQueue
+  **
+  ** Description:     Send queued data until the queue is empty or the stack
+  **                  is congested.  Assumes mCongEvent is held.
+  **
+  ** Returns:         None
+  **
+  *******************************************************************************/
+  void drainSendQueue();
 };
 
 /*****************************************************************************
@@ -595,7 +825,7 @@ class P2pServer : public android::RefBase {
 
   tNFA_HANDLE mNfaP2pServerHandle;     // NFA p2p handle of local server
   PeerToPeer::tJNI_HANDLE mJniHandle;  // JNI Handle
-  SyncEvent mRegServerEvent;           // for NFA_P2pRegisterServer()
+  Completion<tNFA_HANDLE> mRegistered;  // for NFA_P2pRegisterServer()
   SyncEvent mConnRequestEvent;         // for accept()
   std::string mServiceName;
 
@@ -604,11 +834,19 @@ class P2pServer : public android::RefBase {
   ** Function:        P2pServer
   **
   ** Description:     Initialize member variables.
+  **                  jniHandle: JNI handle of the server.
+  **                  serviceName: Service name.
+  **                  backlogDepth: Connections queued until Java accepts
+  **                  them.
+  **                  maxInfoUnit: Largest MIU of accepted connections.
+  **                  recvWindow: Largest receive window of accepted
+  **                  connections.
   **
   ** Returns:         None
   **
   *******************************************************************************/
-  P2pServer(PeerToPeer::tJNI_HANDLE jniHandle, const char* serviceName);
+  P2pServer(PeerToPeer::tJNI_HANDLE jniHandle, const char* serviceName,
+            size_t backlogDepth, uint16_t maxInfoUnit, uint8_t recvWindow);
 
   /*******************************************************************************
   **
@@ -625,11 +863,14 @@ class P2pServer : public android::RefBase {
   **
   ** Function:        accept
   **
-  ** Description:     Accept a peer's request to connect.
+  ** Description:     Take the oldest connection of the backlog, waiting for
+  **                  one if it is empty.
   **                  serverJniHandle: Server's handle.
   **                  connJniHandle: Connection handle.
-  **                  maxInfoUnit: Maximum information unit.
-  **                  recvWindow: Receive window size.
+  **                  maxInfoUnit: Maximum information unit of the
+  **                  connections accepted from now on.
+  **                  recvWindow: Receive window size of the connections
+  **                  accepted from now on.
   **
   ** Returns:         True if ok.
   **
@@ -642,7 +883,8 @@ class P2pServer : public android::RefBase {
   **
   ** Function:        unblockAll
   **
-  ** Description:     Unblocks all server connections
+  ** Description:     Unblocks all server connections; the caller has
+  **                  invalidated their NFA handles.
   **
   ** Returns:         True if ok.
   **
@@ -685,23 +927,98 @@ class P2pServer : public android::RefBase {
   *******************************************************************************/
   bool removeServerConnection(PeerToPeer::tJNI_HANDLE jniHandle);
 
+  /*******************************************************************************
+  **
+  ** Function:        takeFreeConnection
+  **
+  ** Description:     Take a preallocated connection for a peer's request.
+  **                  maxInfoUnit: Receives the largest MIU to accept with.
+  **                  recvWindow: Receives the largest receive window to
+  **                  accept with.
+  **
+  ** Returns:         Connection, or NULL if the backlog is full or the
+  **                  server is closed.
+  **
+  *******************************************************************************/
+  android::sp<NfaConn> takeFreeConnection(uint16_t& maxInfoUnit,
+                                          uint8_t& recvWindow);
+
+  /*******************************************************************************
+  **
+  ** Function:        addToBacklog
+  **
+  ** Description:     Queue a connection the stack accepted for accept().
+  **                  conn: Connection from takeFreeConnection().
+  **
+  ** Returns:         False if the server was closed in the meantime.
+  **
+  *******************************************************************************/
+  bool addToBacklog(const android::sp<NfaConn>& conn);
+
+  /*******************************************************************************
+  **
+  ** Function:        getConnections
+  **
+  ** Description:     Get the connections of the backlog and the accepted
+  **                  ones.
+  **
+  ** Returns:         Connections of the server.
+  **
+  *******************************************************************************/
+  std::vector<android::sp<NfaConn>> getConnections();
+
+  /*******************************************************************************
+  **
+  ** Function:        stopAccepting
+  **
+  ** Description:     Unblock accept() for good and empty the backlog.
+  **
+  ** Returns:         Connections of the backlog, for the caller to
+  **                  disconnect.
+  **
+  *******************************************************************************/
+  std::vector<android::sp<NfaConn>> stopAccepting();
+
+  /*******************************************************************************
+  **
+  ** Function:        dump
+  **
+  ** Description:     Print the backlog of the server.
+  **                  fd: file descriptor to write to.
+  **
+  ** Returns:         None
+  **
+  *******************************************************************************/
+  void dump(int fd);
+
  private:
   Mutex mMutex;
   // mServerConn is protected by mMutex
-  android::sp<NfaConn> mServerConn[MAX_NFA_CONNS_PER_SERVER];
+  std::vector<android::sp<NfaConn>> mServerConn;
+
+  // Variables below protected by mConnRequestEvent.  Connections the stack
+  // has accepted wait in mBacklog, oldest first, until accept() hands them
+  // to Java; mFreeConns holds the preallocated connections for the rest
+  // of the backlog, so requests never allocate on the stack's thread.
+  size_t mBacklogDepth;
+  std::deque<android::sp<NfaConn>> mBacklog;
+  std::vector<android::sp<NfaConn>> mFreeConns;
+  uint16_t mMaxInfoUnit;
+  uint8_t mRecvWindow;
+  bool mStopped;
+  uint32_t mRejected;  // requests that found the backlog full
 
   /*******************************************************************************
   **
-  ** Function:        allocateConnection
+  ** Function:        refillFreeConnectionsLocked
   **
-  ** Description:     Allocate a new connection to accept on
-  **                  jniHandle: JNI connection handle.
+  ** Description:     Preallocate connections for the free part of the
+  **                  backlog.  Assumes mConnRequestEvent is held.
   **
-  ** Returns:         Allocated connection object
-  **                  NULL if the maximum number of connections was reached
+  ** Returns:         None
   **
   *******************************************************************************/
-  android::sp<NfaConn> allocateConnection(PeerToPeer::tJNI_HANDLE jniHandle);
+  void refillFreeConnectionsLocked();
 };
 
 /*****************************************************************************
@@ -716,7 +1033,7 @@ class P2pClient : public android::RefBase {
   tNFA_HANDLE mNfaP2pClientHandle;  // NFA p2p handle of client
   bool mIsConnecting;               // Set true while connecting
   android::sp<NfaConn> mClientConn;
-  SyncEvent mRegisteringEvent;  // For client registration
+  Completion<tNFA_HANDLE> mRegistered;  // For client registration
   SyncEvent mConnectingEvent;   // for NFA_P2pConnectByName or Sap()
   SyncEvent mSnepEvent;         // To wait for SNEP completion
 
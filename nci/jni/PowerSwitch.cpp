@@ -19,6 +19,7 @@
  */
 #include "PowerSwitch.h"
 #include "NfcJniUtil.h"
+#include "NfccConfigBuilder.h"
 #include "nfc_config.h"
 
 #include <android-base/stringprintf.h>
@@ -27,7 +28,7 @@
 using android::base::StringPrintf;
 
 namespace android {
-void doStartupConfig();
+void doStartupConfig(NfccConfigBuilder& config);
 }
 
 extern bool gActivated;
@@ -324,7 +325,11 @@ bool PowerSwitch::setPowerOffSleepState(bool sleep) {
               mCurrDeviceMgtPowerState);
           goto TheEnd;
         }
-        android::doStartupConfig();
+        // leaving power-off-sleep resets the controller's configuration
+        NfccConfigBuilder::invalidate();
+        NfccConfigBuilder config;
+        android::doStartupConfig(config);
+        config.apply(false);
         mCurrLevel = FULL_POWER;
       } else {
         LOG(ERROR) << StringPrintf("%s: API fail; stat=0x%X", fn, stat);
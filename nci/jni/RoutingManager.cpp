@@ -22,6 +22,12 @@
 #include <base/logging.h>
 #include <nativehelper/JNIHelp.h>
 #include <nativehelper/ScopedLocalRef.h>
+#include <nativehelper/ScopedPrimitiveArray.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
+#include <tuple>
 
 #include "JavaClassConstants.h"
 #include "RoutingManager.h"
@@ -35,6 +41,11 @@ extern bool gActivated;
 extern SyncEvent gDeactivatedEvent;
 extern bool nfc_debug_enabled;
 
+namespace android {
+extern void startRfDiscovery(bool isStart);
+extern bool isDiscoveryStarted();
+}  // namespace android
+
 const JNINativeMethod RoutingManager::sMethods[] = {
     {"doGetDefaultRouteDestination", "()I",
      (void*)RoutingManager::
@@ -50,6 +61,13 @@ const JNINativeMethod RoutingManager::sMethods[] = {
          com_android_nfc_cardemulation_doGetOffHostEseDestination},
     {"doGetAidMatchingMode", "()I",
      (void*)RoutingManager::com_android_nfc_cardemulation_doGetAidMatchingMode},
+    {"doCompactAidRoutingTable", "([BII)[B",
+     (void*)RoutingManager::
+         com_android_nfc_cardemulation_doCompactAidRoutingTable},
+    {"doSetAidResolveTable", "([BI)V",
+     (void*)RoutingManager::com_android_nfc_cardemulation_doSetAidResolveTable},
+    {"doSetStaticResponses", "([BI)V",
+     (void*)RoutingManager::com_android_nfc_cardemulation_doSetStaticResponses},
     {"doGetDefaultIsoDepRouteDestination", "()I",
      (void*)RoutingManager::
          com_android_nfc_cardemulation_doGetDefaultIsoDepRouteDestination}};
@@ -60,11 +78,41 @@ static const uint8_t SYS_CODE_PWR_STATE_HOST = 0x01;
 static const uint16_t DEFAULT_SYS_CODE = 0xFEFE;
 
 static const uint8_t AID_ROUTE_QUAL_PREFIX = 0x10;
+// AID routing table entry overhead: TAG + ROUTE + LENGTH + POWER
+static const int AID_ENTRY_HDR_LEN = 4;
+// Never aggregate below a RID (ISO/IEC 7816-5) to keep prefixes narrow
+static const size_t AID_MIN_PREFIX_LEN = 5;
+static const size_t AID_MAX_LEN = 16;
+// Max pipelined NFA requests in flight; bounds GKI buffer usage
+static const size_t PIPELINE_WINDOW = 16;
+// Longest short-form command APDU: header, Lc, 255 data bytes and Le
+static const size_t HCE_RX_BUFFER_RESERVE = 261;
+// Longest wait for NFA_EE_UPDATED_EVT; it runs under mRfReconfigMutex
+static const long EE_UPDATE_TIMEOUT_MS = 2000;
 
 RoutingManager::RoutingManager()
     : mSecureNfcEnabled(false),
       mNativeData(NULL),
-      mAidRoutingConfigured(false) {
+      mAidRoutingConfigured(false),
+      mBatchActive(false),
+      mRoutingEventCount(0),
+      mCommitRequested(0),
+      mCommitDone(0),
+      mCommitEnabled(false),
+      mCommitThreadStarted(false),
+      mHceActive(false),
+      mCommitCount(0),
+      mCoalescedCount(0),
+      mLastCommitMs(0),
+      mMaxCommitMs(0),
+      mHceRequestUs(0),
+      mHceApduCount(0),
+      mHceResponseCount(0),
+      mHceUnansweredCount(0),
+      mHceLastLatencyUs(0),
+      mHceMaxLatencyUs(0),
+      mHceTotalLatencyUs(0),
+      mHceStaticResponseCount(0) {
   static const char fn[] = "RoutingManager::RoutingManager()";
 
   mDefaultOffHostRoute =
@@ -131,17 +179,28 @@ bool RoutingManager::initialize(nfc_jni_native_data* native) {
   static const char fn[] = "RoutingManager::initialize()";
   mNativeData = native;
   mRxDataBuffer.clear();
+  // clear() keeps the capacity, so APDUs never reallocate after this
+  mRxDataBuffer.reserve(HCE_RX_BUFFER_RESERVE);
+  {
+    // NFA starts with an empty AID table after enable
+    SyncEventGuard guard(mRoutingEvent);
+    mRoutedAids.clear();
+  }
 
   {
-    SyncEventGuard guard(mEeRegisterEvent);
     DLOG_IF(INFO, nfc_debug_enabled) << fn << ": try ee register";
+    mEeRegistered.start();
     tNFA_STATUS nfaStat = NFA_EeRegister(nfaEeCallback);
     if (nfaStat != NFA_STATUS_OK) {
       LOG(ERROR) << StringPrintf("%s: fail ee register; error=0x%X", fn,
                                  nfaStat);
+      mEeRegistered.cancel();
       return false;
     }
-    mEeRegisterEvent.wait();
+    if (mEeRegistered.wait(&nfaStat) && nfaStat != NFA_STATUS_OK) {
+      LOG(ERROR) << StringPrintf("%s: ee register failed; error=0x%X", fn,
+                                 nfaStat);
+    }
   }
 
   if ((mDefaultOffHostRoute != 0) || (mDefaultFelicaRoute != 0)) {
@@ -169,6 +228,24 @@ bool RoutingManager::initialize(nfc_jni_native_data* native) {
   updateDefaultRoute();
   updateDefaultProtocolRoute();
 
+  {
+    SyncEventGuard guard(mCommitEvent);
+    mCommitEnabled = true;
+    mHceActive = false;
+    if (!mCommitThreadStarted) {
+      pthread_t thread;
+      pthread_attr_t attr;
+      pthread_attr_init(&attr);
+      pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+      if (pthread_create(&thread, &attr, commitThread, NULL) == 0) {
+        mCommitThreadStarted = true;
+      } else {
+        LOG(ERROR) << fn << ": fail create commit thread";
+      }
+      pthread_attr_destroy(&attr);
+    }
+  }
+
   return true;
 }
 
@@ -187,7 +264,7 @@ void RoutingManager::enableRoutingToHost() {
     nfaStat = NFA_EeSetDefaultProtoRouting(NFC_DH_ID, NFA_PROTOCOL_MASK_T3T, 0,
                                            0, 0, 0, 0);
     if (nfaStat == NFA_STATUS_OK)
-      mRoutingEvent.wait();
+      waitRoutingEvent();
     else
       LOG(ERROR) << fn << "Fail to set default proto routing for T3T";
   }
@@ -198,7 +275,7 @@ void RoutingManager::enableRoutingToHost() {
     nfaStat = NFA_EeSetDefaultProtoRouting(
         NFC_DH_ID, protoMask, 0, 0, mSecureNfcEnabled ? 0 : protoMask, 0, 0);
     if (nfaStat == NFA_STATUS_OK)
-      mRoutingEvent.wait();
+      waitRoutingEvent();
     else
       LOG(ERROR) << fn << "Fail to set default proto routing for IsoDep";
   }
@@ -211,7 +288,7 @@ void RoutingManager::enableRoutingToHost() {
         NFC_DH_ID, techMask, 0, 0, mSecureNfcEnabled ? 0 : techMask,
         mSecureNfcEnabled ? 0 : techMask, mSecureNfcEnabled ? 0 : techMask);
     if (nfaStat == NFA_STATUS_OK)
-      mRoutingEvent.wait();
+      waitRoutingEvent();
     else
       LOG(ERROR) << fn << "Fail to set default tech routing for Nfc-A";
   }
@@ -224,7 +301,7 @@ void RoutingManager::enableRoutingToHost() {
         NFC_DH_ID, techMask, 0, 0, mSecureNfcEnabled ? 0 : techMask,
         mSecureNfcEnabled ? 0 : techMask, mSecureNfcEnabled ? 0 : techMask);
     if (nfaStat == NFA_STATUS_OK)
-      mRoutingEvent.wait();
+      waitRoutingEvent();
     else
       LOG(ERROR) << fn << "Fail to set default tech routing for Nfc-B";
   }
@@ -237,7 +314,7 @@ void RoutingManager::enableRoutingToHost() {
         NFC_DH_ID, techMask, 0, 0, mSecureNfcEnabled ? 0 : techMask,
         mSecureNfcEnabled ? 0 : techMask, mSecureNfcEnabled ? 0 : techMask);
     if (nfaStat == NFA_STATUS_OK)
-      mRoutingEvent.wait();
+      waitRoutingEvent();
     else
       LOG(ERROR) << fn << "Fail to set default tech routing for Nfc-F";
   }
@@ -253,7 +330,7 @@ void RoutingManager::disableRoutingToHost() {
     nfaStat =
         NFA_EeClearDefaultProtoRouting(NFC_DH_ID, NFA_PROTOCOL_MASK_ISO_DEP);
     if (nfaStat == NFA_STATUS_OK)
-      mRoutingEvent.wait();
+      waitRoutingEvent();
     else
       LOG(ERROR) << fn << "Fail to clear default proto routing for IsoDep";
   }
@@ -263,7 +340,7 @@ void RoutingManager::disableRoutingToHost() {
       (mSeTechMask & NFA_TECHNOLOGY_MASK_A) == 0) {
     nfaStat = NFA_EeClearDefaultTechRouting(NFC_DH_ID, NFA_TECHNOLOGY_MASK_A);
     if (nfaStat == NFA_STATUS_OK)
-      mRoutingEvent.wait();
+      waitRoutingEvent();
     else
       LOG(ERROR) << fn << "Fail to clear default tech routing for Nfc-A";
   }
@@ -273,7 +350,7 @@ void RoutingManager::disableRoutingToHost() {
       (mSeTechMask & NFA_TECHNOLOGY_MASK_B) == 0) {
     nfaStat = NFA_EeClearDefaultTechRouting(NFC_DH_ID, NFA_TECHNOLOGY_MASK_B);
     if (nfaStat == NFA_STATUS_OK)
-      mRoutingEvent.wait();
+      waitRoutingEvent();
     else
       LOG(ERROR) << fn << "Fail to clear default tech routing for Nfc-B";
   }
@@ -283,7 +360,7 @@ void RoutingManager::disableRoutingToHost() {
       (mSeTechMask & NFA_TECHNOLOGY_MASK_F) == 0) {
     nfaStat = NFA_EeClearDefaultTechRouting(NFC_DH_ID, NFA_TECHNOLOGY_MASK_F);
     if (nfaStat == NFA_STATUS_OK)
-      mRoutingEvent.wait();
+      waitRoutingEvent();
     else
       LOG(ERROR) << fn << "Fail to clear default tech routing for Nfc-F";
   }
@@ -292,7 +369,7 @@ void RoutingManager::disableRoutingToHost() {
   if (!mIsScbrSupported && mDefaultEe == NFC_DH_ID) {
     nfaStat = NFA_EeClearDefaultProtoRouting(NFC_DH_ID, NFA_PROTOCOL_MASK_T3T);
     if (nfaStat == NFA_STATUS_OK)
-      mRoutingEvent.wait();
+      waitRoutingEvent();
     else
       LOG(ERROR) << fn << "Fail to clear default proto routing for T3T";
   }
@@ -330,10 +407,7 @@ bool RoutingManager::isTypeATypeBTechSupportedInEe(tNFA_HANDLE eeHandle) {
   return status;
 }
 
-bool RoutingManager::addAidRouting(const uint8_t* aid, uint8_t aidLen,
-                                   int route, int aidInfo, int power) {
-  static const char fn[] = "RoutingManager::addAidRouting";
-  DLOG_IF(INFO, nfc_debug_enabled) << fn << ": enter";
+uint8_t RoutingManager::getAidPowerState(int route, int power) {
   uint8_t powerState = 0x01;
   if (!mSecureNfcEnabled) {
     if (power == 0x00) {
@@ -343,15 +417,25 @@ bool RoutingManager::addAidRouting(const uint8_t* aid, uint8_t aidLen,
           (route != 0x00) ? mOffHostAidRoutingPowerState & power : power;
     }
   }
+  return powerState;
+}
+
+bool RoutingManager::addAidRouting(const uint8_t* aid, uint8_t aidLen,
+                                   int route, int aidInfo, int power) {
+  static const char fn[] = "RoutingManager::addAidRouting";
+  DLOG_IF(INFO, nfc_debug_enabled) << fn << ": enter";
+  uint8_t powerState = getAidPowerState(route, power);
   SyncEventGuard guard(mRoutingEvent);
   mAidRoutingConfigured = false;
   tNFA_STATUS nfaStat =
       NFA_EeAddAidRouting(route, aidLen, (uint8_t*)aid, powerState, aidInfo);
   if (nfaStat == NFA_STATUS_OK) {
-    mRoutingEvent.wait();
+    waitRoutingEvent();
   }
   if (mAidRoutingConfigured) {
     DLOG_IF(INFO, nfc_debug_enabled) << fn << ": routed AID";
+    vector<uint8_t> key(aid, aid + aidLen);
+    mRoutedAids[key] = {key, route, aidInfo, powerState};
     return true;
   } else {
     LOG(ERROR) << fn << ": failed to route AID";
@@ -359,6 +443,409 @@ bool RoutingManager::addAidRouting(const uint8_t* aid, uint8_t aidLen,
   }
 }
 
+/*******************************************************************************
+**
+** Function:        waitRoutingEvent
+**
+** Description:     Wait for the completion of a request just sent to NFA;
+**                  called with mRoutingEvent held since before the request.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void RoutingManager::waitRoutingEvent() {
+  const uint32_t count = mRoutingEventCount;
+  mRoutingEvent.waitFor([&] { return mRoutingEventCount != count; });
+}
+
+/*******************************************************************************
+**
+** Function:        runPipelined
+**
+** Description:     Issue a series of NFA requests without waiting for each
+**                  one in turn.  Up to PIPELINE_WINDOW requests are kept in
+**                  flight; NFA reports completions in request order, and the
+**                  event handler appends each one to mBatchResults, so they
+**                  are matched to requests by position.
+**                  count: number of requests.
+**                  failResult: result for a request NFA did not accept.
+**                  issue: sends request i to NFA; called with mRoutingEvent
+**                  held.
+**
+** Returns:         Per-request result, as recorded by the event handler.
+**
+*******************************************************************************/
+vector<int> RoutingManager::runPipelined(
+    size_t count, int failResult,
+    const std::function<tNFA_STATUS(size_t)>& issue) {
+  vector<int> results(count, failResult);
+  vector<size_t> issued;  // request index, in request order
+
+  SyncEventGuard guard(mRoutingEvent);
+  mBatchActive = true;
+  mBatchResults.clear();
+  for (size_t i = 0; i < count; i++) {
+    mRoutingEvent.waitFor([&] {
+      return issued.size() - mBatchResults.size() < PIPELINE_WINDOW;
+    });
+    tNFA_STATUS nfaStat = issue(i);
+    if (nfaStat == NFA_STATUS_OK) {
+      issued.push_back(i);
+    } else {
+      LOG(ERROR) << StringPrintf("%s: fail request #%zu; error=0x%X", __func__,
+                                 i, nfaStat);
+    }
+  }
+  mRoutingEvent.waitFor(
+      [&] { return mBatchResults.size() >= issued.size(); });
+  mBatchActive = false;
+
+  for (size_t n = 0; n < issued.size(); n++) {
+    results[issued[n]] = mBatchResults[n];
+  }
+  return results;
+}
+
+/*******************************************************************************
+**
+** Function:        addAidRoutingList
+**
+** Description:     Add many AID routes with the requests pipelined.  Does
+**                  not commit.
+**                  entries: AIDs to route.
+**
+** Returns:         Per-entry result, true if the AID was routed.
+**
+*******************************************************************************/
+vector<bool> RoutingManager::addAidRoutingList(
+    const vector<AidRoutingEntry>& entries) {
+  static const char fn[] = "RoutingManager::addAidRoutingList";
+  DLOG_IF(INFO, nfc_debug_enabled)
+      << StringPrintf("%s: enter; %zu AIDs", fn, entries.size());
+  vector<int> completions =
+      runPipelined(entries.size(), false, [&](size_t i) {
+        const AidRoutingEntry& entry = entries[i];
+        uint8_t* aid = entry.aid.empty() ? NULL : (uint8_t*)entry.aid.data();
+        return NFA_EeAddAidRouting(
+            entry.route, entry.aid.size(), aid,
+            getAidPowerState(entry.route, entry.power), entry.aidInfo);
+      });
+
+  vector<bool> results(entries.size(), false);
+  size_t numRouted = 0;
+  SyncEventGuard guard(mRoutingEvent);
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (completions[i]) {
+      AidRoutingEntry routed = entries[i];
+      routed.power = getAidPowerState(routed.route, routed.power);
+      mRoutedAids[routed.aid] = routed;
+      results[i] = true;
+      numRouted++;
+    }
+  }
+  DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
+      "%s: routed %zu of %zu AIDs", fn, numRouted, entries.size());
+  return results;
+}
+
+/*******************************************************************************
+**
+** Function:        applyAidRoutingTable
+**
+** Description:     Make the AIDs held by NFA match a desired table, removing
+**                  and adding only the entries that differ from what was
+**                  routed before.  Does not commit.
+**                  entries: complete desired AID table.
+**                  changed: set to true if any entry was removed or added.
+**
+** Returns:         True if every add and remove succeeded.
+**
+*******************************************************************************/
+bool RoutingManager::applyAidRoutingTable(
+    const vector<AidRoutingEntry>& entries, bool* changed) {
+  static const char fn[] = "RoutingManager::applyAidRoutingTable";
+  vector<vector<uint8_t>> toRemove;
+  vector<AidRoutingEntry> toAdd;
+  {
+    SyncEventGuard guard(mRoutingEvent);
+    map<vector<uint8_t>, const AidRoutingEntry*> desired;
+    for (const AidRoutingEntry& entry : entries) desired[entry.aid] = &entry;
+
+    for (auto& routed : mRoutedAids) {
+      auto it = desired.find(routed.first);
+      if (it == desired.end()) {
+        toRemove.push_back(routed.first);
+      } else if (it->second->route != routed.second.route ||
+                 it->second->aidInfo != routed.second.aidInfo ||
+                 getAidPowerState(it->second->route, it->second->power) !=
+                     routed.second.power) {
+        // re-route: remove the old entry before adding the new one
+        toRemove.push_back(routed.first);
+        toAdd.push_back(*it->second);
+      }
+    }
+    for (auto& want : desired) {
+      if (mRoutedAids.find(want.first) == mRoutedAids.end())
+        toAdd.push_back(*want.second);
+    }
+  }
+  DLOG_IF(INFO, nfc_debug_enabled)
+      << StringPrintf("%s: %zu AIDs; remove %zu, add %zu", fn, entries.size(),
+                      toRemove.size(), toAdd.size());
+
+  bool success = true;
+  for (const vector<uint8_t>& aid : toRemove) {
+    if (!removeAidRouting(aid.empty() ? NULL : aid.data(), aid.size()))
+      success = false;
+  }
+  for (bool routed : addAidRoutingList(toAdd)) {
+    if (!routed) success = false;
+  }
+  *changed = !toRemove.empty() || !toAdd.empty();
+  return success;
+}
+
+/*******************************************************************************
+**
+** Function:        unpackAidRoutingEntries
+**
+** Description:     Unpack AID routing entries sent from Java.
+**                  buf: entries of [aidLen][aid][route][aidInfo][power];
+**                  an aidLen of 0 is the empty AID.
+**                  bufLen: length of buf.
+**                  entries: receives the unpacked entries.
+**
+** Returns:         False if buf is malformed.
+**
+*******************************************************************************/
+bool RoutingManager::unpackAidRoutingEntries(
+    const uint8_t* buf, size_t bufLen, vector<AidRoutingEntry>* entries) {
+  size_t offset = 0;
+  while (offset < bufLen) {
+    size_t aidLen = buf[offset++];
+    if (bufLen - offset < aidLen + 3) {
+      LOG(ERROR) << StringPrintf("%s: truncated entry at offset %zu", __func__,
+                                 offset - 1);
+      return false;
+    }
+    AidRoutingEntry entry;
+    entry.aid.assign(buf + offset, buf + offset + aidLen);
+    offset += aidLen;
+    entry.route = buf[offset++];
+    entry.aidInfo = buf[offset++];
+    entry.power = buf[offset++];
+    entries->push_back(std::move(entry));
+  }
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        packAidRoutingEntries
+**
+** Description:     Pack AID routing entries in the format read by
+**                  unpackAidRoutingEntries().
+**                  entries: entries to pack.
+**
+** Returns:         Packed entries.
+**
+*******************************************************************************/
+vector<uint8_t> RoutingManager::packAidRoutingEntries(
+    const vector<AidRoutingEntry>& entries) {
+  vector<uint8_t> buf;
+  for (const AidRoutingEntry& entry : entries) {
+    buf.push_back(entry.aid.size());
+    buf.insert(buf.end(), entry.aid.begin(), entry.aid.end());
+    buf.push_back(entry.route);
+    buf.push_back(entry.aidInfo);
+    buf.push_back(entry.power);
+  }
+  return buf;
+}
+
+static int getAidTableSize(
+    const vector<RoutingManager::AidRoutingEntry>& table) {
+  int size = 0;
+  for (auto& entry : table) size += entry.aid.size() + AID_ENTRY_HDR_LEN;
+  return size;
+}
+
+/*******************************************************************************
+**
+** Function:        hasAidPrefixConflict
+**
+** Description:     Check whether a new prefix entry would change where an AID
+**                  already in the table is routed.
+**                  table: current table.
+**                  merged: entries that the new prefix replaces.
+**                  prefix: the new prefix.
+**                  route, power: route and power state of the new prefix.
+**
+** Returns:         True if the prefix overlaps an entry routed elsewhere.
+**
+*******************************************************************************/
+bool RoutingManager::hasAidPrefixConflict(const vector<AidRoutingEntry>& table,
+                                          const vector<bool>& merged,
+                                          const vector<uint8_t>& prefix,
+                                          int route, int power) {
+  for (size_t i = 0; i < table.size(); i++) {
+    const AidRoutingEntry& entry = table[i];
+    // the empty AID is the default route, which any entry overrides
+    if (merged[i] || entry.aid.empty()) continue;
+    if (entry.route == route && entry.power == power) continue;
+    bool covered = entry.aid.size() >= prefix.size() &&
+                   std::equal(prefix.begin(), prefix.end(), entry.aid.begin());
+    bool entryIsPrefix = (mAidMatchingMode == AID_MATCHING_PREFIX_ONLY) ||
+                         (entry.aidInfo & AID_ROUTE_QUAL_PREFIX);
+    bool covers =
+        entryIsPrefix && entry.aid.size() < prefix.size() &&
+        std::equal(entry.aid.begin(), entry.aid.end(), prefix.begin());
+    if (covered || covers) return true;
+  }
+  return false;
+}
+
+/*******************************************************************************
+**
+** Function:        getAidFallbackRoute
+**
+** Description:     Find where an AID goes when it has no entry of its own:
+**                  the route of the longest prefix entry covering it, or
+**                  the default route if there is none.
+**                  table: current table.
+**                  skip: entries to leave out, as if already removed.
+**                  aid: the AID.
+**                  defaultRoute: route of the empty AID entry.
+**
+** Returns:         Route.
+**
+*******************************************************************************/
+int RoutingManager::getAidFallbackRoute(const vector<AidRoutingEntry>& table,
+                                        const vector<bool>& skip,
+                                        const vector<uint8_t>& aid,
+                                        int defaultRoute) {
+  int route = defaultRoute;
+  size_t longest = 0;
+  for (size_t i = 0; i < table.size(); i++) {
+    const AidRoutingEntry& entry = table[i];
+    if (skip[i] || entry.aid.empty()) continue;
+    if (entry.aid.size() <= longest || entry.aid.size() > aid.size()) continue;
+    bool entryIsPrefix = (mAidMatchingMode == AID_MATCHING_PREFIX_ONLY) ||
+                         (entry.aidInfo & AID_ROUTE_QUAL_PREFIX);
+    if (!entryIsPrefix ||
+        !std::equal(entry.aid.begin(), entry.aid.end(), aid.begin()))
+      continue;
+    route = entry.route;
+    longest = entry.aid.size();
+  }
+  return route;
+}
+
+/*******************************************************************************
+**
+** Function:        compactAidRoutingTable
+**
+** Description:     Shrink an AID routing table that does not fit in the
+**                  controller.  Exact AIDs sharing a prefix, route and power
+**                  state are replaced by one prefix entry, longest prefix
+**                  first, as long as no other entry is affected and the AIDs
+**                  without an entry under the prefix already go to the same
+**                  route.  If that is not enough, entries for the default
+**                  route are dropped; they only carry a power state, and
+**                  are kept if a shorter prefix entry routed elsewhere
+**                  would catch them.  No entry ever changes route.
+**                  table: table to compact, in place.
+**                  maxSize: routing table capacity in bytes.
+**                  defaultRoute: route of the empty AID entry.
+**
+** Returns:         True if the table now fits; the caller must not commit
+**                  it otherwise.
+**
+*******************************************************************************/
+bool RoutingManager::compactAidRoutingTable(vector<AidRoutingEntry>* table,
+                                            int maxSize, int defaultRoute) {
+  static const char fn[] = "RoutingManager::compactAidRoutingTable";
+  int originalSize = getAidTableSize(*table);
+  int size = originalSize;
+  int numPrefixes = 0;
+  int numFallbacks = 0;
+  bool prefixSupported = mAidMatchingMode == AID_MATCHING_EXACT_OR_PREFIX ||
+                         mAidMatchingMode == AID_MATCHING_PREFIX_ONLY ||
+                         mAidMatchingMode ==
+                             AID_MATCHING_EXACT_OR_SUBSET_OR_PREFIX;
+
+  for (size_t len = AID_MAX_LEN - 1;
+       prefixSupported && size > maxSize && len >= AID_MIN_PREFIX_LEN; len--) {
+    // group exact AIDs longer than len by (prefix, route, power)
+    map<tuple<vector<uint8_t>, int, int>, vector<size_t>> groups;
+    for (size_t i = 0; i < table->size(); i++) {
+      const AidRoutingEntry& entry = (*table)[i];
+      if (entry.aidInfo != 0 || entry.aid.size() <= len) continue;
+      vector<uint8_t> prefix(entry.aid.begin(), entry.aid.begin() + len);
+      groups[make_tuple(prefix, entry.route, entry.power)].push_back(i);
+    }
+
+    vector<bool> removed(table->size(), false);
+    vector<AidRoutingEntry> prefixes;
+    for (auto& group : groups) {
+      if (group.second.size() < 2) continue;
+      const vector<uint8_t>& prefix = get<0>(group.first);
+      int route = get<1>(group.first);
+      int power = get<2>(group.first);
+      vector<bool> merged(table->size(), false);
+      for (size_t i : group.second) merged[i] = true;
+      if (hasAidPrefixConflict(*table, merged, prefix, route, power)) continue;
+      // the prefix also catches AIDs without an entry; they must not move
+      if (getAidFallbackRoute(*table, merged, prefix, defaultRoute) != route)
+        continue;
+
+      for (size_t i : group.second) removed[i] = true;
+      prefixes.push_back({prefix, route, AID_ROUTE_QUAL_PREFIX, power});
+    }
+    if (prefixes.empty()) continue;
+
+    vector<AidRoutingEntry> next;
+    for (size_t i = 0; i < table->size(); i++) {
+      if (!removed[i]) next.push_back(std::move((*table)[i]));
+    }
+    next.insert(next.end(), prefixes.begin(), prefixes.end());
+    table->swap(next);
+    numPrefixes += prefixes.size();
+    size = getAidTableSize(*table);
+  }
+
+  // last resort: drop power-state-only entries for the default route,
+  // longest AID first, unless the AID would then match a prefix entry
+  // routed elsewhere
+  while (size > maxSize) {
+    size_t victim = table->size();
+    vector<bool> skip(table->size(), false);
+    for (size_t i = 0; i < table->size(); i++) {
+      const AidRoutingEntry& entry = (*table)[i];
+      if (entry.route != defaultRoute || entry.aid.empty()) continue;
+      if (victim < table->size() &&
+          entry.aid.size() <= (*table)[victim].aid.size())
+        continue;
+      skip[i] = true;
+      bool safe = getAidFallbackRoute(*table, skip, entry.aid,
+                                      defaultRoute) == defaultRoute;
+      skip[i] = false;
+      if (safe) victim = i;
+    }
+    if (victim == table->size()) break;
+    size -= (*table)[victim].aid.size() + AID_ENTRY_HDR_LEN;
+    table->erase(table->begin() + victim);
+    numFallbacks++;
+  }
+
+  LOG(INFO) << StringPrintf(
+      "%s: %d -> %d bytes (max %d); saved %d bytes with %d prefix entries, "
+      "%d forced fallbacks",
+      fn, originalSize, size, maxSize, originalSize - size, numPrefixes,
+      numFallbacks);
+  return size <= maxSize;
+}
+
 bool RoutingManager::removeAidRouting(const uint8_t* aid, uint8_t aidLen) {
   static const char fn[] = "RoutingManager::removeAidRouting";
   DLOG_IF(INFO, nfc_debug_enabled) << fn << ": enter";
@@ -366,10 +853,11 @@ bool RoutingManager::removeAidRouting(const uint8_t* aid, uint8_t aidLen) {
   mAidRoutingConfigured = false;
   tNFA_STATUS nfaStat = NFA_EeRemoveAidRouting(aidLen, (uint8_t*)aid);
   if (nfaStat == NFA_STATUS_OK) {
-    mRoutingEvent.wait();
+    waitRoutingEvent();
   }
   if (mAidRoutingConfigured) {
     DLOG_IF(INFO, nfc_debug_enabled) << fn << ": removed AID";
+    mRoutedAids.erase(vector<uint8_t>(aid, aid + aidLen));
     return true;
   } else {
     LOG(WARNING) << fn << ": failed to remove AID";
@@ -377,24 +865,213 @@ bool RoutingManager::removeAidRouting(const uint8_t* aid, uint8_t aidLen) {
   }
 }
 
-bool RoutingManager::commitRouting() {
-  static const char fn[] = "RoutingManager::commitRouting";
+static uint64_t getMonotonicMs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static uint64_t getMonotonicUs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+bool RoutingManager::eeUpdateNow() {
+  static const char fn[] = "RoutingManager::eeUpdateNow";
   tNFA_STATUS nfaStat = 0;
   DLOG_IF(INFO, nfc_debug_enabled) << fn;
   if(mEeInfoChanged) {
     mSeTechMask = updateEeTechRouteSetting();
     mEeInfoChanged = false;
   }
-  {
-    SyncEventGuard guard(mEeUpdateEvent);
-    nfaStat = NFA_EeUpdateNow();
-    if (nfaStat == NFA_STATUS_OK) {
-      mEeUpdateEvent.wait();  // wait for NFA_EE_UPDATED_EVT
+  mEeUpdated.start();
+  nfaStat = NFA_EeUpdateNow();
+  if (nfaStat == NFA_STATUS_OK) {
+    // wait for NFA_EE_UPDATED_EVT
+    if (!mEeUpdated.wait(NULL, EE_UPDATE_TIMEOUT_MS)) {
+      LOG(ERROR) << fn << ": no NFA_EE_UPDATED_EVT; give up";
+      nfaStat = NFA_STATUS_FAILED;
     }
+  } else {
+    mEeUpdated.cancel();
   }
   return (nfaStat == NFA_STATUS_OK);
 }
 
+/*******************************************************************************
+**
+** Function:        commitRouting
+**
+** Description:     Send the routing table to the controller now, on the
+**                  caller's thread.  The caller must have stopped RF
+**                  discovery if needed.  Any commit requested before this
+**                  call is satisfied by it.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool RoutingManager::commitRouting() {
+  uint32_t generation;
+  {
+    SyncEventGuard guard(mCommitEvent);
+    generation = mCommitRequested;
+  }
+  uint64_t startMs = getMonotonicMs();
+  bool status = eeUpdateNow();
+  completeCommit(generation, status, startMs, false);
+  return status;
+}
+
+/*******************************************************************************
+**
+** Function:        requestCommit
+**
+** Description:     Ask the commit thread to send the routing table to the
+**                  controller.  Requests made while a commit is pending are
+**                  merged into one NFA_EeUpdateNow, which is deferred while
+**                  a host card emulation transaction is in progress.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void RoutingManager::requestCommit() {
+  SyncEventGuard guard(mCommitEvent);
+  uint32_t generation = ++mCommitRequested;
+  if (!mCommitEnabled) {
+    LOG(ERROR) << __func__ << ": routing not initialized; drop commit";
+    mCommitDone = generation;
+  }
+  mCommitEvent.notifyAll();
+}
+
+/*******************************************************************************
+**
+** Function:        abortCommits
+**
+** Description:     Drop pending commits and stop accepting new ones until
+**                  the next initialize(); waits for a commit in progress.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void RoutingManager::abortCommits() {
+  // the commit in progress holds mRfReconfigMutex until its update ends
+  abortEeUpdate();
+  AutoMutex lock(mRfReconfigMutex);
+  SyncEventGuard guard(mCommitEvent);
+  mCommitEnabled = false;
+  if (mCommitDone != mCommitRequested) {
+    DLOG_IF(INFO, nfc_debug_enabled)
+        << StringPrintf("%s: drop %u pending commit(s)", __func__,
+                        mCommitRequested - mCommitDone);
+    mCommitDone = mCommitRequested;
+  }
+  mCommitEvent.notifyAll();
+}
+
+/*******************************************************************************
+**
+** Function:        abortEeUpdate
+**
+** Description:     Release a thread waiting for NFA_EE_UPDATED_EVT, and so
+**                  mRfReconfigMutex; its update counts as failed.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void RoutingManager::abortEeUpdate() { mEeUpdated.cancel(); }
+
+void RoutingManager::completeCommit(uint32_t generation, bool status,
+                                    uint64_t startMs, bool async) {
+  uint32_t elapsedMs = getMonotonicMs() - startMs;
+  SyncEventGuard guard(mCommitEvent);
+  mCommitCount++;
+  mLastCommitMs = elapsedMs;
+  if (elapsedMs > mMaxCommitMs) mMaxCommitMs = elapsedMs;
+  if (generation > mCommitDone) {
+    // a commit thread commit serves its own request; anything else merged
+    uint32_t served = generation - mCommitDone;
+    mCoalescedCount += async ? served - 1 : served;
+    mCommitDone = generation;
+  }
+  DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
+      "%s: generation %u done in %u ms; status=%d", __func__, generation,
+      elapsedMs, status);
+  mCommitEvent.notifyAll();
+}
+
+void* RoutingManager::commitThread(void*) {
+  getInstance().runCommits();
+  return NULL;
+}
+
+void RoutingManager::runCommits() {
+  for (;;) {
+    uint32_t generation;
+    {
+      SyncEventGuard guard(mCommitEvent);
+      while (!mCommitEnabled || mHceActive || mCommitDone == mCommitRequested)
+        mCommitEvent.wait();
+      generation = mCommitRequested;
+    }
+
+    uint64_t startMs = getMonotonicMs();
+    bool status;
+    {
+      AutoMutex lock(mRfReconfigMutex);
+      bool restartDiscovery = android::isDiscoveryStarted();
+      /*Update routing table only in Idle state.*/
+      if (restartDiscovery) android::startRfDiscovery(false);
+      status = eeUpdateNow();
+      if (restartDiscovery) android::startRfDiscovery(true);
+    }
+    completeCommit(generation, status, startMs, true);
+  }
+}
+
+void RoutingManager::dump(int fd) {
+  SyncEventGuard guard(mCommitEvent);
+  dprintf(fd, "Routing commits:\n");
+  dprintf(fd, "  generation requested=%u done=%u pending=%d\n",
+          mCommitRequested, mCommitDone, mCommitDone != mCommitRequested);
+  dprintf(fd, "  commits=%u coalesced requests=%u\n", mCommitCount,
+          mCoalescedCount);
+  dprintf(fd, "  last duration=%u ms max duration=%u ms\n", mLastCommitMs,
+          mMaxCommitMs);
+
+  AutoMutex lock(mHceStatsMutex);
+  dprintf(fd, "HCE APDUs:\n");
+  dprintf(fd, "  received=%u answered=%u unanswered=%u static=%u\n",
+          mHceApduCount, mHceResponseCount, mHceUnansweredCount,
+          mHceStaticResponseCount);
+  dprintf(fd, "  latency last=%u us max=%u us mean=%u us\n",
+          mHceLastLatencyUs, mHceMaxLatencyUs,
+          mHceResponseCount ? (uint32_t)(mHceTotalLatencyUs / mHceResponseCount)
+                            : 0);
+}
+
+/*******************************************************************************
+**
+** Function:        notifyHceResponse
+**
+** Description:     Record that the response to the last HCE command APDU
+**                  was handed to NFA, for the latency statistics.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void RoutingManager::notifyHceResponse() {
+  AutoMutex lock(mHceStatsMutex);
+  if (mHceRequestUs == 0) return;  // not a response to a pending command
+  uint64_t latencyUs = getMonotonicUs() - mHceRequestUs;
+  mHceRequestUs = 0;
+  mHceResponseCount++;
+  mHceLastLatencyUs = (uint32_t)std::min<uint64_t>(latencyUs, UINT32_MAX);
+  mHceMaxLatencyUs = std::max(mHceMaxLatencyUs, mHceLastLatencyUs);
+  mHceTotalLatencyUs += latencyUs;
+}
+
 void RoutingManager::onNfccShutdown() {
   static const char fn[] = "RoutingManager:onNfccShutdown";
   if (mDefaultOffHostRoute == 0x00 && mDefaultFelicaRoute == 0x00) return;
@@ -421,12 +1098,13 @@ void RoutingManager::onNfccShutdown() {
         DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
             "%s: Handle: 0x%04x Change Status Active to Inactive", fn,
             eeInfo[xx].ee_handle);
-        SyncEventGuard guard(mEeSetModeEvent);
+        mEeModeSet.start();
         if ((nfaStat = NFA_EeModeSet(eeInfo[xx].ee_handle,
                                      NFA_EE_MD_DEACTIVATE)) == NFA_STATUS_OK) {
-          mEeSetModeEvent.wait();  // wait for NFA_EE_MODE_SET_EVT
+          mEeModeSet.wait(NULL);  // wait for NFA_EE_MODE_SET_EVT
         } else {
           LOG(ERROR) << fn << "Failed to set EE inactive";
+          mEeModeSet.cancel();
         }
       }
     }
@@ -436,6 +1114,10 @@ void RoutingManager::onNfccShutdown() {
 }
 
 void RoutingManager::notifyActivated(uint8_t technology) {
+  {
+    SyncEventGuard guard(mCommitEvent);
+    mHceActive = true;
+  }
   JNIEnv* e = NULL;
   ScopedAttach attach(mNativeData->vm, &e);
   if (e == NULL) {
@@ -454,6 +1136,17 @@ void RoutingManager::notifyActivated(uint8_t technology) {
 
 void RoutingManager::notifyDeactivated(uint8_t technology) {
   mRxDataBuffer.clear();
+  {
+    // release commits deferred during the transaction
+    SyncEventGuard guard(mCommitEvent);
+    mHceActive = false;
+    mCommitEvent.notifyAll();
+  }
+  {
+    AutoMutex lock(mHceStatsMutex);
+    if (mHceRequestUs != 0) mHceUnansweredCount++;
+    mHceRequestUs = 0;
+  }
   JNIEnv* e = NULL;
   ScopedAttach attach(mNativeData->vm, &e);
   if (e == NULL) {
@@ -478,50 +1171,126 @@ void RoutingManager::handleData(uint8_t technology, const uint8_t* data,
                            &data[dataLen]);  // append data; more to come
     }
     return;  // expect another NFA_CE_DATA_EVT to come
-  } else if (status == NFA_STATUS_OK) {
-    if (dataLen > 0) {
-      mRxDataBuffer.insert(mRxDataBuffer.end(), &data[0],
-                           &data[dataLen]);  // append data
-    }
-    // entire data packet has been received; no more NFA_CE_DATA_EVT
   } else if (status == NFA_STATUS_FAILED) {
     LOG(ERROR) << "RoutingManager::handleData: read data fail";
-    goto TheEnd;
+    mRxDataBuffer.clear();
+    return;
   }
 
-  {
-    JNIEnv* e = NULL;
-    ScopedAttach attach(mNativeData->vm, &e);
-    if (e == NULL) {
-      LOG(ERROR) << "jni env is null";
-      goto TheEnd;
+  // entire data packet has been received; no more NFA_CE_DATA_EVT.  Only a
+  // segmented packet needs reassembly, the common case is passed straight on
+  if (!mRxDataBuffer.empty()) {
+    if (dataLen > 0) {
+      mRxDataBuffer.insert(mRxDataBuffer.end(), &data[0], &data[dataLen]);
     }
+    data = mRxDataBuffer.data();
+    dataLen = mRxDataBuffer.size();
+  }
 
-    ScopedLocalRef<jobject> dataJavaArray(
-        e, e->NewByteArray(mRxDataBuffer.size()));
-    if (dataJavaArray.get() == NULL) {
-      LOG(ERROR) << "fail allocate array";
-      goto TheEnd;
-    }
+  JNIEnv* e = NULL;
+  ScopedAttach attach(mNativeData->vm, &e);
+  if (e == NULL) {
+    LOG(ERROR) << "jni env is null";
+    mRxDataBuffer.clear();
+    return;
+  }
 
-    e->SetByteArrayRegion((jbyteArray)dataJavaArray.get(), 0,
-                          mRxDataBuffer.size(), (jbyte*)(&mRxDataBuffer[0]));
-    if (e->ExceptionCheck()) {
-      e->ExceptionClear();
-      LOG(ERROR) << "fail fill array";
-      goto TheEnd;
+  ScopedLocalRef<jbyteArray> dataJavaArray(e, e->NewByteArray(dataLen));
+  if (dataJavaArray.get() == NULL) {
+    LOG(ERROR) << "fail allocate array";
+    mRxDataBuffer.clear();
+    return;
+  }
+  if (dataLen > 0) {
+    e->SetByteArrayRegion(dataJavaArray.get(), 0, dataLen, (jbyte*)data);
+  }
+
+  // resolve a SELECT here, so Java need not parse it or walk its AID cache
+  int aidIndex = AidTrie::UNRESOLVED;
+  int aidGeneration = 0;
+  const uint8_t* aid = NULL;
+  size_t aidLen = 0;
+  if (technology == NFA_TECHNOLOGY_MASK_A &&
+      AidTrie::parseSelect(data, dataLen, &aid, &aidLen)) {
+    std::shared_ptr<const AidTrie> trie = std::atomic_load(&mAidTrie);
+    if (trie != NULL) {
+      aidIndex = trie->resolve(aid, aidLen);
+      aidGeneration = trie->generation();
     }
+  }
 
+  if (aidIndex != AidTrie::UNRESOLVED &&
+      sendStaticResponse(data, dataLen, aidIndex, aidGeneration)) {
+    // answered already; Java only needs to learn what was selected
     e->CallVoidMethod(mNativeData->manager,
-                      android::gCachedNfcManagerNotifyHostEmuData,
+                      android::gCachedNfcManagerNotifyHostEmuStaticResponse,
                       (int)technology, dataJavaArray.get());
-    if (e->ExceptionCheck()) {
-      e->ExceptionClear();
-      LOG(ERROR) << "fail notify";
+  } else if (aidIndex != AidTrie::UNRESOLVED) {
+    {
+      AutoMutex lock(mHceStatsMutex);
+      mHceApduCount++;
+      mHceRequestUs = getMonotonicUs();
     }
+    e->CallVoidMethod(mNativeData->manager,
+                      android::gCachedNfcManagerNotifyHostEmuSelect,
+                      (int)technology, dataJavaArray.get(), aidGeneration,
+                      aidIndex);
+  } else {
+    {
+      AutoMutex lock(mHceStatsMutex);
+      mHceApduCount++;
+      mHceRequestUs = getMonotonicUs();
+    }
+    e->CallVoidMethod(mNativeData->manager,
+                      android::gCachedNfcManagerNotifyHostEmuData,
+                      (int)technology, dataJavaArray.get());
   }
-TheEnd:
+  // data may point into the buffer, so it is only emptied now
   mRxDataBuffer.clear();
+  if (e->ExceptionCheck()) {
+    e->ExceptionClear();
+    LOG(ERROR) << "fail notify";
+  }
+}
+
+/*******************************************************************************
+**
+** Function:        sendStaticResponse
+**
+** Description:     Answer a resolved SELECT with the response a service
+**                  registered for it, without a round trip through Java.
+**                  data: SELECT command.
+**                  dataLen: length of data.
+**                  aidIndex: entry the AID resolved to.
+**                  aidGeneration: generation of the trie that resolved it.
+**
+** Returns:         True if the response was sent.
+**
+*******************************************************************************/
+bool RoutingManager::sendStaticResponse(const uint8_t* data, uint32_t dataLen,
+                                        int aidIndex, int aidGeneration) {
+  if (aidIndex < 0) return false;  // no service for the AID
+  std::shared_ptr<const StaticResponses> table =
+      std::atomic_load(&mStaticResponses);
+  if (table == NULL || table->generation != aidGeneration) return false;
+
+  // the command is matched up to its AID, so a trailing Le is ignored
+  size_t cmdLen = std::min<size_t>(dataLen, 5 + data[4]);
+  auto it = table->responses.find(vector<uint8_t>(data, data + cmdLen));
+  if (it == table->responses.end()) return false;
+
+  const vector<uint8_t>& response = it->second;
+  tNFA_STATUS status = NFA_SendRawFrame(
+      const_cast<uint8_t*>(response.data()), response.size(), 0);
+  if (status != NFA_STATUS_OK) {
+    LOG(ERROR) << StringPrintf("%s: send failed; status=0x%X", __func__,
+                               status);
+    return false;
+  }
+  AutoMutex lock(mHceStatsMutex);
+  mHceApduCount++;
+  mHceStaticResponseCount++;
+  return true;
 }
 
 void RoutingManager::notifyEeUpdated() {
@@ -629,7 +1398,7 @@ void RoutingManager::updateDefaultProtocolRoute() {
           mSecureNfcEnabled ? 0 : protoMask, mSecureNfcEnabled ? 0 : protoMask);
     }
     if (nfaStat == NFA_STATUS_OK)
-      mRoutingEvent.wait();
+      waitRoutingEvent();
     else
       LOG(ERROR) << fn << "Fail to set default proto routing for T3T";
   }
@@ -649,7 +1418,7 @@ void RoutingManager::updateDefaultRoute() {
     LOG(ERROR) << fn << ": SCBR not supported";
   } else if (nfaStat == NFA_STATUS_OK) {
     mIsScbrSupported = true;
-    mRoutingEvent.wait();
+    waitRoutingEvent();
     DLOG_IF(INFO, nfc_debug_enabled)
         << fn << ": Succeed to register system code";
   } else {
@@ -677,6 +1446,25 @@ void RoutingManager::updateDefaultRoute() {
   }
 }
 
+/*******************************************************************************
+**
+** Function:        getDiscoveredNfceeIds
+**
+** Description:     Get the NFCEEs reported by the last EE discovery.
+**
+** Returns:         NFCEE IDs, without the EE handle group.
+**
+*******************************************************************************/
+vector<uint8_t> RoutingManager::getDiscoveredNfceeIds() {
+  SyncEventGuard guard(mEeInfoEvent);
+  vector<uint8_t> nfceeIds;
+  for (uint8_t i = 0; i < mEeInfo.num_ee; i++) {
+    tNFA_HANDLE eeHandle = mEeInfo.ee_disc_info[i].ee_handle;
+    nfceeIds.push_back((uint8_t)(eeHandle & ~NFA_HANDLE_GROUP_EE));
+  }
+  return nfceeIds;
+}
+
 tNFA_TECHNOLOGY_MASK RoutingManager::updateEeTechRouteSetting() {
   static const char fn[] = "RoutingManager::updateEeTechRouteSetting";
   tNFA_TECHNOLOGY_MASK allSeTechMask = 0x00;
@@ -789,10 +1577,9 @@ void RoutingManager::nfaEeCallback(tNFA_EE_EVT event,
   routingManager.mCbEventData = *eventData;
   switch (event) {
     case NFA_EE_REGISTER_EVT: {
-      SyncEventGuard guard(routingManager.mEeRegisterEvent);
       DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
           "%s: NFA_EE_REGISTER_EVT; status=%u", fn, eventData->ee_register);
-      routingManager.mEeRegisterEvent.notifyOne();
+      routingManager.mEeRegistered.complete(eventData->ee_register);
     } break;
 
     case NFA_EE_DEREGISTER_EVT: {
@@ -803,17 +1590,17 @@ void RoutingManager::nfaEeCallback(tNFA_EE_EVT event,
     } break;
 
     case NFA_EE_MODE_SET_EVT: {
-      SyncEventGuard guard(routingManager.mEeSetModeEvent);
       DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
           "%s: NFA_EE_MODE_SET_EVT; status: 0x%04X  handle: 0x%04X  ", fn,
           eventData->mode_set.status, eventData->mode_set.ee_handle);
-      routingManager.mEeSetModeEvent.notifyOne();
+      routingManager.mEeModeSet.complete(eventData->mode_set.status);
     } break;
 
     case NFA_EE_SET_TECH_CFG_EVT: {
       DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
           "%s: NFA_EE_SET_TECH_CFG_EVT; status=0x%X", fn, eventData->status);
       SyncEventGuard guard(routingManager.mRoutingEvent);
+      routingManager.mRoutingEventCount++;
       routingManager.mRoutingEvent.notifyOne();
     } break;
 
@@ -821,6 +1608,7 @@ void RoutingManager::nfaEeCallback(tNFA_EE_EVT event,
       DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
           "%s: NFA_EE_CLEAR_TECH_CFG_EVT; status=0x%X", fn, eventData->status);
       SyncEventGuard guard(routingManager.mRoutingEvent);
+      routingManager.mRoutingEventCount++;
       routingManager.mRoutingEvent.notifyOne();
     } break;
 
@@ -828,6 +1616,7 @@ void RoutingManager::nfaEeCallback(tNFA_EE_EVT event,
       DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
           "%s: NFA_EE_SET_PROTO_CFG_EVT; status=0x%X", fn, eventData->status);
       SyncEventGuard guard(routingManager.mRoutingEvent);
+      routingManager.mRoutingEventCount++;
       routingManager.mRoutingEvent.notifyOne();
     } break;
 
@@ -835,6 +1624,7 @@ void RoutingManager::nfaEeCallback(tNFA_EE_EVT event,
       DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
           "%s: NFA_EE_CLEAR_PROTO_CFG_EVT; status=0x%X", fn, eventData->status);
       SyncEventGuard guard(routingManager.mRoutingEvent);
+      routingManager.mRoutingEventCount++;
       routingManager.mRoutingEvent.notifyOne();
     } break;
 
@@ -891,11 +1681,21 @@ void RoutingManager::nfaEeCallback(tNFA_EE_EVT event,
       SyncEventGuard guard(routingManager.mRoutingEvent);
       routingManager.mAidRoutingConfigured =
           (eventData->status == NFA_STATUS_OK);
+      if (routingManager.mBatchActive) {
+        routingManager.mBatchResults.push_back(eventData->status ==
+                                               NFA_STATUS_OK);
+      }
+      routingManager.mRoutingEventCount++;
       routingManager.mRoutingEvent.notifyOne();
     } break;
 
     case NFA_EE_ADD_SYSCODE_EVT: {
       SyncEventGuard guard(routingManager.mRoutingEvent);
+      if (routingManager.mBatchActive) {
+        routingManager.mBatchResults.push_back(eventData->status ==
+                                               NFA_STATUS_OK);
+      }
+      routingManager.mRoutingEventCount++;
       routingManager.mRoutingEvent.notifyOne();
       DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
           "%s: NFA_EE_ADD_SYSCODE_EVT  status=%u", fn, eventData->status);
@@ -903,6 +1703,11 @@ void RoutingManager::nfaEeCallback(tNFA_EE_EVT event,
 
     case NFA_EE_REMOVE_SYSCODE_EVT: {
       SyncEventGuard guard(routingManager.mRoutingEvent);
+      if (routingManager.mBatchActive) {
+        routingManager.mBatchResults.push_back(eventData->status ==
+                                               NFA_STATUS_OK);
+      }
+      routingManager.mRoutingEventCount++;
       routingManager.mRoutingEvent.notifyOne();
       DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
           "%s: NFA_EE_REMOVE_SYSCODE_EVT  status=%u", fn, eventData->status);
@@ -914,6 +1719,7 @@ void RoutingManager::nfaEeCallback(tNFA_EE_EVT event,
       SyncEventGuard guard(routingManager.mRoutingEvent);
       routingManager.mAidRoutingConfigured =
           (eventData->status == NFA_STATUS_OK);
+      routingManager.mRoutingEventCount++;
       routingManager.mRoutingEvent.notifyOne();
     } break;
 
@@ -926,8 +1732,7 @@ void RoutingManager::nfaEeCallback(tNFA_EE_EVT event,
     case NFA_EE_UPDATED_EVT: {
       DLOG_IF(INFO, nfc_debug_enabled)
           << StringPrintf("%s: NFA_EE_UPDATED_EVT", fn);
-      SyncEventGuard guard(routingManager.mEeUpdateEvent);
-      routingManager.mEeUpdateEvent.notifyOne();
+      routingManager.mEeUpdated.complete(NFA_STATUS_OK);
     } break;
 
     case NFA_EE_PWR_AND_LINK_CTRL_EVT: {
@@ -945,97 +1750,122 @@ void RoutingManager::nfaEeCallback(tNFA_EE_EVT event,
 }
 
 int RoutingManager::registerT3tIdentifier(uint8_t* t3tId, uint8_t t3tIdLen) {
-  static const char fn[] = "RoutingManager::registerT3tIdentifier";
-
-  DLOG_IF(INFO, nfc_debug_enabled)
-      << fn << ": Start to register NFC-F system on DH";
-
-  if (t3tIdLen != (2 + NCI_RF_F_UID_LEN + NCI_T3T_PMM_LEN)) {
-    LOG(ERROR) << fn << ": Invalid length of T3T Identifier";
-    return NFA_HANDLE_INVALID;
-  }
+  vector<vector<uint8_t>> t3tIds(1, vector<uint8_t>(t3tId, t3tId + t3tIdLen));
+  return registerT3tIdentifiers(t3tIds)[0];
+}
 
-  mNfcFOnDhHandle = NFA_HANDLE_INVALID;
+void RoutingManager::deregisterT3tIdentifier(int handle) {
+  deregisterT3tIdentifiers(vector<int>(1, handle));
+}
 
-  uint16_t systemCode;
-  uint8_t nfcid2[NCI_RF_F_UID_LEN];
-  uint8_t t3tPmm[NCI_T3T_PMM_LEN];
+/*******************************************************************************
+**
+** Function:        registerT3tIdentifiers
+**
+** Description:     Register a set of NFC-F systems on DH and route their
+**                  system codes to DH.  The CE registrations are pipelined,
+**                  followed by the system code routes.  Does not commit.
+**                  t3tIds: LF_T3T_IDENTIFIER values (system code, NFCID2
+**                  and PMm).
+**
+** Returns:         Per-identifier handle, or NFA_HANDLE_INVALID.
+**
+*******************************************************************************/
+vector<int> RoutingManager::registerT3tIdentifiers(
+    const vector<vector<uint8_t>>& t3tIds) {
+  static const char fn[] = "RoutingManager::registerT3tIdentifiers";
+  DLOG_IF(INFO, nfc_debug_enabled)
+      << StringPrintf("%s: enter; %zu identifiers", fn, t3tIds.size());
+
+  vector<uint16_t> systemCodes(t3tIds.size(), 0);
+  vector<int> handles = runPipelined(
+      t3tIds.size(), NFA_HANDLE_INVALID, [&](size_t i) -> tNFA_STATUS {
+        const vector<uint8_t>& t3tId = t3tIds[i];
+        if (t3tId.size() != (2 + NCI_RF_F_UID_LEN + NCI_T3T_PMM_LEN)) {
+          LOG(ERROR) << fn << ": Invalid length of T3T Identifier";
+          return NFA_STATUS_INVALID_PARAM;
+        }
+        uint8_t nfcid2[NCI_RF_F_UID_LEN];
+        uint8_t t3tPmm[NCI_T3T_PMM_LEN];
+        systemCodes[i] = (((int)t3tId[0] << 8) | ((int)t3tId[1] << 0));
+        memcpy(nfcid2, &t3tId[2], NCI_RF_F_UID_LEN);
+        memcpy(t3tPmm, &t3tId[10], NCI_T3T_PMM_LEN);
+        return NFA_CeRegisterFelicaSystemCodeOnDH(systemCodes[i], nfcid2,
+                                                  t3tPmm, nfcFCeCallback);
+      });
 
-  systemCode = (((int)t3tId[0] << 8) | ((int)t3tId[1] << 0));
-  memcpy(nfcid2, t3tId + 2, NCI_RF_F_UID_LEN);
-  memcpy(t3tPmm, t3tId + 10, NCI_T3T_PMM_LEN);
-  {
-    SyncEventGuard guard(mRoutingEvent);
-    tNFA_STATUS nfaStat = NFA_CeRegisterFelicaSystemCodeOnDH(
-        systemCode, nfcid2, t3tPmm, nfcFCeCallback);
-    if (nfaStat == NFA_STATUS_OK) {
-      mRoutingEvent.wait();
-    } else {
-      LOG(ERROR) << fn << ": Fail to register NFC-F system on DH";
-      return NFA_HANDLE_INVALID;
-    }
+  if (!mIsScbrSupported) {
+    LOG(ERROR) << StringPrintf("%s: SCBR Not supported", fn);
+    return handles;
   }
-  DLOG_IF(INFO, nfc_debug_enabled)
-      << fn << ": Succeed to register NFC-F system on DH";
 
   // Register System Code for routing
-  if (mIsScbrSupported) {
-    SyncEventGuard guard(mRoutingEvent);
-    tNFA_STATUS nfaStat = NFA_EeAddSystemCodeRouting(systemCode, NCI_DH_ID,
-                                                     SYS_CODE_PWR_STATE_HOST);
-    if (nfaStat == NFA_STATUS_OK) {
-      mRoutingEvent.wait();
-    }
-    if ((nfaStat != NFA_STATUS_OK) || (mCbEventData.status != NFA_STATUS_OK)) {
-      LOG(ERROR) << StringPrintf("%s: Fail to register system code on DH", fn);
-      return NFA_HANDLE_INVALID;
+  vector<size_t> registered;
+  for (size_t i = 0; i < handles.size(); i++) {
+    if (handles[i] != NFA_HANDLE_INVALID) registered.push_back(i);
+  }
+  vector<int> routed = runPipelined(registered.size(), false, [&](size_t n) {
+    return NFA_EeAddSystemCodeRouting(systemCodes[registered[n]], NCI_DH_ID,
+                                      SYS_CODE_PWR_STATE_HOST);
+  });
+
+  size_t numFailed = 0;
+  for (size_t n = 0; n < registered.size(); n++) {
+    int& handle = handles[registered[n]];
+    if (routed[n]) {
+      // add handle and system code pair to the map
+      mMapScbrHandle.emplace(handle, systemCodes[registered[n]]);
+    } else {
+      LOG(ERROR) << StringPrintf("%s: Fail to register system code 0x%04X",
+                                 fn, systemCodes[registered[n]]);
+      // keep NFA and mMapScbrHandle consistent; the caller sees a failure
+      deregisterT3tIdentifiers(vector<int>(1, handle));
+      handle = NFA_HANDLE_INVALID;
+      numFailed++;
     }
-    DLOG_IF(INFO, nfc_debug_enabled)
-        << StringPrintf("%s: Succeed to register system code on DH", fn);
-    // add handle and system code pair to the map
-    mMapScbrHandle.emplace(mNfcFOnDhHandle, systemCode);
-  } else {
-    LOG(ERROR) << StringPrintf("%s: SCBR Not supported", fn);
   }
-
-  return mNfcFOnDhHandle;
+  DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
+      "%s: exit; %zu registered, %zu system codes failed", fn,
+      registered.size(), numFailed);
+  return handles;
 }
 
-void RoutingManager::deregisterT3tIdentifier(int handle) {
-  static const char fn[] = "RoutingManager::deregisterT3tIdentifier";
-
+/*******************************************************************************
+**
+** Function:        deregisterT3tIdentifiers
+**
+** Description:     Deregister a set of NFC-F systems from DH and remove the
+**                  routes of their system codes.  Does not commit.
+**                  handles: handles from registerT3tIdentifiers().
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void RoutingManager::deregisterT3tIdentifiers(const vector<int>& handles) {
+  static const char fn[] = "RoutingManager::deregisterT3tIdentifiers";
   DLOG_IF(INFO, nfc_debug_enabled)
-      << StringPrintf("%s: Start to deregister NFC-F system on DH", fn);
-  {
-    SyncEventGuard guard(mRoutingEvent);
-    tNFA_STATUS nfaStat = NFA_CeDeregisterFelicaSystemCodeOnDH(handle);
-    if (nfaStat == NFA_STATUS_OK) {
-      mRoutingEvent.wait();
-      DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
-          "%s: Succeeded in deregistering NFC-F system on DH", fn);
-    } else {
-      LOG(ERROR) << StringPrintf("%s: Fail to deregister NFC-F system on DH",
-                                 fn);
-    }
-  }
-  if (mIsScbrSupported) {
-    map<int, uint16_t>::iterator it = mMapScbrHandle.find(handle);
+      << StringPrintf("%s: enter; %zu handles", fn, handles.size());
+
+  runPipelined(handles.size(), false, [&](size_t i) {
+    return NFA_CeDeregisterFelicaSystemCodeOnDH(handles[i]);
+  });
+  if (!mIsScbrSupported) return;
+
+  vector<uint16_t> systemCodes;
+  for (int handle : handles) {
     // find system code for given handle
-    if (it != mMapScbrHandle.end()) {
-      uint16_t systemCode = it->second;
-      mMapScbrHandle.erase(handle);
-      if (systemCode != 0) {
-        SyncEventGuard guard(mRoutingEvent);
-        tNFA_STATUS nfaStat = NFA_EeRemoveSystemCodeRouting(systemCode);
-        if (nfaStat == NFA_STATUS_OK) {
-          mRoutingEvent.wait();
-          DLOG_IF(INFO, nfc_debug_enabled) << StringPrintf(
-              "%s: Succeeded in deregistering system Code on DH", fn);
-        } else {
-          LOG(ERROR) << StringPrintf("%s: Fail to deregister system Code on DH",
-                                     fn);
-        }
-      }
+    map<int, uint16_t>::iterator it = mMapScbrHandle.find(handle);
+    if (it == mMapScbrHandle.end()) continue;
+    if (it->second != 0) systemCodes.push_back(it->second);
+    mMapScbrHandle.erase(it);
+  }
+  vector<int> removed = runPipelined(systemCodes.size(), false, [&](size_t i) {
+    return NFA_EeRemoveSystemCodeRouting(systemCodes[i]);
+  });
+  for (size_t i = 0; i < removed.size(); i++) {
+    if (!removed[i]) {
+      LOG(ERROR) << StringPrintf("%s: Fail to deregister system code 0x%04X",
+                                 fn, systemCodes[i]);
     }
   }
 }
@@ -1051,14 +1881,25 @@ void RoutingManager::nfcFCeCallback(uint8_t event,
     case NFA_CE_REGISTERED_EVT: {
       DLOG_IF(INFO, nfc_debug_enabled)
           << StringPrintf("%s: registerd event notified", fn);
-      routingManager.mNfcFOnDhHandle = eventData->ce_registered.handle;
       SyncEventGuard guard(routingManager.mRoutingEvent);
+      routingManager.mNfcFOnDhHandle = eventData->ce_registered.handle;
+      if (routingManager.mBatchActive) {
+        routingManager.mBatchResults.push_back(
+            eventData->ce_registered.status == NFA_STATUS_OK
+                ? eventData->ce_registered.handle
+                : NFA_HANDLE_INVALID);
+      }
+      routingManager.mRoutingEventCount++;
       routingManager.mRoutingEvent.notifyOne();
     } break;
     case NFA_CE_DEREGISTERED_EVT: {
       DLOG_IF(INFO, nfc_debug_enabled)
           << StringPrintf("%s: deregisterd event notified", fn);
       SyncEventGuard guard(routingManager.mRoutingEvent);
+      if (routingManager.mBatchActive) {
+        routingManager.mBatchResults.push_back(true);
+      }
+      routingManager.mRoutingEventCount++;
       routingManager.mRoutingEvent.notifyOne();
     } break;
     case NFA_CE_ACTIVATED_EVT: {
@@ -1181,6 +2022,87 @@ int RoutingManager::com_android_nfc_cardemulation_doGetAidMatchingMode(
   return getInstance().mAidMatchingMode;
 }
 
+jbyteArray
+RoutingManager::com_android_nfc_cardemulation_doCompactAidRoutingTable(
+    JNIEnv* e, jobject, jbyteArray packedAids, jint maxSize,
+    jint defaultRoute) {
+  vector<AidRoutingEntry> table;
+  {
+    ScopedByteArrayRO bytes(e, packedAids);
+    if (!unpackAidRoutingEntries(
+            reinterpret_cast<const uint8_t*>(bytes.get()), bytes.size(),
+            &table)) {
+      return NULL;
+    }
+  }
+  if (!getInstance().compactAidRoutingTable(&table, maxSize, defaultRoute)) {
+    return NULL;
+  }
+  vector<uint8_t> packed = packAidRoutingEntries(table);
+  jbyteArray packedJavaArray = e->NewByteArray(packed.size());
+  CHECK(packedJavaArray);
+  e->SetByteArrayRegion(packedJavaArray, 0, packed.size(),
+                        (jbyte*)packed.data());
+  return packedJavaArray;
+}
+
+void RoutingManager::com_android_nfc_cardemulation_doSetAidResolveTable(
+    JNIEnv* e, jobject, jbyteArray packedAids, jint generation) {
+  std::shared_ptr<const AidTrie> trie;
+  if (packedAids != NULL) {
+    ScopedByteArrayRO bytes(e, packedAids);
+    trie = AidTrie::build(reinterpret_cast<const uint8_t*>(bytes.get()),
+                          bytes.size(), generation);
+  }
+  // a NULL trie leaves every SELECT to the Java cache
+  std::atomic_store(&getInstance().mAidTrie, trie);
+}
+
+/*******************************************************************************
+**
+** Function:        com_android_nfc_cardemulation_doSetStaticResponses
+**
+** Description:     Replace the canned SELECT responses.  Entries are laid
+**                  out as [cmdLen][command][respLen, 2 octets][response].
+**                  e: JVM environment.
+**                  packedResponses: packed entries, or NULL to drop all.
+**                  generation: AID cache generation the entries belong to.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void RoutingManager::com_android_nfc_cardemulation_doSetStaticResponses(
+    JNIEnv* e, jobject, jbyteArray packedResponses, jint generation) {
+  std::shared_ptr<StaticResponses> table;
+  if (packedResponses != NULL) {
+    ScopedByteArrayRO bytes(e, packedResponses);
+    const uint8_t* packed = reinterpret_cast<const uint8_t*>(bytes.get());
+    size_t len = bytes.size();
+    table = std::make_shared<StaticResponses>();
+    table->generation = generation;
+    size_t offset = 0;
+    while (offset < len) {
+      size_t cmdLen = packed[offset];
+      if (len - offset < 1 + cmdLen + 2) break;
+      const uint8_t* cmd = &packed[offset + 1];
+      size_t respLen =
+          (packed[offset + 1 + cmdLen] << 8) | packed[offset + 2 + cmdLen];
+      const uint8_t* resp = &packed[offset + 3 + cmdLen];
+      if (len - offset - 3 - cmdLen < respLen) break;
+      table->responses[vector<uint8_t>(cmd, cmd + cmdLen)] =
+          vector<uint8_t>(resp, resp + respLen);
+      offset += 3 + cmdLen + respLen;
+    }
+    if (offset != len) {
+      LOG(ERROR) << StringPrintf("%s: truncated entry at %zu", __func__,
+                                 offset);
+      table.reset();
+    }
+  }
+  std::atomic_store(&getInstance().mStaticResponses,
+                    std::shared_ptr<const StaticResponses>(table));
+}
+
 int RoutingManager::
     com_android_nfc_cardemulation_doGetDefaultIsoDepRouteDestination(JNIEnv*) {
   return getInstance().mDefaultIsoDepRoute;
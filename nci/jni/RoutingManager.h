@@ -20,9 +20,12 @@
 #pragma once
 #include <vector>
 #include "NfcJniUtil.h"
+#include "AidTrie.h"
+#include "Completion.h"
 #include "RouteDataSet.h"
 #include "SyncEvent.h"
 
+#include <functional>
 #include <map>
 #include "nfa_api.h"
 #include "nfa_ee_api.h"
@@ -39,9 +42,38 @@ class RoutingManager {
   bool addAidRouting(const uint8_t* aid, uint8_t aidLen, int route, int aidInfo,
                      int power);
   bool removeAidRouting(const uint8_t* aid, uint8_t aidLen);
+  struct AidRoutingEntry {
+    std::vector<uint8_t> aid;
+    int route;
+    int aidInfo;
+    int power;
+  };
+  std::vector<bool> addAidRoutingList(
+      const std::vector<AidRoutingEntry>& entries);
+  bool applyAidRoutingTable(const std::vector<AidRoutingEntry>& entries,
+                            bool* changed);
+  static bool unpackAidRoutingEntries(const uint8_t* buf, size_t bufLen,
+                                      std::vector<AidRoutingEntry>* entries);
+  static std::vector<uint8_t> packAidRoutingEntries(
+      const std::vector<AidRoutingEntry>& entries);
   bool commitRouting();
+  void requestCommit();
+  void abortCommits();
+  void abortEeUpdate();
+  Mutex& getRfReconfigMutex() { return mRfReconfigMutex; }
+  const vector<uint8_t>& getOffHostRouteUicc() const {
+    return mOffHostRouteUicc;
+  }
+  const vector<uint8_t>& getOffHostRouteEse() const {
+    return mOffHostRouteEse;
+  }
+  vector<uint8_t> getDiscoveredNfceeIds();
+  void dump(int fd);
+  void notifyHceResponse();
   int registerT3tIdentifier(uint8_t* t3tId, uint8_t t3tIdLen);
   void deregisterT3tIdentifier(int handle);
+  vector<int> registerT3tIdentifiers(const vector<vector<uint8_t>>& t3tIds);
+  void deregisterT3tIdentifiers(const vector<int>& handles);
   void onNfccShutdown();
   int registerJniFunctions(JNIEnv* e);
   bool setNfcSecure(bool enable);
@@ -63,6 +95,24 @@ class RoutingManager {
   void updateDefaultProtocolRoute();
   void updateDefaultRoute();
   bool isTypeATypeBTechSupportedInEe(tNFA_HANDLE eeHandle);
+  uint8_t getAidPowerState(int route, int power);
+  void waitRoutingEvent();
+  vector<int> runPipelined(size_t count, int failResult,
+                           const std::function<tNFA_STATUS(size_t)>& issue);
+  bool eeUpdateNow();
+  void completeCommit(uint32_t generation, bool status, uint64_t startMs,
+                      bool async);
+  void runCommits();
+  static void* commitThread(void* arg);
+  bool compactAidRoutingTable(std::vector<AidRoutingEntry>* table,
+                              int maxSize, int defaultRoute);
+  bool hasAidPrefixConflict(const std::vector<AidRoutingEntry>& table,
+                            const std::vector<bool>& merged,
+                            const std::vector<uint8_t>& prefix, int route,
+                            int power);
+  int getAidFallbackRoute(const std::vector<AidRoutingEntry>& table,
+                          const std::vector<bool>& skip,
+                          const std::vector<uint8_t>& aid, int defaultRoute);
 
   // See AidRoutingManager.java for corresponding
   // AID_MATCHING_ constants
@@ -73,6 +123,8 @@ class RoutingManager {
   static const int AID_MATCHING_EXACT_OR_PREFIX = 0x01;
   // Every routing table entry is matched as a prefix
   static const int AID_MATCHING_PREFIX_ONLY = 0x02;
+  // Every routing table entry can be matched either exact or prefix or subset
+  static const int AID_MATCHING_EXACT_OR_SUBSET_OR_PREFIX = 0x03;
 
   static void nfaEeCallback(tNFA_EE_EVT event, tNFA_EE_CBACK_DATA* eventData);
   static void stackCallback(uint8_t event, tNFA_CONN_EVT_DATA* eventData);
@@ -87,6 +139,15 @@ class RoutingManager {
   static jbyteArray com_android_nfc_cardemulation_doGetOffHostEseDestination(
       JNIEnv* e);
   static int com_android_nfc_cardemulation_doGetAidMatchingMode(JNIEnv* e);
+  static jbyteArray com_android_nfc_cardemulation_doCompactAidRoutingTable(
+      JNIEnv* e, jobject o, jbyteArray packedAids, jint maxSize,
+      jint defaultRoute);
+  static void com_android_nfc_cardemulation_doSetAidResolveTable(
+      JNIEnv* e, jobject o, jbyteArray packedAids, jint generation);
+  static void com_android_nfc_cardemulation_doSetStaticResponses(
+      JNIEnv* e, jobject o, jbyteArray packedResponses, jint generation);
+  bool sendStaticResponse(const uint8_t* data, uint32_t dataLen, int aidIndex,
+                          int aidGeneration);
   static int com_android_nfc_cardemulation_doGetDefaultIsoDepRouteDestination(
       JNIEnv* e);
 
@@ -114,14 +175,60 @@ class RoutingManager {
   bool mEeInfoChanged;
   bool mReceivedEeInfo;
   bool mAidRoutingConfigured;
+  // completions recorded while runPipelined() is running
+  bool mBatchActive;
+  vector<int> mBatchResults;
+  // completions signalled on mRoutingEvent; guarded by it
+  uint32_t mRoutingEventCount;
+  // AIDs currently held by NFA, keyed by AID; power holds the power state
+  // that was sent, so a secure NFC toggle shows up as a change.  Guarded by
+  // mRoutingEvent.
+  map<vector<uint8_t>, AidRoutingEntry> mRoutedAids;
+  // resolved AID cache of the service; replaced as a whole with
+  // std::atomic_store() and read with std::atomic_load()
+  std::shared_ptr<const AidTrie> mAidTrie;
+  // canned responses to SELECT commands, keyed by the command without Le;
+  // only used while mAidTrie has the same generation.  Replaced like mAidTrie.
+  struct StaticResponses {
+    int generation;
+    map<vector<uint8_t>, vector<uint8_t>> responses;
+  };
+  std::shared_ptr<const StaticResponses> mStaticResponses;
   tNFA_EE_CBACK_DATA mCbEventData;
   tNFA_EE_DISCOVER_REQ mEeInfo;
   tNFA_TECHNOLOGY_MASK mSeTechMask;
   static const JNINativeMethod sMethods[];
-  SyncEvent mEeRegisterEvent;
+  Completion<tNFA_STATUS> mEeRegistered;
   SyncEvent mRoutingEvent;
-  SyncEvent mEeUpdateEvent;
+  Completion<tNFA_STATUS> mEeUpdated;
   SyncEvent mEeInfoEvent;
-  SyncEvent mEeSetModeEvent;
+  Completion<tNFA_STATUS> mEeModeSet;
   SyncEvent mEePwrAndLinkCtrlEvent;
+
+  // Asynchronous commit state; guarded by mCommitEvent.  Generations are
+  // handed out by requestCommit() and completed in order.
+  SyncEvent mCommitEvent;
+  uint32_t mCommitRequested;
+  uint32_t mCommitDone;
+  bool mCommitEnabled;
+  bool mCommitThreadStarted;
+  bool mHceActive;
+  uint32_t mCommitCount;
+  uint32_t mCoalescedCount;
+  uint32_t mLastCommitMs;
+  uint32_t mMaxCommitMs;
+  // serializes RF discovery stop/start between commits and discovery changes
+  Mutex mRfReconfigMutex;
+
+  // HCE command-to-response latency; guarded by mHceStatsMutex.
+  // mHceRequestUs is the delivery time of the unanswered command, or 0.
+  Mutex mHceStatsMutex;
+  uint64_t mHceRequestUs;
+  uint32_t mHceApduCount;
+  uint32_t mHceResponseCount;
+  uint32_t mHceUnansweredCount;
+  uint32_t mHceLastLatencyUs;
+  uint32_t mHceMaxLatencyUs;
+  uint64_t mHceTotalLatencyUs;
+  uint32_t mHceStaticResponseCount;
 };
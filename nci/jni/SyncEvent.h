@@ -71,6 +71,46 @@ class SyncEvent {
     return retVal;
   }
 
+  /*******************************************************************************
+  **
+  ** Function:        waitFor
+  **
+  ** Description:     Block the thread until a condition holds.  The caller
+  **                  must change the condition while holding the event, so
+  **                  a notification sent before this call is not lost and a
+  **                  spurious wakeup only re-tests the condition.
+  **                  pred: Returns true once the condition holds.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  template <class Predicate>
+  void waitFor(Predicate pred) {
+    while (!pred()) mCondVar.wait(mMutex);
+  }
+
+  /*******************************************************************************
+  **
+  ** Function:        waitFor
+  **
+  ** Description:     Block the thread until a condition holds or the time
+  **                  runs out.  Wakeups that leave the condition false do
+  **                  not restart the timeout.
+  **                  millisec: Timeout in milliseconds.
+  **                  pred: Returns true once the condition holds.
+  **
+  ** Returns:         Final value of the condition.
+  **
+  *******************************************************************************/
+  template <class Predicate>
+  bool waitFor(long millisec, Predicate pred) {
+    const struct timespec deadline = CondVar::deadline(millisec);
+    while (!pred()) {
+      if (!mCondVar.waitUntil(mMutex, deadline)) return pred();
+    }
+    return true;
+  }
+
   /*******************************************************************************
   **
   ** Function:        notifyOne
@@ -83,6 +123,17 @@ class SyncEvent {
   *******************************************************************************/
   void notifyOne() { mCondVar.notifyOne(); }
 
+  /*******************************************************************************
+  **
+  ** Function:        notifyAll
+  **
+  ** Description:     Notify all blocked threads that the event has occured.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void notifyAll() { mCondVar.notifyAll(); }
+
   /*******************************************************************************
   **
   ** Function:        end
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Decode BER-TLV and simple-TLV encoded buffers in place.
+ */
+#include "TlvReader.h"
+
+namespace {
+const size_t MAX_TAG_OCTETS = 4;
+const size_t MAX_LENGTH_OCTETS = 4;
+}  // namespace
+
+/*******************************************************************************
+**
+** Function:        decodeLength
+**
+** Description:     Decode a BER length field.
+**                  buf: start of the length field.
+**                  len: octets available at buf.
+**                  length: receives the decoded length.
+**
+** Returns:         Size of the length field, or 0 if it is malformed.
+**
+*******************************************************************************/
+size_t BerTlvReader::decodeLength(const uint8_t* buf, size_t len,
+                                  size_t* length) {
+  if (len == 0) return 0;
+  if (buf[0] < 0x80) {
+    *length = buf[0];
+    return 1;
+  }
+  // 0x80 is the indefinite form, which no caller expects
+  size_t numOctets = buf[0] & 0x7F;
+  if (numOctets == 0 || numOctets > MAX_LENGTH_OCTETS || numOctets >= len) {
+    return 0;
+  }
+  size_t value = 0;
+  for (size_t i = 1; i <= numOctets; i++) value = (value << 8) | buf[i];
+  *length = value;
+  return 1 + numOctets;
+}
+
+/*******************************************************************************
+**
+** Function:        next
+**
+** Description:     Decode the next TLV.
+**                  tlv: receives the TLV.
+**
+** Returns:         True if a TLV was decoded; false at the end of the
+**                  buffer or if the next TLV is malformed, see error().
+**
+*******************************************************************************/
+bool BerTlvReader::next(Tlv* tlv) {
+  if (mError || mOffset >= mLen) return false;
+  const uint8_t* p = &mBuf[mOffset];
+  size_t avail = mLen - mOffset;
+
+  // a low tag number of 0x1F means the number follows in base 128
+  uint32_t tag = p[0];
+  size_t tagLen = 1;
+  if ((p[0] & 0x1F) == 0x1F) {
+    do {
+      if (tagLen >= avail || tagLen >= MAX_TAG_OCTETS) {
+        mError = true;
+        return false;
+      }
+      tag = (tag << 8) | p[tagLen];
+    } while (p[tagLen++] & 0x80);
+  }
+
+  size_t length = 0;
+  size_t lengthLen = decodeLength(p + tagLen, avail - tagLen, &length);
+  if (lengthLen == 0 || avail - tagLen - lengthLen < length) {
+    mError = true;
+    return false;
+  }
+  tlv->tag = tag;
+  tlv->value = p + tagLen + lengthLen;
+  tlv->length = length;
+  mOffset += tagLen + lengthLen + length;
+  return true;
+}
@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Decode BER-TLV and simple-TLV encoded buffers in place.
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*****************************************************************************
+**
+**  Name:           Tlv
+**
+**  Description:    One decoded TLV.  value points into the decoded buffer,
+**                  so it is only valid as long as that buffer is.
+**
+*****************************************************************************/
+struct Tlv {
+  uint32_t tag;
+  const uint8_t* value;
+  size_t length;
+};
+
+// Tags of the parameters of HCI EVT_TRANSACTION, ETSI TS 102 622.
+namespace HciTransactionTag {
+constexpr uint32_t AID = 0x81;
+constexpr uint32_t PARAMETERS = 0x82;
+}  // namespace HciTransactionTag
+
+/*****************************************************************************
+**
+**  Name:           BerTlvReader
+**
+**  Description:    Walk the BER-TLVs of a buffer, as in ISO/IEC 7816-4.
+**                  Tags of up to 4 octets and lengths of up to 4 octets
+**                  are decoded; the indefinite length form is rejected.
+**
+*****************************************************************************/
+class BerTlvReader {
+ public:
+  BerTlvReader(const uint8_t* buf, size_t len)
+      : mBuf(buf), mLen(len), mOffset(0), mError(false) {}
+
+  /*******************************************************************************
+  **
+  ** Function:        next
+  **
+  ** Description:     Decode the next TLV.
+  **                  tlv: receives the TLV.
+  **
+  ** Returns:         True if a TLV was decoded; false at the end of the
+  **                  buffer or if the next TLV is malformed, see error().
+  **
+  *******************************************************************************/
+  bool next(Tlv* tlv);
+
+  /*******************************************************************************
+  **
+  ** Function:        decodeLength
+  **
+  ** Description:     Decode a BER length field.
+  **                  buf: start of the length field.
+  **                  len: octets available at buf.
+  **                  length: receives the decoded length.
+  **
+  ** Returns:         Size of the length field, or 0 if it is malformed.
+  **
+  *******************************************************************************/
+  static size_t decodeLength(const uint8_t* buf, size_t len, size_t* length);
+
+  bool error() const { return mError; }
+  size_t offset() const { return mOffset; }
+
+ private:
+  const uint8_t* mBuf;
+  size_t mLen;
+  size_t mOffset;
+  bool mError;
+};
+
+/*****************************************************************************
+**
+**  Name:           NciParamTlvFormat
+**
+**  Description:    NCI configuration parameters: one octet tags, each with
+**                  a one octet length.
+**
+*****************************************************************************/
+struct NciParamTlvFormat {
+  static constexpr bool THREE_OCTET_LENGTH = false;
+
+  static constexpr bool hasLength(uint8_t) { return true; }
+  static constexpr bool isTerminator(uint8_t) { return false; }
+};
+
+/*****************************************************************************
+**
+**  Name:           SimpleTlvReader
+**
+**  Description:    Walk the simple-TLVs of a buffer; Format says which tags
+**                  carry a length, whether a length of 0xFF is followed by
+**                  two more octets, as in ISO/IEC 7816-4, and which tag
+**                  ends the buffer.
+**
+*****************************************************************************/
+template <class Format>
+class SimpleTlvReader {
+ public:
+  SimpleTlvReader(const uint8_t* buf, size_t len)
+      : mBuf(buf), mLen(len), mOffset(0), mError(false) {}
+
+  /*******************************************************************************
+  **
+  ** Function:        next
+  **
+  ** Description:     Decode the next TLV.  A terminator is returned like
+  **                  any other TLV, and nothing is decoded after it.
+  **                  tlv: receives the TLV.
+  **
+  ** Returns:         True if a TLV was decoded; false at the end of the
+  **                  buffer or if the next TLV is malformed, see error().
+  **
+  *******************************************************************************/
+  bool next(Tlv* tlv) {
+    if (mError || mOffset >= mLen) return false;
+    const uint8_t* p = &mBuf[mOffset];
+    size_t avail = mLen - mOffset;
+    uint8_t tag = p[0];
+    size_t header = 1;
+    size_t length = 0;
+    if (Format::hasLength(tag)) {
+      if (avail < 2) return fail();
+      length = p[1];
+      header = 2;
+      if (Format::THREE_OCTET_LENGTH && length == 0xFF) {
+        if (avail < 4) return fail();
+        length = (p[2] << 8) | p[3];
+        header = 4;
+      }
+      if (avail - header < length) return fail();
+    }
+    tlv->tag = tag;
+    tlv->value = p + header;
+    tlv->length = length;
+    mOffset = Format::isTerminator(tag) ? mLen : mOffset + header + length;
+    return true;
+  }
+
+  bool error() const { return mError; }
+  size_t offset() const { return mOffset; }
+
+ private:
+  bool fail() {
+    mError = true;
+    return false;
+  }
+
+  const uint8_t* mBuf;
+  size_t mLen;
+  size_t mOffset;
+  bool mError;
+};
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <unordered_map>
+
+#include "Mutex.h"
+
+// Connection lookup of the LLCP data path, as PeerToPeer::findConnection
+// does it: a map searched under the shared TimedMutex.  Reports how long
+// each lookup holds the lock that every other connection needs, and how
+// often a lookup has to wait for it, with up to four threads.
+
+namespace {
+const int NUM_CONNS = 16;
+
+typedef std::unordered_map<uint32_t, std::shared_ptr<int>> ConnMap;
+
+TimedMutex sMutex;
+ConnMap sLockedConns;
+
+void setUp() {
+  sLockedConns.clear();
+  for (int i = 0; i < NUM_CONNS; i++) {
+    sLockedConns[0x100 + i] = std::make_shared<int>(i);
+  }
+}
+}  // namespace
+
+static void BM_LookupUnderMutex(benchmark::State& state) {
+  if (state.thread_index() == 0) setUp();
+  uint32_t handle = 0x100 + state.thread_index();
+  for (auto _ : state) {
+    std::shared_ptr<int> conn;
+    {
+      TimedMutex::Autolock lock(sMutex);
+      auto it = sLockedConns.find(handle);
+      if (it != sLockedConns.end()) conn = it->second;
+    }
+    benchmark::DoNotOptimize(conn);
+  }
+  if (state.thread_index() == 0) {
+    TimedMutex::Stats stats = sMutex.getStats();
+    state.counters["hold_ns"] =
+        stats.holdSamples ? (double)stats.holdNs / stats.holdSamples : 0;
+    state.counters["contended"] =
+        stats.acquisitions ? (double)stats.contended / stats.acquisitions : 0;
+  }
+}
+BENCHMARK(BM_LookupUnderMutex)->ThreadRange(1, 4)->UseRealTime();
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+#include "DataQueue.h"
+
+// One record through the queue, and a burst of records queued before the
+// consumer catches up, for record sizes around the LLCP MIU.
+
+static void BM_DataQueueRoundTrip(benchmark::State& state) {
+  DataQueue queue;
+  std::vector<uint8_t> data(state.range(0));
+  std::vector<uint8_t> buffer(data.size());
+  uint16_t len;
+  for (auto _ : state) {
+    queue.enqueue(data.data(), data.size());
+    queue.dequeue(buffer.data(), buffer.size(), len);
+    benchmark::DoNotOptimize(buffer.data());
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_DataQueueRoundTrip)->Arg(16)->Arg(128)->Arg(2175);
+
+static void BM_DataQueueBurst(benchmark::State& state) {
+  const int BURST = 8;
+  DataQueue queue;
+  std::vector<uint8_t> data(state.range(0));
+  std::vector<uint8_t> buffer(data.size());
+  uint16_t len;
+  for (auto _ : state) {
+    for (int i = 0; i < BURST; i++) queue.enqueue(data.data(), data.size());
+    for (int i = 0; i < BURST; i++) {
+      queue.dequeue(buffer.data(), buffer.size(), len);
+    }
+    benchmark::DoNotOptimize(buffer.data());
+  }
+  state.SetBytesProcessed(state.iterations() * BURST * data.size());
+}
+BENCHMARK(BM_DataQueueBurst)->Arg(16)->Arg(128)->Arg(1024);
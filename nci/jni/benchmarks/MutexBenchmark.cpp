@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include "Mutex.h"
+
+// Cost of a short critical section under a plain Mutex and under the
+// TimedMutex of PeerToPeer, uncontended (1 thread) and contended.
+
+namespace {
+Mutex sMutex;
+TimedMutex sTimedMutex;
+uint64_t sCounter;
+}  // namespace
+
+static void BM_Mutex(benchmark::State& state) {
+  for (auto _ : state) {
+    Mutex::Autolock lock(sMutex);
+    benchmark::DoNotOptimize(++sCounter);
+  }
+}
+BENCHMARK(BM_Mutex)->ThreadRange(1, 4)->UseRealTime();
+
+static void BM_TimedMutex(benchmark::State& state) {
+  for (auto _ : state) {
+    TimedMutex::Autolock lock(sTimedMutex);
+    benchmark::DoNotOptimize(++sCounter);
+  }
+}
+BENCHMARK(BM_TimedMutex)->ThreadRange(1, 4)->UseRealTime();
+
+BENCHMARK_MAIN();
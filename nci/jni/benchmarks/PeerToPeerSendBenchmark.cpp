@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "JavaClassConstants.h"
+#include "PeerToPeer.h"
+#include "llcp_defs.h"
+#include "nfc_config.h"
+
+// PeerToPeer::send() against a fake stack.  libnfc-nci is not linked: the
+// NFA_P2p functions below take the place of its P2P API, and connection
+// events are delivered on a thread of their own, as the stack does.  The
+// stack takes data while it has credit and then reports congestion until
+// a peer thread, standing for the remote device, grants more.
+
+bool nfc_debug_enabled = false;
+
+namespace android {
+jmethodID gCachedNfcManagerNotifyLlcpLinkActivation;
+jmethodID gCachedNfcManagerNotifyLlcpLinkDeactivated;
+jmethodID gCachedNfcManagerNotifyLlcpFirstPacketReceived;
+bool isDiscoveryStarted() { return false; }
+void startRfDiscovery(bool) {}
+void nativeNfcTag_registerNdefTypeHandler() {}
+void nativeNfcTag_deregisterNdefTypeHandler() {}
+JNIEnv* nfc_jni_attach_thread(JavaVM*) { return NULL; }
+}  // namespace android
+
+bool NfcConfig::hasKey(const std::string&) { return false; }
+unsigned NfcConfig::getUnsigned(const std::string&) { return 0; }
+unsigned NfcConfig::getUnsigned(const std::string&, unsigned defaultValue) {
+  return defaultValue;
+}
+
+namespace {
+const tNFA_HANDLE CLIENT_HANDLE = 0x0501;
+const tNFA_HANDLE CONN_HANDLE = 0x0502;
+const size_t NO_CONGESTION = SIZE_MAX;
+
+tNFA_P2P_CBACK* sClientCallback;
+uint16_t sRemoteMiu;
+
+// the stack side, protected by sStackMutex
+std::mutex sStackMutex;
+std::condition_variable sStackCond;
+size_t sCredit = NO_CONGESTION;
+bool sCongested = false;
+bool sPeerStop = false;
+
+void deliver(tNFA_P2P_EVT event, tNFA_P2P_EVT_DATA data) {
+  std::thread([event, data]() mutable { sClientCallback(event, &data); })
+      .detach();
+}
+
+// the remote device: grant window bytes each time the stack is congested
+void runPeer(size_t window) {
+  std::unique_lock<std::mutex> lock(sStackMutex);
+  for (;;) {
+    sStackCond.wait(lock, [] { return sCongested || sPeerStop; });
+    if (sPeerStop) return;
+    sCredit = window;
+    sCongested = false;
+    lock.unlock();
+    tNFA_P2P_EVT_DATA data;
+    data.congest.handle = CONN_HANDLE;
+    data.congest.is_congested = FALSE;
+    data.congest.link_type = NFA_P2P_DLINK_TYPE;
+    sClientCallback(NFA_P2P_CONGEST_EVT, &data);
+    lock.lock();
+  }
+}
+
+PeerToPeer::tJNI_HANDLE connect(uint16_t remoteMiu) {
+  PeerToPeer& p2p = PeerToPeer::getInstance();
+  sRemoteMiu = remoteMiu;
+  PeerToPeer::tJNI_HANDLE jniHandle = p2p.allocJniHandle();
+  if (!p2p.createClient(jniHandle, LLCP_MAX_MIU, 7) ||
+      !p2p.connectConnOriented(jniHandle, "urn:nfc:sn:snep")) {
+    return 0;
+  }
+  return jniHandle;
+}
+}  // namespace
+
+tNFA_STATUS NFA_P2pRegisterClient(tNFA_P2P_LINK_TYPE, tNFA_P2P_CBACK* cback) {
+  sClientCallback = cback;
+  tNFA_P2P_EVT_DATA data;
+  data.reg_client.client_handle = CLIENT_HANDLE;
+  deliver(NFA_P2P_REG_CLIENT_EVT, data);
+  return NFA_STATUS_OK;
+}
+
+tNFA_STATUS NFA_P2pConnectByName(tNFA_HANDLE, char*, uint16_t, uint8_t) {
+  tNFA_P2P_EVT_DATA data;
+  data.connected.client_handle = CLIENT_HANDLE;
+  data.connected.conn_handle = CONN_HANDLE;
+  data.connected.remote_sap = 0x04;
+  data.connected.remote_miu = sRemoteMiu;
+  data.connected.remote_rw = 7;
+  deliver(NFA_P2P_CONNECTED_EVT, data);
+  return NFA_STATUS_OK;
+}
+
+tNFA_STATUS NFA_P2pDisconnect(tNFA_HANDLE handle, bool) {
+  tNFA_P2P_EVT_DATA data;
+  data.disc.handle = handle;
+  data.disc.reason = NFA_P2P_DISC_REASON_LOCAL_INITITATE;
+  deliver(NFA_P2P_DISC_EVT, data);
+  return NFA_STATUS_OK;
+}
+
+tNFA_STATUS NFA_P2pSendData(tNFA_HANDLE, uint16_t length, uint8_t* data) {
+  std::lock_guard<std::mutex> lock(sStackMutex);
+  if (sCredit < length) {
+    sCongested = true;
+    sStackCond.notify_all();
+    return NFA_STATUS_CONGESTED;
+  }
+  if (sCredit != NO_CONGESTION) sCredit -= length;
+  benchmark::DoNotOptimize(data[length - 1]);
+  return NFA_STATUS_OK;
+}
+
+tNFA_STATUS NFA_P2pRegisterServer(uint8_t, tNFA_P2P_LINK_TYPE, char*,
+                                  tNFA_P2P_CBACK*) {
+  return NFA_STATUS_FAILED;
+}
+tNFA_STATUS NFA_P2pAcceptConn(tNFA_HANDLE, uint16_t, uint8_t) {
+  return NFA_STATUS_FAILED;
+}
+tNFA_STATUS NFA_P2pRejectConn(tNFA_HANDLE) { return NFA_STATUS_FAILED; }
+tNFA_STATUS NFA_P2pConnectBySap(tNFA_HANDLE, uint8_t, uint16_t, uint8_t) {
+  return NFA_STATUS_FAILED;
+}
+tNFA_STATUS NFA_P2pDeregister(tNFA_HANDLE) { return NFA_STATUS_FAILED; }
+tNFA_STATUS NFA_P2pReadData(tNFA_HANDLE, uint32_t, uint32_t* length,
+                            uint8_t*, bool* more) {
+  *length = 0;
+  *more = false;
+  return NFA_STATUS_FAILED;
+}
+tNFA_STATUS NFA_P2pSetLLCPConfig(uint16_t, uint8_t, uint8_t, uint8_t,
+                                 uint16_t, uint16_t, uint16_t, uint16_t,
+                                 uint16_t) {
+  return NFA_STATUS_FAILED;
+}
+tNFA_STATUS NFA_SetP2pListenTech(tNFA_TECHNOLOGY_MASK) {
+  return NFA_STATUS_FAILED;
+}
+
+// The stack takes every PDU: the cost of send() itself, cut into PDUs of
+// the remote MIU.
+static void BM_Send(benchmark::State& state) {
+  size_t len = state.range(0);
+  PeerToPeer::tJNI_HANDLE jniHandle = connect(state.range(1));
+  if (jniHandle == 0) {
+    state.SkipWithError("connect failed");
+    return;
+  }
+  std::vector<uint8_t> buffer(len);
+  for (auto _ : state) {
+    if (!PeerToPeer::getInstance().send(jniHandle, buffer.data(), len)) {
+      state.SkipWithError("send failed");
+      break;
+    }
+  }
+  PeerToPeer::getInstance().disconnectConnOriented(jniHandle);
+  state.SetBytesProcessed(state.iterations() * len);
+}
+BENCHMARK(BM_Send)
+    ->Args({128, 128})
+    ->Args({1024, 128})
+    ->Args({1024, LLCP_MAX_MIU})
+    ->Args({8192, LLCP_MAX_MIU});
+
+// The peer grants one window at a time, so data is queued while the stack
+// is congested and drained on each uncongestion event.
+static void BM_SendCongested(benchmark::State& state) {
+  size_t len = state.range(0);
+  {
+    std::lock_guard<std::mutex> lock(sStackMutex);
+    sCredit = state.range(2);
+    sCongested = false;
+    sPeerStop = false;
+  }
+  std::thread peer(runPeer, (size_t)state.range(2));
+  PeerToPeer::tJNI_HANDLE jniHandle = connect(state.range(1));
+  std::vector<uint8_t> buffer(len);
+  for (auto _ : state) {
+    if (jniHandle == 0 ||
+        !PeerToPeer::getInstance().send(jniHandle, buffer.data(), len)) {
+      state.SkipWithError("send failed");
+      break;
+    }
+  }
+  if (jniHandle != 0) {
+    PeerToPeer::getInstance().disconnectConnOriented(jniHandle);
+  }
+  {
+    std::lock_guard<std::mutex> lock(sStackMutex);
+    sCredit = NO_CONGESTION;
+    sPeerStop = true;
+    sStackCond.notify_all();
+  }
+  peer.join();
+  state.SetBytesProcessed(state.iterations() * len);
+}
+BENCHMARK(BM_SendCongested)
+    ->Args({1024, 128, 896})
+    ->Args({1024, LLCP_MAX_MIU, 4096})
+    ->UseRealTime();
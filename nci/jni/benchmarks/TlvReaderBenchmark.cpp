@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+#include "TlvReader.h"
+
+// Decoding of HCI EVT_TRANSACTION and of an NCI GET_CONFIG response with
+// TlvReader, against the code the readers replaced, which is kept here.
+
+namespace {
+// getDataFromBerTlv() of HciEventManager, before TlvReader
+std::vector<uint8_t> legacyGetDataFromBerTlv(std::vector<uint8_t> berTlv) {
+  if (berTlv.empty()) {
+    return std::vector<uint8_t>();
+  }
+  size_t lengthTag = berTlv[0];
+  if (lengthTag < 0x80 && berTlv.size() == (lengthTag + 1)) {
+    return std::vector<uint8_t>(berTlv.begin() + 1, berTlv.end());
+  } else if (lengthTag == 0x81 && berTlv.size() > 2) {
+    size_t length = berTlv[1];
+    if ((length + 2) == berTlv.size()) {
+      return std::vector<uint8_t>(berTlv.begin() + 2, berTlv.end());
+    }
+  } else if (lengthTag == 0x82 && berTlv.size() > 3) {
+    size_t length = ((berTlv[1] << 8) | berTlv[2]);
+    if ((length + 3) == berTlv.size()) {
+      return std::vector<uint8_t>(berTlv.begin() + 3, berTlv.end());
+    }
+  } else if (lengthTag == 0x83 && berTlv.size() > 4) {
+    size_t length = (berTlv[1] << 16) | (berTlv[2] << 8) | berTlv[3];
+    if ((length + 4) == berTlv.size()) {
+      return std::vector<uint8_t>(berTlv.begin() + 4, berTlv.end());
+    }
+  } else if (lengthTag == 0x84 && berTlv.size() > 5) {
+    size_t length =
+        (berTlv[1] << 24) | (berTlv[2] << 16) | (berTlv[3] << 8) | berTlv[4];
+    if ((length + 5) == berTlv.size()) {
+      return std::vector<uint8_t>(berTlv.begin() + 5, berTlv.end());
+    }
+  }
+  return std::vector<uint8_t>();
+}
+
+// EVT_TRANSACTION handling of HciEventManager::nfaHciCallback(), before
+// TlvReader: the AID and the parameters, as copies
+bool legacyDecodeTransaction(const uint8_t* buff, uint32_t buffLength,
+                             std::vector<uint8_t>* aid,
+                             std::vector<uint8_t>* data) {
+  std::vector<uint8_t> event_buff(buff, buff + buffLength);
+  if (buffLength <= 3 || event_buff[0] != 0x81) return false;
+  uint32_t aidlen = event_buff[1];
+  if (aidlen >= (buffLength - 1)) return false;
+  aid->assign(event_buff.begin() + 2, event_buff.begin() + aidlen + 2);
+  int32_t berTlvStart = aidlen + 2 + 1;
+  int32_t berTlvLen = buffLength - berTlvStart;
+  data->clear();
+  if (berTlvLen > 0 && event_buff[2 + aidlen] == 0x82) {
+    std::vector<uint8_t> berTlv(event_buff.begin() + berTlvStart,
+                                event_buff.end());
+    *data = legacyGetDataFromBerTlv(berTlv);
+  }
+  return true;
+}
+
+// EVT_TRANSACTION with a 16 octet AID and parameters of the given length
+std::vector<uint8_t> makeTransaction(size_t paramsLen) {
+  std::vector<uint8_t> evt = {0x81, 16};
+  for (int i = 0; i < 16; i++) evt.push_back(0xA0 + i);
+  evt.push_back(0x82);
+  if (paramsLen < 0x80) {
+    evt.push_back(paramsLen);
+  } else if (paramsLen < 0x100) {
+    evt.push_back(0x81);
+    evt.push_back(paramsLen);
+  } else {
+    evt.push_back(0x82);
+    evt.push_back(paramsLen >> 8);
+    evt.push_back(paramsLen & 0xFF);
+  }
+  evt.resize(evt.size() + paramsLen, 0x5A);
+  return evt;
+}
+
+// Parameters of a GET_CONFIG response, as copied to sConfig: their number,
+// then the parameters, LF_T3T_MAX (0x52) last
+std::vector<uint8_t> makeConfigResponse(size_t numParams) {
+  std::vector<uint8_t> rsp = {(uint8_t)numParams};
+  for (size_t i = 1; i < numParams; i++) {
+    rsp.insert(rsp.end(), {(uint8_t)(0x30 + i), 2, 0x01, 0x02});
+  }
+  rsp.insert(rsp.end(), {0x52, 1, 0x0F});
+  return rsp;
+}
+}  // namespace
+
+static void BM_HciTransactionLegacy(benchmark::State& state) {
+  std::vector<uint8_t> evt = makeTransaction(state.range(0));
+  std::vector<uint8_t> aid;
+  std::vector<uint8_t> data;
+  for (auto _ : state) {
+    legacyDecodeTransaction(evt.data(), evt.size(), &aid, &data);
+    benchmark::DoNotOptimize(data.data());
+  }
+  state.SetBytesProcessed(state.iterations() * evt.size());
+}
+BENCHMARK(BM_HciTransactionLegacy)->Arg(8)->Arg(200)->Arg(1024);
+
+static void BM_HciTransactionTlvReader(benchmark::State& state) {
+  std::vector<uint8_t> evt = makeTransaction(state.range(0));
+  for (auto _ : state) {
+    BerTlvReader reader(evt.data(), evt.size());
+    Tlv aid;
+    Tlv params = {0, NULL, 0};
+    reader.next(&aid);
+    if (reader.offset() < evt.size() &&
+        evt[reader.offset()] == HciTransactionTag::PARAMETERS) {
+      reader.next(&params);
+    }
+    benchmark::DoNotOptimize(aid.value);
+    benchmark::DoNotOptimize(params.value);
+  }
+  state.SetBytesProcessed(state.iterations() * evt.size());
+}
+BENCHMARK(BM_HciTransactionTlvReader)->Arg(8)->Arg(200)->Arg(1024);
+
+// The old LF_T3T_MAX check read a fixed offset, right only when the
+// parameter is the sole one of the response
+static void BM_ConfigLfT3tMaxLegacy(benchmark::State& state) {
+  std::vector<uint8_t> rsp = makeConfigResponse(1);
+  for (auto _ : state) {
+    uint8_t lfT3tMax = 0;
+    if (rsp.size() >= 4 || rsp[1] == 0x52) lfT3tMax = rsp[3];
+    benchmark::DoNotOptimize(lfT3tMax);
+  }
+}
+BENCHMARK(BM_ConfigLfT3tMaxLegacy);
+
+static void BM_ConfigLfT3tMaxTlvReader(benchmark::State& state) {
+  std::vector<uint8_t> rsp = makeConfigResponse(state.range(0));
+  for (auto _ : state) {
+    uint8_t lfT3tMax = 0;
+    SimpleTlvReader<NciParamTlvFormat> reader(&rsp[1], rsp.size() - 1);
+    Tlv param;
+    while (reader.next(&param)) {
+      if (param.tag == 0x52 && param.length >= 1) lfT3tMax = param.value[0];
+    }
+    benchmark::DoNotOptimize(lfT3tMax);
+  }
+}
+BENCHMARK(BM_ConfigLfT3tMaxTlvReader)->Arg(1)->Arg(8);
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "TlvReader.h"
+
+namespace {
+// simple-TLVs with 0xFF extended lengths, ISO/IEC 7816-4
+struct ExtendedTlvFormat {
+  static constexpr bool THREE_OCTET_LENGTH = true;
+
+  static constexpr bool hasLength(uint8_t tag) { return tag != 0x00; }
+  static constexpr bool isTerminator(uint8_t) { return false; }
+};
+
+template <class Reader>
+void walk(const uint8_t* data, size_t size) {
+  Reader reader(data, size);
+  Tlv tlv;
+  size_t offset = 0;
+  while (reader.next(&tlv)) {
+    // every value lies inside the buffer, and the reader moves forward
+    if (tlv.value < data || tlv.length > size ||
+        tlv.value + tlv.length > data + size || reader.offset() <= offset) {
+      __builtin_trap();
+    }
+    offset = reader.offset();
+  }
+}
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  walk<BerTlvReader>(data, size);
+  walk<SimpleTlvReader<NciParamTlvFormat>>(data, size);
+  walk<SimpleTlvReader<ExtendedTlvFormat>>(data, size);
+  return 0;
+}
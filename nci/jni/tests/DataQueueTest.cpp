@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "DataQueue.h"
+
+namespace {
+std::vector<uint8_t> record(size_t len, uint8_t first) {
+  std::vector<uint8_t> data(len);
+  for (size_t i = 0; i < len; i++) data[i] = first + i;
+  return data;
+}
+}  // namespace
+
+TEST(DataQueueTest, StartsEmpty) {
+  DataQueue queue(16);
+  uint8_t buffer[16];
+  uint16_t len = 0;
+
+  EXPECT_TRUE(queue.isEmpty());
+  EXPECT_FALSE(queue.dequeue(buffer, sizeof(buffer), len));
+  EXPECT_EQ(14u, queue.freeSpace());
+}
+
+TEST(DataQueueTest, KeepsRecordsInOrder) {
+  DataQueue queue(64);
+  std::vector<uint8_t> a = record(3, 0x10);
+  std::vector<uint8_t> b = record(5, 0x20);
+  ASSERT_TRUE(queue.enqueue(a.data(), a.size()));
+  ASSERT_TRUE(queue.enqueue(b.data(), b.size()));
+
+  uint8_t buffer[16];
+  uint16_t len = 0;
+  ASSERT_TRUE(queue.dequeue(buffer, sizeof(buffer), len));
+  EXPECT_EQ(a, std::vector<uint8_t>(buffer, buffer + len));
+  ASSERT_TRUE(queue.dequeue(buffer, sizeof(buffer), len));
+  EXPECT_EQ(b, std::vector<uint8_t>(buffer, buffer + len));
+  EXPECT_TRUE(queue.isEmpty());
+}
+
+TEST(DataQueueTest, RejectsEmptyData) {
+  DataQueue queue(16);
+  uint8_t data[1] = {0};
+
+  EXPECT_FALSE(queue.enqueue(data, 0));
+  EXPECT_FALSE(queue.enqueue(NULL, 1));
+  EXPECT_TRUE(queue.isEmpty());
+}
+
+TEST(DataQueueTest, RejectsDataWhenFull) {
+  DataQueue queue(16);
+  std::vector<uint8_t> a = record(10, 0x10);
+  std::vector<uint8_t> b = record(3, 0x20);
+
+  ASSERT_TRUE(queue.enqueue(a.data(), a.size()));
+  EXPECT_EQ(2u, queue.freeSpace());
+  EXPECT_FALSE(queue.enqueue(b.data(), b.size()));
+  EXPECT_EQ(1u, queue.getRejectedCount());
+
+  // data that fits exactly is still taken
+  std::vector<uint8_t> c = record(2, 0x30);
+  ASSERT_TRUE(queue.enqueue(c.data(), c.size()));
+  EXPECT_EQ(0u, queue.freeSpace());
+
+  // room is back once the front record is dequeued
+  uint8_t buffer[16];
+  uint16_t len = 0;
+  ASSERT_TRUE(queue.dequeue(buffer, sizeof(buffer), len));
+  EXPECT_EQ(a, std::vector<uint8_t>(buffer, buffer + len));
+  ASSERT_TRUE(queue.enqueue(b.data(), b.size()));
+  EXPECT_EQ(1u, queue.getRejectedCount());
+}
+
+TEST(DataQueueTest, RejectsDataLargerThanRing) {
+  DataQueue queue(16);
+  std::vector<uint8_t> data = record(15, 0);
+
+  EXPECT_FALSE(queue.enqueue(data.data(), data.size()));
+  EXPECT_TRUE(queue.isEmpty());
+}
+
+TEST(DataQueueTest, WrapsAroundTheRing) {
+  // 7 is prime to every record size below, so headers and data straddle
+  // the end of the ring at every offset
+  DataQueue queue(7);
+  uint8_t buffer[8];
+  uint16_t len = 0;
+  for (int i = 0; i < 100; i++) {
+    std::vector<uint8_t> data = record(1 + i % 4, i);
+    ASSERT_TRUE(queue.enqueue(data.data(), data.size())) << i;
+    ASSERT_TRUE(queue.dequeue(buffer, sizeof(buffer), len)) << i;
+    ASSERT_EQ(data, std::vector<uint8_t>(buffer, buffer + len)) << i;
+  }
+  EXPECT_TRUE(queue.isEmpty());
+  EXPECT_EQ(0u, queue.getRejectedCount());
+}
+
+TEST(DataQueueTest, FillsTheRingAcrossItsEnd) {
+  DataQueue queue(16);
+  uint8_t buffer[16];
+  uint16_t len = 0;
+  std::vector<uint8_t> a = record(9, 0x10);
+  ASSERT_TRUE(queue.enqueue(a.data(), a.size()));
+  ASSERT_TRUE(queue.dequeue(buffer, sizeof(buffer), len));
+
+  // the ring is empty but starts at 11: fill all of it, wrapping
+  std::vector<uint8_t> b = record(14, 0x20);
+  ASSERT_TRUE(queue.enqueue(b.data(), b.size()));
+  EXPECT_EQ(0u, queue.freeSpace());
+  EXPECT_FALSE(queue.enqueue(a.data(), 1));
+  ASSERT_TRUE(queue.dequeue(buffer, sizeof(buffer), len));
+  EXPECT_EQ(b, std::vector<uint8_t>(buffer, buffer + len));
+  EXPECT_TRUE(queue.isEmpty());
+}
+
+TEST(DataQueueTest, DequeuesLargeRecordInParts) {
+  DataQueue queue(32);
+  std::vector<uint8_t> data = record(10, 0x40);
+  ASSERT_TRUE(queue.enqueue(data.data(), data.size()));
+
+  std::vector<uint8_t> out;
+  uint8_t buffer[4];
+  uint16_t len = 0;
+  while (queue.dequeue(buffer, sizeof(buffer), len)) {
+    EXPECT_LE(len, sizeof(buffer));
+    out.insert(out.end(), buffer, buffer + len);
+  }
+  EXPECT_EQ(data, out);
+  EXPECT_TRUE(queue.isEmpty());
+}
+
+TEST(DataQueueTest, PassesRecordsBetweenThreads) {
+  const int NUM_RECORDS = 10000;
+  DataQueue queue(64);
+
+  std::thread producer([&queue] {
+    for (int i = 0; i < NUM_RECORDS; i++) {
+      std::vector<uint8_t> data = record(1 + i % 13, i);
+      while (!queue.enqueue(data.data(), data.size())) {
+        std::this_thread::yield();
+      }
+    }
+  });
+  uint8_t buffer[16];
+  uint16_t len = 0;
+  for (int i = 0; i < NUM_RECORDS; i++) {
+    while (!queue.dequeue(buffer, sizeof(buffer), len)) {
+      std::this_thread::yield();
+    }
+    ASSERT_EQ(record(1 + i % 13, i), std::vector<uint8_t>(buffer, buffer + len))
+        << i;
+  }
+  producer.join();
+  EXPECT_TRUE(queue.isEmpty());
+}
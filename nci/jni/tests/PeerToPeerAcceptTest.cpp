@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <vector>
+
+#include "JavaClassConstants.h"
+#include "PeerToPeer.h"
+#include "llcp_defs.h"
+#include "nfc_config.h"
+
+// The accept backlog of PeerToPeer against a fake stack.  libnfc-nci is not
+// linked: the NFA_P2p functions below take the place of its P2P API and
+// record what the server did with each connection request.  Requests and
+// disconnections of the peer go straight to the server callback.  Each
+// request carries its own remote MIU, so the test can tell which one
+// accept() handed out.
+
+bool nfc_debug_enabled = false;
+
+namespace android {
+jmethodID gCachedNfcManagerNotifyLlcpLinkActivation;
+jmethodID gCachedNfcManagerNotifyLlcpLinkDeactivated;
+jmethodID gCachedNfcManagerNotifyLlcpFirstPacketReceived;
+bool isDiscoveryStarted() { return false; }
+void startRfDiscovery(bool) {}
+void nativeNfcTag_registerNdefTypeHandler() {}
+void nativeNfcTag_deregisterNdefTypeHandler() {}
+JNIEnv* nfc_jni_attach_thread(JavaVM*) { return NULL; }
+}  // namespace android
+
+namespace {
+const size_t BACKLOG = 2;
+const tNFA_HANDLE SERVER_HANDLE = 0x0401;
+const tNFA_HANDLE FIRST_CONN_HANDLE = 0x0601;
+const uint16_t FIRST_REMOTE_MIU = 128;
+const char SERVICE_NAME[] = "urn:nfc:sn:accept-test";
+
+tNFA_P2P_CBACK* sServerCallback;
+std::vector<tNFA_HANDLE> sAccepted;
+std::vector<tNFA_HANDLE> sRejected;
+std::vector<tNFA_HANDLE> sDisconnected;
+
+// request n of a test: its NFA handle and remote MIU
+tNFA_HANDLE connHandle(int n) { return FIRST_CONN_HANDLE + n; }
+uint16_t remoteMiu(int n) { return FIRST_REMOTE_MIU + n; }
+
+void peerConnects(int n) {
+  tNFA_P2P_EVT_DATA data;
+  data.conn_req.server_handle = SERVER_HANDLE;
+  data.conn_req.conn_handle = connHandle(n);
+  data.conn_req.remote_sap = 0x20;
+  data.conn_req.remote_miu = remoteMiu(n);
+  data.conn_req.remote_rw = 1;
+  sServerCallback(NFA_P2P_CONN_REQ_EVT, &data);
+}
+
+void peerDisconnects(int n) {
+  tNFA_P2P_EVT_DATA data;
+  data.disc.handle = connHandle(n);
+  data.disc.reason = NFA_P2P_DISC_REASON_REMOTE_INITIATE;
+  sServerCallback(NFA_P2P_DISC_EVT, &data);
+}
+}  // namespace
+
+bool NfcConfig::hasKey(const std::string&) { return false; }
+unsigned NfcConfig::getUnsigned(const std::string&) { return 0; }
+unsigned NfcConfig::getUnsigned(const std::string& key,
+                                unsigned defaultValue) {
+  return key == "LLCP_ACCEPT_BACKLOG" ? BACKLOG : defaultValue;
+}
+
+tNFA_STATUS NFA_P2pRegisterServer(uint8_t, tNFA_P2P_LINK_TYPE,
+                                  char* serviceName, tNFA_P2P_CBACK* cback) {
+  sServerCallback = cback;
+  tNFA_P2P_EVT_DATA data;
+  data.reg_server.server_handle = SERVER_HANDLE;
+  data.reg_server.server_sap = 0x10;
+  snprintf(data.reg_server.service_name,
+           sizeof(data.reg_server.service_name), "%s", serviceName);
+  cback(NFA_P2P_REG_SERVER_EVT, &data);
+  return NFA_STATUS_OK;
+}
+
+tNFA_STATUS NFA_P2pAcceptConn(tNFA_HANDLE handle, uint16_t, uint8_t) {
+  sAccepted.push_back(handle);
+  return NFA_STATUS_OK;
+}
+
+tNFA_STATUS NFA_P2pRejectConn(tNFA_HANDLE handle) {
+  sRejected.push_back(handle);
+  return NFA_STATUS_OK;
+}
+
+tNFA_STATUS NFA_P2pDisconnect(tNFA_HANDLE handle, bool) {
+  sDisconnected.push_back(handle);
+  return NFA_STATUS_OK;
+}
+
+tNFA_STATUS NFA_P2pDeregister(tNFA_HANDLE) { return NFA_STATUS_OK; }
+tNFA_STATUS NFA_P2pSetLLCPConfig(uint16_t, uint8_t, uint8_t, uint8_t,
+                                 uint16_t, uint16_t, uint16_t, uint16_t,
+                                 uint16_t) {
+  return NFA_STATUS_OK;
+}
+tNFA_STATUS NFA_P2pRegisterClient(tNFA_P2P_LINK_TYPE, tNFA_P2P_CBACK*) {
+  return NFA_STATUS_FAILED;
+}
+tNFA_STATUS NFA_P2pConnectByName(tNFA_HANDLE, char*, uint16_t, uint8_t) {
+  return NFA_STATUS_FAILED;
+}
+tNFA_STATUS NFA_P2pConnectBySap(tNFA_HANDLE, uint8_t, uint16_t, uint8_t) {
+  return NFA_STATUS_FAILED;
+}
+tNFA_STATUS NFA_P2pSendData(tNFA_HANDLE, uint16_t, uint8_t*) {
+  return NFA_STATUS_FAILED;
+}
+tNFA_STATUS NFA_P2pReadData(tNFA_HANDLE, uint32_t, uint32_t* length,
+                            uint8_t*, bool* more) {
+  *length = 0;
+  *more = false;
+  return NFA_STATUS_FAILED;
+}
+tNFA_STATUS NFA_SetP2pListenTech(tNFA_TECHNOLOGY_MASK) {
+  return NFA_STATUS_FAILED;
+}
+
+class PeerToPeerAcceptTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    sAccepted.clear();
+    sRejected.clear();
+    sDisconnected.clear();
+    PeerToPeer& p2p = PeerToPeer::getInstance();
+    p2p.initialize();
+    p2p.handleNfcOnOff(true);  // drop what an earlier test left behind
+    mServer = p2p.allocJniHandle();
+    ASSERT_TRUE(p2p.registerServer(mServer, SERVICE_NAME, LLCP_MAX_MIU, 1));
+  }
+
+  void TearDown() override {
+    PeerToPeer::getInstance().deregisterServer(mServer);
+  }
+
+  // Remote MIU of the connection accept() hands out, or 0 if none
+  uint16_t acceptNext() {
+    PeerToPeer& p2p = PeerToPeer::getInstance();
+    PeerToPeer::tJNI_HANDLE conn = p2p.allocJniHandle();
+    int maxInfoUnit = LLCP_MAX_MIU;
+    int recvWindow = 1;
+    if (!p2p.accept(mServer, conn, maxInfoUnit, recvWindow)) return 0;
+    return p2p.getRemoteMaxInfoUnit(conn);
+  }
+
+  PeerToPeer::tJNI_HANDLE mServer;
+};
+
+TEST_F(PeerToPeerAcceptTest, AcceptsQueuedConnectionsInOrder) {
+  peerConnects(0);
+  peerConnects(1);
+  EXPECT_EQ(std::vector<tNFA_HANDLE>({connHandle(0), connHandle(1)}),
+            sAccepted);
+
+  EXPECT_EQ(remoteMiu(0), acceptNext());
+  EXPECT_EQ(remoteMiu(1), acceptNext());
+  EXPECT_TRUE(sRejected.empty());
+}
+
+TEST_F(PeerToPeerAcceptTest, RejectsConnectionsBeyondBacklog) {
+  for (size_t n = 0; n <= BACKLOG; n++) peerConnects(n);
+  EXPECT_EQ(BACKLOG, sAccepted.size());
+  EXPECT_EQ(std::vector<tNFA_HANDLE>({connHandle(BACKLOG)}), sRejected);
+
+  // accept() makes room for one more
+  EXPECT_EQ(remoteMiu(0), acceptNext());
+  peerConnects(BACKLOG + 1);
+  EXPECT_EQ(BACKLOG + 1, sAccepted.size());
+  EXPECT_EQ(1u, sRejected.size());
+}
+
+TEST_F(PeerToPeerAcceptTest, SkipsConnectionsClosedBeforeAccept) {
+  peerConnects(0);
+  peerConnects(1);
+  peerDisconnects(0);
+
+  EXPECT_EQ(remoteMiu(1), acceptNext());
+  // the stack already closed it; it is not disconnected again
+  EXPECT_TRUE(sDisconnected.empty());
+
+  // its place in the backlog was given back
+  peerConnects(2);
+  peerConnects(3);
+  EXPECT_TRUE(sRejected.empty());
+  EXPECT_EQ(remoteMiu(2), acceptNext());
+  EXPECT_EQ(remoteMiu(3), acceptNext());
+}
+
+TEST_F(PeerToPeerAcceptTest, ClosesQueuedConnectionsOnDeregister) {
+  peerConnects(0);
+  peerConnects(1);
+  EXPECT_EQ(remoteMiu(0), acceptNext());
+
+  EXPECT_TRUE(PeerToPeer::getInstance().deregisterServer(mServer));
+  EXPECT_EQ(std::vector<tNFA_HANDLE>({connHandle(1)}), sDisconnected);
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include "TlvReader.h"
+
+namespace {
+// simple-TLVs with 0xFF extended lengths and a terminator, ISO/IEC 7816-4
+struct ExtendedTlvFormat {
+  static constexpr bool THREE_OCTET_LENGTH = true;
+
+  static constexpr bool hasLength(uint8_t tag) {
+    return tag != 0x00 && tag != 0xFE;
+  }
+  static constexpr bool isTerminator(uint8_t tag) { return tag == 0xFE; }
+};
+}  // namespace
+
+TEST(BerTlvReaderTest, ReadsTransactionEvent) {
+  const uint8_t buf[] = {0x81, 0x03, 0xA0, 0x00, 0x01, 0x82, 0x02, 0x90, 0x00};
+  BerTlvReader reader(buf, sizeof(buf));
+  Tlv tlv;
+
+  ASSERT_TRUE(reader.next(&tlv));
+  EXPECT_EQ(HciTransactionTag::AID, tlv.tag);
+  EXPECT_EQ(&buf[2], tlv.value);
+  EXPECT_EQ(3u, tlv.length);
+  ASSERT_TRUE(reader.next(&tlv));
+  EXPECT_EQ(HciTransactionTag::PARAMETERS, tlv.tag);
+  EXPECT_EQ(&buf[7], tlv.value);
+  EXPECT_EQ(2u, tlv.length);
+  EXPECT_FALSE(reader.next(&tlv));
+  EXPECT_FALSE(reader.error());
+}
+
+TEST(BerTlvReaderTest, ReadsLongFormLengths) {
+  uint8_t buf[4 + 0x1FF] = {0x82, 0x82, 0x01, 0xFF};
+  BerTlvReader reader(buf, sizeof(buf));
+  Tlv tlv;
+
+  ASSERT_TRUE(reader.next(&tlv));
+  EXPECT_EQ(0x1FFu, tlv.length);
+  EXPECT_EQ(&buf[4], tlv.value);
+  EXPECT_FALSE(reader.next(&tlv));
+  EXPECT_FALSE(reader.error());
+}
+
+TEST(BerTlvReaderTest, ReadsMultiOctetTags) {
+  const uint8_t buf[] = {0x9F, 0x81, 0x01, 0x01, 0x55};
+  BerTlvReader reader(buf, sizeof(buf));
+  Tlv tlv;
+
+  ASSERT_TRUE(reader.next(&tlv));
+  EXPECT_EQ(0x9F8101u, tlv.tag);
+  EXPECT_EQ(1u, tlv.length);
+}
+
+TEST(BerTlvReaderTest, RejectsValueLongerThanBuffer) {
+  const uint8_t buf[] = {0x81, 0x05, 0xA0, 0x00, 0x01};
+  BerTlvReader reader(buf, sizeof(buf));
+  Tlv tlv;
+
+  EXPECT_FALSE(reader.next(&tlv));
+  EXPECT_TRUE(reader.error());
+}
+
+TEST(BerTlvReaderTest, RejectsTruncatedLengthField) {
+  // two length octets announced, one present
+  const uint8_t buf[] = {0x82, 0x82, 0x01};
+  BerTlvReader reader(buf, sizeof(buf));
+  Tlv tlv;
+
+  EXPECT_FALSE(reader.next(&tlv));
+  EXPECT_TRUE(reader.error());
+}
+
+TEST(BerTlvReaderTest, RejectsMissingLength) {
+  const uint8_t buf[] = {0x81};
+  BerTlvReader reader(buf, sizeof(buf));
+  Tlv tlv;
+
+  EXPECT_FALSE(reader.next(&tlv));
+  EXPECT_TRUE(reader.error());
+}
+
+TEST(BerTlvReaderTest, RejectsIndefiniteAndOversizedLengths) {
+  size_t length;
+  const uint8_t indefinite[] = {0x80, 0x00};
+  EXPECT_EQ(0u, BerTlvReader::decodeLength(indefinite, sizeof(indefinite),
+                                           &length));
+  const uint8_t oversized[] = {0x85, 0x00, 0x00, 0x00, 0x00, 0x01};
+  EXPECT_EQ(0u,
+            BerTlvReader::decodeLength(oversized, sizeof(oversized), &length));
+  // 0xFF is the long form with 127 octets, not an extended length
+  const uint8_t reserved[] = {0xFF, 0x00, 0x01};
+  EXPECT_EQ(0u,
+            BerTlvReader::decodeLength(reserved, sizeof(reserved), &length));
+}
+
+TEST(BerTlvReaderTest, RejectsTruncatedTag) {
+  const uint8_t buf[] = {0x9F, 0x81};
+  BerTlvReader reader(buf, sizeof(buf));
+  Tlv tlv;
+
+  EXPECT_FALSE(reader.next(&tlv));
+  EXPECT_TRUE(reader.error());
+}
+
+TEST(BerTlvReaderTest, StopsAfterError) {
+  const uint8_t buf[] = {0x81, 0x07, 0x01};
+  BerTlvReader reader(buf, sizeof(buf));
+  Tlv tlv;
+
+  EXPECT_FALSE(reader.next(&tlv));
+  EXPECT_FALSE(reader.next(&tlv));
+  EXPECT_TRUE(reader.error());
+  EXPECT_EQ(0u, reader.offset());
+}
+
+TEST(SimpleTlvReaderTest, ReadsNciParameters) {
+  const uint8_t buf[] = {0x52, 0x01, 0x10, 0x53, 0x00};
+  SimpleTlvReader<NciParamTlvFormat> reader(buf, sizeof(buf));
+  Tlv tlv;
+
+  ASSERT_TRUE(reader.next(&tlv));
+  EXPECT_EQ(0x52u, tlv.tag);
+  EXPECT_EQ(1u, tlv.length);
+  EXPECT_EQ(0x10, tlv.value[0]);
+  ASSERT_TRUE(reader.next(&tlv));
+  EXPECT_EQ(0x53u, tlv.tag);
+  EXPECT_EQ(0u, tlv.length);
+  EXPECT_FALSE(reader.next(&tlv));
+  EXPECT_FALSE(reader.error());
+}
+
+TEST(SimpleTlvReaderTest, NciLengthOf0xFFIsOneOctet) {
+  uint8_t buf[2 + 0xFF] = {0x52, 0xFF};
+  SimpleTlvReader<NciParamTlvFormat> reader(buf, sizeof(buf));
+  Tlv tlv;
+
+  ASSERT_TRUE(reader.next(&tlv));
+  EXPECT_EQ(0xFFu, tlv.length);
+  EXPECT_EQ(&buf[2], tlv.value);
+}
+
+TEST(SimpleTlvReaderTest, RejectsTruncatedNciParameter) {
+  const uint8_t buf[] = {0x52, 0x03, 0x10, 0x11};
+  SimpleTlvReader<NciParamTlvFormat> reader(buf, sizeof(buf));
+  Tlv tlv;
+
+  EXPECT_FALSE(reader.next(&tlv));
+  EXPECT_TRUE(reader.error());
+
+  const uint8_t noLength[] = {0x52};
+  SimpleTlvReader<NciParamTlvFormat> reader2(noLength, sizeof(noLength));
+  EXPECT_FALSE(reader2.next(&tlv));
+  EXPECT_TRUE(reader2.error());
+}
+
+TEST(SimpleTlvReaderTest, ReadsExtendedLength) {
+  uint8_t buf[4 + 0x0123 + 1] = {0x03, 0xFF, 0x01, 0x23};
+  buf[sizeof(buf) - 1] = 0xFE;
+  SimpleTlvReader<ExtendedTlvFormat> reader(buf, sizeof(buf));
+  Tlv tlv;
+
+  ASSERT_TRUE(reader.next(&tlv));
+  EXPECT_EQ(0x03u, tlv.tag);
+  EXPECT_EQ(0x0123u, tlv.length);
+  EXPECT_EQ(&buf[4], tlv.value);
+  ASSERT_TRUE(reader.next(&tlv));
+  EXPECT_EQ(0xFEu, tlv.tag);
+  EXPECT_EQ(0u, tlv.length);
+  EXPECT_FALSE(reader.next(&tlv));
+  EXPECT_FALSE(reader.error());
+}
+
+TEST(SimpleTlvReaderTest, RejectsTruncatedExtendedLength) {
+  const uint8_t missingOctets[] = {0x03, 0xFF, 0x01};
+  SimpleTlvReader<ExtendedTlvFormat> reader(missingOctets,
+                                            sizeof(missingOctets));
+  Tlv tlv;
+  EXPECT_FALSE(reader.next(&tlv));
+  EXPECT_TRUE(reader.error());
+
+  const uint8_t shortValue[] = {0x03, 0xFF, 0x00, 0x04, 0x01, 0x02, 0x03};
+  SimpleTlvReader<ExtendedTlvFormat> reader2(shortValue, sizeof(shortValue));
+  EXPECT_FALSE(reader2.next(&tlv));
+  EXPECT_TRUE(reader2.error());
+}
+
+TEST(SimpleTlvReaderTest, SkipsTagsWithoutLength) {
+  const uint8_t buf[] = {0x00, 0x00, 0x03, 0x01, 0xD0, 0xFE, 0x03};
+  SimpleTlvReader<ExtendedTlvFormat> reader(buf, sizeof(buf));
+  Tlv tlv;
+
+  ASSERT_TRUE(reader.next(&tlv));
+  EXPECT_EQ(0x00u, tlv.tag);
+  ASSERT_TRUE(reader.next(&tlv));
+  EXPECT_EQ(0x00u, tlv.tag);
+  ASSERT_TRUE(reader.next(&tlv));
+  EXPECT_EQ(0x03u, tlv.tag);
+  EXPECT_EQ(1u, tlv.length);
+  // nothing after the terminator is decoded
+  ASSERT_TRUE(reader.next(&tlv));
+  EXPECT_EQ(0xFEu, tlv.tag);
+  EXPECT_FALSE(reader.next(&tlv));
+  EXPECT_FALSE(reader.error());
+}
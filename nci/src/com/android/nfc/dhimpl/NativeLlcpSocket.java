@@ -19,6 +19,7 @@ package com.android.nfc.dhimpl;
 import com.android.nfc.DeviceHost;
 
 import java.io.IOException;
+import java.nio.ByteBuffer;
 
 /**
  * LlcpClientSocket represents a LLCP Connection-Oriented client to be used in a
@@ -74,6 +75,36 @@ public class NativeLlcpSocket implements DeviceHost.LlcpSocket {
         return receiveLength;
     }
 
+    private native int doReceiveBatch(byte[] recvBuff, int[] pduLengths);
+    @Override
+    public int receiveBatch(byte[] recvBuff, int[] pduLengths) throws IOException {
+        int pduCount = doReceiveBatch(recvBuff, pduLengths);
+        if (pduCount == -1) {
+            throw new IOException();
+        }
+        return pduCount;
+    }
+
+    private native int doReceiveBatchDirect(ByteBuffer recvBuff, int offset, int length,
+            int[] pduLengths);
+    @Override
+    public int receiveBatch(ByteBuffer recvBuff, int[] pduLengths) throws IOException {
+        if (!recvBuff.isDirect()) {
+            throw new IllegalArgumentException("recvBuff is not a direct buffer");
+        }
+        int pduCount = doReceiveBatchDirect(recvBuff, recvBuff.position(),
+                recvBuff.remaining(), pduLengths);
+        if (pduCount == -1) {
+            throw new IOException();
+        }
+        int receiveLength = 0;
+        for (int i = 0; i < pduCount; i++) {
+            receiveLength += pduLengths[i];
+        }
+        recvBuff.position(recvBuff.position() + receiveLength);
+        return pduCount;
+    }
+
     private native int doGetRemoteSocketMiu();
     @Override
     public int getRemoteMiu() { return doGetRemoteSocketMiu(); }
@@ -30,6 +30,7 @@ import java.io.FileDescriptor;
 import java.util.Arrays;
 import java.util.HashMap;
 import java.util.Iterator;
+import java.util.Map;
 
 /**
  * Native interface to the NFC Manager functions
@@ -130,10 +131,7 @@ public class NativeNfcManager implements DeviceHost {
     public native boolean sendRawFrame(byte[] data);
 
     @Override
-    public native boolean routeAid(byte[] aid, int route, int aidInfo, int power);
-
-    @Override
-    public native boolean unrouteAid(byte[] aid);
+    public native boolean setAidRoutingTable(byte[] packedAids, boolean commit, boolean force);
 
     @Override
     public native boolean commitRouting();
@@ -168,6 +166,49 @@ public class NativeNfcManager implements DeviceHost {
         }
     }
 
+    public native int[] doRegisterT3tIdentifiers(byte[][] t3tIdentifiers);
+
+    @Override
+    public boolean[] registerT3tIdentifiers(byte[][] t3tIdentifiers) {
+        boolean[] registered = new boolean[t3tIdentifiers.length];
+        synchronized (mLock) {
+            int[] handles = doRegisterT3tIdentifiers(t3tIdentifiers);
+            for (int i = 0; i < t3tIdentifiers.length; i++) {
+                if (handles != null && handles[i] != 0xffff) {
+                    mT3tIdentifiers.put(Integer.valueOf(handles[i]), t3tIdentifiers[i]);
+                    registered[i] = true;
+                }
+            }
+        }
+        return registered;
+    }
+
+    public native void doDeregisterT3tIdentifiers(int[] handles);
+
+    @Override
+    public void deregisterT3tIdentifiers(byte[][] t3tIdentifiers) {
+        synchronized (mLock) {
+            int[] handles = new int[t3tIdentifiers.length];
+            int count = 0;
+            boolean[] matched = new boolean[t3tIdentifiers.length];
+            Iterator<Map.Entry<Integer, byte[]>> it = mT3tIdentifiers.entrySet().iterator();
+            while (it.hasNext()) {
+                Map.Entry<Integer, byte[]> entry = it.next();
+                for (int i = 0; i < t3tIdentifiers.length; i++) {
+                    if (!matched[i] && Arrays.equals(entry.getValue(), t3tIdentifiers[i])) {
+                        matched[i] = true;
+                        handles[count++] = entry.getKey().intValue();
+                        it.remove();
+                        break;
+                    }
+                }
+            }
+            if (count > 0) {
+                doDeregisterT3tIdentifiers(Arrays.copyOf(handles, count));
+            }
+        }
+    }
+
     @Override
     public void clearT3tIdentifiersCache() {
         synchronized (mLock) {
@@ -446,6 +487,15 @@ public class NativeNfcManager implements DeviceHost {
         mListener.onHostCardEmulationData(technology, data);
     }
 
+    private void notifyHostEmuSelect(int technology, byte[] data, int aidGeneration,
+            int aidIndex) {
+        mListener.onHostCardEmulationSelect(technology, data, aidGeneration, aidIndex);
+    }
+
+    private void notifyHostEmuStaticResponse(int technology, byte[] data) {
+        mListener.onHostCardEmulationStaticResponse(technology, data);
+    }
+
     private void notifyHostEmuDeactivated(int technology) {
         mListener.onHostCardEmulationDeactivated(technology);
     }
@@ -458,8 +508,8 @@ public class NativeNfcManager implements DeviceHost {
         mListener.onRemoteFieldDeactivated();
     }
 
-    private void notifyTransactionListeners(byte[] aid, byte[] data, String evtSrc) {
-        mListener.onNfcTransactionEvent(aid, data, evtSrc);
+    private void notifyTransactionListeners(byte[][] aids, byte[][] data, String[] evtSrcs) {
+        mListener.onNfcTransactionEvents(aids, data, evtSrcs);
     }
 
     private void notifyEeUpdated() {
@@ -22,6 +22,7 @@ import android.os.Bundle;
 
 import java.io.FileDescriptor;
 import java.io.IOException;
+import java.nio.ByteBuffer;
 
 public interface DeviceHost {
     public interface DeviceHostListener {
@@ -31,6 +32,17 @@ public interface DeviceHost {
          */
         public void onHostCardEmulationActivated(int technology);
         public void onHostCardEmulationData(int technology, byte[] data);
+        /**
+         * A SELECT command whose AID was already resolved by the native layer;
+         * aidIndex is valid for the AID cache generation aidGeneration.
+         */
+        public void onHostCardEmulationSelect(int technology, byte[] data, int aidGeneration,
+                int aidIndex);
+        /**
+         * A SELECT command the native layer already answered with a static
+         * response.
+         */
+        public void onHostCardEmulationStaticResponse(int technology, byte[] data);
         public void onHostCardEmulationDeactivated(int technology);
 
         /**
@@ -49,7 +61,10 @@ public interface DeviceHost {
 
         public void onRemoteFieldDeactivated();
 
-        public void onNfcTransactionEvent(byte[] aid, byte[] data, String seName);
+        /**
+         * Notifies a burst of transaction events; the arrays are parallel.
+         */
+        public void onNfcTransactionEvents(byte[][] aids, byte[][] data, String[] seNames);
 
         public void onEeUpdated();
 
@@ -139,6 +154,20 @@ public interface DeviceHost {
 
         public int receive(byte[] recvBuff) throws IOException;
 
+        /**
+         * Blocks like {@link #receive(byte[])} for the first PDU, then also returns every PDU
+         * that has already arrived, as long as a whole PDU still fits in recvBuff. The PDUs are
+         * stored back to back and their lengths put in pduLengths.
+         * @return the number of PDUs received
+         */
+        public int receiveBatch(byte[] recvBuff, int[] pduLengths) throws IOException;
+
+        /**
+         * Same as {@link #receiveBatch(byte[], int[])}, into the remaining space of a direct
+         * buffer. The position of recvBuff is advanced past the received data.
+         */
+        public int receiveBatch(ByteBuffer recvBuff, int[] pduLengths) throws IOException;
+
         public int getRemoteMiu();
 
         public int getRemoteRw();
@@ -151,6 +180,13 @@ public interface DeviceHost {
     }
 
     public interface LlcpServerSocket {
+        /**
+         * Returns the oldest pending connection, blocking until a peer connects if there is none.
+         * Connection requests are accepted as they arrive, before accept() is called, so the
+         * MIU and receive window the server socket was created with are upper bounds: use
+         * {@link LlcpSocket#getLocalMiu()} and {@link LlcpSocket#getLocalRw()} of the returned
+         * socket for the values its connection uses.
+         */
         public LlcpSocket accept() throws IOException, LlcpException;
 
         public void close() throws IOException;
@@ -191,9 +227,13 @@ public interface DeviceHost {
 
     public boolean sendRawFrame(byte[] data);
 
-    public boolean routeAid(byte[] aid, int route, int aidInfo, int power);
-
-    public boolean unrouteAid(byte[] aid);
+    /**
+     * Replace the AID routing table with a packed list of
+     * [aidLen][aid][route][aidInfo][power] entries. Only entries that differ
+     * from the current table are touched, and the table is committed only if
+     * an entry changed or force is set.
+     */
+    public boolean setAidRoutingTable(byte[] packedAids, boolean commit, boolean force);
 
     public boolean commitRouting();
 
@@ -201,6 +241,17 @@ public interface DeviceHost {
 
     public void deregisterT3tIdentifier(byte[] t3tIdentifier);
 
+    /**
+     * Register a set of LF_T3T_IDENTIFIERs with one native call; the routing
+     * table is committed once. Returns whether each identifier was registered.
+     */
+    public boolean[] registerT3tIdentifiers(byte[][] t3tIdentifiers);
+
+    /**
+     * Deregister a set of LF_T3T_IDENTIFIERs with one native call.
+     */
+    public void deregisterT3tIdentifiers(byte[][] t3tIdentifiers);
+
     public void clearT3tIdentifiersCache();
 
     public int getLfT3tMax();
@@ -208,6 +259,10 @@ public interface DeviceHost {
     public LlcpConnectionlessSocket createLlcpConnectionlessSocket(int nSap, String sn)
             throws LlcpException;
 
+    /**
+     * Creates a server socket. miu and rw bound every connection the socket accepts, including
+     * the ones a peer opens before {@link LlcpServerSocket#accept()} is first called.
+     */
     public LlcpServerSocket createLlcpServerSocket(int nSap, String sn, int miu,
             int rw, int linearBufferLength) throws LlcpException;
 
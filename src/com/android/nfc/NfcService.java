@@ -119,6 +119,7 @@ import java.util.NoSuchElementException;
 import java.util.Scanner;
 import java.util.Set;
 import java.util.concurrent.atomic.AtomicInteger;
+import java.util.function.Consumer;
 import java.util.stream.Collectors;
 
 public class NfcService implements DeviceHostListener {
@@ -156,8 +157,6 @@ public class NfcService implements DeviceHostListener {
     static final int MSG_LLCP_LINK_DEACTIVATED = 2;
     static final int MSG_MOCK_NDEF = 3;
     static final int MSG_LLCP_LINK_FIRST_PACKET = 4;
-    static final int MSG_ROUTE_AID = 5;
-    static final int MSG_UNROUTE_AID = 6;
     static final int MSG_COMMIT_ROUTING = 7;
     static final int MSG_INVOKE_BEAM = 8;
     static final int MSG_RF_FIELD_ACTIVATED = 9;
@@ -172,8 +171,8 @@ public class NfcService implements DeviceHostListener {
     static final int MSG_PREFERRED_PAYMENT_CHANGED = 18;
     static final int MSG_TOAST_DEBOUNCE_EVENT = 19;
     static final int MSG_DELAY_POLLING = 20;
-
-    static final String MSG_ROUTE_AID_PARAM_TAG = "power";
+    static final int MSG_SET_AID_ROUTING_TABLE = 21;
+    static final int MSG_UPDATE_T3T_IDENTIFIERS = 22;
 
     // Negative value for NO polling delay
     static final int NO_POLL_DELAY = -1;
@@ -389,6 +388,22 @@ public class NfcService implements DeviceHostListener {
         }
     }
 
+    @Override
+    public void onHostCardEmulationSelect(int technology, byte[] data, int aidGeneration,
+            int aidIndex) {
+        if (mCardEmulationManager != null) {
+            mCardEmulationManager.onHostCardEmulationSelect(technology, data, aidGeneration,
+                    aidIndex);
+        }
+    }
+
+    @Override
+    public void onHostCardEmulationStaticResponse(int technology, byte[] data) {
+        if (mCardEmulationManager != null) {
+            mCardEmulationManager.onHostCardEmulationStaticResponse(technology, data);
+        }
+    }
+
     @Override
     public void onHostCardEmulationDeactivated(int technology) {
         if (mCardEmulationManager != null) {
@@ -437,11 +452,14 @@ public class NfcService implements DeviceHostListener {
     }
 
     @Override
-    public void onNfcTransactionEvent(byte[] aid, byte[] data, String seName) {
-        byte[][] dataObj = {aid, data, seName.getBytes()};
-        sendMessage(NfcService.MSG_TRANSACTION_EVENT, dataObj);
-        NfcStatsLog.write(NfcStatsLog.NFC_CARDEMULATION_OCCURRED,
-                NfcStatsLog.NFC_CARDEMULATION_OCCURRED__CATEGORY__OFFHOST, seName);
+    public void onNfcTransactionEvents(byte[][] aids, byte[][] data, String[] seNames) {
+        byte[][][] events = new byte[aids.length][][];
+        for (int i = 0; i < aids.length; i++) {
+            events[i] = new byte[][] {aids[i], data[i], seNames[i].getBytes()};
+            NfcStatsLog.write(NfcStatsLog.NFC_CARDEMULATION_OCCURRED,
+                    NfcStatsLog.NFC_CARDEMULATION_OCCURRED__CATEGORY__OFFHOST, seNames[i]);
+        }
+        sendMessage(NfcService.MSG_TRANSACTION_EVENT, events);
     }
 
     @Override
@@ -467,6 +485,12 @@ public class NfcService implements DeviceHostListener {
         public int presenceCheckDelay;
     }
 
+    static final class T3tIdentifierUpdate {
+        byte[][] toRemove;
+        byte[][] toAdd;
+        Consumer<boolean[]> onRegistered;
+    }
+
     public NfcService(Application nfcApplication) {
         mUserId = ActivityManager.getCurrentUser();
         mContext = nfcApplication;
@@ -2191,7 +2215,7 @@ public class NfcService implements DeviceHostListener {
         }
     }
 
-    static byte[] hexStringToBytes(String s) {
+    public static byte[] hexStringToBytes(String s) {
         if (s == null || s.length() == 0) return null;
         int len = s.length();
         if (len % 2 != 0) {
@@ -2427,29 +2451,22 @@ public class NfcService implements DeviceHostListener {
         sendMessage(MSG_MOCK_NDEF, msg);
     }
 
-    public void routeAids(String aid, int route, int aidInfo, int power) {
-        Message msg = mHandler.obtainMessage();
-        msg.what = MSG_ROUTE_AID;
-        msg.arg1 = route;
-        msg.obj = aid;
-        msg.arg2 = aidInfo;
-
-        Bundle aidPowerState = new Bundle();
-        aidPowerState.putInt(MSG_ROUTE_AID_PARAM_TAG, power);
-        msg.setData(aidPowerState);
-
+    /**
+     * Replace the AID routing table with a single native call. packedAids
+     * holds [aidLen][aid][route][aidInfo][power] entries. The table is
+     * committed only if it changed, unless force is set.
+     */
+    public void setAidRoutingTable(byte[] packedAids, boolean force) {
+        Message msg = mHandler.obtainMessage(MSG_SET_AID_ROUTING_TABLE, force ? 1 : 0, 0,
+                packedAids);
         mHandler.sendMessage(msg);
     }
 
-    public void unrouteAids(String aid) {
-        sendMessage(MSG_UNROUTE_AID, aid);
-    }
-
     public int getNciVersion() {
         return mDeviceHost.getNciVersion();
     }
 
-    private byte[] getT3tIdentifierBytes(String systemCode, String nfcId2, String t3tPmm) {
+    public static byte[] getT3tIdentifierBytes(String systemCode, String nfcId2, String t3tPmm) {
         ByteBuffer buffer = ByteBuffer.allocate(2 + 8 + 8); /* systemcode + nfcid2 + t3tpmm */
         buffer.put(hexStringToBytes(systemCode));
         buffer.put(hexStringToBytes(nfcId2));
@@ -2475,6 +2492,22 @@ public class NfcService implements DeviceHostListener {
         sendMessage(MSG_DEREGISTER_T3T_IDENTIFIER, t3tIdentifier);
     }
 
+    /**
+     * Deregister toRemove and register toAdd with discovery stopped only once.
+     * onRegistered, if set, is called on the handler thread with whether each
+     * entry of toAdd was registered.
+     */
+    public void updateT3tIdentifiers(List<byte[]> toRemove, List<byte[]> toAdd,
+            Consumer<boolean[]> onRegistered) {
+        Log.d(TAG, "request to update LF_T3T_IDENTIFIERs: -" + toRemove.size() + " +"
+                + toAdd.size());
+        T3tIdentifierUpdate update = new T3tIdentifierUpdate();
+        update.toRemove = toRemove.toArray(new byte[0][]);
+        update.toAdd = toAdd.toArray(new byte[0][]);
+        update.onRegistered = onRegistered;
+        sendMessage(MSG_UPDATE_T3T_IDENTIFIERS, update);
+    }
+
     public void clearT3tIdentifiersCache() {
         Log.d(TAG, "clear T3t Identifiers Cache");
         mDeviceHost.clearT3tIdentifiersCache();
@@ -2523,24 +2556,22 @@ public class NfcService implements DeviceHostListener {
         @Override
         public void handleMessage(Message msg) {
             switch (msg.what) {
-                case MSG_ROUTE_AID: {
-                    int route = msg.arg1;
-                    int aidInfo = msg.arg2;
-                    String aid = (String) msg.obj;
-
-                    int power = 0x00;
-                    Bundle bundle = msg.getData();
-                    if (bundle != null) {
-                        power = bundle.getInt(MSG_ROUTE_AID_PARAM_TAG);
+                case MSG_SET_AID_ROUTING_TABLE: {
+                    byte[] packedAids = (byte[]) msg.obj;
+                    boolean force = msg.arg1 != 0;
+                    boolean commit;
+                    synchronized (NfcService.this) {
+                        commit = mState != NfcAdapter.STATE_OFF
+                                && mState != NfcAdapter.STATE_TURNING_OFF
+                                && mCurrentDiscoveryParameters.shouldEnableDiscovery();
+                    }
+                    if (!commit) {
+                        Log.d(TAG, "Routing AIDs without commit; NFCC is off or discovery is"
+                                + " disabled");
+                    }
+                    if (!mDeviceHost.setAidRoutingTable(packedAids, commit, force)) {
+                        Log.e(TAG, "Failed to update AID routing table");
                     }
-
-                    mDeviceHost.routeAid(hexStringToBytes(aid), route, aidInfo, power);
-                    // Restart polling config
-                    break;
-                }
-                case MSG_UNROUTE_AID: {
-                    String aid = (String) msg.obj;
-                    mDeviceHost.unrouteAid(hexStringToBytes(aid));
                     break;
                 }
                 case MSG_REGISTER_T3T_IDENTIFIER: {
@@ -2567,6 +2598,27 @@ public class NfcService implements DeviceHostListener {
                     mDeviceHost.enableDiscovery(params, shouldRestart);
                     break;
                 }
+                case MSG_UPDATE_T3T_IDENTIFIERS: {
+                    Log.d(TAG, "message to update LF_T3T_IDENTIFIERs");
+                    T3tIdentifierUpdate update = (T3tIdentifierUpdate) msg.obj;
+                    mDeviceHost.disableDiscovery();
+
+                    if (update.toRemove.length > 0) {
+                        mDeviceHost.deregisterT3tIdentifiers(update.toRemove);
+                    }
+                    boolean[] registered = new boolean[0];
+                    if (update.toAdd.length > 0) {
+                        registered = mDeviceHost.registerT3tIdentifiers(update.toAdd);
+                    }
+
+                    NfcDiscoveryParameters params = computeDiscoveryParameters(mScreenState);
+                    boolean shouldRestart = mCurrentDiscoveryParameters.shouldEnableDiscovery();
+                    mDeviceHost.enableDiscovery(params, shouldRestart);
+                    if (update.onRegistered != null) {
+                        update.onRegistered.accept(registered);
+                    }
+                    break;
+                }
                 case MSG_INVOKE_BEAM: {
                     mP2pLinkManager.onManualBeamInvoke((BeamShareData)msg.obj);
                     break;
@@ -2820,8 +2872,9 @@ public class NfcService implements DeviceHostListener {
                     if (mCardEmulationManager != null) {
                         mCardEmulationManager.onOffHostAidSelected();
                     }
-                    byte[][] data = (byte[][]) msg.obj;
-                    sendOffHostTransactionEvent(data[0], data[1], data[2]);
+                    for (byte[][] data : (byte[][][]) msg.obj) {
+                        sendOffHostTransactionEvent(data[0], data[1], data[2]);
+                    }
                     break;
 
                 case MSG_PREFERRED_PAYMENT_CHANGED:
@@ -20,8 +20,10 @@ import android.util.Log;
 import android.util.SparseArray;
 import android.util.proto.ProtoOutputStream;
 
+import com.android.internal.annotations.VisibleForTesting;
 import com.android.nfc.NfcService;
 import com.android.nfc.NfcStatsLog;
+import java.io.ByteArrayOutputStream;
 import java.io.FileDescriptor;
 import java.io.PrintWriter;
 import java.util.ArrayList;
@@ -80,8 +82,12 @@ public class AidRoutingManager {
     private native byte[] doGetOffHostEseDestination();
     private native int doGetAidMatchingMode();
     private native int doGetDefaultIsoDepRouteDestination();
+    private native byte[] doCompactAidRoutingTable(byte[] packedAids, int maxSize,
+            int defaultRoute);
+    private native void doSetAidResolveTable(byte[] packedAids, int generation);
+    private native void doSetStaticResponses(byte[] packedResponses, int generation);
 
-    final class AidEntry {
+    static final class AidEntry {
         boolean isOnHost;
         String offHostSE;
         int route;
@@ -109,6 +115,23 @@ public class AidRoutingManager {
         if (DBG) Log.d(TAG, "mDefaultIsoDepRoute=0x" + Integer.toHexString(mDefaultIsoDepRoute));
     }
 
+    /**
+     * Replace the table the native layer resolves SELECT commands with.
+     * packedAids holds [aidLen][aid][kind][index] entries, with a 2-byte index.
+     */
+    public void setAidResolveTable(byte[] packedAids, int generation) {
+        doSetAidResolveTable(packedAids, generation);
+    }
+
+    /**
+     * Replace the responses the native layer sends for SELECT commands on its
+     * own. packedResponses holds [cmdLen][command][respLen][response] entries,
+     * with a 2-byte respLen; they only apply to the given resolve generation.
+     */
+    public void setStaticResponses(byte[] packedResponses, int generation) {
+        doSetStaticResponses(packedResponses, generation);
+    }
+
     public boolean supportsAidPrefixRouting() {
         return mAidMatchingSupport == AID_MATCHING_EXACT_OR_PREFIX ||
                 mAidMatchingSupport == AID_MATCHING_PREFIX_ONLY ||
@@ -136,46 +159,6 @@ public class AidRoutingManager {
         return routeTableSize;
     }
 
-    private void clearNfcRoutingTableLocked() {
-        for (Map.Entry<String, Integer> aidEntry : mRouteForAid.entrySet())  {
-            String aid = aidEntry.getKey();
-            if (aid.endsWith("*")) {
-                if (mAidMatchingSupport == AID_MATCHING_EXACT_ONLY) {
-                    Log.e(TAG, "Device does not support prefix AIDs but AID [" + aid
-                            + "] is registered");
-                } else if (mAidMatchingSupport == AID_MATCHING_PREFIX_ONLY) {
-                    if (DBG) Log.d(TAG, "Unrouting prefix AID " + aid);
-                    // Cut off '*' since controller anyway treats all AIDs as a prefix
-                    aid = aid.substring(0, aid.length() - 1);
-                } else if (mAidMatchingSupport == AID_MATCHING_EXACT_OR_PREFIX ||
-                    mAidMatchingSupport == AID_MATCHING_EXACT_OR_SUBSET_OR_PREFIX) {
-                    aid = aid.substring(0, aid.length() - 1);
-                    if (DBG) Log.d(TAG, "Unrouting prefix AID " + aid);
-                }
-            }  else if (aid.endsWith("#")) {
-                if (mAidMatchingSupport == AID_MATCHING_EXACT_ONLY) {
-                    Log.e(TAG, "Device does not support subset AIDs but AID [" + aid
-                            + "] is registered");
-                } else if (mAidMatchingSupport == AID_MATCHING_PREFIX_ONLY ||
-                    mAidMatchingSupport == AID_MATCHING_EXACT_OR_PREFIX) {
-                    Log.e(TAG, "Device does not support subset AIDs but AID [" + aid
-                            + "] is registered");
-                } else if (mAidMatchingSupport == AID_MATCHING_EXACT_OR_SUBSET_OR_PREFIX) {
-                    if (DBG) Log.d(TAG, "Unrouting subset AID " + aid);
-                    aid = aid.substring(0, aid.length() - 1);
-                }
-            } else {
-                if (DBG) Log.d(TAG, "Unrouting exact AID " + aid);
-            }
-
-            NfcService.getInstance().unrouteAids(aid);
-        }
-        if (NfcService.getInstance().getNciVersion() >= NfcService.getInstance().NCI_VERSION_2_0) {
-            // unRoute EmptyAid
-            NfcService.getInstance().unrouteAids("");
-        }
-    }
-
     private int getRouteForSecureElement(String se) {
         if (se == null || se.length() <= 3) {
             return 0;
@@ -200,6 +183,7 @@ public class AidRoutingManager {
 
     public boolean configureRouting(HashMap<String, AidEntry> aidMap, boolean force) {
         boolean aidRouteResolved = false;
+        byte[] packedAidTable = null;
         HashMap<String, AidEntry> aidRoutingTableCache = new HashMap<String, AidEntry>(aidMap.size());
         ArrayList<Integer> seList = new ArrayList<Integer>();
         mDefaultRoute = doGetDefaultRouteDestination();
@@ -245,8 +229,8 @@ public class AidRoutingManager {
                 return false;
             }
 
-            // Otherwise, update internal structures and commit new routing
-            clearNfcRoutingTableLocked();
+            // Otherwise, update internal structures and commit new routing;
+            // the native layer only touches entries that actually changed
             mRouteForAid = routeForAid;
             mAidRoutingTable = aidRoutingTable;
 
@@ -391,13 +375,27 @@ public class AidRoutingManager {
               }
 
               if (calculateAidRouteSize(aidRoutingTableCache) <= mMaxAidRoutingTableSize) {
+                  packedAidTable = packAidRoutingTable(aidRoutingTableCache);
+                  aidRouteResolved = true;
+                  break;
+              }
+
+              // Before switching the default route, try to make the table fit by
+              // aggregating AIDs into prefix entries
+              packedAidTable = doCompactAidRoutingTable(
+                      packAidRoutingTable(aidRoutingTableCache), mMaxAidRoutingTableSize,
+                      mDefaultRoute);
+              if (packedAidTable != null) {
+                  if (DBG) Log.d(TAG, "AidRoutingTable compacted to " + packedAidTable.length
+                          + " bytes");
                   aidRouteResolved = true;
                   break;
               }
           }
 
           if(aidRouteResolved == true) {
-              commit(aidRoutingTableCache);
+              // Replace the table and commit with a single native call
+              NfcService.getInstance().setAidRoutingTable(packedAidTable, force);
           } else {
               NfcStatsLog.write(NfcStatsLog.NFC_ERROR_OCCURRED,
                       NfcStatsLog.NFC_ERROR_OCCURRED__TYPE__AID_OVERFLOW, 0, 0);
@@ -407,26 +405,33 @@ public class AidRoutingManager {
         return true;
     }
 
-    private void commit(HashMap<String, AidEntry> routeCache ) {
-
-        if(routeCache != null) {
-
-            for (Map.Entry<String, AidEntry> aidEntry : routeCache.entrySet())  {
-                int route = aidEntry.getValue().route;
-                int aidType = aidEntry.getValue().aidInfo;
-                String aid = aidEntry.getKey();
-                int power = aidEntry.getValue().power;
-                if (DBG) {
-                    Log.d(TAG, "commit aid:" + aid + ",route:" + route
-                        + ",aidtype:" + aidType + ", power state:" + power);
-                }
-
-                NfcService.getInstance().routeAids(aid, route, aidType, power);
+    /**
+     * Pack a routing table into [aidLen][aid][route][aidInfo][power] entries,
+     * the format the native layer diffs against the table it has routed.
+     */
+    @VisibleForTesting
+    static byte[] packAidRoutingTable(Map<String, AidEntry> routeCache) {
+        ByteArrayOutputStream packed = new ByteArrayOutputStream();
+        for (Map.Entry<String, AidEntry> aidEntry : routeCache.entrySet())  {
+            String aid = aidEntry.getKey();
+            int route = aidEntry.getValue().route;
+            int aidType = aidEntry.getValue().aidInfo;
+            int power = aidEntry.getValue().power;
+            if (DBG) {
+                Log.d(TAG, "commit aid:" + aid + ",route:" + route
+                    + ",aidtype:" + aidType + ", power state:" + power);
             }
-        }
 
-        // And finally commit the routing
-        NfcService.getInstance().commitRouting();
+            // [aidLen][aid][route][aidInfo][power]; the empty AID has aidLen 0
+            byte[] aidBytes = NfcService.hexStringToBytes(aid);
+            int aidLen = (aidBytes == null) ? 0 : aidBytes.length;
+            packed.write(aidLen);
+            if (aidLen > 0) packed.write(aidBytes, 0, aidLen);
+            packed.write(route);
+            packed.write(aidType);
+            packed.write(power);
+        }
+        return packed.toByteArray();
     }
 
     /**
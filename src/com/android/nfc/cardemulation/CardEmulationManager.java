@@ -130,6 +130,25 @@ public class CardEmulationManager implements RegisteredServicesCache.Callback,
         }
     }
 
+    public void onHostCardEmulationSelect(int technology, byte[] data, int aidGeneration,
+            int aidIndex) {
+        if (mPowerManager != null) {
+            mPowerManager.userActivity(SystemClock.uptimeMillis(), PowerManager.USER_ACTIVITY_EVENT_TOUCH, 0);
+        }
+        if (technology == NFC_HCE_APDU) {
+            mHostEmulationManager.onHostEmulationSelect(data, aidGeneration, aidIndex);
+        }
+    }
+
+    public void onHostCardEmulationStaticResponse(int technology, byte[] data) {
+        if (mPowerManager != null) {
+            mPowerManager.userActivity(SystemClock.uptimeMillis(), PowerManager.USER_ACTIVITY_EVENT_TOUCH, 0);
+        }
+        if (technology == NFC_HCE_APDU) {
+            mHostEmulationManager.onHostEmulationStaticResponse(data);
+        }
+    }
+
     public void onHostCardEmulationDeactivated(int technology) {
         if (technology == NFC_HCE_APDU) {
             mHostEmulationManager.onHostEmulationDeactivated();
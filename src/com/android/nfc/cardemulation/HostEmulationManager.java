@@ -44,6 +44,7 @@ import com.android.nfc.cardemulation.RegisteredAidCache.AidResolveInfo;
 import java.io.FileDescriptor;
 import java.io.PrintWriter;
 import java.util.ArrayList;
+import java.util.Arrays;
 
 public class HostEmulationManager {
     static final String TAG = "HostEmulationManager";
@@ -58,6 +59,9 @@ public class HostEmulationManager {
     /** Minimum AID lenth as per ISO7816 */
     static final int MINIMUM_AID_LENGTH = 5;
 
+    /** Maximum AID lenth as per ISO7816 */
+    static final int MAXIMUM_AID_LENGTH = 16;
+
     /** Length of Select APDU header including length byte */
     static final int SELECT_APDU_HDR_LENGTH = 5;
 
@@ -67,6 +71,21 @@ public class HostEmulationManager {
     static final byte[] ANDROID_HCE_RESPONSE = {0x14, (byte)0x81, 0x00, 0x00, (byte)0x90, 0x00};
 
     static final byte[] AID_NOT_FOUND = {0x6A, (byte)0x82};
+
+    /**
+     * Messages a service sends besides the HostApduService.MSG_* ones; they
+     * start well above those, so new framework messages cannot collide.
+     */
+    static final int MSG_FIRST_SERVICE_EXTENSION = 100;
+    /**
+     * Sent by the active service to have its response to a SELECT command
+     * sent by the NFC stack from now on, with the command and response in the
+     * "command" and "response" byte arrays of the data bundle.
+     */
+    static final int MSG_STATIC_RESPONSE = MSG_FIRST_SERVICE_EXTENSION;
+    static final int MAX_STATIC_RESPONSE_LENGTH = 0xFFFF;
+    // APDUs held for a service selected by a static response until it is bound
+    static final int MAX_PENDING_APDUS = 4;
     static final byte[] UNKNOWN_ERROR = {0x6F, 0x00};
 
     final Context mContext;
@@ -106,6 +125,11 @@ public class HostEmulationManager {
     int mState;
     byte[] mSelectApdu;
 
+    // Whether the service being bound was selected by a static response
+    boolean mStaticSelectPending;
+    // APDUs that followed that static response, in order
+    final ArrayList<byte[]> mPendingApdus = new ArrayList<>();
+
     public HostEmulationManager(Context context, RegisteredAidCache aidCache) {
         mContext = context;
         mLock = new Object();
@@ -160,7 +184,82 @@ public class HostEmulationManager {
 
     public void onHostEmulationData(byte[] data) {
         Log.d(TAG, "notifyHostEmulationData");
-        String selectAid = findSelectAid(data);
+        onHostEmulationData(data, findSelectAid(data), null);
+    }
+
+    /**
+     * A SELECT the native layer already matched against the AID cache; the
+     * cache is only walked again if it changed in the meantime.
+     */
+    public void onHostEmulationSelect(byte[] data, int aidGeneration, int aidIndex) {
+        Log.d(TAG, "notifyHostEmulationSelect");
+        String selectAid = bytesToString(data, SELECT_APDU_HDR_LENGTH,
+                data[4] & 0xFF);
+        onHostEmulationData(data, selectAid, mAidCache.getResolvedAid(aidGeneration, aidIndex));
+    }
+
+    /**
+     * The native layer answered a SELECT command with a static response; the
+     * service that registered it becomes the active one, as if it had
+     * answered the SELECT itself, and gets the APDUs that follow.
+     */
+    public void onHostEmulationStaticResponse(byte[] data) {
+        Log.d(TAG, "notifyHostEmulationStaticResponse");
+        synchronized (mLock) {
+            if (mState == STATE_IDLE || mState == STATE_W4_DEACTIVATE) {
+                return;
+            }
+            mLastSelectedAid = bytesToString(data, SELECT_APDU_HDR_LENGTH,
+                    data[4] & 0xFF);
+            String key = bytesToString(data, 0, getSelectCommandLength(data));
+            // the cache drops the owner together with the response
+            RegisteredAidCache.StaticResponse staticResponse = mAidCache.getStaticResponse(key);
+            if (staticResponse == null) {
+                Log.e(TAG, "No service registered the static response for AID "
+                        + mLastSelectedAid);
+                return;
+            }
+            Messenger existingService =
+                    bindServiceIfNeededLocked(staticResponse.userId, staticResponse.service);
+            if (existingService != null) {
+                setActiveServiceLocked(existingService);
+                mState = STATE_XFER;
+            } else {
+                // made active once bound; APDUs until then are held for it
+                mSelectApdu = null;
+                mStaticSelectPending = true;
+                mPendingApdus.clear();
+                mState = STATE_W4_SERVICE;
+            }
+        }
+    }
+
+    /**
+     * Accept a static response from the active service. The AID cache checks
+     * that the SELECT command resolves to that service by default and needs
+     * no checks at tap time, and drops the response when that changes.
+     */
+    void setStaticResponseLocked(byte[] command, byte[] response) {
+        String selectAid = (command.length > 4 && (command[4] & 0xFF) <= MAXIMUM_AID_LENGTH)
+                ? findSelectAid(command) : null;
+        if (selectAid == null || mActiveServiceName == null || response.length < 2
+                || response.length > MAX_STATIC_RESPONSE_LENGTH) {
+            Log.e(TAG, "Ignoring static response to an unsupported command");
+            return;
+        }
+        // drop Le, so the command matches with or without it
+        byte[] select = Arrays.copyOf(command, getSelectCommandLength(command));
+        if (!mAidCache.setStaticResponse(select, selectAid, response, mActiveServiceName,
+                mActiveServiceUserId)) {
+            Log.e(TAG, "Ignoring static response for AID " + selectAid);
+        }
+    }
+
+    static int getSelectCommandLength(byte[] select) {
+        return Math.min(select.length, SELECT_APDU_HDR_LENGTH + (select[4] & 0xFF));
+    }
+
+    void onHostEmulationData(byte[] data, String selectAid, AidResolveInfo preResolved) {
         ComponentName resolvedService = null;
         ApduServiceInfo resolvedServiceInfo = null;
         AidResolveInfo resolveInfo = null;
@@ -177,7 +276,8 @@ public class HostEmulationManager {
                     NfcService.getInstance().sendData(ANDROID_HCE_RESPONSE);
                     return;
                 }
-                resolveInfo = mAidCache.resolveAid(selectAid);
+                resolveInfo = preResolved != null ? preResolved
+                        : mAidCache.resolveAid(selectAid);
                 if (resolveInfo == null || resolveInfo.services.size() == 0) {
                     // Tell the remote we don't handle this AID
                     NfcService.getInstance().sendData(AID_NOT_FOUND);
@@ -246,6 +346,8 @@ public class HostEmulationManager {
                             Log.d(TAG, "Waiting for new service.");
                             // Queue SELECT APDU to be used
                             mSelectApdu = data;
+                            mStaticSelectPending = false;
+                            mPendingApdus.clear();
                             mState = STATE_W4_SERVICE;
                         }
                         if (CardEmulation.CATEGORY_PAYMENT.equals(resolveInfo.category)) {
@@ -263,7 +365,14 @@ public class HostEmulationManager {
                     }
                     break;
                 case STATE_W4_SERVICE:
-                    Log.d(TAG, "Unexpected APDU in STATE_W4_SERVICE");
+                    if (!mStaticSelectPending || selectAid != null) {
+                        Log.d(TAG, "Unexpected APDU in STATE_W4_SERVICE");
+                    } else if (mPendingApdus.size() < MAX_PENDING_APDUS) {
+                        // the reader already has its SELECT response
+                        mPendingApdus.add(data);
+                    } else {
+                        Log.e(TAG, "Too many APDUs while binding service, dropping APDU");
+                    }
                     break;
                 case STATE_XFER:
                     if (selectAid != null) {
@@ -277,6 +386,8 @@ public class HostEmulationManager {
                         } else {
                             // Waiting for service to be bound
                             mSelectApdu = data;
+                            mStaticSelectPending = false;
+                            mPendingApdus.clear();
                             mState = STATE_W4_SERVICE;
                         }
                     } else if (mActiveService != null) {
@@ -301,6 +412,8 @@ public class HostEmulationManager {
             mActiveService = null;
             mActiveServiceName = null;
             mActiveServiceUserId = -1;
+            mStaticSelectPending = false;
+            mPendingApdus.clear();
             unbindServiceIfNeededLocked();
             mState = STATE_IDLE;
         }
@@ -357,7 +470,7 @@ public class HostEmulationManager {
         }
     }
 
-    void sendDataToServiceLocked(Messenger service, byte[] data) {
+    void setActiveServiceLocked(Messenger service) {
         if (service != mActiveService) {
             sendDeactivateToActiveServiceLocked(HostApduService.DEACTIVATION_DESELECTED);
             mActiveService = service;
@@ -369,6 +482,10 @@ public class HostEmulationManager {
                 mActiveServiceUserId = mServiceUserId;
             }
         }
+    }
+
+    void sendDataToServiceLocked(Messenger service, byte[] data) {
+        setActiveServiceLocked(service);
         Message msg = Message.obtain(null, HostApduService.MSG_COMMAND_APDU);
         Bundle dataBundle = new Bundle();
         dataBundle.putByteArray("data", data);
@@ -498,7 +615,7 @@ public class HostEmulationManager {
         }
     };
 
-    private ServiceConnection mConnection = new ServiceConnection() {
+    ServiceConnection mConnection = new ServiceConnection() {
         @Override
         public void onServiceConnected(ComponentName name, IBinder service) {
             synchronized (mLock) {
@@ -515,7 +632,15 @@ public class HostEmulationManager {
                 if (mSelectApdu != null) {
                     sendDataToServiceLocked(mService, mSelectApdu);
                     mSelectApdu = null;
+                } else if (mStaticSelectPending) {
+                    // the stack already answered the SELECT
+                    setActiveServiceLocked(mService);
+                    for (byte[] apdu : mPendingApdus) {
+                        sendDataToServiceLocked(mService, apdu);
+                    }
                 }
+                mStaticSelectPending = false;
+                mPendingApdus.clear();
             }
         }
 
@@ -563,6 +688,16 @@ public class HostEmulationManager {
                 } else {
                     Log.d(TAG, "Dropping data, wrong state " + Integer.toString(state));
                 }
+            } else if (msg.what == MSG_STATIC_RESPONSE) {
+                Bundle dataBundle = msg.getData();
+                byte[] command = dataBundle != null ? dataBundle.getByteArray("command") : null;
+                byte[] response = dataBundle != null ? dataBundle.getByteArray("response") : null;
+                if (command == null || response == null) {
+                    return;
+                }
+                synchronized (mLock) {
+                    setStaticResponseLocked(command, response);
+                }
             } else if (msg.what == HostApduService.MSG_UNHANDLED) {
                 synchronized (mLock) {
                     AidResolveInfo resolveInfo = mAidCache.resolveAid(mLastSelectedAid);
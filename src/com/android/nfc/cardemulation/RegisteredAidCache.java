@@ -31,6 +31,7 @@ import com.android.nfc.NfcService;
 
 import com.google.android.collect.Maps;
 
+import java.io.ByteArrayOutputStream;
 import java.io.FileDescriptor;
 import java.io.PrintWriter;
 import java.util.ArrayList;
@@ -139,6 +140,36 @@ public class RegisteredAidCache {
 
     final AidResolveInfo EMPTY_RESOLVE_INFO = new AidResolveInfo();
 
+    // Kinds of AID entries pushed to the native resolver
+    static final int RESOLVE_EXACT = 0;
+    static final int RESOLVE_PREFIX = 1;
+    static final int RESOLVE_SUBSET = 2;
+    // Result of the native resolver when no AID matched
+    static final int RESOLVE_NO_MATCH = -2;
+
+    // What resolveAid() returns for each AID pushed to the native resolver,
+    // by index; only valid for mResolveGeneration.
+    ArrayList<AidResolveInfo> mResolvedAids = new ArrayList<AidResolveInfo>();
+    int mResolveGeneration = 0;
+
+    static final int MAX_STATIC_RESPONSES = 16;
+    // A response the native layer sends for a SELECT command without asking
+    // the service, and the service that registered it.
+    static final class StaticResponse {
+        final byte[] response;
+        final ComponentName service;
+        final int userId;
+
+        StaticResponse(byte[] response, ComponentName service, int userId) {
+            this.response = response;
+            this.service = service;
+            this.userId = userId;
+        }
+    }
+    // Static responses keyed by the hex command. Dropped whenever routing
+    // changes, together with their owners.
+    final HashMap<String, StaticResponse> mStaticResponses = Maps.newHashMap();
+
     final Context mContext;
     final AidRoutingManager mRoutingManager;
 
@@ -829,9 +860,72 @@ public class RegisteredAidCache {
             resolvedAids.clear();
         }
 
+        publishResolvedAidsLocked();
         updateRoutingLocked(false);
     }
 
+    /**
+     * Hand the AID cache to the native resolver, so SELECT commands can be
+     * resolved before they reach Java. Each entry carries an index into
+     * mResolvedAids, which holds what resolveAid() would return if that entry
+     * is the only match.
+     */
+    void publishResolvedAidsLocked() {
+        ArrayList<AidResolveInfo> resolvedAids = new ArrayList<AidResolveInfo>();
+        ByteArrayOutputStream packed = new ByteArrayOutputStream();
+        boolean matchesPrefixes = mSupportsPrefixes || mSupportsSubset;
+        for (Map.Entry<String, AidResolveInfo> entry : mAidCache.entrySet()) {
+            String aid = entry.getKey();
+            int kind = RESOLVE_EXACT;
+            if (isPrefix(aid) || isSubset(aid)) {
+                // without prefix matching, resolveAid() never matches these
+                if (!matchesPrefixes) continue;
+                kind = isPrefix(aid) ? RESOLVE_PREFIX : RESOLVE_SUBSET;
+                aid = aid.substring(0, aid.length() - 1);
+            }
+            byte[] aidBytes = NfcService.hexStringToBytes(aid);
+            int index = resolvedAids.size();
+            if (aidBytes.length > 16 || index > 0xFFFF) continue;
+
+            AidResolveInfo resolveInfo = entry.getValue();
+            if (matchesPrefixes) {
+                // the form resolveAid() builds when it merges matches
+                AidResolveInfo merged = new AidResolveInfo();
+                merged.services.addAll(resolveInfo.services);
+                merged.defaultService = resolveInfo.defaultService;
+                merged.category = resolveInfo.defaultService != null
+                        ? resolveInfo.category : CardEmulation.CATEGORY_OTHER;
+                resolveInfo = merged;
+            }
+            resolvedAids.add(resolveInfo);
+            packed.write(aidBytes.length);
+            packed.write(aidBytes, 0, aidBytes.length);
+            packed.write(kind);
+            packed.write(index >> 8);
+            packed.write(index & 0xFF);
+        }
+        mResolvedAids = resolvedAids;
+        mResolveGeneration++;
+        mRoutingManager.setAidResolveTable(packed.toByteArray(), mResolveGeneration);
+    }
+
+    /**
+     * Returns what resolveAid() returns for a SELECT the native resolver
+     * matched, or null if the result is stale and resolveAid() must be used.
+     */
+    public AidResolveInfo getResolvedAid(int generation, int index) {
+        synchronized (mLock) {
+            if (generation != mResolveGeneration) {
+                return null;
+            } else if (index == RESOLVE_NO_MATCH) {
+                return EMPTY_RESOLVE_INFO;
+            } else if (index >= 0 && index < mResolvedAids.size()) {
+                return mResolvedAids.get(index);
+            }
+            return null;
+        }
+    }
+
     private int computeAidPowerState(boolean isOnHost, boolean requiresScreenOn,
                                      boolean requiresUnlock) {
         int power = POWER_STATE_ALL;
@@ -859,7 +953,64 @@ public class RegisteredAidCache {
         return power;
     }
 
+    /**
+     * Have the native layer answer a SELECT command with a fixed response,
+     * until the routing or the preferred services change. Only the service
+     * the AID resolves to by default may register one, and only if it needs
+     * no unlock or screen-on check at tap time; this is checked under the
+     * lock, so a response never outlives the resolution it was accepted for.
+     */
+    public boolean setStaticResponse(byte[] command, String aid, byte[] response,
+            ComponentName service, int userId) {
+        synchronized (mLock) {
+            AidResolveInfo resolveInfo = resolveAid(aid);
+            ApduServiceInfo defaultService = resolveInfo.defaultService;
+            if (defaultService == null || !defaultService.getComponent().equals(service)
+                    || defaultService.requiresUnlock() || defaultService.requiresScreenOn()
+                    || !defaultService.isOnHost()) {
+                return false;
+            }
+            String key = HostEmulationManager.bytesToString(command, 0, command.length);
+            if (!mStaticResponses.containsKey(key)
+                    && mStaticResponses.size() >= MAX_STATIC_RESPONSES) {
+                Log.e(TAG, "Too many static responses, ignoring " + key);
+                return false;
+            }
+            mStaticResponses.put(key, new StaticResponse(response, service, userId));
+            publishStaticResponsesLocked();
+            return true;
+        }
+    }
+
+    /**
+     * Returns the static response the native layer holds for a SELECT
+     * command, without Le, or null if it holds none.
+     */
+    public StaticResponse getStaticResponse(String command) {
+        synchronized (mLock) {
+            return mStaticResponses.get(command);
+        }
+    }
+
+    void publishStaticResponsesLocked() {
+        ByteArrayOutputStream packed = new ByteArrayOutputStream();
+        for (Map.Entry<String, StaticResponse> entry : mStaticResponses.entrySet()) {
+            byte[] command = NfcService.hexStringToBytes(entry.getKey());
+            byte[] response = entry.getValue().response;
+            packed.write(command.length);
+            packed.write(command, 0, command.length);
+            packed.write(response.length >> 8);
+            packed.write(response.length & 0xFF);
+            packed.write(response, 0, response.length);
+        }
+        mRoutingManager.setStaticResponses(packed.toByteArray(), mResolveGeneration);
+    }
+
     void updateRoutingLocked(boolean force) {
+        if (!mStaticResponses.isEmpty()) {
+            mStaticResponses.clear();
+            publishStaticResponsesLocked();
+        }
         if (!mNfcEnabled) {
             if (DBG) Log.d(TAG, "Not updating routing table because NFC is off.");
             return;
@@ -874,7 +1025,7 @@ public class RegisteredAidCache {
                 if (DBG) Log.d(TAG, "Not routing AID " + aid + " on request.");
                 continue;
             }
-            AidRoutingManager.AidEntry aidType = mRoutingManager.new AidEntry();
+            AidRoutingManager.AidEntry aidType = new AidRoutingManager.AidEntry();
             if (aid.endsWith("#")) {
                 aidType.aidInfo |= AID_ROUTE_QUAL_SUBSET;
             }
@@ -33,7 +33,7 @@ import java.util.Iterator;
 import java.util.List;
 import java.util.Map;
 
-public class RegisteredT3tIdentifiersCache {
+public class RegisteredT3tIdentifiersCache implements SystemCodeRoutingManager.Callback {
     static final String TAG = "RegisteredT3tIdentifiersCache";
 
     static final boolean DBG = SystemProperties.getBoolean("persist.nfc.debug_enabled", false);
@@ -89,7 +89,7 @@ public class RegisteredT3tIdentifiersCache {
     public RegisteredT3tIdentifiersCache(Context context) {
         Log.d(TAG, "RegisteredT3tIdentifiersCache");
         mContext = context;
-        mRoutingManager = new SystemCodeRoutingManager();
+        mRoutingManager = new SystemCodeRoutingManager(this);
     }
 
     public NfcFServiceInfo resolveNfcid2(String nfcid2) {
@@ -169,6 +169,22 @@ public class RegisteredT3tIdentifiersCache {
         mRoutingManager.configureRouting(t3tIdentifiers);
     }
 
+    @Override
+    public void onT3tIdentifiersRejected(List<T3tIdentifier> rejected) {
+        synchronized (mLock) {
+            for (T3tIdentifier t3tIdentifier : rejected) {
+                // only drop the service if it still owns the rejected identifier
+                NfcFServiceInfo service = mForegroundT3tIdentifiersCache.get(t3tIdentifier.nfcid2);
+                if (service != null
+                        && service.getSystemCode().equalsIgnoreCase(t3tIdentifier.systemCode)) {
+                    Log.w(TAG, "NFCID2 " + t3tIdentifier.nfcid2 + " not routed; dropping "
+                            + service.getComponent());
+                    mForegroundT3tIdentifiersCache.remove(t3tIdentifier.nfcid2);
+                }
+            }
+        }
+    }
+
     public void onSecureNfcToggled() {
         synchronized(mLock) {
             updateRoutingLocked(true);
@@ -38,6 +38,20 @@ public class SystemCodeRoutingManager {
     List<T3tIdentifier> mConfiguredT3tIdentifiers =
             new ArrayList<T3tIdentifier>();
 
+    final Callback mCallback;
+
+    public interface Callback {
+        /**
+         * Called with the identifiers the controller did not accept; they are
+         * no longer part of the configured routing.
+         */
+        void onT3tIdentifiersRejected(List<T3tIdentifier> rejected);
+    }
+
+    public SystemCodeRoutingManager(Callback callback) {
+        mCallback = callback;
+    }
+
     public boolean configureRouting(List<T3tIdentifier> t3tIdentifiers) {
         if (DBG) Log.d(TAG, "configureRouting");
         List<T3tIdentifier> toBeAdded = new ArrayList<T3tIdentifier>();
@@ -57,17 +71,22 @@ public class SystemCodeRoutingManager {
                 Log.d(TAG, "Routing table unchanged, not updating");
                 return false;
             }
-            // Update internal structures
+            // Update internal structures; the whole change is applied, and
+            // committed, as one batch
+            List<byte[]> removeBytes = new ArrayList<byte[]>();
             for (T3tIdentifier t3tIdentifier : toBeRemoved) {
                 if (DBG) Log.d(TAG, "deregisterNfcFSystemCodeonDh:");
-                NfcService.getInstance().deregisterT3tIdentifier(
-                        t3tIdentifier.systemCode, t3tIdentifier.nfcid2, t3tIdentifier.t3tPmm);
+                removeBytes.add(NfcService.getT3tIdentifierBytes(
+                        t3tIdentifier.systemCode, t3tIdentifier.nfcid2, t3tIdentifier.t3tPmm));
             }
+            List<byte[]> addBytes = new ArrayList<byte[]>();
             for (T3tIdentifier t3tIdentifier : toBeAdded) {
                 if (DBG) Log.d(TAG, "registerNfcFSystemCodeonDh:");
-                NfcService.getInstance().registerT3tIdentifier(
-                        t3tIdentifier.systemCode, t3tIdentifier.nfcid2 , t3tIdentifier.t3tPmm);
+                addBytes.add(NfcService.getT3tIdentifierBytes(
+                        t3tIdentifier.systemCode, t3tIdentifier.nfcid2, t3tIdentifier.t3tPmm));
             }
+            NfcService.getInstance().updateT3tIdentifiers(removeBytes, addBytes,
+                    registered -> onT3tIdentifiersRegistered(toBeAdded, registered));
             if (DBG) {
                 Log.d(TAG, "(Before) mConfiguredT3tIdentifiers: size=" +
                         mConfiguredT3tIdentifiers.size());
@@ -83,15 +102,28 @@ public class SystemCodeRoutingManager {
                             "/" + t3tIdentifier.t3tPmm);
                 }
             }
-            mConfiguredT3tIdentifiers = t3tIdentifiers;
+            mConfiguredT3tIdentifiers = new ArrayList<T3tIdentifier>(t3tIdentifiers);
         }
-
-        // And finally commit the routing
-        NfcService.getInstance().commitRouting();
-
         return true;
     }
 
+    void onT3tIdentifiersRegistered(List<T3tIdentifier> added, boolean[] registered) {
+        List<T3tIdentifier> rejected = new ArrayList<T3tIdentifier>();
+        synchronized (mLock) {
+            for (int i = 0; i < added.size(); i++) {
+                if (i < registered.length && registered[i]) continue;
+                T3tIdentifier t3tIdentifier = added.get(i);
+                Log.e(TAG, "Failed to register " + t3tIdentifier.systemCode + "/"
+                        + t3tIdentifier.nfcid2);
+                mConfiguredT3tIdentifiers.remove(t3tIdentifier);
+                rejected.add(t3tIdentifier);
+            }
+        }
+        if (!rejected.isEmpty() && mCallback != null) {
+            mCallback.onT3tIdentifiersRejected(rejected);
+        }
+    }
+
     /**
      * This notifies that the SystemCode routing table in the controller
      * has been cleared (usually due to NFC being turned off).
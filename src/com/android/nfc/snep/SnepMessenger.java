@@ -36,6 +36,8 @@ public class SnepMessenger {
     private static final boolean DBG =
             SystemProperties.getBoolean("persist.nfc.debug_enabled", false);
     private static final int HEADER_LENGTH = 6;
+    // Fragments read per call once the first one is in
+    private static final int MAX_BATCH_FRAGMENTS = 16;
     final LlcpSocket mSocket;
     final int mFragmentLength;
     final boolean mIsClient;
@@ -241,21 +243,31 @@ public class SnepMessenger {
             doneReading = true;
         }
 
-        // Remaining fragments
+        // Remaining fragments, taking all that have arrived in one call
+        byte[] fragments = doneReading ? partial : new byte[Math.max(mFragmentLength,
+                Math.min(requestSize - readSize, MAX_BATCH_FRAGMENTS * mFragmentLength))];
+        int[] fragmentLengths = new int[MAX_BATCH_FRAGMENTS];
         while (!doneReading) {
             try {
-                size = mSocket.receive(partial);
-                if (DBG) Log.d(TAG, "read " + size + " bytes");
-                if (size < 0) {
+                int count = mSocket.receiveBatch(fragments, fragmentLengths);
+                size = 0;
+                for (int i = 0; i < count; i++) {
+                    size += fragmentLengths[i];
+                }
+                if (DBG) Log.d(TAG, "read " + size + " bytes in " + count + " fragments");
+                if (size <= 0) {
                     try {
                         mSocket.send(SnepMessage.getMessage(fieldReject).toByteArray());
                     } catch (IOException e) {
                         // Ignore
                     }
                     throw new IOException();
+                } else if (readSize + size > requestSize) {
+                    // More data than the header announced; rejected below
+                    throw new IOException("SNEP message longer than its header.");
                 } else {
                     readSize += size;
-                    buffer.write(partial, 0, size);
+                    buffer.write(fragments, 0, size);
                     if (readSize == requestSize) {
                         doneReading = true;
                     }
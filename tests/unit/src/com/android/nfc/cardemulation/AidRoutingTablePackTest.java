@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.android.nfc.cardemulation;
+
+import static com.google.common.truth.Truth.assertThat;
+
+import androidx.test.ext.junit.runners.AndroidJUnit4;
+
+import org.junit.Test;
+import org.junit.runner.RunWith;
+
+import java.util.HashMap;
+import java.util.HashSet;
+import java.util.Set;
+
+@RunWith(AndroidJUnit4.class)
+public final class AidRoutingTablePackTest {
+    static final int ROUTE_HOST = 0x00;
+    static final int ROUTE_ESE = 0x86;
+    static final int AID_INFO_PREFIX = 0x10;
+    static final int POWER_ALL = 0x3B;
+
+    private static AidRoutingManager.AidEntry entry(int route, int aidInfo, int power) {
+        AidRoutingManager.AidEntry entry = new AidRoutingManager.AidEntry();
+        entry.route = route;
+        entry.aidInfo = aidInfo;
+        entry.power = power;
+        return entry;
+    }
+
+    @Test
+    public void testPackSingleEntry() {
+        HashMap<String, AidRoutingManager.AidEntry> table = new HashMap<>();
+        table.put("A000000003", entry(ROUTE_ESE, AID_INFO_PREFIX, POWER_ALL));
+
+        byte[] packed = AidRoutingManager.packAidRoutingTable(table);
+
+        assertThat(packed).isEqualTo(new byte[] {
+                0x05, (byte) 0xA0, 0x00, 0x00, 0x00, 0x03,
+                (byte) ROUTE_ESE, AID_INFO_PREFIX, POWER_ALL});
+    }
+
+    @Test
+    public void testPackEmptyAid() {
+        HashMap<String, AidRoutingManager.AidEntry> table = new HashMap<>();
+        table.put("", entry(ROUTE_HOST, 0, POWER_ALL));
+
+        byte[] packed = AidRoutingManager.packAidRoutingTable(table);
+
+        assertThat(packed).isEqualTo(new byte[] {0x00, ROUTE_HOST, 0x00, POWER_ALL});
+    }
+
+    @Test
+    public void testPackEmptyTable() {
+        byte[] packed = AidRoutingManager.packAidRoutingTable(new HashMap<>());
+
+        assertThat(packed).isEmpty();
+    }
+
+    @Test
+    public void testPackEveryEntryOnce() {
+        HashMap<String, AidRoutingManager.AidEntry> table = new HashMap<>();
+        table.put("A0000000031010", entry(ROUTE_ESE, 0, POWER_ALL));
+        table.put("F001020304", entry(ROUTE_HOST, AID_INFO_PREFIX, 0x01));
+        table.put("", entry(ROUTE_HOST, 0, POWER_ALL));
+
+        byte[] packed = AidRoutingManager.packAidRoutingTable(table);
+
+        // the order of the entries is not part of the format
+        Set<String> entries = new HashSet<>();
+        int i = 0;
+        while (i < packed.length) {
+            int aidLen = packed[i++];
+            StringBuilder sb = new StringBuilder();
+            for (int j = 0; j < aidLen; j++) {
+                sb.append(String.format("%02X", packed[i++]));
+            }
+            sb.append(String.format("/%02X/%02X/%02X", packed[i], packed[i + 1], packed[i + 2]));
+            i += 3;
+            entries.add(sb.toString());
+        }
+        assertThat(i).isEqualTo(packed.length);
+        assertThat(entries).containsExactly(
+                "A0000000031010/86/00/3B", "F001020304/00/10/01", "/00/00/3B");
+    }
+}
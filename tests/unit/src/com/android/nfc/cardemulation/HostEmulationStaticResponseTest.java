@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.android.nfc.cardemulation;
+
+import static com.google.common.truth.Truth.assertThat;
+
+import static org.mockito.ArgumentMatchers.any;
+import static org.mockito.ArgumentMatchers.anyInt;
+import static org.mockito.ArgumentMatchers.anyString;
+import static org.mockito.ArgumentMatchers.eq;
+import static org.mockito.Mockito.mock;
+import static org.mockito.Mockito.never;
+import static org.mockito.Mockito.verify;
+import static org.mockito.Mockito.when;
+
+import android.content.ComponentName;
+import android.content.Context;
+import android.nfc.cardemulation.HostApduService;
+import android.os.Handler;
+import android.os.HandlerThread;
+import android.os.Message;
+import android.os.Messenger;
+
+import androidx.test.InstrumentationRegistry;
+import androidx.test.ext.junit.runners.AndroidJUnit4;
+
+import org.junit.After;
+import org.junit.Before;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+
+import java.util.concurrent.LinkedBlockingQueue;
+import java.util.concurrent.TimeUnit;
+
+@RunWith(AndroidJUnit4.class)
+public final class HostEmulationStaticResponseTest {
+    private static final int MAX_TIMEOUT_MS = 5000;
+    private static final ComponentName SERVICE =
+            new ComponentName("com.example.pay", "com.example.pay.PayService");
+
+    // SELECT 2PAY.SYS.DDF01 with and without Le
+    private static final byte[] SELECT_PPSE = hexStrToByteArray(
+            "00A404000E325041592E5359532E444446303100");
+    private static final byte[] SELECT_PPSE_NO_LE = hexStrToByteArray(
+            "00A404000E325041592E5359532E4444463031");
+    private static final String SELECT_PPSE_KEY = "00A404000E325041592E5359532E4444463031";
+    private static final byte[] FCI = hexStrToByteArray("6F0A840E9000");
+    private static final byte[] GPO = hexStrToByteArray("80A8000002830000");
+
+    private RegisteredAidCache mAidCache;
+    private HostEmulationManager mManager;
+    private HandlerThread mServiceThread;
+    private Messenger mService;
+    private final LinkedBlockingQueue<Message> mServiceMessages = new LinkedBlockingQueue<>();
+
+    @Before
+    public void setUp() {
+        mAidCache = mock(RegisteredAidCache.class);
+        Context context = mock(Context.class);
+        // the manager's own Messenger needs a Looper
+        InstrumentationRegistry.getInstrumentation().runOnMainSync(
+                () -> mManager = new HostEmulationManager(context, mAidCache));
+
+        mServiceThread = new HandlerThread("HostApduService");
+        mServiceThread.start();
+        mService = new Messenger(new Handler(mServiceThread.getLooper()) {
+            @Override
+            public void handleMessage(Message msg) {
+                Message copy = new Message();
+                copy.copyFrom(msg);
+                mServiceMessages.add(copy);
+            }
+        });
+
+        // the service is bound as payment service and answered the last SELECT
+        mManager.mPaymentService = mService;
+        mManager.mPaymentServiceName = SERVICE;
+        mManager.mPaymentServiceUserId = 0;
+        mManager.mPaymentServiceBound = true;
+        mManager.onHostEmulationActivated();
+        mManager.mActiveService = mService;
+        mManager.mActiveServiceName = SERVICE;
+        mManager.mActiveServiceUserId = 0;
+        mManager.mState = HostEmulationManager.STATE_XFER;
+    }
+
+    @After
+    public void tearDown() throws Exception {
+        mServiceThread.quitSafely();
+    }
+
+    @Test
+    public void testStaticResponseRegisteredWithoutLe() {
+        when(mAidCache.setStaticResponse(any(), anyString(), any(), eq(SERVICE), eq(0)))
+                .thenReturn(true);
+
+        mManager.setStaticResponseLocked(SELECT_PPSE, FCI);
+
+        verify(mAidCache).setStaticResponse(eq(SELECT_PPSE_NO_LE),
+                eq("325041592E5359532E4444463031"), eq(FCI), eq(SERVICE), eq(0));
+    }
+
+    @Test
+    public void testStaticResponseForNonSelectIgnored() {
+        mManager.setStaticResponseLocked(GPO, FCI);
+
+        verify(mAidCache, never()).setStaticResponse(any(), anyString(), any(), any(), anyInt());
+    }
+
+    @Test
+    public void testStaticResponseKeepsServiceForNextApdu() throws Exception {
+        when(mAidCache.setStaticResponse(any(), anyString(), any(), eq(SERVICE), eq(0)))
+                .thenReturn(true);
+        mManager.setStaticResponseLocked(SELECT_PPSE, FCI);
+        when(mAidCache.getStaticResponse(SELECT_PPSE_KEY))
+                .thenReturn(new RegisteredAidCache.StaticResponse(FCI, SERVICE, 0));
+
+        // next tap: the stack answers SELECT PPSE on its own
+        mManager.onHostEmulationDeactivated();
+        assertThat(nextServiceMessage().what).isEqualTo(HostApduService.MSG_DEACTIVATED);
+        mManager.onHostEmulationActivated();
+        mManager.onHostEmulationStaticResponse(SELECT_PPSE);
+
+        assertThat(mManager.mState).isEqualTo(HostEmulationManager.STATE_XFER);
+        assertThat(mManager.mActiveServiceName).isEqualTo(SERVICE);
+
+        mManager.onHostEmulationData(GPO);
+
+        Message msg = nextServiceMessage();
+        assertThat(msg.what).isEqualTo(HostApduService.MSG_COMMAND_APDU);
+        assertThat(msg.getData().getByteArray("data")).isEqualTo(GPO);
+    }
+
+    @Test
+    public void testRejectedStaticResponseDoesNotSelectService() throws Exception {
+        when(mAidCache.setStaticResponse(any(), anyString(), any(), any(), anyInt()))
+                .thenReturn(false);
+        mManager.setStaticResponseLocked(SELECT_PPSE, FCI);
+
+        mManager.onHostEmulationDeactivated();
+        assertThat(nextServiceMessage().what).isEqualTo(HostApduService.MSG_DEACTIVATED);
+        mManager.onHostEmulationActivated();
+        mManager.onHostEmulationStaticResponse(SELECT_PPSE);
+
+        assertThat(mManager.mState).isEqualTo(HostEmulationManager.STATE_W4_SELECT);
+        assertThat(mManager.mActiveService).isNull();
+    }
+
+    @Test
+    public void testApdusWhileBindingReachServiceOnceBound() throws Exception {
+        ComponentName unbound =
+                new ComponentName("com.example.transit", "com.example.transit.TransitService");
+        when(mAidCache.getStaticResponse(SELECT_PPSE_KEY))
+                .thenReturn(new RegisteredAidCache.StaticResponse(FCI, unbound, 0));
+        mManager.onHostEmulationDeactivated();
+        assertThat(nextServiceMessage().what).isEqualTo(HostApduService.MSG_DEACTIVATED);
+
+        // the bind does not complete right away
+        mManager.onHostEmulationActivated();
+        mManager.onHostEmulationStaticResponse(SELECT_PPSE);
+        assertThat(mManager.mState).isEqualTo(HostEmulationManager.STATE_W4_SERVICE);
+        mManager.onHostEmulationData(GPO);
+        mManager.mConnection.onServiceConnected(unbound, mService.getBinder());
+
+        assertThat(mManager.mState).isEqualTo(HostEmulationManager.STATE_XFER);
+        Message msg = nextServiceMessage();
+        assertThat(msg.what).isEqualTo(HostApduService.MSG_COMMAND_APDU);
+        assertThat(msg.getData().getByteArray("data")).isEqualTo(GPO);
+    }
+
+    private Message nextServiceMessage() throws InterruptedException {
+        Message msg = mServiceMessages.poll(MAX_TIMEOUT_MS, TimeUnit.MILLISECONDS);
+        assertThat(msg).isNotNull();
+        return msg;
+    }
+
+    private static byte[] hexStrToByteArray(String hexStr) {
+        byte[] data = new byte[hexStr.length() / 2];
+        for (int i = 0; i < data.length; i++) {
+            data[i] = (byte) Integer.parseInt(hexStr.substring(i * 2, i * 2 + 2), 16);
+        }
+        return data;
+    }
+}
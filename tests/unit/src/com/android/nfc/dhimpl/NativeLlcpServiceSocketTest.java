@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.android.nfc.dhimpl;
+
+import static org.junit.Assert.fail;
+
+import androidx.test.ext.junit.runners.AndroidJUnit4;
+
+import org.junit.BeforeClass;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+
+import java.io.IOException;
+
+@RunWith(AndroidJUnit4.class)
+public final class NativeLlcpServiceSocketTest {
+    private static final int MAX_TIMEOUT_MS = 5000;
+
+    @BeforeClass
+    public static void loadNativeLibrary() throws Exception {
+        // NativeNfcManager loads and registers the JNI library
+        Class.forName(NativeNfcManager.class.getName());
+    }
+
+    @Test(timeout = MAX_TIMEOUT_MS)
+    public void testAcceptOnUnregisteredServerThrows() {
+        // mHandle is 0, which is never a server's handle
+        NativeLlcpServiceSocket server = new NativeLlcpServiceSocket();
+
+        try {
+            server.accept();
+            fail("accept() returned a socket for an unregistered server");
+        } catch (IOException e) {
+            // expected
+        }
+    }
+}